@@ -5,6 +5,7 @@
 #include "FreeImage.h"
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_IO.h"
+#include "FreeImageAlgorithms_Utils.h"
 #include "FreeImageAlgorithms_Drawing.h"
 #include "FreeImageAlgorithms_Filters.h"
 #include "FreeImageAlgorithms_Testing.h"
@@ -16,6 +17,8 @@
 #include "FreeImageAlgorithms_LinearScale.h"
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 static const double kernel[] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
 			 			  1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
@@ -77,6 +80,181 @@ TestFIA_ConvolutionTest(CuTest* tc)
     FreeImage_Unload(dib4);
 }
 
+static void
+TestFIA_ConvolutionNativeTypeTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+
+	FIBITMAP *dib_src = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib_src != NULL);
+
+    FIBITMAP* dib1 = FreeImage_ConvertToType(dib_src, FIT_UINT16, 1);
+    FIBITMAP* dib1_double = FreeImage_ConvertToType(dib1, FIT_DOUBLE, 0);
+
+    CuAssertTrue(tc, dib1 != NULL);
+    CuAssertTrue(tc, dib1_double != NULL);
+
+	FIABITMAP *dib2 = FIA_SetBorder(dib1, 10, 10, BorderType_Constant, 0.0);
+	FIABITMAP *dib2_double = FIA_SetBorder(dib1_double, 10, 10, BorderType_Constant, 0.0);
+
+	FilterKernel convolve_kernel = FIA_NewKernel(10, 10, kernel, 441.0);
+
+	PROFILE_START("FreeImageAlgorithms_Convolve_DoublePromoted");
+
+	FIBITMAP* dib3 = FIA_Convolve(dib2_double, convolve_kernel);
+
+	PROFILE_STOP("FreeImageAlgorithms_Convolve_DoublePromoted");
+
+	PROFILE_START("FreeImageAlgorithms_Convolve_Native");
+
+	FIBITMAP* dib4 = FIA_ConvolveToType(dib2, convolve_kernel, FIT_DOUBLE);
+
+	PROFILE_STOP("FreeImageAlgorithms_Convolve_Native");
+
+	CuAssertTrue(tc, dib3 != NULL);
+	CuAssertTrue(tc, dib4 != NULL);
+
+	int width = FreeImage_GetWidth(dib3);
+	int height = FreeImage_GetHeight(dib3);
+
+	for(int y=0; y < height; y++) {
+
+		double *row3 = (double *) FreeImage_GetScanLine(dib3, y);
+		double *row4 = (double *) FreeImage_GetScanLine(dib4, y);
+
+		for(int x=0; x < width; x++)
+			CuAssertDblEquals(tc, row3[x], row4[x], 1e-9);
+	}
+
+	FIBITMAP* dib5 = FIA_ConvolveToType(dib2, convolve_kernel, FIT_UINT16);
+
+	CuAssertTrue(tc, dib5 != NULL);
+	CuAssertTrue(tc, FreeImage_GetImageType(dib5) == FIT_UINT16);
+
+	FIA_SimpleSaveFIBToFile(dib5, TEST_DATA_OUTPUT_DIR "/Convolution/drone-bee-convolved-uint16.tif");
+
+	FreeImage_Unload(dib_src);
+	FreeImage_Unload(dib1);
+	FreeImage_Unload(dib1_double);
+	FIA_Unload(dib2);
+	FIA_Unload(dib2_double);
+	FreeImage_Unload(dib3);
+    FreeImage_Unload(dib4);
+    FreeImage_Unload(dib5);
+}
+
+static void
+TestFIA_ConvolutionSIMDTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+
+	FIBITMAP *dib_src = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib_src != NULL);
+
+    FIBITMAP* dib1 = FreeImage_ConvertToType(dib_src, FIT_FLOAT, 1);
+
+    CuAssertTrue(tc, dib1 != NULL);
+
+	FIABITMAP *dib2 = FIA_SetBorder(dib1, 10, 10, BorderType_Constant, 0.0);
+
+	FilterKernel convolve_kernel = FIA_NewKernel(10, 10, kernel, 441.0);
+
+	FIA_SetCpuFeatureMask(0);
+
+	PROFILE_START("FreeImageAlgorithms_Convolve_Scalar");
+
+	FIBITMAP* dib3 = FIA_ConvolveToType(dib2, convolve_kernel, FIT_FLOAT);
+
+	PROFILE_STOP("FreeImageAlgorithms_Convolve_Scalar");
+
+	FIA_SetCpuFeatureMask(~0);
+
+	PROFILE_START("FreeImageAlgorithms_Convolve_SIMD");
+
+	FIBITMAP* dib4 = FIA_ConvolveToType(dib2, convolve_kernel, FIT_FLOAT);
+
+	PROFILE_STOP("FreeImageAlgorithms_Convolve_SIMD");
+
+	CuAssertTrue(tc, dib3 != NULL);
+	CuAssertTrue(tc, dib4 != NULL);
+
+	int width = FreeImage_GetWidth(dib3);
+	int height = FreeImage_GetHeight(dib3);
+
+	// The SIMD and scalar code add in the same order so must match exactly.
+	for(int y=0; y < height; y++) {
+
+		float *row3 = (float *) FreeImage_GetScanLine(dib3, y);
+		float *row4 = (float *) FreeImage_GetScanLine(dib4, y);
+
+		for(int x=0; x < width; x++)
+			CuAssertTrue(tc, row3[x] == row4[x]);
+	}
+
+	FreeImage_Unload(dib_src);
+	FreeImage_Unload(dib1);
+	FIA_Unload(dib2);
+	FreeImage_Unload(dib3);
+    FreeImage_Unload(dib4);
+}
+
+static void
+TestFIA_ConvolutionThreadsTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+
+	FIBITMAP *dib_src = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib_src != NULL);
+
+    FIBITMAP* dib1 = FreeImage_ConvertToType(dib_src, FIT_FLOAT, 1);
+
+    CuAssertTrue(tc, dib1 != NULL);
+
+	FIABITMAP *dib2 = FIA_SetBorder(dib1, 10, 10, BorderType_Constant, 0.0);
+
+	FilterKernel convolve_kernel = FIA_NewKernel(10, 10, kernel, 441.0);
+
+	FIA_SetNumberOfThreads(1);
+
+	PROFILE_START("FreeImageAlgorithms_Convolve_OneThread");
+
+	FIBITMAP* dib3 = FIA_ConvolveToType(dib2, convolve_kernel, FIT_FLOAT);
+
+	PROFILE_STOP("FreeImageAlgorithms_Convolve_OneThread");
+
+	FIA_SetNumberOfThreads(0);
+
+	PROFILE_START("FreeImageAlgorithms_Convolve_AllThreads");
+
+	FIBITMAP* dib4 = FIA_ConvolveToType(dib2, convolve_kernel, FIT_FLOAT);
+
+	PROFILE_STOP("FreeImageAlgorithms_Convolve_AllThreads");
+
+	CuAssertTrue(tc, dib3 != NULL);
+	CuAssertTrue(tc, dib4 != NULL);
+
+	int width = FreeImage_GetWidth(dib3);
+	int height = FreeImage_GetHeight(dib3);
+
+	for(int y=0; y < height; y++) {
+
+		float *row3 = (float *) FreeImage_GetScanLine(dib3, y);
+		float *row4 = (float *) FreeImage_GetScanLine(dib4, y);
+
+		for(int x=0; x < width; x++)
+			CuAssertTrue(tc, row3[x] == row4[x]);
+	}
+
+	FreeImage_Unload(dib_src);
+	FreeImage_Unload(dib1);
+	FIA_Unload(dib2);
+	FreeImage_Unload(dib3);
+    FreeImage_Unload(dib4);
+}
+
 static void
 TestFIA_SobelTest(CuTest* tc)
 {
@@ -209,6 +387,472 @@ TestFIA_MedianFilterTest(CuTest* tc)
 	FreeImage_Unload(dib5);
 }
 
+static void
+TestFIA_MedianFilterHistogramTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+
+	FIBITMAP *dib1 = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib1 != NULL);
+
+	FIBITMAP *dib2 = FreeImage_ConvertToGreyscale(dib1);
+
+	CuAssertTrue(tc, dib2 != NULL);
+
+	FIBITMAP *dib3 = FIA_ConvertToGreyscaleFloatType(dib2, FIT_FLOAT);
+
+	CuAssertTrue(tc, dib3 != NULL);
+
+	FIABITMAP* dib4 = FIA_SetBorder(dib2, 15, 15, BorderType_Copy, 0.0);
+	FIABITMAP* dib5 = FIA_SetBorder(dib3, 15, 15, BorderType_Copy, 0.0);
+
+	// 8bit images use the sliding histogram
+	PROFILE_START("MedianFilterHistogram");
+
+	FIBITMAP* dib6 = FIA_MedianFilter(dib4, 15, 15);
+
+	PROFILE_STOP("MedianFilterHistogram");
+
+	// Float images use the sorted window
+	PROFILE_START("MedianFilterSortedWindow");
+
+	FIBITMAP* dib7 = FIA_MedianFilter(dib5, 15, 15);
+
+	PROFILE_STOP("MedianFilterSortedWindow");
+
+	CuAssertTrue(tc, dib6 != NULL);
+	CuAssertTrue(tc, dib7 != NULL);
+
+	int width = FreeImage_GetWidth(dib6);
+	int height = FreeImage_GetHeight(dib6);
+
+	for(int y=0; y < height; y++) {
+
+		unsigned char *row6 = (unsigned char *) FreeImage_GetScanLine(dib6, y);
+		float *row7 = (float *) FreeImage_GetScanLine(dib7, y);
+
+		for(int x=0; x < width; x++)
+			CuAssertTrue(tc, (float) row6[x] == row7[x]);
+	}
+
+	FIA_SimpleSaveFIBToFile(dib6, TEST_DATA_OUTPUT_DIR  "/Convolution/drone-bee-median_filtered_r15.tif");
+
+	FreeImage_Unload(dib1);
+	FreeImage_Unload(dib2);
+	FreeImage_Unload(dib3);
+	FIA_Unload(dib4);
+	FIA_Unload(dib5);
+	FreeImage_Unload(dib6);
+	FreeImage_Unload(dib7);
+}
+
+// Smoothed random noise, so there is one clear correlation peak.
+static FIBITMAP *
+CreateNoiseImage(int width, int height)
+{
+	FIBITMAP *noise = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+	FIBITMAP *dib = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	srand(1234);
+
+	for(int y=0; y < height; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(noise, y);
+
+		for(int x=0; x < width; x++)
+			ptr[x] = (BYTE) (rand() % 256);
+	}
+
+	for(int y=0; y < height; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < width; x++) {
+
+			int sum = 0, count = 0;
+
+			for(int j=MAX(y-1, 0); j <= MIN(y+1, height-1); j++) {
+
+				BYTE *noise_ptr = FreeImage_GetScanLine(noise, j);
+
+				for(int i=MAX(x-1, 0); i <= MIN(x+1, width-1); i++, count++)
+					sum += noise_ptr[i];
+			}
+
+			ptr[x] = (BYTE) (sum / count);
+		}
+	}
+
+	FreeImage_Unload(noise);
+
+	return dib;
+}
+
+// The median of each window found by sorting, as the filter used to.
+static unsigned short
+SortedWindowMedian(FIABITMAP *src, int x, int y, int x_radius, int y_radius)
+{
+	std::vector<unsigned short> window;
+
+	for(int row = y + src->yborder - y_radius; row <= y + src->yborder + y_radius; row++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(src->fib, row);
+
+		for(int col = x + src->xborder - x_radius; col <= x + src->xborder + x_radius; col++)
+			window.push_back(ptr[col]);
+	}
+
+	std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+
+	return window[window.size() / 2];
+}
+
+static void
+TestFIA_MedianFilter16BitTest(CuTest* tc)
+{
+	const int width = 200, height = 150, x_radius = 7, y_radius = 4;
+
+	FIBITMAP *dib1 = FreeImage_AllocateT(FIT_UINT16, width, height, 16, 0, 0, 0);
+
+	CuAssertTrue(tc, dib1 != NULL);
+
+	// Values over the whole 16 bit range so the median moves between
+	// coarse blocks as well as within them.
+	srand(4321);
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib1, y);
+
+		for(int x=0; x < width; x++)
+			ptr[x] = (unsigned short) ((x * 300 + y * 40 + (rand() % 4096)) % 65536);
+	}
+
+	FIABITMAP* dib2 = FIA_SetBorder(dib1, x_radius, y_radius, BorderType_Copy, 0.0);
+
+	PROFILE_START("MedianFilterHistogram16Bit");
+
+	FIBITMAP* dib3 = FIA_MedianFilter(dib2, x_radius, y_radius);
+
+	PROFILE_STOP("MedianFilterHistogram16Bit");
+
+	CuAssertTrue(tc, dib3 != NULL);
+	CuAssertIntEquals(tc, FIT_UINT16, FreeImage_GetImageType(dib3));
+	CuAssertIntEquals(tc, width, FreeImage_GetWidth(dib3));
+	CuAssertIntEquals(tc, height, FreeImage_GetHeight(dib3));
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib3, y);
+
+		for(int x=0; x < width; x++)
+			CuAssertIntEquals(tc, SortedWindowMedian(dib2, x, y, x_radius, y_radius), ptr[x]);
+	}
+
+	FreeImage_Unload(dib1);
+	FIA_Unload(dib2);
+	FreeImage_Unload(dib3);
+}
+
+// What FIA_FFTCorrelateImageRegions does, with FIA_FFTCorrelateImagesSubPixel
+static void
+FFTCorrelateRegionsSubPixel(FIBITMAP *src1, FIARECT rect1, FIBITMAP *src2, FIARECT rect2,
+	FIAPOINTF *pt)
+{
+	FIBITMAP *rgn1 = FIARectIsEmpty(rect1) ? FreeImage_Clone(src1) :
+		FIA_Copy(src1, rect1.left, rect1.top, rect1.right, rect1.bottom);
+	FIBITMAP *rgn2 = FIARectIsEmpty(rect2) ? FreeImage_Clone(src2) :
+		FIA_Copy(src2, rect2.left, rect2.top, rect2.right, rect2.bottom);
+
+	FIA_FFTCorrelateImagesSubPixel(rgn1, rgn2, NULL, PEAK_FIT_PARABOLIC, pt);
+
+	pt->x = pt->x - rect2.left + rect1.left;
+	pt->y = pt->y - rect2.top + rect1.top;
+
+	FreeImage_Unload(rgn1);
+	FreeImage_Unload(rgn2);
+}
+
+static void
+TestFIA_CorrelateFFTPairsTest(CuTest* tc)
+{
+	FIBITMAP *src = CreateNoiseImage(250, 160);
+
+	CuAssertTrue(tc, src != NULL);
+
+	// A 3 x 2 grid of tiles. The overlaps differ so each pair on its own
+	// would be padded to a different size.
+	const int tile_width = 100, tile_height = 80;
+	const int lefts[3] = {0, 70, 130}, tops[2] = {0, 60};
+	FIBITMAP *tiles[6];
+
+	for(int i=0; i < 6; i++) {
+		int left = lefts[i % 3], top = tops[i / 3];
+
+		tiles[i] = FreeImage_Copy(src, left, top, left + tile_width, top + tile_height);
+		CuAssertTrue(tc, tiles[i] != NULL);
+	}
+
+	// Every horizontal and vertical neighbour overlap, plus whole tile
+	// pairs that share the transform of tile 1.
+	CorrelationPair pairs[9];
+	int number_of_pairs = 0;
+
+	for(int i=0; i < 6; i++) {
+
+		if(i % 3 < 2) {
+			int overlap = lefts[i % 3] + tile_width - lefts[i % 3 + 1];
+
+			CorrelationPair *pair = &pairs[number_of_pairs++];
+			memset(pair, 0, sizeof(CorrelationPair));
+			pair->first = i;
+			pair->first_rect = MakeFIARect(tile_width - overlap - 10, 0, tile_width - 1, tile_height - 1);
+			pair->second = i + 1;
+			pair->second_rect = MakeFIARect(0, 0, overlap + 9, tile_height - 1);
+		}
+
+		if(i < 3) {
+			int overlap = tops[0] + tile_height - tops[1];
+
+			CorrelationPair *pair = &pairs[number_of_pairs++];
+			memset(pair, 0, sizeof(CorrelationPair));
+			pair->first = i;
+			pair->first_rect = MakeFIARect(0, tile_height - overlap - 10, tile_width - 1, tile_height - 1);
+			pair->second = i + 3;
+			pair->second_rect = MakeFIARect(0, 0, tile_width - 1, overlap + 9);
+		}
+	}
+
+	for(int i=0; i < 3; i += 2) {
+		CorrelationPair *whole = &pairs[number_of_pairs++];
+		memset(whole, 0, sizeof(CorrelationPair));
+		whole->first = i;
+		whole->second = 1;
+	}
+
+	PROFILE_START("FIA_FFTCorrelateImagePairs");
+
+	int err = FIA_FFTCorrelateImagePairs(tiles, 6, pairs, number_of_pairs, NULL,
+		PEAK_FIT_PARABOLIC);
+
+	PROFILE_STOP("FIA_FFTCorrelateImagePairs");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, err);
+
+	// Each pair must give the same offset as correlating it on its own.
+	for(int i=0; i < number_of_pairs; i++) {
+
+		FIAPOINT pt;
+		FIAPOINTF subpixel_pt;
+		FIBITMAP *first = tiles[pairs[i].first];
+		FIBITMAP *second = tiles[pairs[i].second];
+
+		if(FIARectIsEmpty(pairs[i].first_rect))
+			FIA_FFTCorrelateImages(first, second, NULL, &pt);
+		else
+			FIA_FFTCorrelateImageRegions(first, pairs[i].first_rect,
+				second, pairs[i].second_rect, NULL, &pt);
+
+		FFTCorrelateRegionsSubPixel(first, pairs[i].first_rect,
+			second, pairs[i].second_rect, &subpixel_pt);
+
+		CuAssertIntEquals(tc, FIA_SUCCESS, pairs[i].result);
+		CuAssertIntEquals(tc, pt.x, pairs[i].offset.x);
+		CuAssertIntEquals(tc, pt.y, pairs[i].offset.y);
+		CuAssertDblEquals(tc, subpixel_pt.x, pairs[i].subpixel_offset.x, 0.01);
+		CuAssertDblEquals(tc, subpixel_pt.y, pairs[i].subpixel_offset.y, 0.01);
+	}
+
+	// The tiles were cut from known places
+	CuAssertIntEquals(tc, lefts[1] - lefts[0], pairs[number_of_pairs - 2].offset.x);
+	CuAssertIntEquals(tc, 0, pairs[number_of_pairs - 2].offset.y);
+
+	for(int i=0; i < 6; i++)
+		FreeImage_Unload(tiles[i]);
+
+	FreeImage_Unload(src);
+}
+
+static void
+TestFIA_CorrelateSubPixelTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+
+	FIBITMAP *dib1 = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib1 != NULL);
+
+	FIBITMAP *src1 = FreeImage_ConvertToGreyscale(dib1);
+	FIBITMAP *src2 = FreeImage_Copy(src1, 20, 30, 100, 110);
+
+	CuAssertTrue(tc, src2 != NULL);
+
+	FIAPOINT pt;
+	FIAPOINTF fft_pt, kernel_pt;
+	double max;
+
+	FIA_FFTCorrelateImages(src1, src2, NULL, &pt);
+
+	PROFILE_START("FIA_FFTCorrelateImagesSubPixel");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS,
+		FIA_FFTCorrelateImagesSubPixel(src1, src2, NULL, PEAK_FIT_GAUSSIAN, &fft_pt));
+
+	PROFILE_STOP("FIA_FFTCorrelateImagesSubPixel");
+
+	// The fit stays within half a pixel of the whole pixel peak
+	CuAssertDblEquals(tc, pt.x, fft_pt.x, 0.5);
+	CuAssertDblEquals(tc, pt.y, fft_pt.y, 0.5);
+
+	PROFILE_START("FIA_KernelCorrelateImagesSubPixel");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS,
+		FIA_KernelCorrelateImagesSubPixel(src1, src2, FIA_EMPTY_RECT, NULL, NULL,
+		PEAK_FIT_PARABOLIC, &kernel_pt, &max));
+
+	PROFILE_STOP("FIA_KernelCorrelateImagesSubPixel");
+
+	// An exact copy correlates to a symmetric peak at the copied position
+	CuAssertDblEquals(tc, 20.0, kernel_pt.x, 0.1);
+	CuAssertDblEquals(tc, 30.0, kernel_pt.y, 0.1);
+
+	FreeImage_Unload(dib1);
+	FreeImage_Unload(src1);
+	FreeImage_Unload(src2);
+}
+
+static void
+TestFIA_CorrelateSIMDTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+	const FREE_IMAGE_TYPE types[2] = {FIT_FLOAT, FIT_DOUBLE};
+
+	FIBITMAP *dib1 = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib1 != NULL);
+
+	FIBITMAP *src = FreeImage_ConvertToGreyscale(dib1);
+
+	CuAssertTrue(tc, src != NULL);
+
+	// Only float and double sources have SIMD correlation rows
+	for(int i=0; i < 2; i++) {
+
+		FIBITMAP *src1 = FreeImage_ConvertToType(src, types[i], 1);
+		FIBITMAP *src2 = FreeImage_Copy(src1, 50, 60, 111, 121);
+
+		CuAssertTrue(tc, src1 != NULL);
+		CuAssertTrue(tc, src2 != NULL);
+
+		FIAPOINT scalar_pt, simd_pt;
+		double scalar_max, simd_max;
+
+		FIA_SetCpuFeatureMask(0);
+		FIA_SetNumberOfThreads(1);
+
+		PROFILE_START("FIA_KernelCorrelateImages_Scalar");
+
+		CuAssertIntEquals(tc, FIA_SUCCESS, FIA_KernelCorrelateImages(src1, src2,
+			FIA_EMPTY_RECT, NULL, NULL, &scalar_pt, &scalar_max));
+
+		PROFILE_STOP("FIA_KernelCorrelateImages_Scalar");
+
+		FIA_SetCpuFeatureMask(~0);
+		FIA_SetNumberOfThreads(0);
+
+		PROFILE_START("FIA_KernelCorrelateImages_SIMD");
+
+		CuAssertIntEquals(tc, FIA_SUCCESS, FIA_KernelCorrelateImages(src1, src2,
+			FIA_EMPTY_RECT, NULL, NULL, &simd_pt, &simd_max));
+
+		PROFILE_STOP("FIA_KernelCorrelateImages_SIMD");
+
+		CuAssertIntEquals(tc, 50, scalar_pt.x);
+		CuAssertIntEquals(tc, 60, scalar_pt.y);
+		CuAssertIntEquals(tc, scalar_pt.x, simd_pt.x);
+		CuAssertIntEquals(tc, scalar_pt.y, simd_pt.y);
+		CuAssertDblEquals(tc, scalar_max, simd_max, 1e-12);
+
+		FreeImage_Unload(src1);
+		FreeImage_Unload(src2);
+	}
+
+	FreeImage_Unload(dib1);
+	FreeImage_Unload(src);
+}
+
+static void
+TestFIA_CorrelatePyramidTest(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "drone-bee-greyscale.jpg";
+
+	FIBITMAP *dib1 = FIA_LoadFIBFromFile(file);
+
+	CuAssertTrue(tc, dib1 != NULL);
+
+	FIBITMAP *src1 = FreeImage_ConvertToGreyscale(dib1);
+	FIBITMAP *src2 = FreeImage_Copy(src1, 60, 40, 124, 104);
+
+	CuAssertTrue(tc, src2 != NULL);
+
+	FIAPOINT pt, pyramid_pt;
+	double max, pyramid_max;
+
+	PROFILE_START("FIA_KernelCorrelateImages");
+
+	FIA_KernelCorrelateImages(src1, src2, FIA_EMPTY_RECT, NULL, NULL, &pt, &max);
+
+	PROFILE_STOP("FIA_KernelCorrelateImages");
+
+	PROFILE_START("FIA_KernelCorrelateImagesPyramid");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_KernelCorrelateImagesPyramid(src1, src2,
+		FIA_EMPTY_RECT, NULL, NULL, 3, &pyramid_pt, &pyramid_max));
+
+	PROFILE_STOP("FIA_KernelCorrelateImagesPyramid");
+
+	CuAssertIntEquals(tc, pt.x, pyramid_pt.x);
+	CuAssertIntEquals(tc, pt.y, pyramid_pt.y);
+	CuAssertDblEquals(tc, max, pyramid_max, 1e-9);
+
+	// A one pixel wide cross through the kernel centre of the copied
+	// position. Lines this thin vanish if the mask is averaged when halved.
+	int width = FreeImage_GetWidth(src1);
+	int height = FreeImage_GetHeight(src1);
+	int centre_x = 60 + 31, centre_y = 40 + 31;
+
+	FIBITMAP *mask = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	CuAssertTrue(tc, mask != NULL);
+
+	for(int y=0; y < height; y++) {
+
+		BYTE *mask_ptr = (BYTE *) FIA_GetScanLineFromTop (mask, y);
+
+		for(int x=0; x < width; x++)
+			mask_ptr[x] = (x == centre_x || y == centre_y) ? 1 : 0;
+	}
+
+	FIARECT search_area = MakeFIARect(centre_x - 25, centre_y - 25, centre_x + 25, centre_y + 25);
+
+	FIA_KernelCorrelateImages(src1, src2, search_area, mask, NULL, &pt, &max);
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_KernelCorrelateImagesPyramid(src1, src2,
+		search_area, mask, NULL, 3, &pyramid_pt, &pyramid_max));
+
+	CuAssertIntEquals(tc, 60, pt.x);
+	CuAssertIntEquals(tc, 40, pt.y);
+	CuAssertIntEquals(tc, pt.x, pyramid_pt.x);
+	CuAssertIntEquals(tc, pt.y, pyramid_pt.y);
+	CuAssertDblEquals(tc, max, pyramid_max, 1e-9);
+
+	FreeImage_Unload(mask);
+	FreeImage_Unload(dib1);
+	FreeImage_Unload(src1);
+	FreeImage_Unload(src2);
+}
+
 /*
 static void
 TestFIA_CorrelateFilterTest(CuTest* tc)
@@ -2009,7 +2653,16 @@ CuGetFreeImageAlgorithmsConvolutionSuite(void)
 	//SUITE_ADD_TEST(suite, TestFIA_SobelTest);
 	//SUITE_ADD_TEST(suite, TestFIA_SobelAdvancedTest);
 	//SUITE_ADD_TEST(suite, TestFIA_ConvolutionTest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolutionNativeTypeTest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolutionSIMDTest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolutionThreadsTest);
 	//SUITE_ADD_TEST(suite, TestFIA_MedianFilterTest);
+	SUITE_ADD_TEST(suite, TestFIA_MedianFilterHistogramTest);
+	SUITE_ADD_TEST(suite, TestFIA_MedianFilter16BitTest);
+	SUITE_ADD_TEST(suite, TestFIA_CorrelateFFTPairsTest);
+	SUITE_ADD_TEST(suite, TestFIA_CorrelateSubPixelTest);
+	SUITE_ADD_TEST(suite, TestFIA_CorrelateSIMDTest);
+	SUITE_ADD_TEST(suite, TestFIA_CorrelatePyramidTest);
 
 	//SUITE_ADD_TEST(suite, TestFIA_CorrelateSpiceSection1);
 	//SUITE_ADD_TEST(suite, TestFIA_CorrelateSpiceSection2);
@@ -493,6 +493,66 @@ TestFIA_FloodFillTest(CuTest* tc)
     FreeImage_Unload(dib3);
 }
 
+static void
+TestFIA_FloodFillToleranceTest(CuTest* tc)
+{
+    // A float ramp along x split by a wall that only meets itself at a corner
+    FIBITMAP *src = FreeImage_AllocateT(FIT_FLOAT, 20, 10, 32, 0, 0, 0);
+
+    for(int y=0; y < 10; y++) {
+
+        float *ptr = (float *) FreeImage_GetScanLine(src, y);
+
+        for(int x=0; x < 20; x++)
+            ptr[x] = (x == 10 && y < 9) ? 100.0f : x * 0.5f;
+    }
+
+    ((float *) FreeImage_GetScanLine(src, 9))[11] = 100.0f;
+
+    PROFILE_START("FloodFillMask");
+
+    FIBITMAP *mask4 = FIA_FloodFillMask(src, 0, 0, 5.5, FIA_CONNECTIVITY_4);
+    FIBITMAP *mask8 = FIA_FloodFillMask(src, 0, 0, 5.5, FIA_CONNECTIVITY_8);
+
+    PROFILE_STOP("FloodFillMask");
+
+    CuAssertTrue(tc, mask4 != NULL && mask8 != NULL);
+
+    // Values up to 5.5 are within tolerance and the wall stops the fill
+    CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(mask4, 0)[9]);
+    CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(mask4, 0)[10]);
+    CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(mask4, 9)[10]);
+    CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(mask4, 0)[11]);
+
+    // Only 8 connectivity gets through the corner
+    CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(mask8, 0)[11]);
+    CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(mask8, 0)[12]);
+
+    // The source is untouched and the in place fill changes the same pixels
+    CuAssertTrue(tc, ((float *) FreeImage_GetScanLine(src, 0))[9] == 4.5f);
+
+    CuAssertIntEquals(tc, FIA_SUCCESS,
+        FIA_InPlaceFloodFillWithTolerance(src, 0, 0, -1.0, 5.5, FIA_CONNECTIVITY_8));
+
+    for(int y=0; y < 10; y++) {
+
+        float *ptr = (float *) FreeImage_GetScanLine(src, y);
+        BYTE *mask_ptr = FreeImage_GetScanLine(mask8, y);
+
+        for(int x=0; x < 20; x++)
+            CuAssertIntEquals(tc, mask_ptr[x] == 255, ptr[x] == -1.0f);
+    }
+
+    // Only 4 and 8 connectivity are accepted
+    CuAssertTrue(tc, FIA_FloodFillMask(src, 0, 0, 5.5, (FIA_CONNECTIVITY) 6) == NULL);
+    CuAssertIntEquals(tc, FIA_ERROR,
+        FIA_InPlaceFloodFillWithTolerance(src, 0, 0, -1.0, 5.5, (FIA_CONNECTIVITY) 0));
+
+    FreeImage_Unload(mask4);
+    FreeImage_Unload(mask8);
+    FreeImage_Unload(src);
+}
+
 /*
 static int FIA_DrawImageFromSrcToDst(FIBITMAP *dst, FIBITMAP *src, FIARECT dst_rect)
 {
@@ -1334,6 +1394,7 @@ CuGetFreeImageAlgorithmsDrawingSuite(void)
     //SUITE_ADD_TEST(suite, TestFIA_SolidRectTest);
     //SUITE_ADD_TEST(suite, TestFIA_ConvexHullTest);
     SUITE_ADD_TEST(suite, TestFIA_GreyscaleElipseTest);
+    SUITE_ADD_TEST(suite, TestFIA_FloodFillToleranceTest);
     //SUITE_ADD_TEST(suite, TestFIA_GSLineTest);
 /*
     SUITE_ADD_TEST(suite, TestFIA_Colour24bitLineTest);
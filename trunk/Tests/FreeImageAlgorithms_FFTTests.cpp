@@ -72,6 +72,116 @@ Test_FFT(CuTest* tc)
 	FreeImage_Unload(log_dib);
 }
 
+static void
+Test_RealFFT(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "bumblebee.jpg";
+	
+	FIBITMAP *dib = FIA_LoadFIBFromFile(file);	
+    CuAssertTrue(tc, dib != NULL);
+
+	FIBITMAP *greyscale_dib = FreeImage_ConvertToGreyscale(dib);
+    CuAssertTrue(tc, greyscale_dib != NULL);
+
+	// The real transform needs an even width.
+	int width = FreeImage_GetWidth(greyscale_dib) & ~1;
+	int height = FreeImage_GetHeight(greyscale_dib);
+
+	FIBITMAP *even_dib = FreeImage_Copy(greyscale_dib, 0, 0, width, height);
+    CuAssertTrue(tc, even_dib != NULL);
+
+	FIBITMAP *fft_dib = FIA_FFT(even_dib);
+    CuAssertTrue(tc, fft_dib != NULL);
+
+	PROFILE_START("FIA_RealFFT");
+
+	FIBITMAP *half_dib = FIA_RealFFT(even_dib);
+
+	PROFILE_STOP("FIA_RealFFT");
+
+    CuAssertTrue(tc, half_dib != NULL);
+    CuAssertIntEquals(tc, width / 2 + 1, FreeImage_GetWidth(half_dib));
+
+	// The half spectrum must match the first columns of the full spectrum.
+	double dc = ((FICOMPLEX *) FIA_GetScanLineFromTop(fft_dib, 0))->r;
+
+	for(int y=0; y < height; y++) {
+
+		FICOMPLEX *full = (FICOMPLEX *) FreeImage_GetScanLine(fft_dib, y);
+		FICOMPLEX *half = (FICOMPLEX *) FreeImage_GetScanLine(half_dib, y);
+
+		for(int x=0; x < width / 2 + 1; x++) {
+			CuAssertDblEquals(tc, full[x].r, half[x].r, dc * 1e-5);
+			CuAssertDblEquals(tc, full[x].i, half[x].i, dc * 1e-5);
+		}
+	}
+
+	// The inverse is not scaled so divide by the number of pixels.
+	FIBITMAP *inverse_dib = FIA_RealIFFT(half_dib, width);
+    CuAssertTrue(tc, inverse_dib != NULL);
+
+	for(int y=0; y < height; y++) {
+
+		BYTE *src = (BYTE *) FreeImage_GetScanLine(even_dib, y);
+		double *dst = (double *) FreeImage_GetScanLine(inverse_dib, y);
+
+		for(int x=0; x < width; x++)
+			CuAssertDblEquals(tc, (double) src[x], dst[x] / (width * height), 0.01);
+	}
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(greyscale_dib);
+	FreeImage_Unload(even_dib);
+	FreeImage_Unload(fft_dib);
+	FreeImage_Unload(half_dib);
+	FreeImage_Unload(inverse_dib);
+}
+
+static void
+Test_FFTPlanCache(CuTest* tc)
+{
+	const char *file = TEST_DATA_DIR "bumblebee.jpg";
+	
+	FIBITMAP *dib = FIA_LoadFIBFromFile(file);	
+    CuAssertTrue(tc, dib != NULL);
+
+	FIBITMAP *greyscale_dib = FreeImage_ConvertToGreyscale(dib);
+    CuAssertTrue(tc, greyscale_dib != NULL);
+
+	int width = FreeImage_GetWidth(greyscale_dib);
+	int height = FreeImage_GetHeight(greyscale_dib);
+
+	FIA_ClearFFTPlanCache();
+
+	FIBITMAP *uncached_dib = FIA_FFT(greyscale_dib);
+    CuAssertTrue(tc, uncached_dib != NULL);
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_PrepareFFTPlan(width, height, 0, 0));
+
+	PROFILE_START("FIA_FFT cached plan");
+
+	FIBITMAP *cached_dib = FIA_FFT(greyscale_dib);
+
+	PROFILE_STOP("FIA_FFT cached plan");
+
+    CuAssertTrue(tc, cached_dib != NULL);
+
+	// A cached plan must give exactly the same result as a new one.
+	for(int y=0; y < height; y++)
+		CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(uncached_dib, y),
+			FreeImage_GetScanLine(cached_dib, y), width * sizeof(FICOMPLEX)) == 0);
+
+	// Real plans need an even width.
+	CuAssertIntEquals(tc, FIA_ERROR, FIA_PrepareFFTPlan(width | 1, height, 0, 1));
+
+	FIA_ClearFFTPlanCache();
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(greyscale_dib);
+	FreeImage_Unload(uncached_dib);
+	FreeImage_Unload(cached_dib);
+}
+
 CuSuite* 
 DLL_CALLCONV CuGetFreeImageAlgorithmsFFTSuite(void)
 {
@@ -81,6 +191,8 @@ DLL_CALLCONV CuGetFreeImageAlgorithmsFFTSuite(void)
 
 	SUITE_ADD_TEST(suite, Test_Shift);
 	SUITE_ADD_TEST(suite, Test_FFT);
+	SUITE_ADD_TEST(suite, Test_RealFFT);
+	SUITE_ADD_TEST(suite, Test_FFTPlanCache);
 
 	return suite;
 }
@@ -5,9 +5,12 @@
 #include "FreeImage.h"
 #include "FreeImageAlgorithms_IO.h"
 #include "FreeImageAlgorithms_LinearScale.h"
+#include "FreeImageAlgorithms_Palettes.h"
 
 #include "FreeImageAlgorithms_Testing.h"
 
+#include <limits>
+
 
 static void
 TestFIA_LinearScaleTest(CuTest* tc)
@@ -57,6 +60,112 @@ TestFIA_LinearScaleRangeTest(CuTest* tc)
 	FreeImage_Unload(scaled_dib);
 }
 
+static void
+TestFIA_LinearScaleToColourTest(CuTest* tc)
+{
+	const int width = 300, height = 200;
+	double min_found, max_found;
+	RGBQUAD palette[256];
+
+	FIBITMAP *dib = FreeImage_AllocateT(FIT_UINT16, width, height, 16, 0, 0, 0);
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < width; x++)
+			ptr[x] = 1000 + x * 10 + y;
+	}
+
+	FIA_GetRainBowPalette(palette);
+
+	PROFILE_START("LinearScaleToColour");
+
+	FIBITMAP *colour_dib = FIA_LinearScaleToColour(dib, 0, 0, palette, 32, &min_found, &max_found);
+
+	PROFILE_STOP("LinearScaleToColour");
+
+	CuAssertTrue(tc, colour_dib != NULL);
+	CuAssertIntEquals(tc, 32, FreeImage_GetBPP(colour_dib));
+	CuAssertDblEquals(tc, 1000.0, min_found, 0.0);
+	CuAssertDblEquals(tc, 1000.0 + 299 * 10 + 199, max_found, 0.0);
+
+	// Each pixel has the palette colour of the pixel scaled to 8 bits
+	FIBITMAP *scaled_dib = FIA_LinearScaleToStandardType(dib, 0, 0, NULL, NULL);
+	FIBITMAP *rgb_dib = FreeImage_Allocate(width, height, 24, 0, 0, 0);
+
+	CuAssertIntEquals(tc, FIA_SUCCESS,
+		FIA_LinearScaleToColourDst(rgb_dib, dib, 0, 0, palette, NULL, NULL));
+
+	for(int y=0; y < height; y++) {
+
+		BYTE *scaled_ptr = FreeImage_GetScanLine(scaled_dib, y);
+		RGBQUAD *colour_ptr = (RGBQUAD *) FreeImage_GetScanLine(colour_dib, y);
+		BYTE *rgb_ptr = FreeImage_GetScanLine(rgb_dib, y);
+
+		for(int x=0; x < width; x++) {
+
+			RGBQUAD expected = palette[scaled_ptr[x]];
+
+			CuAssertIntEquals(tc, expected.rgbRed, colour_ptr[x].rgbRed);
+			CuAssertIntEquals(tc, expected.rgbBlue, colour_ptr[x].rgbBlue);
+			CuAssertIntEquals(tc, expected.rgbGreen, rgb_ptr[x * 3 + FI_RGBA_GREEN]);
+		}
+	}
+
+	// The destination must match the source
+	FIBITMAP *small_dib = FreeImage_Allocate(10, 10, 24, 0, 0, 0);
+
+	CuAssertIntEquals(tc, FIA_ERROR,
+		FIA_LinearScaleToColourDst(small_dib, dib, 0, 0, palette, NULL, NULL));
+
+	FreeImage_Unload(small_dib);
+	FreeImage_Unload(rgb_dib);
+	FreeImage_Unload(scaled_dib);
+	FreeImage_Unload(colour_dib);
+	FreeImage_Unload(dib);
+}
+
+static void
+TestFIA_LinearScaleToColourNaNTest(CuTest* tc)
+{
+	const int width = 100, height = 100;
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	double min_found, max_found;
+	RGBQUAD palette[256];
+
+	FIBITMAP *dib = FreeImage_AllocateT(FIT_FLOAT, width, height, 32, 0, 0, 0);
+
+	for(int y=0; y < height; y++) {
+
+		float *ptr = (float *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < width; x++)
+			ptr[x] = (x == 0) ? nan : (float) (x + y);
+	}
+
+	FIA_GetRainBowPalette(palette);
+
+	FIBITMAP *colour_dib = FIA_LinearScaleToColour(dib, 0, 0, palette, 32, &min_found, &max_found);
+
+	CuAssertTrue(tc, colour_dib != NULL);
+
+	// NaN is left out of the range and given the first colour
+	CuAssertDblEquals(tc, 1.0, min_found, 0.0);
+	CuAssertDblEquals(tc, 99.0 + 99.0, max_found, 0.0);
+
+	for(int y=0; y < height; y++) {
+
+		RGBQUAD *colour_ptr = (RGBQUAD *) FreeImage_GetScanLine(colour_dib, y);
+
+		CuAssertIntEquals(tc, palette[0].rgbRed, colour_ptr[0].rgbRed);
+		CuAssertIntEquals(tc, palette[0].rgbGreen, colour_ptr[0].rgbGreen);
+		CuAssertIntEquals(tc, palette[0].rgbBlue, colour_ptr[0].rgbBlue);
+	}
+
+	FreeImage_Unload(colour_dib);
+	FreeImage_Unload(dib);
+}
 
 CuSuite* DLL_CALLCONV
 CuGetFreeImageAlgorithmsLinearScaleSuite(void)
@@ -67,6 +176,8 @@ CuGetFreeImageAlgorithmsLinearScaleSuite(void)
 
 	SUITE_ADD_TEST(suite, TestFIA_LinearScaleTest);
     SUITE_ADD_TEST(suite, TestFIA_LinearScaleRangeTest);
+    SUITE_ADD_TEST(suite, TestFIA_LinearScaleToColourTest);
+    SUITE_ADD_TEST(suite, TestFIA_LinearScaleToColourNaNTest);
 
 	return suite;
 }
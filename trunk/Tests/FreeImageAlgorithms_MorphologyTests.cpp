@@ -4,8 +4,10 @@
 #include "FreeImage.h"
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_IO.h"
+#include "FreeImageAlgorithms_Logic.h"
 #include "FreeImageAlgorithms_Testing.h"
 #include "FreeImageAlgorithms_Palettes.h"
+#include "FreeImageAlgorithms_Utils.h"
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Morphology.h"
 
@@ -185,6 +187,421 @@ TestFIA_ClosingTest(CuTest* tc)
 	FreeImage_Unload(result_dib);
 }
 
+static int
+CountSetPixels(FIBITMAP *dib)
+{
+	int count = 0;
+
+	for(int y=0; y < (int) FreeImage_GetHeight(dib); y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < (int) FreeImage_GetWidth(dib); x++) {
+			if(ptr[x] > 0)
+				count++;
+		}
+	}
+
+	return count;
+}
+
+static void
+TestFIA_RectangleKernelTest(CuTest* tc)
+{
+	// A 60x60 square in the middle of a 300x300 image
+	FIBITMAP *dib = FreeImage_Allocate(300, 300, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	for(int y=120; y < 180; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=120; x < 180; x++)
+			ptr[x] = 255;
+	}
+
+	double *values = (double *) malloc(sizeof(double) * 25 * 25);
+
+	for(int i=0; i < 25 * 25; i++)
+		values[i] = 1.0;
+
+	FilterKernel kernel = FIA_NewKernel(12, 12, values, 1.0);
+
+	FIABITMAP *border_dib = FIA_SetBorder(dib, 12, 12, BorderType_Constant, 0.0);
+
+	PROFILE_START("25x25 BinaryDilation");
+
+	FIBITMAP *dilated = FIA_BinaryDilation(border_dib, kernel);
+
+	PROFILE_STOP("25x25 BinaryDilation");
+
+	PROFILE_START("25x25 BinaryErosion");
+
+	FIBITMAP *eroded = FIA_BinaryErosion(border_dib, kernel);
+
+	PROFILE_STOP("25x25 BinaryErosion");
+
+	PROFILE_START("25x25 BinaryOpening");
+
+	FIBITMAP *opened = FIA_BinaryOpening(border_dib, kernel);
+
+	PROFILE_STOP("25x25 BinaryOpening");
+
+	CuAssertTrue(tc, dilated != NULL && eroded != NULL && opened != NULL);
+
+	CuAssertIntEquals(tc, 84 * 84, CountSetPixels(dilated));
+	CuAssertIntEquals(tc, 36 * 36, CountSetPixels(eroded));
+	CuAssertIntEquals(tc, 60 * 60, CountSetPixels(opened));
+
+	// A 25x1 line only grows the square sideways
+	FilterKernel line = FIA_NewKernel(12, 0, values, 1.0);
+	FIABITMAP *line_border_dib = FIA_SetBorder(dib, 12, 0, BorderType_Constant, 0.0);
+	FIBITMAP *line_dilated = FIA_BinaryDilation(line_border_dib, line);
+
+	CuAssertIntEquals(tc, 84 * 60, CountSetPixels(line_dilated));
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(dilated);
+	FreeImage_Unload(eroded);
+	FreeImage_Unload(opened);
+	FreeImage_Unload(line_dilated);
+	FIA_Unload(border_dib);
+	FIA_Unload(line_border_dib);
+	free(values);
+}
+
+// The same rectangle inside a kernel with an extra ring of zeros is not
+// a full kernel, so FIA_BinaryDilation and FIA_BinaryErosion use the per
+// pixel code for it rather than the van Herk passes.
+static void
+CheckRectangleKernelAgainstPerPixel(CuTest* tc, FIBITMAP *dib, int x_radius, int y_radius)
+{
+	int kernel_width = 2 * x_radius + 1, kernel_height = 2 * y_radius + 1;
+	int ring_kernel_width = kernel_width + 2, ring_kernel_height = kernel_height + 2;
+
+	double *values = (double *) malloc(sizeof(double) * kernel_width * kernel_height);
+	double *ring_values = (double *) malloc(sizeof(double) * ring_kernel_width * ring_kernel_height);
+
+	for(int i=0; i < kernel_width * kernel_height; i++)
+		values[i] = 1.0;
+
+	for(int y=0; y < ring_kernel_height; y++) {
+		for(int x=0; x < ring_kernel_width; x++) {
+			ring_values[y * ring_kernel_width + x] = (x == 0 || y == 0 || x == ring_kernel_width - 1
+				|| y == ring_kernel_height - 1) ? 0.0 : 1.0;
+		}
+	}
+
+	FilterKernel kernel = FIA_NewKernel(x_radius, y_radius, values, 1.0);
+	FilterKernel ring_kernel = FIA_NewKernel(x_radius + 1, y_radius + 1, ring_values, 1.0);
+
+	FIABITMAP *border_dib = FIA_SetBorder(dib, x_radius, y_radius, BorderType_Constant, 0.0);
+	FIABITMAP *ring_border_dib = FIA_SetBorder(dib, x_radius + 1, y_radius + 1, BorderType_Constant, 0.0);
+
+	FIBITMAP *results[4];
+
+	results[0] = FIA_BinaryDilation(border_dib, kernel);
+	results[1] = FIA_BinaryDilation(ring_border_dib, ring_kernel);
+	results[2] = FIA_BinaryErosion(border_dib, kernel);
+	results[3] = FIA_BinaryErosion(ring_border_dib, ring_kernel);
+
+	for(int i=0; i < 4; i++)
+		CuAssertTrue(tc, results[i] != NULL);
+
+	int width = FreeImage_GetWidth(dib);
+	int height = FreeImage_GetHeight(dib);
+
+	for(int i=0; i < 4; i++) {
+		CuAssertIntEquals(tc, width, FreeImage_GetWidth(results[i]));
+		CuAssertIntEquals(tc, height, FreeImage_GetHeight(results[i]));
+	}
+
+	for(int i=0; i < 4; i += 2) {
+
+		for(int y=0; y < height; y++) {
+
+			BYTE *van_herk_ptr = FreeImage_GetScanLine(results[i], y);
+			BYTE *per_pixel_ptr = FreeImage_GetScanLine(results[i + 1], y);
+
+			for(int x=0; x < width; x++)
+				CuAssertIntEquals(tc, per_pixel_ptr[x], van_herk_ptr[x]);
+		}
+	}
+
+	for(int i=0; i < 4; i++)
+		FreeImage_Unload(results[i]);
+
+	FIA_Unload(border_dib);
+	FIA_Unload(ring_border_dib);
+	free(values);
+	free(ring_values);
+}
+
+static void
+TestFIA_RectangleKernelPerPixelTest(CuTest* tc)
+{
+	// Random blocks, some touching the image edges, in an image whose
+	// width is not a whole number of 8 pixel blocks.
+	const int width = 157, height = 93;
+
+	FIBITMAP *dib = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	srand(2011);
+
+	for(int i=0; i < 40; i++) {
+
+		int left = rand() % width, top = rand() % height;
+		int right = MIN(left + 1 + rand() % 20, width);
+		int bottom = MIN(top + 1 + rand() % 12, height);
+		BYTE value = (BYTE) (1 + rand() % 255);
+
+		for(int y=top; y < bottom; y++) {
+
+			BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+			for(int x=left; x < right; x++)
+				ptr[x] = value;
+		}
+	}
+
+	// Pixels on every edge
+	for(int x=0; x < width; x += 3) {
+		FreeImage_GetScanLine(dib, 0)[x] = 255;
+		FreeImage_GetScanLine(dib, height - 1)[x] = 255;
+	}
+
+	for(int y=0; y < height; y += 2) {
+		FreeImage_GetScanLine(dib, y)[0] = 255;
+		FreeImage_GetScanLine(dib, y)[width - 1] = 255;
+	}
+
+	CheckRectangleKernelAgainstPerPixel(tc, dib, 1, 1);
+	CheckRectangleKernelAgainstPerPixel(tc, dib, 3, 1);
+	CheckRectangleKernelAgainstPerPixel(tc, dib, 12, 12);
+	CheckRectangleKernelAgainstPerPixel(tc, dib, 12, 0);
+	CheckRectangleKernelAgainstPerPixel(tc, dib, 0, 7);
+
+	FreeImage_Unload(dib);
+}
+
+static void
+TestFIA_Binary3x3Test(CuTest* tc)
+{
+	// A 31x20 rectangle against the right edge of an image
+	// whose width is not a whole number of 64 pixel words
+	FIBITMAP *dib = FreeImage_Allocate(131, 67, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	for(int y=10; y < 30; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=100; x < 131; x++)
+			ptr[x] = 255;
+	}
+
+	PROFILE_START("Binary3x3Dilation");
+
+	FIBITMAP *dilated = FIA_Binary3x3Dilation(dib);
+
+	PROFILE_STOP("Binary3x3Dilation");
+
+	FIBITMAP *eroded = FIA_Binary3x3Erosion(dib);
+	FIBITMAP *inner = FIA_BinaryInnerBorder(dib);
+	FIBITMAP *outer = FIA_BinaryOuterBorder(dib);
+	FIBITMAP *and_dib = FIA_BinaryAnd(dib, dilated, 0);
+	FIBITMAP *nor_dib = FIA_BinaryOr(dib, dilated, 1);
+
+	CuAssertTrue(tc, dilated != NULL && eroded != NULL && inner != NULL && outer != NULL);
+
+	CuAssertIntEquals(tc, 32 * 22, CountSetPixels(dilated));
+	CuAssertIntEquals(tc, 29 * 18, CountSetPixels(eroded));
+	CuAssertIntEquals(tc, 31 * 20 - 29 * 18, CountSetPixels(inner));
+	CuAssertIntEquals(tc, 32 * 22 - 31 * 20, CountSetPixels(outer));
+	CuAssertIntEquals(tc, 31 * 20, CountSetPixels(and_dib));
+	CuAssertIntEquals(tc, 131 * 67 - 32 * 22, CountSetPixels(nor_dib));
+
+	// Same as the general kernel code
+	const double vals[9]={1,1,1,1,1,1,1,1,1};
+	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);
+	FIABITMAP *border_dib = FIA_SetBorder(dib, 1, 1, BorderType_Constant, 0.0);
+	FIBITMAP *kernel_dilated = FIA_BinaryDilation(border_dib, kernel);
+
+	for(int y=0; y < 67; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dilated, y);
+		BYTE *kernel_ptr = FreeImage_GetScanLine(kernel_dilated, y);
+
+		for(int x=0; x < 131; x++)
+			CuAssertIntEquals(tc, kernel_ptr[x], ptr[x]);
+	}
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(dilated);
+	FreeImage_Unload(eroded);
+	FreeImage_Unload(inner);
+	FreeImage_Unload(outer);
+	FreeImage_Unload(and_dib);
+	FreeImage_Unload(nor_dib);
+	FreeImage_Unload(kernel_dilated);
+	FIA_Unload(border_dib);
+}
+
+static double
+SumOfPixels(FIBITMAP *dib)
+{
+	double sum = 0.0;
+
+	for(int y=0; y < (int) FreeImage_GetHeight(dib); y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < (int) FreeImage_GetWidth(dib); x++)
+			sum += ptr[x];
+	}
+
+	return sum;
+}
+
+static void
+TestFIA_GreyscaleMorphologyTest(CuTest* tc)
+{
+	// 3x3 spots 50 above a flat background of 100
+	FIBITMAP *dib = FreeImage_AllocateT(FIT_UINT16, 200, 150, 16, 0, 0, 0);
+
+	for(int y=0; y < 150; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < 200; x++)
+			ptr[x] = ((x % 20) < 3 && (y % 30) < 3) ? 150 : 100;
+	}
+
+	double values[7 * 7];
+
+	for(int i=0; i < 7 * 7; i++)
+		values[i] = 1.0;
+
+	FilterKernel square = FIA_NewKernel(3, 3, values, 1.0);
+
+	// A diamond goes through the code for other shapes
+	double diamond_values[7 * 7];
+
+	for(int y=0; y < 7; y++)
+		for(int x=0; x < 7; x++)
+			diamond_values[y * 7 + x] = (abs(x - 3) + abs(y - 3) <= 3) ? 1.0 : 0.0;
+
+	FilterKernel diamond = FIA_NewKernel(3, 3, diamond_values, 1.0);
+
+	FIABITMAP *border_dib = FIA_SetBorder(dib, 3, 3, BorderType_Copy, 0.0);
+
+	PROFILE_START("7x7 GreyscaleWhiteTopHat");
+
+	FIBITMAP *white = FIA_GreyscaleWhiteTopHat(border_dib, square);
+
+	PROFILE_STOP("7x7 GreyscaleWhiteTopHat");
+
+	FIBITMAP *diamond_white = FIA_GreyscaleWhiteTopHat(border_dib, diamond);
+	FIBITMAP *black = FIA_GreyscaleBlackTopHat(border_dib, square);
+	FIBITMAP *dilated = FIA_GreyscaleDilation(border_dib, square);
+
+	CuAssertTrue(tc, white != NULL && diamond_white != NULL && black != NULL && dilated != NULL);
+
+	CuAssertIntEquals(tc, 200, FreeImage_GetWidth(white));
+	CuAssertIntEquals(tc, 150, FreeImage_GetHeight(white));
+
+	// 10 x 5 spots of 9 pixels
+	CuAssertDblEquals(tc, 50.0 * 50 * 9, SumOfPixels(white), 0.0);
+	CuAssertDblEquals(tc, 50.0 * 50 * 9, SumOfPixels(diamond_white), 0.0);
+	CuAssertDblEquals(tc, 0.0, SumOfPixels(black), 0.0);
+
+	// Each spot grows to 9x9, the first row and column of spots are cut to 6
+	CuAssertDblEquals(tc, 200.0 * 150 * 100 + 50.0 * (6 + 9 * 9) * (6 + 9 * 4),
+		SumOfPixels(dilated), 0.0);
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(white);
+	FreeImage_Unload(diamond_white);
+	FreeImage_Unload(black);
+	FreeImage_Unload(dilated);
+	FIA_Unload(border_dib);
+}
+
+static void
+TestFIA_GreyscaleReconstructionTest(CuTest* tc)
+{
+	// A spot 90 above a background of 10 and a spot only 20 above it
+	FIBITMAP *dib = FreeImage_AllocateT(FIT_UINT16, 80, 20, 16, 0, 0, 0);
+	FIBITMAP *marker = FreeImage_AllocateT(FIT_UINT16, 80, 20, 16, 0, 0, 0);
+
+	for(int y=0; y < 20; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < 80; x++) {
+			ptr[x] = 10;
+
+			if(x >= 10 && x < 13 && y >= 5 && y < 8)
+				ptr[x] = 100;
+
+			if(x >= 60 && x < 63 && y >= 10 && y < 13)
+				ptr[x] = 30;
+		}
+	}
+
+	// The marker is zero apart from one pixel in the bright spot
+	((unsigned short *) FreeImage_GetScanLine(marker, 6))[11] = 1000;
+
+	PROFILE_START("GreyscaleReconstruction");
+
+	FIBITMAP *reconstructed = FIA_GreyscaleReconstruction(marker, dib, FIA_CONNECTIVITY_8);
+
+	PROFILE_STOP("GreyscaleReconstruction");
+
+	FIBITMAP *maxima = FIA_RegionalMaxima(dib, FIA_CONNECTIVITY_8);
+	FIBITMAP *hmaxima = FIA_HMaxima(dib, 25.0, FIA_CONNECTIVITY_8);
+
+	CuAssertTrue(tc, reconstructed != NULL && maxima != NULL && hmaxima != NULL);
+
+	// The bright spot comes back whole and the rest is the background
+	CuAssertDblEquals(tc, 80.0 * 20 * 10 + 9.0 * 90, SumOfPixels(reconstructed), 0.0);
+
+	FIBITMAP *hmaxima_maxima = FIA_RegionalMaxima(hmaxima, FIA_CONNECTIVITY_8);
+
+	CuAssertTrue(tc, hmaxima_maxima != NULL);
+
+	// The dim spot is lower than h so only the bright one is left
+	CuAssertIntEquals(tc, 75, ((unsigned short *) FreeImage_GetScanLine(hmaxima, 6))[11]);
+	CuAssertIntEquals(tc, 10, ((unsigned short *) FreeImage_GetScanLine(hmaxima, 11))[61]);
+
+	int maxima_count = 0, hmaxima_count = 0;
+
+	for(int y=0; y < 20; y++) {
+		for(int x=0; x < 80; x++) {
+			maxima_count += (FreeImage_GetScanLine(maxima, y)[x] == 255);
+			hmaxima_count += (FreeImage_GetScanLine(hmaxima_maxima, y)[x] == 255);
+		}
+	}
+
+	CuAssertIntEquals(tc, 18, maxima_count);
+	CuAssertIntEquals(tc, 9, hmaxima_count);
+
+	// Only 4 and 8 connectivity are allowed
+	CuAssertTrue(tc, FIA_GreyscaleReconstruction(marker, dib, (FIA_CONNECTIVITY) 6) == NULL);
+	CuAssertTrue(tc, FIA_RegionalMaxima(dib, (FIA_CONNECTIVITY) 16) == NULL);
+	CuAssertTrue(tc, FIA_HMaxima(dib, 25.0, (FIA_CONNECTIVITY) 0) == NULL);
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(marker);
+	FreeImage_Unload(reconstructed);
+	FreeImage_Unload(maxima);
+	FreeImage_Unload(hmaxima);
+	FreeImage_Unload(hmaxima_maxima);
+}
 
 CuSuite* DLL_CALLCONV
 CuGetFreeImageAlgorithmsMorphologySuite(void)
@@ -197,6 +614,11 @@ CuGetFreeImageAlgorithmsMorphologySuite(void)
 	SUITE_ADD_TEST(suite, TestFIA_ErosionTest);
 	SUITE_ADD_TEST(suite, TestFIA_OpeningTest);
 	SUITE_ADD_TEST(suite, TestFIA_ClosingTest);
+	SUITE_ADD_TEST(suite, TestFIA_RectangleKernelTest);
+	SUITE_ADD_TEST(suite, TestFIA_RectangleKernelPerPixelTest);
+	SUITE_ADD_TEST(suite, TestFIA_Binary3x3Test);
+	SUITE_ADD_TEST(suite, TestFIA_GreyscaleMorphologyTest);
+	SUITE_ADD_TEST(suite, TestFIA_GreyscaleReconstructionTest);
 
 	return suite;
 }
@@ -12,6 +12,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <math.h>
 
 static void
 TestFIA_FillholeTest(CuTest* tc)
@@ -262,6 +263,280 @@ TestFIA_MultiscaleProductsTest(CuTest* tc)
 	FreeImage_Unload(dst);
 }
 
+static void
+DrawSquare(FIBITMAP *dib, int left, int bottom, int size)
+{
+	for(int y=bottom; y < bottom + size; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=left; x < left + size; x++)
+			ptr[x] = 255;
+	}
+}
+
+static void
+TestFIA_FillholesConnectivityTest(CuTest* tc)
+{
+	// The outline of a square with its top right corner missing, against the
+	// left edge of the image. The inside only leaks out through the corner.
+	FIBITMAP *dib = FreeImage_Allocate(30, 20, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	for(int i=0; i < 10; i++) {
+		FreeImage_GetScanLine(dib, 5)[i] = 255;
+		FreeImage_GetScanLine(dib, 14)[i] = 255;
+		FreeImage_GetScanLine(dib, 5 + i)[0] = 255;
+		FreeImage_GetScanLine(dib, 5 + i)[9] = 255;
+	}
+
+	FreeImage_GetScanLine(dib, 14)[9] = 0;
+
+	PROFILE_START("FillholesWithConnectivity");
+
+	FIBITMAP *filled4 = FIA_FillholesWithConnectivity(dib, 1, FIA_CONNECTIVITY_4);
+	FIBITMAP *filled8 = FIA_FillholesWithConnectivity(dib, 1, FIA_CONNECTIVITY_8);
+
+	PROFILE_STOP("FillholesWithConnectivity");
+
+	CuAssertTrue(tc, filled4 != NULL && filled8 != NULL);
+
+	CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(filled4, 6)[1]);
+	CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(filled4, 13)[8]);
+	CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(filled4, 14)[9]);
+	CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(filled4, 2)[2]);
+
+	CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(filled8, 6)[1]);
+	CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(filled8, 13)[8]);
+	CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(filled8, 5)[0]);
+
+	CuAssertTrue(tc, FIA_FillholesWithConnectivity(dib, 1, (FIA_CONNECTIVITY) 6) == NULL);
+
+	FreeImage_Unload(filled4);
+	FreeImage_Unload(filled8);
+	FreeImage_Unload(dib);
+}
+
+static void
+TestFIA_LabelParticlesTest(CuTest* tc)
+{
+	// Two squares that only touch at a corner and one on its own
+	FIBITMAP *dib = FreeImage_Allocate(101, 50, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	DrawSquare(dib, 10, 10, 10);
+	DrawSquare(dib, 20, 20, 10);
+	DrawSquare(dib, 70, 5, 31);
+
+	PARTICLEINFO *info = NULL;
+
+	PROFILE_START("LabelParticles");
+
+	FIBITMAP *labels = FIA_LabelParticles(dib, 1, FIA_CONNECTIVITY_4, &info);
+
+	PROFILE_STOP("LabelParticles");
+
+	CuAssertTrue(tc, labels != NULL && info != NULL);
+	CuAssertIntEquals(tc, FIT_UINT32, FreeImage_GetImageType(labels));
+	CuAssertIntEquals(tc, 3, info->number_of_blobs);
+
+	// Labels are in the order the particles are found from the bottom row
+	CuAssertIntEquals(tc, 1, ((DWORD *) FreeImage_GetScanLine(labels, 5))[70]);
+	CuAssertIntEquals(tc, 2, ((DWORD *) FreeImage_GetScanLine(labels, 10))[10]);
+	CuAssertIntEquals(tc, 3, ((DWORD *) FreeImage_GetScanLine(labels, 29))[29]);
+	CuAssertIntEquals(tc, 0, ((DWORD *) FreeImage_GetScanLine(labels, 40))[50]);
+	CuAssertIntEquals(tc, 31 * 31, info->blobs[0].area);
+	CuAssertIntEquals(tc, 100, info->blobs[0].rect.right);
+
+	FIA_FreeParticleInfo(info);
+	FreeImage_Unload(labels);
+
+	labels = FIA_LabelParticles(dib, 1, FIA_CONNECTIVITY_8, &info);
+
+	CuAssertTrue(tc, labels != NULL && info != NULL);
+	CuAssertIntEquals(tc, 2, info->number_of_blobs);
+	CuAssertIntEquals(tc, 2, ((DWORD *) FreeImage_GetScanLine(labels, 29))[29]);
+	CuAssertIntEquals(tc, 200, info->blobs[1].area);
+
+	FIA_FreeParticleInfo(info);
+	FreeImage_Unload(labels);
+
+	// Only 4 and 8 connectivity are accepted
+	CuAssertTrue(tc, FIA_LabelParticles(dib, 1, (FIA_CONNECTIVITY) 6, NULL) == NULL);
+	CuAssertTrue(tc, FIA_LabelParticles(dib, 1, (FIA_CONNECTIVITY) 0, NULL) == NULL);
+
+	FreeImage_Unload(dib);
+}
+
+static int
+CompareBlobInfo(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(BLOBINFO));
+}
+
+static void
+TestFIA_ParallelParticleInfoTest(CuTest* tc)
+{
+	// Tall enough to be labelled in several strips
+	FIBITMAP *dib = FreeImage_Allocate(301, 1000, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	srand(15);
+
+	for(int y=0; y < 1000; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < 301; x++)
+			ptr[x] = (rand() % 100 < 45) ? 255 : 0;
+	}
+
+	PARTICLEINFO *info = NULL, *parallel_info = NULL;
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_ParticleInfo(dib, &info, 1));
+
+	PROFILE_START("ParallelParticleInfo");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_ParallelParticleInfo(dib, &parallel_info, 1));
+
+	PROFILE_STOP("ParallelParticleInfo");
+
+	CuAssertIntEquals(tc, info->number_of_blobs, parallel_info->number_of_blobs);
+
+	// The same particles in a different order
+	qsort(info->blobs, info->number_of_blobs, sizeof(BLOBINFO), CompareBlobInfo);
+	qsort(parallel_info->blobs, parallel_info->number_of_blobs, sizeof(BLOBINFO), CompareBlobInfo);
+
+	CuAssertTrue(tc, memcmp(info->blobs, parallel_info->blobs,
+		sizeof(BLOBINFO) * info->number_of_blobs) == 0);
+
+	FIA_FreeParticleInfo(info);
+	FIA_FreeParticleInfo(parallel_info);
+	FreeImage_Unload(dib);
+}
+
+static void
+TestFIA_ParticleMeasurementsTest(CuTest* tc)
+{
+	// A 10 x 4 rectangle and a diagonal line of five pixels
+	FIBITMAP *dib = FreeImage_Allocate(40, 30, 8, 0, 0, 0);
+	FIBITMAP *grey = FreeImage_AllocateT(FIT_UINT16, 40, 30, 16, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	for(int y=5; y < 9; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+		unsigned short *grey_ptr = (unsigned short *) FreeImage_GetScanLine(grey, y);
+
+		for(int x=5; x < 15; x++) {
+			ptr[x] = 255;
+			grey_ptr[x] = 7;
+		}
+	}
+
+	for(int i=0; i < 5; i++) {
+		FreeImage_GetScanLine(dib, 10 + i)[20 + i] = 255;
+		((unsigned short *) FreeImage_GetScanLine(grey, 10 + i))[20 + i] = 100 + i;
+	}
+
+	PARTICLEMEASUREMENTS *measurements = NULL;
+
+	PROFILE_START("ParticleMeasurements");
+
+	int err = FIA_ParticleMeasurements(dib, grey, 1, FIA_CONNECTIVITY_8, &measurements);
+
+	PROFILE_STOP("ParticleMeasurements");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, err);
+	CuAssertIntEquals(tc, 2, measurements->number_of_blobs);
+
+	BLOBMEASUREMENT *rect = &measurements->blobs[0];
+
+	CuAssertIntEquals(tc, 40, rect->info.area);
+	CuAssertIntEquals(tc, 28, rect->perimeter);
+	CuAssertDblEquals(tc, 280.0, rect->intensity_sum, 1e-9);
+	CuAssertDblEquals(tc, 7.0, rect->intensity_mean, 1e-9);
+	CuAssertDblEquals(tc, 7.0, rect->intensity_min, 1e-9);
+	CuAssertDblEquals(tc, 40.0, rect->convex_hull_area, 1e-9);
+	CuAssertDblEquals(tc, 0.0, rect->orientation, 1e-9);
+	CuAssertDblEquals(tc, sqrt(1.0 - 1.25 / 8.25), rect->eccentricity, 1e-9);
+	CuAssertDblEquals(tc, sqrt(160.0 / 3.14159265358979323846), rect->equivalent_diameter, 1e-9);
+
+	BLOBMEASUREMENT *line = &measurements->blobs[1];
+
+	CuAssertIntEquals(tc, 5, line->info.area);
+	CuAssertIntEquals(tc, 20, line->perimeter);
+	CuAssertDblEquals(tc, 100.0, line->intensity_min, 1e-9);
+	CuAssertDblEquals(tc, 104.0, line->intensity_max, 1e-9);
+	CuAssertDblEquals(tc, 9.0, line->convex_hull_area, 1e-9);
+	CuAssertDblEquals(tc, 3.14159265358979323846 / 4.0, line->orientation, 1e-9);
+	CuAssertDblEquals(tc, 1.0, line->eccentricity, 1e-9);
+
+	FIA_FreeParticleMeasurements(measurements);
+
+	CuAssertIntEquals(tc, FIA_ERROR,
+		FIA_ParticleMeasurements(dib, grey, 1, (FIA_CONNECTIVITY) 6, &measurements));
+	FreeImage_Unload(grey);
+	FreeImage_Unload(dib);
+}
+
+static void
+TestFIA_FindImageMaximaPlateauTest(CuTest* tc)
+{
+	// Two spots on a plateau larger than the region growing used to reach.
+	// The plateau is a shoulder of the spots so it is not a peak.
+	FIBITMAP *dib = FreeImage_Allocate(300, 200, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	for(int y=0; y < 200; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < 300; x++) {
+			ptr[x] = (x > 20 && x < 280 && y > 20 && y < 180) ? 50 : 10;
+
+			if(x >= 100 && x < 103 && y >= 100 && y < 103)
+				ptr[x] = 200;
+
+			if(x >= 200 && x < 202 && y >= 50 && y < 52)
+				ptr[x] = 90;
+		}
+	}
+
+	FIAPeak *peaks = NULL;
+	int number_of_peaks = 0;
+
+	PROFILE_START("FindImageMaxima Plateau");
+
+	FIBITMAP *peak_dib = FIA_FindImageMaxima(dib, NULL, 20.0, 1, 1, &peaks, 0, &number_of_peaks);
+
+	PROFILE_STOP("FindImageMaxima Plateau");
+
+	CuAssertTrue(tc, peak_dib != NULL);
+	CuAssertIntEquals(tc, 2, number_of_peaks);
+
+	int peak_pixels = 0;
+
+	for(int y=0; y < 200; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(peak_dib, y);
+
+		for(int x=0; x < 300; x++)
+			peak_pixels += (ptr[x] == 255);
+	}
+
+	// Every pixel of both spots and nothing else
+	CuAssertIntEquals(tc, 9 + 4, peak_pixels);
+
+	FIA_FreePeaks(peaks);
+	FreeImage_Unload(peak_dib);
+	FreeImage_Unload(dib);
+}
 
 CuSuite* DLL_CALLCONV
 CuGetFreeImageAlgorithmsParticleSuite(void)
@@ -273,6 +548,11 @@ CuGetFreeImageAlgorithmsParticleSuite(void)
 	FIA_EnableOldBrokenCodeCompatibility();
 
 	SUITE_ADD_TEST(suite, TestFIA_FillholeTest);
+	SUITE_ADD_TEST(suite, TestFIA_FillholesConnectivityTest);
+	SUITE_ADD_TEST(suite, TestFIA_LabelParticlesTest);
+	SUITE_ADD_TEST(suite, TestFIA_ParallelParticleInfoTest);
+	SUITE_ADD_TEST(suite, TestFIA_ParticleMeasurementsTest);
+	SUITE_ADD_TEST(suite, TestFIA_FindImageMaximaPlateauTest);
 	//SUITE_ADD_TEST(suite, TestFIA_ParticleInfoTest);
 	//SUITE_ADD_TEST(suite, TestFIA_MultiscaleProductsTest);
 	//SUITE_ADD_TEST(suite, TestFIA_ParticleInfoTest2);
@@ -104,6 +104,287 @@ static void TestFIA_StatisticsTest(CuTest* tc)
     FreeImage_Unload(dib);
 }
 
+static void TestFIA_StatisticReport16BitTest(CuTest* tc)
+{
+	// Values near the top of the range with a small spread and a few saturated pixels
+	const int width = 1001, height = 777;
+
+    FIBITMAP *dib = FreeImage_AllocateT(FIT_UINT16, width, height, 16, 0, 0, 0);
+	FIBITMAP *mask = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	double sum = 0.0, masked_sum = 0.0;
+	int masked_area = 0;
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+		BYTE *mask_ptr = FreeImage_GetScanLine(mask, y);
+
+		for(int x=0; x < width; x++) {
+			ptr[x] = (x == y) ? 65535 : 60000 + ((x * 7 + y * 13) % 97) * ((x + y) % 3);
+			mask_ptr[x] = (x % 5) ? 255 : 0;
+			sum += ptr[x];
+
+			if(mask_ptr[x]) {
+				masked_sum += ptr[x];
+				masked_area++;
+			}
+		}
+	}
+
+	// Two pass reference
+	double mean = sum / (width * height), masked_mean = masked_sum / masked_area;
+	double m2 = 0.0, m3 = 0.0, masked_m2 = 0.0;
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < width; x++) {
+			double d = ptr[x] - mean;
+
+			m2 += d * d;
+			m3 += d * d * d;
+
+			if(x % 5)
+				masked_m2 += (ptr[x] - masked_mean) * (ptr[x] - masked_mean);
+		}
+	}
+
+	double sd = sqrt(m2 / (width * height - 1));
+
+    StatisticReport report, masked_report, threaded_report;
+
+	PROFILE_START("FIA_StatisticReport 16bit");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_StatisticReport(dib, &report));
+
+	PROFILE_STOP("FIA_StatisticReport 16bit");
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_StatisticReportWithMask(dib, mask, &masked_report));
+
+	CuAssertIntEquals(tc, width * height, report.area);
+	CuAssertDblEquals(tc, 60000.0, report.minValue, 0.0);
+	CuAssertDblEquals(tc, 65535.0, report.maxValue, 0.0);
+	CuAssertDblEquals(tc, mean, report.mean, 1e-9 * mean);
+	CuAssertDblEquals(tc, sd, report.stdDeviation, 1e-9 * sd);
+	CuAssertDblEquals(tc, m3 / (width * height) / (sd * sd * sd), report.skewness, 1e-6);
+	CuAssertDblEquals(tc, (double) height / (width * height), report.percentage_overloaded, 1e-6);
+
+	CuAssertIntEquals(tc, masked_area, masked_report.area);
+	CuAssertDblEquals(tc, masked_mean, masked_report.mean, 1e-9 * masked_mean);
+	CuAssertDblEquals(tc, sqrt(masked_m2 / (masked_area - 1)), masked_report.stdDeviation, 1e-6);
+
+	// The bands are merged in order so the thread count does not change the result
+	int threads = FIA_GetNumberOfThreads();
+
+	FIA_SetNumberOfThreads(3);
+	FIA_StatisticReport(dib, &threaded_report);
+	FIA_SetNumberOfThreads(threads);
+
+	CuAssertTrue(tc, memcmp(&report, &threaded_report, sizeof(StatisticReport)) == 0);
+
+    FreeImage_Unload(dib);
+    FreeImage_Unload(mask);
+}
+
+static void TestFIA_IntegerHistogramTest(CuTest* tc)
+{
+	// Every 16 bit value from 0 to 4095 appears (y + 1) times in column y % 8
+	const int width = 4096, height = 8;
+
+    FIBITMAP *dib = FreeImage_AllocateT(FIT_UINT16, width, height, 16, 0, 0, 0);
+	FIBITMAP *mask = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+		BYTE *mask_ptr = FreeImage_GetScanLine(mask, y);
+
+		for(int x=0; x < width; x++) {
+			ptr[x] = (x + y * 512) % 4096;
+			mask_ptr[x] = (y < 2) ? 1 : 0;
+		}
+	}
+
+	unsigned long *hist = (unsigned long *) malloc(4096 * sizeof(unsigned long));
+
+	PROFILE_START("FIA_Histogram 16bit");
+
+	// One value per bin
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_Histogram(dib, 0.0, 4095.0, 4096, hist));
+
+	PROFILE_STOP("FIA_Histogram 16bit");
+
+	for(int i=0; i < 4096; i++)
+		CuAssertIntEquals(tc, height, (int) hist[i]);
+
+	// Four values per bin over part of the range
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_HistogramWithMask(dib, mask, 1024.0, 2048.0, 257, hist));
+
+	for(int i=0; i < 256; i++)
+		CuAssertIntEquals(tc, 2 * 4, (int) hist[i]);
+
+	CuAssertIntEquals(tc, 2, (int) hist[256]);
+
+	// Bins that do not hold a power of two of values
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_Histogram(dib, 0.0, 4095.0, 10, hist));
+
+	unsigned long total = 0;
+
+	for(int i=0; i < 10; i++)
+		total += hist[i];
+
+	CuAssertIntEquals(tc, width * height, (int) total);
+	CuAssertIntEquals(tc, 8, (int) hist[9]);
+	CuAssertIntEquals(tc, 455 * 8, (int) hist[0]);
+
+	free(hist);
+    FreeImage_Unload(dib);
+    FreeImage_Unload(mask);
+}
+
+static void TestFIA_SummedAreaTableTest(CuTest* tc)
+{
+	const int width = 200, height = 100;
+
+    FIBITMAP *dib = FreeImage_AllocateT(FIT_FLOAT, width, height, 32, 0, 0, 0);
+
+	for(int y=0; y < height; y++) {
+
+		float *ptr = (float *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < width; x++)
+			ptr[x] = 1000.0f + (float) ((x * 7 + y * 13) % 10);
+	}
+
+	PROFILE_START("FIA_SummedAreaTableNew");
+
+	FIA_SummedAreaTable *table = FIA_SummedAreaTableNew(dib);
+
+	PROFILE_STOP("FIA_SummedAreaTableNew");
+
+	CuAssertTrue(tc, table != NULL);
+
+	// The whole image agrees with the statistic report
+	StatisticReport report;
+	FIARECT rect = {0, 0, width - 1, height - 1};
+	double sum, mean, variance;
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_StatisticReport(dib, &report));
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_SummedAreaTableStatistics(table, rect, &sum, &mean, &variance));
+
+	CuAssertDblEquals(tc, report.mean, mean, 1e-9);
+	CuAssertDblEquals(tc, report.mean * width * height, sum, 1e-6);
+	CuAssertDblEquals(tc, report.stdDeviation * report.stdDeviation, variance, 1e-9);
+
+	// Change the top left corner and check a rectangle that overlaps it
+	for(int y=height - 10; y < height; y++) {
+
+		float *ptr = (float *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < 10; x++)
+			ptr[x] = 2000.0f;
+	}
+
+	FIARECT changed = {0, 0, 9, 9};
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_SummedAreaTableUpdate(table, dib, changed));
+
+	FIARECT corner = {5, 5, 14, 9};
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_SummedAreaTableStatistics(table, corner, &sum, &mean, &variance));
+
+	double expected = 0.0;
+
+	for(int y=corner.top; y <= corner.bottom; y++) {
+
+		float *ptr = (float *) FreeImage_GetScanLine(dib, height - y - 1);
+
+		for(int x=corner.left; x <= corner.right; x++)
+			expected += ptr[x];
+	}
+
+	CuAssertDblEquals(tc, expected, sum, 1e-6);
+	CuAssertDblEquals(tc, expected / 50.0, mean, 1e-9);
+
+	// Rectangles outside the image are an error
+	FIARECT outside = {190, 90, 200, 99};
+
+	CuAssertIntEquals(tc, FIA_ERROR, FIA_SummedAreaTableStatistics(table, outside, &sum, NULL, NULL));
+
+	FIA_SummedAreaTableDestroy(table);
+    FreeImage_Unload(dib);
+}
+
+static void TestFIA_HistEq16BitTest(CuTest* tc)
+{
+	// A dim left half and a bright right half with little contrast in each
+	const int width = 256, height = 128;
+
+    FIBITMAP *dib = FreeImage_AllocateT(FIT_UINT16, width, height, 16, 0, 0, 0);
+
+	for(int y=0; y < height; y++) {
+
+		unsigned short *ptr = (unsigned short *) FreeImage_GetScanLine(dib, y);
+
+		for(int x=0; x < width; x++)
+			ptr[x] = (x < width / 2) ? 1000 + (x % 8) : 3000 + (y % 8);
+	}
+
+	PROFILE_START("FIA_HistEq 16bit");
+
+	FIBITMAP *eq = FIA_HistEq(dib);
+
+	PROFILE_STOP("FIA_HistEq 16bit");
+
+	CuAssertTrue(tc, eq != NULL);
+
+	// The brightest value maps to the top of the range
+	double min, max;
+
+	FIA_FindMinMax(eq, &min, &max);
+	CuAssertDblEquals(tc, 65535.0, max, 0.0);
+	CuAssertDblEquals(tc, 65535.0 / 16.0, min, 0.5);
+
+	PROFILE_START("FIA_ContrastLimitedAdaptiveHistEq 16bit");
+
+	FIBITMAP *clahe = FIA_ContrastLimitedAdaptiveHistEq(dib, 4, 2, 1024, 0.0);
+
+	PROFILE_STOP("FIA_ContrastLimitedAdaptiveHistEq 16bit");
+
+	FIBITMAP *clipped = FIA_ContrastLimitedAdaptiveHistEq(dib, 4, 2, 1024, 2.0);
+
+	CuAssertTrue(tc, clahe != NULL && clipped != NULL);
+	CuAssertIntEquals(tc, FIT_UINT16, FreeImage_GetImageType(clahe));
+
+	// The result keeps the range of the source
+	FIA_FindMinMax(clahe, &min, &max);
+	CuAssertTrue(tc, min >= 1000.0 && max <= 3007.0);
+
+	// Without a clip limit the detail of the dim half is stretched, with one it is held back
+	StatisticReport src_report, clahe_report, clipped_report;
+	FIBITMAP *src_half = FreeImage_Copy(dib, 0, 0, width / 4, height);
+	FIBITMAP *clahe_half = FreeImage_Copy(clahe, 0, 0, width / 4, height);
+	FIBITMAP *clipped_half = FreeImage_Copy(clipped, 0, 0, width / 4, height);
+
+	FIA_StatisticReport(src_half, &src_report);
+	FIA_StatisticReport(clahe_half, &clahe_report);
+	FIA_StatisticReport(clipped_half, &clipped_report);
+
+	CuAssertTrue(tc, clahe_report.stdDeviation > 10.0 * src_report.stdDeviation);
+	CuAssertTrue(tc, clipped_report.stdDeviation < clahe_report.stdDeviation);
+	CuAssertTrue(tc, clipped_report.stdDeviation >= src_report.stdDeviation);
+
+	FreeImage_Unload(src_half);
+	FreeImage_Unload(clahe_half);
+	FreeImage_Unload(clipped_half);
+	FreeImage_Unload(clipped);
+	FreeImage_Unload(clahe);
+	FreeImage_Unload(eq);
+    FreeImage_Unload(dib);
+}
+
 static void TestFIA_CentroidTest(CuTest* tc)
 {
     const char *file= TEST_DATA_DIR "drone-bee-greyscale.jpg";
@@ -192,6 +473,10 @@ CuGetFreeImageAlgorithmsStatisticSuite(void)
     //SUITE_ADD_TEST(suite, TestFIA_MonoComparisonTest);
     //SUITE_ADD_TEST(suite, TestFIA_HistogramTest);
     SUITE_ADD_TEST(suite, TestFIA_StatisticsTest);
+    SUITE_ADD_TEST(suite, TestFIA_StatisticReport16BitTest);
+    SUITE_ADD_TEST(suite, TestFIA_IntegerHistogramTest);
+    SUITE_ADD_TEST(suite, TestFIA_SummedAreaTableTest);
+    SUITE_ADD_TEST(suite, TestFIA_HistEq16BitTest);
     //SUITE_ADD_TEST(suite, TestFIA_CentroidTest);
 
     return suite;
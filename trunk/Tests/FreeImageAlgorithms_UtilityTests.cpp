@@ -17,6 +17,7 @@
 #include "FreeImageAlgorithms_Testing.h"
 
 #include <iostream>
+#include <math.h>
 
 #include "profile.h"
 
@@ -191,6 +192,63 @@ TestFIA_DistanceTransformTest2(CuTest* tc)
 	FreeImage_Unload(dib3);
 }
 
+static void
+TestFIA_DistanceTransformExTest(CuTest* tc)
+{
+	// Two feature pixels in a 40x30 image
+	FIBITMAP *dib = FreeImage_Allocate(40, 30, 8, 0, 0, 0);
+
+	FIA_SetGreyLevelPalette(dib);
+
+	for(int y=0; y < 30; y++)
+		memset(FreeImage_GetScanLine(dib, y), 255, 40);
+
+	FreeImage_GetScanLine(dib, 5)[5] = 0;
+	FreeImage_GetScanLine(dib, 20)[30] = 0;
+
+	FIBITMAP *nearest = NULL;
+
+	PROFILE_START("DistanceTransformEx");
+
+	FIBITMAP *squared = FIA_DistanceTransformEx(dib, 1.0, 1.0, 1, &nearest);
+
+	PROFILE_STOP("DistanceTransformEx");
+
+	FIBITMAP *spaced = FIA_DistanceTransformEx(dib, 2.0, 0.5, 0, NULL);
+
+	CuAssertTrue(tc, squared != NULL && nearest != NULL && spaced != NULL);
+	CuAssertIntEquals(tc, FIT_UINT32, FreeImage_GetImageType(squared));
+	CuAssertIntEquals(tc, FIT_FLOAT, FreeImage_GetImageType(spaced));
+
+	for(int y=0; y < 30; y++) {
+
+		DWORD *squared_ptr = (DWORD *) FreeImage_GetScanLine(squared, y);
+		int *nearest_ptr = (int *) FreeImage_GetScanLine(nearest, y);
+		float *spaced_ptr = (float *) FreeImage_GetScanLine(spaced, y);
+
+		for(int x=0; x < 40; x++) {
+
+			int d1 = (x - 5) * (x - 5) + (y - 5) * (y - 5);
+			int d2 = (x - 30) * (x - 30) + (y - 20) * (y - 20);
+
+			CuAssertIntEquals(tc, MIN(d1, d2), (int) squared_ptr[x]);
+
+			if(d1 != d2)
+				CuAssertIntEquals(tc, (d1 < d2) ? 5 * 40 + 5 : 20 * 40 + 30, nearest_ptr[x]);
+
+			double s1 = 4.0 * (x - 5) * (x - 5) + 0.25 * (y - 5) * (y - 5);
+			double s2 = 4.0 * (x - 30) * (x - 30) + 0.25 * (y - 20) * (y - 20);
+
+			CuAssertDblEquals(tc, sqrt(MIN(s1, s2)), spaced_ptr[x], 1e-4);
+		}
+	}
+
+	FreeImage_Unload(dib);
+	FreeImage_Unload(squared);
+	FreeImage_Unload(nearest);
+	FreeImage_Unload(spaced);
+}
+
 static void PasteTest(CuTest* tc)
 {
 	const char *file1 = TEST_DATA_DIR "drone-bee-greyscale.jpg";
@@ -481,6 +539,7 @@ CuGetFreeImageAlgorithmsUtilitySuite(void)
 
 //	SUITE_ADD_TEST(suite, CopyTest);
 	SUITE_ADD_TEST(suite, CopyTestRect);
+	SUITE_ADD_TEST(suite, TestFIA_DistanceTransformExTest);
 	//SUITE_ADD_TEST(suite, FastCopyTest);
 	//SUITE_ADD_TEST(suite, HatchImageTest);
 	//SUITE_ADD_TEST(suite, AlphaCombineTest);
@@ -66,6 +66,13 @@ typedef struct
 
 } FIAPOINT;
 
+typedef struct
+{
+	double x;
+	double y;
+
+} FIAPOINTF;
+
 typedef enum
 {
     BorderType_Constant,
@@ -74,6 +81,15 @@ typedef enum
 
 } BorderType;
 
+/** Whether pixels that only touch at a corner are connected.
+*/
+typedef enum
+{
+    FIA_CONNECTIVITY_4 = 4,
+    FIA_CONNECTIVITY_8 = 8
+
+} FIA_CONNECTIVITY;
+
 typedef enum
 {
 	COLOUR_ORDER_RGB,
@@ -101,6 +117,7 @@ typedef enum _FIA_MatrixOrder {FIA_MatrixOrderPrepend = 0, FIA_MatrixOrderAppend
 #define _CPU_FEATURE_SSE    0x0002
 #define _CPU_FEATURE_SSE2   0x0004
 #define _CPU_FEATURE_3DNOW  0x0008
+#define _CPU_FEATURE_AVX2   0x0010
 
 typedef enum {BIT_NONE=-1, BIT8, BIT16, BIT24, BIT32} FREEIMAGE_ALGORITHMS_SAVE_BITDEPTH;
 
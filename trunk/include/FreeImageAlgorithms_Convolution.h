@@ -42,8 +42,31 @@ typedef struct
 
 typedef enum {CORRELATION_KERNEL, CORRELATION_FFT} CorrelationType;
 
+/** How the correlation peak is refined to sub pixel accuracy.
+ *  The peak and its neighbours on each axis are fitted with a parabola,
+ *  or a gaussian which suits the sharp peaks of FFT correlation.
+*/
+typedef enum {PEAK_FIT_NONE, PEAK_FIT_PARABOLIC, PEAK_FIT_GAUSSIAN} PeakFitType;
+
 typedef FIBITMAP* (__cdecl *CORRELATION_PREFILTER) (FIBITMAP*);
 
+/** A pair of image regions for FIA_FFTCorrelateImagePairs.
+ *  An empty rect, see FIARectIsEmpty, selects the whole image.
+*/
+typedef struct
+{
+	int first;				// Index of the first image
+	FIARECT first_rect;		// Region of the first image
+	int second;				// Index of the second image
+	FIARECT second_rect;	// Region of the second image
+
+	FIAPOINT offset;		// Set to the offset as returned by FIA_FFTCorrelateImageRegions
+	FIAPOINTF subpixel_offset;	// Set to the offset refined by the PeakFitType passed
+	double peak;			// Set to the height of the correlation peak
+	int result;				// Set to FIA_SUCCESS or FIA_ERROR
+
+} CorrelationPair;
+
 /** \brief Create a kernel.
  *
  *  \param x_radius for a kernel of width 3 the x radius would be 1.
@@ -65,13 +88,74 @@ FIA_NewKernel(int x_radius, int y_radius,
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_Convolve(FIABITMAP *src, const FilterKernel kernel);
 
+/** \brief Convolve and image with a kernel producing an image of the requested type.
+ *
+ *  8bit greyscale, FIT_UINT16, FIT_INT16, FIT_FLOAT and FIT_DOUBLE images are
+ *  convolved directly without first being converted to FIT_DOUBLE.
+ *  The sums are accumulated in double precision. Integer destination types
+ *  are rounded and clamped to the range of the type.
+ *
+ *  \param src FIBITMAP bitmap to perform the convolution on.
+ *  \param kernel FilterKernel The kernel created with FIA_NewKernel.
+ *  \param dst_type FREE_IMAGE_TYPE of the result. Can be FIT_BITMAP (8bit), FIT_UINT16,
+ *         FIT_INT16, FIT_FLOAT or FIT_DOUBLE.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_ConvolveToType(FIABITMAP *src, const FilterKernel kernel, FREE_IMAGE_TYPE dst_type);
+
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_SeparableConvolve(FIABITMAP *src, FilterKernel horz_kernel, FilterKernel vert_kernel);
 
+/** \brief Separable convolution producing an image of the requested type.
+ *
+ *  The intermediate result is kept as FIT_DOUBLE when dst_type is FIT_DOUBLE
+ *  and as FIT_FLOAT otherwise.
+ *
+ *  \param src FIBITMAP bitmap to perform the convolution on.
+ *  \param horz_kernel FilterKernel The horizontal kernel.
+ *  \param vert_kernel FilterKernel The vertical kernel.
+ *  \param dst_type FREE_IMAGE_TYPE of the result, see FIA_ConvolveToType.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_SeparableConvolveToType(FIABITMAP *src, FilterKernel horz_kernel, FilterKernel vert_kernel,
+							FREE_IMAGE_TYPE dst_type);
+
 DLL_API int DLL_CALLCONV
 FIA_KernelCorrelateImages(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask,
 						  CORRELATION_PREFILTER filter, FIAPOINT *pt, double *max);
 
+/** \brief FIA_KernelCorrelateImages using a coarse to fine search.
+ *
+ *  The images are repeatedly halved with FIA_RescaleToHalf. The peak is found
+ *  over the whole search area on the smallest images, then only a few pixels
+ *  around it are searched at each larger size. Large search areas take a small
+ *  fraction of the time of FIA_KernelCorrelateImages and normally give the same
+ *  point. Images with fine repeating detail may match the wrong peak when halved.
+ *  A half size mask pixel is set if any of the four pixels it covers is set.
+ *
+ *  \param levels Number of times to halve the images. Halving stops early
+ *         once src2 would be smaller than 8 pixels. 0 gives FIA_KernelCorrelateImages.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_KernelCorrelateImagesPyramid(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask,
+						  CORRELATION_PREFILTER filter, int levels, FIAPOINT *pt, double *max);
+
+/** \brief FIA_KernelCorrelateImages with the offset refined to sub pixel accuracy.
+ *
+ *  The fit uses the correlation values either side of the peak. Values outside
+ *  the search area or mask are not used, the offset on that axis is then whole.
+ *
+ *  \param fit PeakFitType how to fit the peak. PEAK_FIT_NONE gives the whole pixel offset.
+ *  \param pt FIAPOINTF The point where src2 should be placed relative to src1.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_KernelCorrelateImagesSubPixel(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask,
+						  CORRELATION_PREFILTER filter, PeakFitType fit, FIAPOINTF *pt, double *max);
+
 /** \brief Correlate two regions from two two images
  *
  *  \param src1 FIBITMAP Background bitmap to perform the correlation on.
@@ -94,10 +178,27 @@ DLL_API int DLL_CALLCONV
 FIA_FFTCorrelateImages(FIBITMAP *src1, FIBITMAP *src2,
 				CORRELATION_PREFILTER filter, FIAPOINT *pt);
 
+/** \brief FIA_FFTCorrelateImages with the offset refined to sub pixel accuracy.
+ *
+ *  \param fit PeakFitType how to fit the peak. PEAK_FIT_NONE gives the whole pixel offset.
+ *  \param pt FIAPOINTF The point where src2 should be placed relative to src1.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_FFTCorrelateImagesSubPixel(FIBITMAP *src1, FIBITMAP *src2,
+				CORRELATION_PREFILTER filter, PeakFitType fit, FIAPOINTF *pt);
+
 DLL_API int DLL_CALLCONV
 FIA_FFTCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1, FIBITMAP * src2,
         FIARECT rect2, CORRELATION_PREFILTER filter, FIAPOINT * pt);
 
+/** \brief Calculates the FFT of src1 for repeated use with FIA_FFTCorrelateImageWithPreCorrelationFFT.
+ *
+ *  The result is the full FIA_FFT spectrum of the padded, filtered src1.
+ *  The padded width is always even.
+ *
+ *  \return FIBITMAP* FIT_COMPLEX image on success and NULL on error.
+*/
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_PreCalculateCorrelationFFT(FIBITMAP *_src1, FIBITMAP *_src2, int pad_size, CORRELATION_PREFILTER filter);
 
@@ -105,6 +206,26 @@ DLL_API int DLL_CALLCONV
 FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft_fib, FIBITMAP *_src1, FIBITMAP *_src2, int pad_size,
         CORRELATION_PREFILTER filter, FIAPOINT * pt);
 
+/** \brief Correlates many pairs of image regions using FFTs, eg the overlaps of a tile mosaic.
+ *
+ *  Gives the same offsets as calling FIA_FFTCorrelateImageRegions for each pair.
+ *  Every region is padded to one size that suits the largest pair, so each
+ *  distinct region (image index and rect) is filtered and transformed once
+ *  however many pairs use it. The pairs are shared between threads, see
+ *  FIA_SetNumberOfThreads, so the filter may be called from several threads at once.
+ *
+ *  \param images Array of images referred to by the pairs.
+ *  \param number_of_images Number of images in the array.
+ *  \param pairs Array of pairs. The offset, peak and result of each are set.
+ *  \param number_of_pairs Number of pairs.
+ *  \param filter Optional prefilter applied to every region, may be NULL.
+ *  \param fit PeakFitType used to set the subpixel_offset of each pair, see FIA_FFTCorrelateImagesSubPixel.
+ *  \return FIA_SUCCESS if every pair succeeded, otherwise FIA_ERROR.
+*/
+DLL_API int DLL_CALLCONV
+FIA_FFTCorrelateImagePairs(FIBITMAP **images, int number_of_images,
+        CorrelationPair *pairs, int number_of_pairs, CORRELATION_PREFILTER filter, PeakFitType fit);
+
 DLL_API FIBITMAP* __cdecl
 FIA_EdgeDetect(FIBITMAP *src);
 
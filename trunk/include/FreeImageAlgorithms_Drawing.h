@@ -171,6 +171,38 @@ FIA_FloodFill(FIBITMAP* src, int seed_x, int seed_y, int fill_colour);
 DLL_API int DLL_CALLCONV
 FIA_InPlaceFloodFill(FIBITMAP* src, int seed_x, int seed_y, int fill_colour);
 
+/** \brief Floodfills the pixels within a tolerance of the seed value.
+ *
+ *	Works on greyscale images of any integer or floating point type. The connected
+ *  pixels whose values are within tolerance of the value at the seed are set to
+ *  fill_colour. The fill uses a span stack on the heap so large fills do not
+ *  overflow the call stack.
+ *
+ *  \param src Image to draw on.
+ *  \param seed_x x position to start from.
+ *  \param seed_y y position to start from.
+ *  \param fill_colour greyscale intensity of the fill.
+ *  \param tolerance largest difference from the seed value that is filled.
+ *  \param connectivity whether pixels touching at a corner are connected.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_InPlaceFloodFillWithTolerance(FIBITMAP* src, int seed_x, int seed_y, double fill_colour,
+								  double tolerance, FIA_CONNECTIVITY connectivity);
+
+/** \brief Finds the pixels a flood fill would fill without changing the image.
+ *
+ *  \param src Greyscale image of any integer or floating point type.
+ *  \param seed_x x position to start from.
+ *  \param seed_y y position to start from.
+ *  \param tolerance largest difference from the seed value that is filled.
+ *  \param connectivity whether pixels touching at a corner are connected.
+ *  \return FIBITMAP* 8bit image where the filled pixels are 255 and the rest 0, or NULL.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_FloodFillMask(FIBITMAP* src, int seed_x, int seed_y, double tolerance,
+				  FIA_CONNECTIVITY connectivity);
+
 
 /** \brief Draw a polygon from an array of FIAPOINT's.
  *
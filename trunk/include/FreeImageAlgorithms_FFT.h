@@ -44,6 +44,53 @@ FIA_FFT(FIBITMAP *src);
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_IFFT(FIBITMAP *src);
 
+/** \brief Performs a forward fourier transform of a real valued image.
+ *
+ *  The spectrum of a real image is conjugate symmetric so only the
+ *  non-redundant half, width / 2 + 1 columns by height rows, is returned.
+ *  Column 0 is the zero x frequency. This needs about half the memory
+ *  and time of FIA_FFT.
+ *
+ *  \param src FIBITMAP greyscale image with an even width.
+ *  \return FIBITMAP* FIT_COMPLEX half spectrum on success and NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RealFFT(FIBITMAP *src);
+
+/** \brief Performs an inverse fourier transform of a half spectrum from FIA_RealFFT.
+ *
+ *  Like FIA_IFFT the result is not scaled by 1 / (width * height).
+ *
+ *  \param src FIBITMAP FIT_COMPLEX half spectrum.
+ *  \param width Width of the real image, src must be width / 2 + 1 columns wide.
+ *  \return FIBITMAP* FIT_DOUBLE image on success and NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RealIFFT(FIBITMAP *src, int width);
+
+/** \brief Creates an FFT plan and keeps it in the plan cache.
+ *
+ *  FFT functions keep their plans in a cache so repeated transforms of
+ *  the same size skip the plan set up. Calling this first moves that cost
+ *  out of the first transform. The cache is thread safe.
+ *
+ *  \param width Width of the image to be transformed.
+ *  \param height Height of the image to be transformed.
+ *  \param inverse 0 for a forward transform, 1 for an inverse transform.
+ *  \param real 1 for the FIA_RealFFT / FIA_RealIFFT plan, 0 for FIA_FFT / FIA_IFFT.
+ *         For an inverse real plan width is the width of the real image.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_PrepareFFTPlan(int width, int height, int inverse, int real);
+
+/** \brief Frees the plans in the FFT plan cache.
+ *
+ *  Plans in use by other threads are unaffected.
+*/
+DLL_API void DLL_CALLCONV
+FIA_ClearFFTPlanCache(void);
+
 /** \brief Creates a FIT_DOUBLE absolute image from a complex image.
  *	
  *  \param src FIBITMAP complex image.
@@ -64,6 +64,34 @@ FIA_StretchImageAcrossRange(FIBITMAP *src, double min, double max);
 DLL_API int DLL_CALLCONV
 FIA_InplaceLinearScaleToStandardType(FIBITMAP **src, double min, double max, double* found_min, double* found_max);
 
+/** \brief Scale a greyscale image linearly and colour it with a palette for display.
+ *
+ *  Gives the same colours as FIA_LinearScaleToStandardType followed by setting the palette
+ *  and converting to 24 or 32 bits, but scales, looks up and writes each pixel in one
+ *  multithreaded pass without intermediate images.
+ *  \param src Image to convert
+ *  \param min Min value to stretch to. If min and max are both 0 the range of the image is used.
+ *  \param max Max value to stretch to.
+ *  \param palette RGBQUAD[256] palette such as from FIA_GetFalseColourPalette or NULL for greyscale.
+ *  \param bpp 24 or 32 bits per pixel of the result.
+ *  \param min_within_image Minimum value the image was stretched from.
+ *  \param max_within_image Maximum value the image was stretched from.
+ *  \return FIBITMAP* The colour image on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_LinearScaleToColour(FIBITMAP *src, double min, double max, RGBQUAD *palette, int bpp,
+                        double *min_within_image, double *max_within_image);
+
+/** \brief Scale a greyscale image linearly and colour it with a palette into an existing image.
+ *
+ *  As FIA_LinearScaleToColour but writes into dst so a display loop need not allocate.
+ *  \param dst 24 or 32 bit image the size of src.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_LinearScaleToColourDst(FIBITMAP *dst, FIBITMAP *src, double min, double max, RGBQUAD *palette,
+                           double *min_within_image, double *max_within_image);
+
 #ifdef __cplusplus
 }
 #endif
@@ -120,6 +120,116 @@ FIA_BinaryInnerBorder (FIBITMAP * src);
 DLL_API FIBITMAP *DLL_CALLCONV
 FIA_BinaryOuterBorder (FIBITMAP * src);
 
+/*! \file 
+ *	Greyscale dilation, the maximum under the kernel.
+ *
+ *  The kernel values above zero make a flat structuring element of any shape.
+ *  Works on 8bit, 16bit, 32bit, float and double greyscale images.
+ *  The result is smaller than src by the kernel radius on each side,
+ *  so set a border the size of the radius with FIA_SetBorder.
+ *
+ *  \param src FIABITMAP bitmap to perform the operation on.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleDilation(FIABITMAP* src, FilterKernel kernel);
+
+/*! \file 
+ *	Greyscale erosion, the minimum under the kernel.
+ *
+ *  \param src FIABITMAP bitmap to perform the operation on.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleErosion(FIABITMAP* src, FilterKernel kernel);
+
+/*! \file 
+ *	Greyscale erosion followed by a dilation.
+ *  Removes bright features smaller than the kernel.
+ *
+ *  \param src FIABITMAP bitmap to perform the operation on.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleOpening(FIABITMAP* src, FilterKernel kernel);
+
+/*! \file 
+ *	Greyscale dilation followed by an erosion.
+ *  Removes dark features smaller than the kernel.
+ *
+ *  \param src FIABITMAP bitmap to perform the operation on.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleClosing(FIABITMAP* src, FilterKernel kernel);
+
+/*! \file 
+ *	White top-hat, the image minus its greyscale opening.
+ *  Keeps bright features smaller than the kernel and removes the background.
+ *
+ *  \param src FIABITMAP bitmap to perform the operation on.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleWhiteTopHat(FIABITMAP* src, FilterKernel kernel);
+
+/*! \file 
+ *	Black top-hat, the greyscale closing of the image minus the image.
+ *  Keeps dark features smaller than the kernel.
+ *
+ *  \param src FIABITMAP bitmap to perform the operation on.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleBlackTopHat(FIABITMAP* src, FilterKernel kernel);
+
+/*! \file 
+ *	Greyscale reconstruction by dilation of marker under mask.
+ *
+ *  marker is dilated again and again, never going above mask, until it
+ *  stops changing. Uses Vincent's hybrid algorithm so the time is linear
+ *  in the size of the image. marker and mask must be the same type and size,
+ *  8bit, 16bit, 32bit, float or double greyscale.
+ *
+ *  \param marker FIBITMAP image to reconstruct from.
+ *  \param mask FIBITMAP image that limits the reconstruction.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are connected.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleReconstruction(FIBITMAP* marker, FIBITMAP* mask, FIA_CONNECTIVITY connectivity);
+
+/*! \file 
+ *	The h-maxima transform, the reconstruction of src - h under src.
+ *  Removes the maxima that rise less than h above their surroundings and
+ *  lowers the others by h. For integer images h is rounded to a whole number.
+ *
+ *  \param src FIBITMAP greyscale image to perform the operation on.
+ *  \param h double The height a maximum must have to be kept.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are connected.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_HMaxima(FIBITMAP* src, double h, FIA_CONNECTIVITY connectivity);
+
+/*! \file 
+ *	Finds the regional maxima of an image, the connected plateaux whose
+ *  neighbours are all lower. Use on the result of FIA_HMaxima to keep
+ *  only the maxima of a given height.
+ *
+ *  \param src FIBITMAP greyscale image to perform the operation on.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are connected.
+ *  \return 8bit FIBITMAP with the maxima set to 255 on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RegionalMaxima(FIBITMAP* src, FIA_CONNECTIVITY connectivity);
+
 
 #ifdef __cplusplus
 }
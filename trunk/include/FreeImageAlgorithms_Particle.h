@@ -60,6 +60,38 @@ typedef struct
 
 } PARTICLEINFO;
 
+/** Data structure for the measurements of a blob in an image.
+ *
+ *  The perimeter is the number of pixel edges between the blob and the background,
+ *  including the edges of any holes. The orientation is the angle of the major axis
+ *  in radians from the x axis, anticlockwise as the image is displayed, between -pi/2
+ *  and pi/2. The eccentricity of the ellipse with the same second order moments is 0
+ *  for a circle and tends to 1 for a line. The convex hull is that of the pixel squares.
+*/
+typedef struct
+{
+	BLOBINFO info;
+	double intensity_sum;
+	double intensity_mean;
+	double intensity_min;
+	double intensity_max;
+	int perimeter;
+	double orientation;
+	double eccentricity;
+	double equivalent_diameter;
+	double convex_hull_area;
+
+} BLOBMEASUREMENT;
+
+/** Data structure for the measurements of all blobs in an image.
+*/
+typedef struct
+{
+	int number_of_blobs;
+	BLOBMEASUREMENT* blobs;
+
+} PARTICLEMEASUREMENTS;
+
 
 DLL_API void DLL_CALLCONV
 FIA_EnableOldBrokenCodeCompatibility(void);
@@ -76,6 +108,70 @@ DLL_API int DLL_CALLCONV
 FIA_ParticleInfo(FIBITMAP* src, PARTICLEINFO** info, unsigned char white_on_black);
 
 
+/** \brief Find information about particles or blobs in an image using several threads.
+ *
+ *  Horizontal strips of the image are labelled in parallel and the particles that
+ *  cross the borders of the strips are then joined. The particles are the same as
+ *  FIA_ParticleInfo finds but they are sorted by the first pixel of each in memory
+ *  order: lowest row of the image first, then left to right along that row.
+ *  The order does not depend on the number of threads.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param info PARTICLEINFO** Address of pointer to hold particle information the pointer should be NULL.
+ *  \param white_on_black unsigned char Determines the background intensity value.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_ParallelParticleInfo(FIBITMAP* src, PARTICLEINFO** info, unsigned char white_on_black);
+
+
+/** \brief Labels the particles or blobs in an image.
+ *
+ *  Returns a FIT_UINT32 image where background pixels are 0 and the pixels of
+ *  each particle hold its number, from 1. Particle n is blob n - 1 of info.
+ *  The image is labelled in strips on several threads and the particles are
+ *  numbered in the order FIA_ParallelParticleInfo gives.
+ *  With FIA_CONNECTIVITY_8 the particles are the same as FIA_ParticleInfo finds.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param white_on_black unsigned char Determines the background intensity value.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are connected.
+ *  \param info PARTICLEINFO** Address of pointer to hold particle information or NULL.
+ *         Free it with FIA_FreeParticleInfo.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_LabelParticles(FIBITMAP* src, unsigned char white_on_black,
+				   FIA_CONNECTIVITY connectivity, PARTICLEINFO** info);
+
+
+/** \brief Measures the particles or blobs in an image.
+ *
+ *  Everything is summed over the runs of each particle as they are joined, on
+ *  several threads like FIA_ParallelParticleInfo, and the particles are in the same order.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param grey FIBITMAP Greyscale image the size of src to measure the intensities of
+ *         the particles from, or NULL. If NULL the intensities are 0.
+ *  \param white_on_black unsigned char Determines the background intensity value.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are connected.
+ *  \param measurements PARTICLEMEASUREMENTS** Address of pointer to hold the measurements.
+ *         Free it with FIA_FreeParticleMeasurements.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_ParticleMeasurements(FIBITMAP* src, FIBITMAP* grey, unsigned char white_on_black,
+						 FIA_CONNECTIVITY connectivity, PARTICLEMEASUREMENTS** measurements);
+
+
+/** \brief Frees the data returned by FIA_ParticleMeasurements.
+ *
+ *  \param measurements PARTICLEMEASUREMENTS* pointer to the measurements.
+*/
+DLL_API void DLL_CALLCONV
+FIA_FreeParticleMeasurements(PARTICLEMEASUREMENTS* measurements);
+
+
 /** \brief Frees the data returned by FIA_ParticleInfo.
  *
  *  \param info PARTICLEINFO* pointer to particle information.
@@ -87,7 +183,8 @@ FIA_FreeParticleInfo(PARTICLEINFO* info);
 
 /** \brief Fills the hole in a particle or blob image.
  *
- *  Image data is an 8bit binary image.
+ *  Image data is an 8bit binary image. Background pixels are connected
+ *  to their four neighbours.
  *
  *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
  *  \param white_on_black unsigned char Determines the background intensity value.
@@ -98,6 +195,22 @@ FIA_Fillholes(FIBITMAP* src,
 							 unsigned char white_on_black);
 
 
+/** \brief Fills the hole in a particle or blob image.
+ *
+ *  Image data is an 8bit binary image. The background that can be reached
+ *  from the border of the image is found in one pass and the rest of the
+ *  background, the holes, is set to 255.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param white_on_black unsigned char Determines the background intensity value.
+ *  \param connectivity FIA_CONNECTIVITY Whether background pixels touching at a corner are connected.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_FillholesWithConnectivity(FIBITMAP* src, unsigned char white_on_black,
+							  FIA_CONNECTIVITY connectivity);
+
+
 /** \brief Finds the maxima within particles or blobs.
  *
  *  The code finds maxima in particles or blobs. Plateaux are cound as are peaks but
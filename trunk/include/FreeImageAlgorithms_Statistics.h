@@ -56,11 +56,31 @@ FIA_HistEq_Random_Additions(FIBITMAP *src);
 /** \brief Equalise and image using histogram equalisation.
  *
  *  \param src FIBITMAP bitmap to perform the equalisation operation on.
+ *         Must be an 8 bit or FIT_UINT16 image. The result spreads over the whole range of the type.
  *  \return FIBITMAP on success or NULL on error.
 */
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_HistEq(FIBITMAP *src);
 
+/** \brief Contrast limited adaptive histogram equalisation (CLAHE).
+ *
+ *  The image is split into tiles_x by tiles_y tiles. Each tile is equalised from its own
+ *  clipped histogram and every pixel is interpolated between the mappings of the four nearest tiles.
+ *  The result keeps the minimum and maximum of src.
+ *
+ *  \param src FIBITMAP bitmap to perform the equalisation operation on. Must be an 8 bit or FIT_UINT16 image.
+ *  \param tiles_x Number of tiles across the image.
+ *  \param tiles_y Number of tiles down the image.
+ *  \param number_of_bins Number of histogram bins between the minimum and maximum of src, up to 65536.
+ *  \param clip_limit Highest count of a bin as a multiple of the mean count of a tile.
+ *         Values of 1 or less clip at the mean count, which leaves each tile close to unchanged,
+ *         and 0 or less turn clipping off.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_ContrastLimitedAdaptiveHistEq(FIBITMAP *src, int tiles_x, int tiles_y,
+                                  int number_of_bins, double clip_limit);
+
 /** \brief Calculate the greylevel average of all the pixels.
  *
  *  \param src FIBITMAP bitmap to perform the average calculation operation on. 
@@ -200,6 +220,53 @@ FIA_Centroid(FIBITMAP *src, float *x_centroid, float *y_centroid);
 DLL_API double DLL_CALLCONV
 FIA_GetMedianFromImage(FIBITMAP* src);
 
+/** \brief Summed area table of a greylevel image.
+ *
+ *  Holds the sums and the sums of squares of the pixels of an image so the
+ *  sum, mean and variance of any rectangle can be found in constant time.
+ *  8 and 16 bit images are summed exactly in 64 bit integers, other types in doubles.
+ */
+typedef struct _FIA_SummedAreaTable FIA_SummedAreaTable;
+
+/** \brief Build the summed area table of a greylevel image.
+ *
+ *  \param src FIBITMAP greylevel image to sum.
+ *  \return FIA_SummedAreaTable* The table on success or NULL on error.
+ *           Free it with FIA_SummedAreaTableDestroy.
+ */
+DLL_API FIA_SummedAreaTable* DLL_CALLCONV
+FIA_SummedAreaTableNew(FIBITMAP *src);
+
+DLL_API void DLL_CALLCONV
+FIA_SummedAreaTableDestroy(FIA_SummedAreaTable *table);
+
+/** \brief Update a summed area table after part of its image has changed.
+ *
+ *  Scanlines are stored bottom up, so the entries recomputed are those from the
+ *  left edge of rect to the right of the image, and from the bottom row of rect
+ *  up to the top of the image. Rows below rect and columns left of it are kept.
+ *
+ *  \param table FIA_SummedAreaTable * Table built from src.
+ *  \param src FIBITMAP The changed image. Must be the same type and size as when the table was built.
+ *  \param rect FIARECT Rectangle of changed pixels, measured from the top left of the image.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+ */
+DLL_API int DLL_CALLCONV
+FIA_SummedAreaTableUpdate(FIA_SummedAreaTable *table, FIBITMAP *src, FIARECT rect);
+
+/** \brief Statistics of the pixels within a rectangle from a summed area table.
+ *
+ *  \param table FIA_SummedAreaTable * Table of the image.
+ *  \param rect FIARECT Rectangle measured from the top left of the image. Must be inside the image.
+ *  \param sum double * Sum of the pixels. May be NULL.
+ *  \param mean double * Mean of the pixels. May be NULL.
+ *  \param variance double * Variance of the pixels, the square of StatisticReport stdDeviation. May be NULL.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+ */
+DLL_API int DLL_CALLCONV
+FIA_SummedAreaTableStatistics(FIA_SummedAreaTable *table, FIARECT rect,
+                              double *sum, double *mean, double *variance);
+
 #ifdef __cplusplus
 }
 #endif
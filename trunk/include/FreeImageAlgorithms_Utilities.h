@@ -89,6 +89,44 @@ FIA_CheckSizesAreSame(FIBITMAP *fib1, FIBITMAP *fib2);
 DLL_API int DLL_CALLCONV
 _os_support(int feature);
 
+/** \brief Returns the SIMD instruction sets the library may use.
+ *
+ *  The cpu is queried once. The result is limited by FIA_SetCpuFeatureMask.
+ *
+ *  \return int, combination of _CPU_FEATURE_MMX, _CPU_FEATURE_SSE,
+ *          _CPU_FEATURE_SSE2 and _CPU_FEATURE_AVX2.
+*/
+DLL_API int DLL_CALLCONV
+FIA_GetCpuFeatures(void);
+
+/** \brief Restricts the SIMD instruction sets the library may use.
+ *
+ *  Mainly for testing and benchmarking the scalar code paths.
+ *
+ *  \param mask Combination of _CPU_FEATURE_* flags. 0 disables all SIMD code,
+ *         ~0 allows everything the cpu supports.
+*/
+DLL_API void DLL_CALLCONV
+FIA_SetCpuFeatureMask(int mask);
+
+/** \brief Sets the number of threads functions like FIA_Convolve split their work between.
+ *
+ *  The results do not depend on the number of threads.
+ *  Should not be called while other library functions are running.
+ *
+ *  \param threads Number of threads. Values less than 1 use one thread per processor,
+ *         which is also the default. 1 runs everything on the calling thread.
+*/
+DLL_API void DLL_CALLCONV
+FIA_SetNumberOfThreads(int threads);
+
+/** \brief Returns the number of threads set with FIA_SetNumberOfThreads.
+ *
+ *  \return int number of threads.
+*/
+DLL_API int DLL_CALLCONV
+FIA_GetNumberOfThreads(void);
+
 DLL_API void DLL_CALLCONV
 FIA_SSEFindFloatMinMax(const float *data, long n, float *min, float *max);
 
@@ -654,6 +692,25 @@ FIA_Is8Bit(FIBITMAP *src);
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_DistanceTransform(FIBITMAP *src);
 
+/** \brief Compute the Euclidean distance of each pixel to the nearest zero pixel.
+ *
+ *  The zero pixels of the 8bit src image are the features. The column and row
+ *  passes run on the thread pool. Pixels of an image with no features get the
+ *  largest value of the result type and a nearest index of -1.
+ *
+ *  \param src 8bit image to transform.
+ *  \param x_spacing double The distance between pixel centres along x.
+ *  \param y_spacing double The distance between pixel centres along y.
+ *  \param squared int If non zero a FIT_UINT32 image of squared distances, rounded
+ *         to whole numbers, is returned instead of a FIT_FLOAT image of distances.
+ *  \param nearest FIBITMAP** If not NULL is set to a FIT_INT32 image of the index,
+ *         y * width + x, of the nearest feature of each pixel.
+ *  \return FIBITMAP* Returns FIBITMAP* on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_DistanceTransformEx(FIBITMAP *src, double x_spacing, double y_spacing,
+						int squared, FIBITMAP **nearest);
+
 /** \brief Get the value of a particular pixel.
  *
  *	Does not check the position is valid works with all greyscale types.
@@ -26,6 +26,83 @@
 
 int CheckMemory(void *ptr);
 
+// Returns FIA_ERROR, with a message, unless connectivity is FIA_CONNECTIVITY_4
+// or FIA_CONNECTIVITY_8.
+int CheckConnectivity(int connectivity);
+
+// Andrew's monotone chain convex hull of the n points of P sorted by x then y.
+// The vertices are written to H, which needs room for n + 1 points, and the
+// first is repeated at the end. Returns the number of points written.
+int ChainHull_2D(FIAPOINT *P, int n, FIAPOINT *H);
+
+// acc[i] += src[i] * value for i < n, using SSE2 or AVX2 when available.
+void KernelRowMultiplyAdd(double *acc, const double *src, double value, int n);
+void KernelRowMultiplyAdd(double *acc, const float *src, double value, int n);
+
+// Returns the sum of src[i] * kernel[i] for i < n, using SSE2 or AVX2 when available.
+double KernelRowDotProduct(const double *src, const double *kernel, int n);
+double KernelRowDotProduct(const float *src, const double *kernel, int n);
+
+// Processes the rows from start_row up to but not including end_row.
+typedef void (*FIA_ROW_RANGE_FUNCTION) (void *user_data, int start_row, int end_row);
+
+// Splits number_of_rows into ranges of at least min_rows_per_range rows and runs
+// them on the thread pool. Returns once every range has been processed.
+int RunRowRangesInParallel(int number_of_rows, int min_rows_per_range,
+                           FIA_ROW_RANGE_FUNCTION function, void *user_data);
+
+// A process wide lock for short critical sections such as cache lookups.
+// Not recursive. Do not hold it while calling other library functions.
+void EnterGlobalLock(void);
+void LeaveGlobalLock(void);
+
+// A binary image packed 64 pixels to a word. Pixel x of a row is bit x % 64
+// of word x / 64. The bits past the width of a row are always zero.
+// Row y is row y of the 8 bit image it came from so rows are bottom up.
+typedef unsigned long long BinaryMaskWord;
+
+typedef struct
+{
+	int width;
+	int height;
+	int words_per_row;
+	BinaryMaskWord *bits;
+
+} BinaryMask;
+
+inline BinaryMaskWord *
+BinaryMaskRow(const BinaryMask *mask, int y)
+{
+	return mask->bits + (size_t) y * mask->words_per_row;
+}
+
+// Returns a cleared mask or NULL if there is not enough memory.
+BinaryMask *NewBinaryMask(int width, int height);
+void FreeBinaryMask(BinaryMask *mask);
+
+// Any non zero pixel of an 8 bit FIT_BITMAP is set. Returns NULL for other images.
+BinaryMask *BinaryMaskFromImage(FIBITMAP *src);
+
+// Returns an image of the type of src. Set pixels become foreground, or the
+// value of the src pixel if keep_values is set and that pixel is non zero.
+FIBITMAP *BinaryMaskToImage(const BinaryMask *mask, FIBITMAP *src, int keep_values,
+                            unsigned char foreground);
+
+// dst may be the same mask as either source.
+void BinaryMaskAnd(BinaryMask *dst, const BinaryMask *a, const BinaryMask *b);
+void BinaryMaskOr(BinaryMask *dst, const BinaryMask *a, const BinaryMask *b);
+void BinaryMaskAndNot(BinaryMask *dst, const BinaryMask *a, const BinaryMask *b);
+void BinaryMaskNot(BinaryMask *dst, const BinaryMask *src);
+
+// 3x3 dilation and erosion. Pixels outside the mask count as unset.
+// dst must not be src. Return FIA_ERROR if there is not enough memory.
+int BinaryMask3x3Dilate(BinaryMask *dst, const BinaryMask *src);
+int BinaryMask3x3Erode(BinaryMask *dst, const BinaryMask *src);
+
+// Sets bit x of dst for each non zero src[x], x < width, and clears the rest
+// of the last word. Uses SSE2 when available.
+void PackBinaryRow(BinaryMaskWord *dst, const unsigned char *src, int width);
+
 /// Max function
 template <class T> inline T
 MAX(T a, T b)
@@ -29,6 +29,8 @@ struct kiss_fft_state{
     int nfft;
     int inverse;
     int factors[2*MAXFACTORS];
+    kiss_fft_cpx * tmpbuf;      /* nfft values for in place transforms */
+    kiss_fft_cpx * scratchbuf;  /* largest generic radix, see kf_bfly_generic */
     kiss_fft_cpx twiddles[1];
 };
 
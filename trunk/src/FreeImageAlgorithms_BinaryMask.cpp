@@ -0,0 +1,414 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ * Oxford University (Gray Institute for Radiation Oncology and Biology)
+ *
+ * This file is part of FreeImageAlgorithms.
+ *
+ * FreeImageAlgorithms is free software: you can redistribute it and/or modify
+ * it under the terms of the Lesser GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeImageAlgorithms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * Lesser GNU General Public License for more details.
+ *
+ * You should have received a copy of the Lesser GNU General Public License
+ * along with FreeImageAlgorithms.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_Utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Binary images held one bit per pixel so the logic and 3x3 morphology
+// work on 64 pixels at a time. Images are only converted to and from
+// 8 bit at the edge of the public functions.
+
+// The bits of the last word of a row that are inside the image.
+static inline BinaryMaskWord
+LastWordMask (int width)
+{
+    int used = width % 64;
+
+    return (used == 0) ? ~(BinaryMaskWord) 0 : (((BinaryMaskWord) 1 << used) - 1);
+}
+
+BinaryMask *
+NewBinaryMask (int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    BinaryMask *mask = (BinaryMask *) malloc (sizeof (BinaryMask));
+
+    if (mask == NULL)
+        return NULL;
+
+    mask->width = width;
+    mask->height = height;
+    mask->words_per_row = (width + 63) / 64;
+    mask->bits = (BinaryMaskWord *) calloc ((size_t) mask->words_per_row * height,
+                                            sizeof (BinaryMaskWord));
+
+    if (mask->bits == NULL)
+    {
+        free (mask);
+        return NULL;
+    }
+
+    return mask;
+}
+
+void
+FreeBinaryMask (BinaryMask * mask)
+{
+    if (mask == NULL)
+        return;
+
+    free (mask->bits);
+    free (mask);
+}
+
+typedef struct
+{
+    BinaryMask *mask;
+    FIBITMAP *fib;
+    int keep_values;
+    unsigned char foreground;
+
+} BinaryMaskImageRange;
+
+static void
+PackRowRange (void *data, int start_row, int end_row)
+{
+    BinaryMaskImageRange *range = (BinaryMaskImageRange *) data;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        PackBinaryRow (BinaryMaskRow (range->mask, y),
+                       (const unsigned char *) FreeImage_GetScanLine (range->fib, y),
+                       range->mask->width);
+    }
+}
+
+BinaryMask *
+BinaryMaskFromImage (FIBITMAP * src)
+{
+    if (src == NULL || FreeImage_GetBPP (src) != 8 || FreeImage_GetImageType (src) != FIT_BITMAP)
+        return NULL;
+
+    BinaryMaskImageRange range;
+
+    range.mask = NewBinaryMask (FreeImage_GetWidth (src), FreeImage_GetHeight (src));
+    range.fib = src;
+
+    if (range.mask == NULL)
+        return NULL;
+
+    RunRowRangesInParallel (range.mask->height, 64, PackRowRange, &range);
+
+    return range.mask;
+}
+
+// byte_masks[b] has byte i set to 0xFF for each bit i of b. Bytes are in
+// memory order so the table is built for the byte order of the machine.
+static BinaryMaskWord byte_masks[256];
+static volatile int byte_masks_ready = 0;
+
+static void
+InitByteMasks (void)
+{
+    if (byte_masks_ready)
+        return;
+
+    EnterGlobalLock ();
+
+    if (!byte_masks_ready)
+    {
+        for(int b = 0; b < 256; b++)
+        {
+            unsigned char bytes[8];
+
+            for(int i = 0; i < 8; i++)
+                bytes[i] = (b & (1 << i)) ? 0xFF : 0;
+
+            memcpy (&byte_masks[b], bytes, 8);
+        }
+
+        byte_masks_ready = 1;
+    }
+
+    LeaveGlobalLock ();
+}
+
+// Each byte of values if it is non zero, otherwise that byte of fill.
+static inline BinaryMaskWord
+ValuesOrForeground (BinaryMaskWord values, BinaryMaskWord fill)
+{
+    const BinaryMaskWord low_bits = 0x7F7F7F7F7F7F7F7FULL;
+    BinaryMaskWord non_zero = (((values & low_bits) + low_bits) | values) & ~low_bits;
+
+    non_zero = (non_zero >> 7) * 0xFF;
+
+    return values | (fill & ~non_zero);
+}
+
+// src and dst rows may be the same when keep_values is set.
+static void
+UnpackRowRange (void *data, int start_row, int end_row)
+{
+    BinaryMaskImageRange *range = (BinaryMaskImageRange *) data;
+    FIBITMAP *dst = range->fib;
+    const int width = range->mask->width;
+    const int keep_values = range->keep_values;
+    const unsigned char foreground = range->foreground;
+    const BinaryMaskWord fill = 0x0101010101010101ULL * foreground;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const BinaryMaskWord *row = BinaryMaskRow (range->mask, y);
+        unsigned char *dst_ptr = (unsigned char *) FreeImage_GetScanLine (dst, y);
+
+        for(int start = 0; start < width; start += 64)
+        {
+            BinaryMaskWord word = row[start / 64];
+            int end = MIN (start + 64, width);
+
+            if (word == 0)
+            {
+                memset (dst_ptr + start, 0, end - start);
+                continue;
+            }
+
+            register int x = start;
+
+            for(; x + 8 <= end; x += 8, word >>= 8)
+            {
+                BinaryMaskWord values = 0;
+
+                if (keep_values)
+                    memcpy (&values, dst_ptr + x, 8);
+
+                BinaryMaskWord pixels = byte_masks[word & 0xFF] & ValuesOrForeground (values, fill);
+
+                memcpy (dst_ptr + x, &pixels, 8);
+            }
+
+            for(; x < end; x++, word >>= 1)
+            {
+                unsigned char value = keep_values ? dst_ptr[x] : 0;
+
+                dst_ptr[x] = (word & 1) ? (value ? value : foreground) : 0;
+            }
+        }
+    }
+}
+
+FIBITMAP *
+BinaryMaskToImage (const BinaryMask * mask, FIBITMAP * src, int keep_values,
+                   unsigned char foreground)
+{
+    if (mask == NULL || src == NULL)
+        return NULL;
+
+    FIBITMAP *dst;
+
+    if (keep_values)
+        dst = FreeImage_Clone (src);
+    else
+        dst = FIA_CloneImageType (src, mask->width, mask->height);
+
+    if (dst == NULL)
+        return NULL;
+
+    BinaryMaskImageRange range;
+
+    range.mask = (BinaryMask *) mask;
+    range.fib = dst;
+    range.keep_values = keep_values;
+    range.foreground = foreground;
+
+    InitByteMasks ();
+
+    RunRowRangesInParallel (mask->height, 64, UnpackRowRange, &range);
+
+    return dst;
+}
+
+void
+BinaryMaskAnd (BinaryMask * dst, const BinaryMask * a, const BinaryMask * b)
+{
+    size_t n = (size_t) dst->words_per_row * dst->height;
+
+    for(register size_t i = 0; i < n; i++)
+        dst->bits[i] = a->bits[i] & b->bits[i];
+}
+
+void
+BinaryMaskOr (BinaryMask * dst, const BinaryMask * a, const BinaryMask * b)
+{
+    size_t n = (size_t) dst->words_per_row * dst->height;
+
+    for(register size_t i = 0; i < n; i++)
+        dst->bits[i] = a->bits[i] | b->bits[i];
+}
+
+void
+BinaryMaskAndNot (BinaryMask * dst, const BinaryMask * a, const BinaryMask * b)
+{
+    size_t n = (size_t) dst->words_per_row * dst->height;
+
+    for(register size_t i = 0; i < n; i++)
+        dst->bits[i] = a->bits[i] & ~b->bits[i];
+}
+
+void
+BinaryMaskNot (BinaryMask * dst, const BinaryMask * src)
+{
+    BinaryMaskWord last = LastWordMask (dst->width);
+    int words = dst->words_per_row;
+
+    for(int y = 0; y < dst->height; y++)
+    {
+        const BinaryMaskWord *src_row = BinaryMaskRow (src, y);
+        BinaryMaskWord *dst_row = BinaryMaskRow (dst, y);
+
+        for(register int i = 0; i < words; i++)
+            dst_row[i] = ~src_row[i];
+
+        dst_row[words - 1] &= last;
+    }
+}
+
+// The 3x3 operations are separable. The horizontal pass combines each
+// pixel with its left and right neighbours by shifting whole words, the
+// vertical pass combines each row with the rows above and below.
+
+typedef struct
+{
+    const BinaryMask *src;
+    BinaryMask *dst;
+    int dilate;
+
+} BinaryMask3x3Range;
+
+static void
+Horizontal3x3Range (void *data, int start_row, int end_row)
+{
+    BinaryMask3x3Range *range = (BinaryMask3x3Range *) data;
+    int words = range->src->words_per_row;
+    BinaryMaskWord last = LastWordMask (range->src->width);
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const BinaryMaskWord *src_row = BinaryMaskRow (range->src, y);
+        BinaryMaskWord *dst_row = BinaryMaskRow (range->dst, y);
+
+        for(register int i = 0; i < words; i++)
+        {
+            BinaryMaskWord previous = (i > 0) ? src_row[i - 1] : 0;
+            BinaryMaskWord next = (i < words - 1) ? src_row[i + 1] : 0;
+            BinaryMaskWord left = (src_row[i] << 1) | (previous >> 63);
+            BinaryMaskWord right = (src_row[i] >> 1) | (next << 63);
+
+            if (range->dilate)
+                dst_row[i] = src_row[i] | left | right;
+            else
+                dst_row[i] = src_row[i] & left & right;
+        }
+
+        dst_row[words - 1] &= last;
+    }
+}
+
+static void
+Vertical3x3Range (void *data, int start_row, int end_row)
+{
+    BinaryMask3x3Range *range = (BinaryMask3x3Range *) data;
+    int words = range->src->words_per_row;
+    int height = range->src->height;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const BinaryMaskWord *row = BinaryMaskRow (range->src, y);
+        BinaryMaskWord *dst_row = BinaryMaskRow (range->dst, y);
+
+        if (range->dilate)
+        {
+            memcpy (dst_row, row, words * sizeof (BinaryMaskWord));
+
+            if (y > 0)
+            {
+                const BinaryMaskWord *below = BinaryMaskRow (range->src, y - 1);
+
+                for(register int i = 0; i < words; i++)
+                    dst_row[i] |= below[i];
+            }
+
+            if (y < height - 1)
+            {
+                const BinaryMaskWord *above = BinaryMaskRow (range->src, y + 1);
+
+                for(register int i = 0; i < words; i++)
+                    dst_row[i] |= above[i];
+            }
+        }
+        else
+        {
+            if (y == 0 || y == height - 1)
+            {
+                memset (dst_row, 0, words * sizeof (BinaryMaskWord));
+                continue;
+            }
+
+            const BinaryMaskWord *below = BinaryMaskRow (range->src, y - 1);
+            const BinaryMaskWord *above = BinaryMaskRow (range->src, y + 1);
+
+            for(register int i = 0; i < words; i++)
+                dst_row[i] = below[i] & row[i] & above[i];
+        }
+    }
+}
+
+static int
+BinaryMask3x3 (BinaryMask * dst, const BinaryMask * src, int dilate)
+{
+    BinaryMask *rows = NewBinaryMask (src->width, src->height);
+
+    if (rows == NULL)
+        return FIA_ERROR;
+
+    BinaryMask3x3Range range;
+
+    range.src = src;
+    range.dst = rows;
+    range.dilate = dilate;
+
+    RunRowRangesInParallel (src->height, 64, Horizontal3x3Range, &range);
+
+    range.src = rows;
+    range.dst = dst;
+
+    RunRowRangesInParallel (src->height, 64, Vertical3x3Range, &range);
+
+    FreeBinaryMask (rows);
+
+    return FIA_SUCCESS;
+}
+
+int
+BinaryMask3x3Dilate (BinaryMask * dst, const BinaryMask * src)
+{
+    return BinaryMask3x3 (dst, src, 1);
+}
+
+int
+BinaryMask3x3Erode (BinaryMask * dst, const BinaryMask * src)
+{
+    return BinaryMask3x3 (dst, src, 0);
+}
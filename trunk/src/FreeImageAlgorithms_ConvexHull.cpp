@@ -18,6 +18,7 @@
  * along with FreeImageAlgorithms.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "FreeImageAlgorithms_Utils.h"
 #include "FreeImageAlgorithms_Drawing.h"
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Utilities.h"
@@ -42,10 +43,11 @@
 //            =0 for P2 on the line
 //            <0 for P2 right of the line
 //    See: the January 2001 Algorithm on Area of Triangles
-inline int
+//    Worked in 64 bits as the products overflow an int for large point sets.
+inline long long
 isLeft (FIAPOINT P0, FIAPOINT P1, FIAPOINT P2)
 {
-    return (P1.x - P0.x) * (P2.y - P0.y) - (P2.x - P0.x) * (P1.y - P0.y);
+    return (long long) (P1.x - P0.x) * (P2.y - P0.y) - (long long) (P2.x - P0.x) * (P1.y - P0.y);
 }
 
 // chainHull_2D(): Andrew's monotone chain 2D convex hull algorithm
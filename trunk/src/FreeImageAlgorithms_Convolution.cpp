@@ -33,9 +33,11 @@
 #include "FreeImageAlgorithms_LinearScale.h"
 
 #include "kiss_fft.h"
+#include "kiss_fftr.h"
 
 #include <math.h>
 #include <iostream>
+#include <map>
 
 #include "Constants.h"
 
@@ -52,166 +54,355 @@ FIA_NewKernel(int x_radius, int y_radius, const double *values, double divider)
     return kernel;
 }
 
-FIBITMAP *
-DLL_CALLCONV
-FIA_Convolve(FIABITMAP * src, FilterKernel kernel)
+// The kernel runs directly on the pixels of these types.
+// Anything else (colour, 32bit integer) is converted to FIT_DOUBLE first.
+static int
+IsNativeKernelType (FIBITMAP * src)
 {
-    FIBITMAP *dst = NULL;
-    FIABITMAP border_tmp;
+    switch (FreeImage_GetImageType(src))
+    {
+        case FIT_BITMAP:
+            return (FreeImage_GetBPP(src) == 8);
 
-    if (!src)
+        case FIT_UINT16:
+        case FIT_INT16:
+        case FIT_FLOAT:
+        case FIT_DOUBLE:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+static int
+IsValidKernelDestinationType (FREE_IMAGE_TYPE type)
+{
+    switch (type)
     {
-        return NULL;
+        case FIT_BITMAP:
+        case FIT_UINT16:
+        case FIT_INT16:
+        case FIT_FLOAT:
+        case FIT_DOUBLE:
+            return 1;
+
+        default:
+            return 0;
     }
+}
 
-    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
+// Fills in border_tmp with the image the kernel should be run over.
+// Returns 1 if a converted copy was made that the caller must unload.
+static int
+GetKernelSourceImage (FIABITMAP * src, FIABITMAP * border_tmp)
+{
+    border_tmp->xborder = src->xborder;
+    border_tmp->yborder = src->yborder;
 
-    if (src_type == FIT_COMPLEX)
+    if (IsNativeKernelType(src->fib))
+    {
+        border_tmp->fib = src->fib;
+        return 0;
+    }
+
+    border_tmp->fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
+
+    return 1;
+}
+
+template < typename Tsrc > static FIBITMAP *
+ConvolveKernelImage (FIABITMAP * src, FilterKernel kernel, FREE_IMAGE_TYPE dst_type)
+{
+    Kernel<Tsrc, double> *kern = new Kernel<Tsrc, double> (src, kernel.x_radius,
+            kernel.y_radius, kernel.values, kernel.divider);
+
+    FIBITMAP *dst = kern->Convolve(dst_type);
+
+    delete kern;
+
+    return dst;
+}
+
+#define KERNEL_BAND_HEIGHT 64
+
+// Integer images are converted to double a band of rows at a time.
+// Converting once per pixel is much cheaper than converting once for
+// every kernel tap and the band stays in cache, unlike a converted copy
+// of the whole image.
+template < typename Tsrc > static FIBITMAP *
+ConvolveKernelImageInBands (FIABITMAP * src, FilterKernel kernel, FREE_IMAGE_TYPE dst_type)
+{
+    const int width = FreeImage_GetWidth(src->fib);
+    const int dst_width = width - (2 * src->xborder);
+    const int dst_height = FreeImage_GetHeight(src->fib) - (2 * src->yborder);
+
+    FIBITMAP *dst = KernelAllocateImage(dst_type, dst_width, dst_height);
+
+    if (dst == NULL)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform convolution on a complex image");
         return NULL;
     }
 
-    border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
+    FIABITMAP band;
+    band.fib = NULL;
+    band.xborder = src->xborder;
+    band.yborder = src->yborder;
+
+    for (int y = 0; y < dst_height; y += KERNEL_BAND_HEIGHT)
+    {
+        int band_rows = MIN(KERNEL_BAND_HEIGHT, dst_height - y);
+        int band_height = band_rows + (2 * src->yborder);
+
+        // Only the last band can be shorter than the rest.
+        if (band.fib == NULL || (int) FreeImage_GetHeight(band.fib) != band_height)
+        {
+            if (band.fib != NULL)
+            {
+                FreeImage_Unload(band.fib);
+            }
+
+            band.fib = FreeImage_AllocateT(FIT_DOUBLE, width, band_height, 64, 0, 0, 0);
+        }
+
+        for (register int row = 0; row < band_height; row++)
+        {
+            Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine(src->fib, y + row);
+            double *band_ptr = (double *) FreeImage_GetScanLine(band.fib, row);
 
-    border_tmp.xborder = src->xborder;
-    border_tmp.yborder = src->yborder;
+            for (register int x = 0; x < width; x++)
+            {
+                band_ptr[x] = (double) src_ptr[x];
+            }
+        }
 
-    Kernel<double>*kern = new Kernel<double> (&border_tmp, kernel.x_radius,
+        Kernel<double, double> *kern = new Kernel<double, double> (&band, kernel.x_radius,
             kernel.y_radius, kernel.values, kernel.divider);
 
-    dst = kern->Convolve();
+        kern->ConvolveInto(dst, y);
 
-    FreeImage_Unload(border_tmp.fib);
+        delete kern;
+    }
 
-    if (NULL == dst)
+    if (band.fib != NULL)
     {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                src_type, FIT_BITMAP);
+        FreeImage_Unload(band.fib);
     }
 
+    return dst;
+}
+
+template < typename Tsrc > static FIBITMAP *
+CorrelateKernelImage (FIABITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+{
+    Kernel<Tsrc, double> *kern = new Kernel<Tsrc, double> (src, kernel.x_radius,
+            kernel.y_radius, kernel.values, kernel.divider);
+
+    kern->SetSearchArea(search_area);
+    kern->SetMask(mask);
+
+    FIBITMAP *dst = kern->Correlate();
+
     delete kern;
 
     return dst;
 }
 
 static FIBITMAP *
+ConvolveNativeImage (FIABITMAP * src, FilterKernel kernel, FREE_IMAGE_TYPE dst_type)
+{
+    switch (FreeImage_GetImageType(src->fib))
+    {
+        case FIT_BITMAP:
+            return ConvolveKernelImageInBands<unsigned char> (src, kernel, dst_type);
+        case FIT_UINT16:
+            return ConvolveKernelImageInBands<unsigned short> (src, kernel, dst_type);
+        case FIT_INT16:
+            return ConvolveKernelImageInBands<short> (src, kernel, dst_type);
+        case FIT_FLOAT:
+            return ConvolveKernelImage<float> (src, kernel, dst_type);
+        case FIT_DOUBLE:
+            return ConvolveKernelImage<double> (src, kernel, dst_type);
+        default:
+            return NULL;
+    }
+}
+
+static FIBITMAP *
+CorrelateNativeImage (FIABITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+{
+    switch (FreeImage_GetImageType(src->fib))
+    {
+        case FIT_BITMAP:
+            return CorrelateKernelImage<unsigned char> (src, kernel, search_area, mask);
+        case FIT_UINT16:
+            return CorrelateKernelImage<unsigned short> (src, kernel, search_area, mask);
+        case FIT_INT16:
+            return CorrelateKernelImage<short> (src, kernel, search_area, mask);
+        case FIT_FLOAT:
+            return CorrelateKernelImage<float> (src, kernel, search_area, mask);
+        case FIT_DOUBLE:
+            return CorrelateKernelImage<double> (src, kernel, search_area, mask);
+        default:
+            return NULL;
+    }
+}
+
+static int
+CheckKernelSource (FIABITMAP * src, FilterKernel kernel)
+{
+    if (!src || !src->fib)
+    {
+        return FIA_ERROR;
+    }
+
+    if (FreeImage_GetImageType(src->fib) == FIT_COMPLEX)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Error can not perform convolution on a complex image");
+        return FIA_ERROR;
+    }
+
+    if (src->xborder < kernel.x_radius || src->yborder < kernel.y_radius)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Image border must be at least as large as the kernel radius");
+        return FIA_ERROR;
+    }
+
+    return FIA_SUCCESS;
+}
+
+FIBITMAP *
 DLL_CALLCONV
-FIA_Correlate(FIABITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+FIA_ConvolveToType(FIABITMAP * src, FilterKernel kernel, FREE_IMAGE_TYPE dst_type)
 {
     FIBITMAP *dst = NULL;
     FIABITMAP border_tmp;
 
-    if (!src)
+    if (CheckKernelSource(src, kernel) == FIA_ERROR)
     {
         return NULL;
     }
 
-    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
-
-    if (src_type == FIT_COMPLEX)
+    if (!IsValidKernelDestinationType(dst_type))
     {
         FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform convolution on a complex image");
+                "Convolution can not produce an image of type %d", dst_type);
         return NULL;
     }
 
-    border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
-    border_tmp.xborder = src->xborder;
-    border_tmp.yborder = src->yborder;
-
-    Kernel<double>*kern = new Kernel<double> (&border_tmp, kernel.x_radius,
-            kernel.y_radius, kernel.values, kernel.divider);
+    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
 
-	kern->SetSearchArea(search_area);
-	kern->SetMask(mask);
+    int converted = GetKernelSourceImage(src, &border_tmp);
 
-    dst = kern->Correlate();
+    if (border_tmp.fib != NULL)
+    {
+        dst = ConvolveNativeImage(&border_tmp, kernel, dst_type);
+    }
 
-    FreeImage_Unload(border_tmp.fib);
+    if (converted && border_tmp.fib != NULL)
+    {
+        FreeImage_Unload(border_tmp.fib);
+    }
 
     if (NULL == dst)
     {
         FreeImage_OutputMessageProc(
                 FIF_UNKNOWN,
                 "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                src_type, FIT_BITMAP);
+                src_type, dst_type);
     }
 
-    delete kern;
-
     return dst;
 }
 
 FIBITMAP *
 DLL_CALLCONV
-FIA_SeparableConvolve(FIABITMAP * src, FilterKernel horz_kernel,
-        FilterKernel vert_kernel)
+FIA_Convolve(FIABITMAP * src, FilterKernel kernel)
 {
-    FIBITMAP *tmp_dst = NULL, *dst = NULL;
-    FIABITMAP *tmp_border = NULL;
+    return FIA_ConvolveToType(src, kernel, FIT_DOUBLE);
+}
+
+static FIBITMAP *
+DLL_CALLCONV
+FIA_Correlate(FIABITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+{
+    FIBITMAP *dst = NULL;
     FIABITMAP border_tmp;
-    int xborder = src->xborder;
-    int yborder = src->yborder;
 
-    if (!src)
+    if (CheckKernelSource(src, kernel) == FIA_ERROR)
     {
         return NULL;
     }
 
     FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
 
-    if (src_type == FIT_COMPLEX)
+    int converted = GetKernelSourceImage(src, &border_tmp);
+
+    if (border_tmp.fib != NULL)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform convolution on a complex image");
-        return NULL;
+        dst = CorrelateNativeImage(&border_tmp, kernel, search_area, mask);
     }
 
-    if (src_type == FIT_DOUBLE)
+    if (converted && border_tmp.fib != NULL)
     {
-        border_tmp.fib = FreeImage_Clone(src->fib);
+        FreeImage_Unload(border_tmp.fib);
     }
-    else
+
+    if (NULL == dst)
     {
-        border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
+        FreeImage_OutputMessageProc(
+                FIF_UNKNOWN,
+                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
+                src_type, FIT_DOUBLE);
     }
 
-    border_tmp.xborder = src->xborder;
-    border_tmp.yborder = src->yborder;
+    return dst;
+}
+
+FIBITMAP *
+DLL_CALLCONV
+FIA_SeparableConvolveToType(FIABITMAP * src, FilterKernel horz_kernel,
+        FilterKernel vert_kernel, FREE_IMAGE_TYPE dst_type)
+{
+    FIBITMAP *tmp_dst = NULL, *dst = NULL;
+    FIABITMAP *tmp_border = NULL;
+
+    if (!src)
+    {
+        return NULL;
+    }
 
-    Kernel<double>*kern1 = new Kernel<double> (&border_tmp,
-            horz_kernel.x_radius, horz_kernel.y_radius, horz_kernel.values,
-            horz_kernel.divider);
+    // The intermediate result is kept in floating point so the
+    // second pass does not work on rounded values.
+    FREE_IMAGE_TYPE tmp_type = (dst_type == FIT_DOUBLE) ? FIT_DOUBLE : FIT_FLOAT;
 
-    tmp_dst = kern1->Convolve();
+    tmp_dst = FIA_ConvolveToType(src, horz_kernel, tmp_type);
 
-    tmp_border = FIA_SetZeroBorder(tmp_dst, xborder, yborder);
+    if (tmp_dst == NULL)
+    {
+        return NULL;
+    }
 
-    Kernel<double>*kern2 = new Kernel<double> (tmp_border,
-            vert_kernel.x_radius, vert_kernel.y_radius, vert_kernel.values,
-            vert_kernel.divider);
+    tmp_border = FIA_SetZeroBorder(tmp_dst, src->xborder, src->yborder);
 
-    dst = kern2->Convolve();
+    dst = FIA_ConvolveToType(tmp_border, vert_kernel, dst_type);
 
     FIA_Unload(tmp_border);
     FreeImage_Unload(tmp_dst);
-    FreeImage_Unload(border_tmp.fib);
-
-    if (NULL == dst)
-    {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                src_type, FIT_BITMAP);
-    }
 
     return dst;
 }
 
+FIBITMAP *
+DLL_CALLCONV
+FIA_SeparableConvolve(FIABITMAP * src, FilterKernel horz_kernel,
+        FilterKernel vert_kernel)
+{
+    return FIA_SeparableConvolveToType(src, horz_kernel, vert_kernel, FIT_DOUBLE);
+}
+
 static int DLL_CALLCONV
 FIA_NewKernelFromImage(FIBITMAP * src, FilterKernel * kernel)
 {
@@ -277,14 +468,249 @@ FIA_NewKernelFromImage(FIBITMAP * src, FilterKernel * kernel)
     return FIA_SUCCESS;
 }
 
-int DLL_CALLCONV
-FIA_KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area, FIBITMAP *mask,
-        CORRELATION_PREFILTER filter, FIAPOINT * pt, double *max)
+// Returns the offset of the top of a peak from the middle of three samples across it.
+static double
+FitPeakOffset(double before, double peak, double after, PeakFitType fit)
+{
+    // A gaussian is a parabola in log space. It needs positive samples
+    // so fall back to a parabola if any are not.
+    if (fit == PEAK_FIT_GAUSSIAN && before > 0.0 && peak > 0.0 && after > 0.0)
+    {
+        before = log(before);
+        peak = log(peak);
+        after = log(after);
+    }
+
+    double curvature = before - 2.0 * peak + after;
+
+    // Flat or not a maximum
+    if (curvature >= 0.0)
+        return 0.0;
+
+    double offset = 0.5 * (before - after) / curvature;
+
+    return MAX(-0.5, MIN(0.5, offset));
+}
+
+// Gets a value next to the peak of a correlation surface.
+// FFT surfaces are circular so wrap around. Kernel surfaces are only
+// valid in the search area and where the mask is set.
+static int
+GetPeakNeighbour(FIBITMAP *surface, int x, int y, int wrap,
+        FIARECT search_area, FIBITMAP *mask, double *value)
+{
+    int width = FreeImage_GetWidth(surface);
+    int height = FreeImage_GetHeight(surface);
+
+    if (wrap)
+    {
+        x = (x + width) % width;
+        y = (y + height) % height;
+    }
+    else
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return 0;
+
+        // Same rows and columns as Kernel::Correlate searches
+        if (!FIARectIsEmpty(search_area))
+        {
+            if (x < search_area.left || x >= search_area.right)
+                return 0;
+
+            if (y < height - 1 - search_area.bottom || y >= height - 1 - search_area.top)
+                return 0;
+        }
+
+        if (mask != NULL && FreeImage_GetScanLine(mask, y)[x] == 0)
+            return 0;
+    }
+
+    return FIA_GetPixelValue(surface, x, y, value) == FIA_SUCCESS;
+}
+
+// Fits the peak found by FIA_FindMaxXY along each axis.
+// dx and dy are in the surface's bottom up coordinates.
+static void
+FitCorrelationPeak(FIBITMAP *surface, FIAPOINT peak, PeakFitType fit, int wrap,
+        FIARECT search_area, FIBITMAP *mask, double *dx, double *dy)
+{
+    double centre, before, after;
+
+    *dx = 0.0;
+    *dy = 0.0;
+
+    if (fit == PEAK_FIT_NONE || FIA_GetPixelValue(surface, peak.x, peak.y, &centre) == FIA_ERROR)
+        return;
+
+    if (GetPeakNeighbour(surface, peak.x - 1, peak.y, wrap, search_area, mask, &before)
+            && GetPeakNeighbour(surface, peak.x + 1, peak.y, wrap, search_area, mask, &after))
+    {
+        *dx = FitPeakOffset(before, centre, after, fit);
+    }
+
+    if (GetPeakNeighbour(surface, peak.x, peak.y - 1, wrap, search_area, mask, &before)
+            && GetPeakNeighbour(surface, peak.x, peak.y + 1, wrap, search_area, mask, &after))
+    {
+        *dy = FitPeakOffset(before, centre, after, fit);
+    }
+}
+
+// Pyramid search stops halving before the src2 image gets smaller than this.
+#define MIN_PYRAMID_KERNEL_SIZE 8
+
+// Half width of the window searched at each finer level around the
+// position found at the level below. Covers the rounding from halving.
+#define PYRAMID_SEARCH_RADIUS 3
+
+// Exhaustive correlation of src2 over src1 within search_area.
+// Sets pt to where the top left of src2 goes on src1.
+static int
+KernelCorrelationPeak(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask,
+        FIAPOINT *pt)
+{
+    FilterKernel kernel;
+    double max;
+
+    if (FIA_NewKernelFromImage(src2, &kernel) == FIA_ERROR)
+        return FIA_ERROR;
+
+    FIABITMAP *tmp = FIA_SetZeroBorder(src1, kernel.x_radius, kernel.y_radius);
+
+    FIBITMAP *dib = FIA_Correlate(tmp, kernel, search_area, mask);
+
+    FIA_Unload(tmp);
+    free((void *) kernel.values);
+
+    if (dib == NULL)
+        return FIA_ERROR;
+
+    FIA_FindMaxXY(dib, &max, pt);
+
+    pt->x -= kernel.x_radius;
+    pt->y = FreeImage_GetHeight(src1) - 1 - pt->y - kernel.y_radius;
+
+    FreeImage_Unload(dib);
+
+    return FIA_SUCCESS;
+}
+
+// Search area of the image at half size. Rounded outwards.
+static FIARECT
+HalveSearchArea(FIARECT search_area)
+{
+    if (FIARectIsEmpty(search_area))
+        return search_area;
+
+    return MakeFIARect(search_area.left >> 1, search_area.top >> 1,
+            (search_area.right + 1) >> 1, (search_area.bottom + 1) >> 1);
+}
+
+// Half size 8 bit mask. Kernel::Correlate searches wherever the mask is non
+// zero so a pixel is set if any of the four it covers is set.
+static FIBITMAP *
+HalveMask(FIBITMAP *mask)
+{
+    int dst_width = FreeImage_GetWidth(mask) / 2;
+    int dst_height = FreeImage_GetHeight(mask) / 2;
+
+    FIBITMAP *dst = FIA_CloneImageType(mask, dst_width, dst_height);
+
+    if (dst == NULL)
+        return NULL;
+
+    for(register int y = 0; y < dst_height; y++)
+    {
+        BYTE *dst_ptr = (BYTE *) FreeImage_GetScanLine(dst, y);
+        BYTE *src_ptr = (BYTE *) FreeImage_GetScanLine(mask, y * 2);
+        BYTE *src_next_line_ptr = (BYTE *) FreeImage_GetScanLine(mask, y * 2 + 1);
+
+        for(register int x = 0; x < dst_width; x++)
+        {
+            int startx = x * 2;
+
+            dst_ptr[x] = MAX(MAX(src_ptr[startx], src_ptr[startx + 1]),
+                    MAX(src_next_line_ptr[startx], src_next_line_ptr[startx + 1]));
+        }
+    }
+
+    return dst;
+}
+
+// Finds the peak on a pyramid of half size images and returns a small
+// search area around it for the full size images. The rect is relative
+// to the top left like the search_area passed to Kernel::Correlate.
+static FIARECT
+PyramidSearchArea(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask, int levels)
+{
+    int src2_width = FreeImage_GetWidth(src2);
+    int src2_height = FreeImage_GetHeight(src2);
+
+    if (levels <= 0 || src2_width / 2 < MIN_PYRAMID_KERNEL_SIZE
+            || src2_height / 2 < MIN_PYRAMID_KERNEL_SIZE)
+    {
+        return search_area;
+    }
+
+    FIBITMAP *half_src1 = FIA_RescaleToHalf(src1);
+    FIBITMAP *half_src2 = FIA_RescaleToHalf(src2);
+    FIBITMAP *half_mask = NULL;
+
+    if (mask != NULL)
+        half_mask = HalveMask(mask);
+
+    FIAPOINT half_pt;
+    int err = FIA_ERROR;
+
+    if (half_src1 != NULL && half_src2 != NULL && (mask == NULL || half_mask != NULL))
+    {
+        FIARECT half_area = PyramidSearchArea(half_src1, half_src2,
+                HalveSearchArea(search_area), half_mask, levels - 1);
+
+        err = KernelCorrelationPeak(half_src1, half_src2, half_area, half_mask, &half_pt);
+    }
+
+    if (half_src1 != NULL)
+        FreeImage_Unload(half_src1);
+
+    if (half_src2 != NULL)
+        FreeImage_Unload(half_src2);
+
+    if (half_mask != NULL)
+        FreeImage_Unload(half_mask);
+
+    if (err == FIA_ERROR)
+        return search_area;
+
+    // Centre of the kernel at full size, see FIA_NewKernelFromImage.
+    int x = 2 * half_pt.x + (src2_width - 1) / 2;
+    int y = 2 * half_pt.y + (src2_height - 1) / 2;
+
+    // Kernel::Correlate searches x from left up to right and y from
+    // below top down to bottom.
+    FIARECT rect = MakeFIARect(x - PYRAMID_SEARCH_RADIUS, y - PYRAMID_SEARCH_RADIUS - 1,
+            x + PYRAMID_SEARCH_RADIUS + 1, y + PYRAMID_SEARCH_RADIUS);
+
+    if (!FIARectIsEmpty(search_area))
+    {
+        rect.left = MAX(rect.left, search_area.left);
+        rect.top = MAX(rect.top, search_area.top);
+        rect.right = MIN(rect.right, search_area.right);
+        rect.bottom = MIN(rect.bottom, search_area.bottom);
+    }
+
+    return rect;
+}
+
+static int
+KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area, FIBITMAP *mask,
+        CORRELATION_PREFILTER filter, int levels, PeakFitType fit, FIAPOINT * pt, FIAPOINTF *subpixel,
+        double *max)
 {
     FilterKernel kernel;
     FIABITMAP *tmp = NULL;
     int height, bpp1, bpp2, filtered_src1_width, filtered_src1_height;
-    double found_max;
+    double found_max, dx, dy;
 
     FREE_IMAGE_TYPE src1_type, src2_type;
 
@@ -414,6 +840,10 @@ FIA_KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_are
 		}
 	}
 
+    // Narrow the search to around the peak found on smaller images
+    if (levels > 0)
+        search_area = PyramidSearchArea(filtered_src1, filtered_src2, search_area, mask, levels);
+
     kernel.x_radius = 0;
     kernel.y_radius = 0;
     kernel.values = NULL;
@@ -438,6 +868,8 @@ FIA_KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_are
 
     FIA_FindMaxXY(dib, &found_max, pt);
 
+    FitCorrelationPeak(dib, *pt, fit, 0, search_area, mask, &dx, &dy);
+
     if (max != NULL)
         *max = found_max;
 
@@ -448,6 +880,13 @@ FIA_KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_are
 
     pt->y = height - pt->y - 1;
 
+    // pt->y is now from the top so dy changes sign
+    if (subpixel != NULL)
+    {
+        subpixel->x = pt->x + dx;
+        subpixel->y = pt->y - dy;
+    }
+
 	if(src1 != NULL)
 		FreeImage_Unload(src1);
 
@@ -497,6 +936,35 @@ CLEANUP:
     return FIA_ERROR;
 }
 
+int DLL_CALLCONV
+FIA_KernelCorrelateImages(FIBITMAP * src1, FIBITMAP * src2, FIARECT search_area, FIBITMAP *mask,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt, double *max)
+{
+    return KernelCorrelateImages(src1, src2, search_area, mask, filter,
+            0, PEAK_FIT_NONE, pt, NULL, max);
+}
+
+int DLL_CALLCONV
+FIA_KernelCorrelateImagesPyramid(FIBITMAP * src1, FIBITMAP * src2, FIARECT search_area,
+        FIBITMAP *mask, CORRELATION_PREFILTER filter, int levels, FIAPOINT * pt, double *max)
+{
+    return KernelCorrelateImages(src1, src2, search_area, mask, filter,
+            levels, PEAK_FIT_NONE, pt, NULL, max);
+}
+
+int DLL_CALLCONV
+FIA_KernelCorrelateImagesSubPixel(FIBITMAP * src1, FIBITMAP * src2, FIARECT search_area,
+        FIBITMAP *mask, CORRELATION_PREFILTER filter, PeakFitType fit, FIAPOINTF * pt, double *max)
+{
+    FIAPOINT peak;
+
+    pt->x = 0.0;
+    pt->y = 0.0;
+
+    return KernelCorrelateImages(src1, src2, search_area, mask, filter,
+            0, fit, &peak, pt, max);
+}
+
 int DLL_CALLCONV
 FIA_KernelCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1,
         FIBITMAP * src2, FIARECT rect2, FIARECT search_rect, FIBITMAP *mask, CORRELATION_PREFILTER filter,
@@ -595,9 +1063,9 @@ PadImage(FIBITMAP * src, int padded_width_size, int padded_height_size)
     return border_src;
 }
 
-int DLL_CALLCONV
-FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
-        CORRELATION_PREFILTER filter, FIAPOINT * pt)
+static int
+FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
+        CORRELATION_PREFILTER filter, PeakFitType fit, FIAPOINT * pt, FIAPOINTF *subpixel)
 {
     FIBITMAP *src1 = FreeImage_Clone(_src1);
     FIBITMAP *src2 = FreeImage_Clone(_src2);
@@ -682,7 +1150,7 @@ FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
     }
 
     // Find the padded width and height.
-    int pad_width = kiss_fft_next_fast_size(src1_width + FreeImage_GetWidth(
+    int pad_width = kiss_fftr_next_fast_size_real(src1_width + FreeImage_GetWidth(
             filtered_src2) + 1);
     int pad_height = kiss_fft_next_fast_size(src1_height + FreeImage_GetHeight(
             filtered_src2) + 1);
@@ -690,14 +1158,12 @@ FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
     FIBITMAP *border_src1 = PadImage(filtered_src1, pad_width, pad_height);
     FIBITMAP *border_src2 = PadImage(filtered_src2, pad_width, pad_height);
 
-    FIBITMAP *fft1 = FIA_FFT(border_src1);
-    FIBITMAP *fft2 = FIA_FFT(border_src2);
+    FIBITMAP *fft1 = FIA_RealFFT(border_src1);
+    FIBITMAP *fft2 = FIA_RealFFT(border_src2);
 
 #ifdef GENERATE_DEBUG_IMAGES
-    FIBITMAP *i = FIA_IFFT(fft1);
-    FIBITMAP *r = FIA_ComplexImageToRealValued(i);
+    FIBITMAP *r = FIA_RealIFFT(fft1, pad_width);
     FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(r, 1),  DEBUG_DATA_DIR "FIA_FFTCorrelateImages-fft.png", BIT24);
-    FreeImage_Unload(i);
     FreeImage_Unload(r);
 #endif
 
@@ -710,18 +1176,19 @@ FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
         return FIA_ERROR;
     }
 
-    FIBITMAP *ifft = FIA_IFFT(fft1);
-
-    FIBITMAP *real = FIA_ComplexImageToRealValued(ifft);
+    FIBITMAP *real = FIA_RealIFFT(fft1, pad_width);
 
 #ifdef GENERATE_DEBUG_IMAGES
     FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft.png", BIT24);
 #endif
 
-    double max;
+    double max, dx, dy;
 
     FIA_FindMaxXY(real, &max, pt);
 
+    // Fit while the surface is still to hand, it wraps around at the edges.
+    FitCorrelationPeak(real, *pt, fit, 1, FIA_EMPTY_RECT, NULL, &dx, &dy);
+
     if (pt->x > src1_width)
     {
         pt->x = pt->x - pad_width;
@@ -735,8 +1202,13 @@ FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
         pt->y = pt->y - pad_height;
     }
 
+    if (subpixel != NULL)
+    {
+        subpixel->x = pt->x + dx;
+        subpixel->y = pt->y - dy;
+    }
+
     FreeImage_Unload(real);
-    FreeImage_Unload(ifft);
     FreeImage_Unload(fft1);
     FreeImage_Unload(fft2);
     FreeImage_Unload(src1);
@@ -749,6 +1221,25 @@ FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
     return FIA_SUCCESS;
 }
 
+int DLL_CALLCONV
+FIA_FFTCorrelateImages(FIBITMAP * src1, FIBITMAP * src2,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt)
+{
+    return FFTCorrelateImages(src1, src2, filter, PEAK_FIT_NONE, pt, NULL);
+}
+
+int DLL_CALLCONV
+FIA_FFTCorrelateImagesSubPixel(FIBITMAP * src1, FIBITMAP * src2,
+        CORRELATION_PREFILTER filter, PeakFitType fit, FIAPOINTF * pt)
+{
+    FIAPOINT peak;
+
+    pt->x = 0.0;
+    pt->y = 0.0;
+
+    return FFTCorrelateImages(src1, src2, filter, fit, &peak, pt);
+}
+
 FIBITMAP* DLL_CALLCONV
 FIA_PreCalculateCorrelationFFT(FIBITMAP *_src1, FIBITMAP *_src2, int pad_size, CORRELATION_PREFILTER filter)
 {
@@ -824,11 +1315,13 @@ FIA_PreCalculateCorrelationFFT(FIBITMAP *_src1, FIBITMAP *_src2, int pad_size, C
     }
 
     // Find the padded width and height.
-    int pad_width = kiss_fft_next_fast_size(src1_width + pad_size );
+    int pad_width = kiss_fftr_next_fast_size_real(src1_width + pad_size );
     int pad_height = kiss_fft_next_fast_size(src1_height + pad_size);
 
     FIBITMAP *border_src1 = PadImage(filtered_src1, pad_width, pad_height);
 
+    // Callers get the full spectrum as FIA_FFT returns it. Only the
+    // correlation itself uses the half spectrum.
     FIBITMAP *fft = FIA_FFT(border_src1);
 
     FreeImage_Unload(src1);
@@ -838,18 +1331,55 @@ FIA_PreCalculateCorrelationFFT(FIBITMAP *_src1, FIBITMAP *_src2, int pad_size, C
 
 #ifdef GENERATE_DEBUG_IMAGES
     FIBITMAP *ifft = FIA_IFFT(fft);
-    FIBITMAP *real = FIA_ComplexImageToRealValued(ifft);
+    FIBITMAP *real = FIA_ConvertComplexImageToAbsoluteValued(ifft);
 
     FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft-pre-generated.png", BIT24);
 
-    FreeImage_Unload(ifft);
     FreeImage_Unload(real);
+    FreeImage_Unload(ifft);
 
 #endif
 
     return fft;
 }
 
+// Multiplies the half spectrum from FIA_RealFFT by the matching columns of a
+// full spectrum from FIA_FFT. Both store the rows in the same order so the
+// full spectrum is read in place, only its first columns are used.
+static int
+MultiplyByFullSpectrum(FIBITMAP *half, FIBITMAP *fft, int pad_width, int pad_height)
+{
+    if ((int) FreeImage_GetWidth(fft) != pad_width || (int) FreeImage_GetHeight(fft) != pad_height)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Precalculated FFT is %d,%d but the padded image is %d,%d",
+                FreeImage_GetWidth(fft), FreeImage_GetHeight(fft), pad_width, pad_height);
+
+        return FIA_ERROR;
+    }
+
+    int bins = FreeImage_GetWidth(half);
+    double tmp;
+
+    for(register int y = 0; y < pad_height; y++)
+    {
+        const FICOMPLEX *fft_ptr = (const FICOMPLEX *) FreeImage_GetScanLine(fft, y);
+        FICOMPLEX *half_ptr = (FICOMPLEX *) FreeImage_GetScanLine(half, y);
+
+        for(register int x = 0; x < bins; x++)
+        {
+            // real part = ac - bd
+            tmp = (fft_ptr[x].r * half_ptr[x].r) - (fft_ptr[x].i * half_ptr[x].i);
+
+            // imaginary part = bc + da
+            half_ptr[x].i = (fft_ptr[x].i * half_ptr[x].r) + (half_ptr[x].i * fft_ptr[x].r);
+            half_ptr[x].r = tmp;
+        }
+    }
+
+    return FIA_SUCCESS;
+}
+
 int DLL_CALLCONV
 FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft1_fib, FIBITMAP *_src1, FIBITMAP *_src2, int pad_size,
         CORRELATION_PREFILTER filter, FIAPOINT * pt)
@@ -857,7 +1387,6 @@ FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft1_fib, FIBITMAP *_src1,
     if(FreeImage_GetImageType(fft1_fib) != FIT_COMPLEX)
         return FIA_ERROR;
 
-    FIBITMAP *fft_fib = FreeImage_Clone(fft1_fib);
     FIBITMAP *src1 = FreeImage_Clone(_src1);
     FIBITMAP *src2 = FreeImage_Clone(_src2);
 
@@ -933,25 +1462,20 @@ FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft1_fib, FIBITMAP *_src1,
      }
 
      // Find the padded width and height.
-     int pad_width = kiss_fft_next_fast_size(src1_width + pad_size);
+     int pad_width = kiss_fftr_next_fast_size_real(src1_width + pad_size);
      int pad_height = kiss_fft_next_fast_size(src1_height + pad_size);
 
      FIBITMAP *border_src2 = PadImage(filtered_src2, pad_width, pad_height);
 
-     FIBITMAP *fft2 = FIA_FFT(border_src2);
+     FIBITMAP *fft2 = FIA_RealFFT(border_src2);
 
      FIA_ComplexConjugate(fft2);
 
-     if (FIA_MultiplyComplexImages(fft_fib, fft2) == FIA_ERROR)
-     {
-         FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                 "FIA_MultiplyComplexImages Failed");
+     // fft2 holds the product so the precalculated fft is left for the next call
+     if (MultiplyByFullSpectrum(fft2, fft1_fib, pad_width, pad_height) == FIA_ERROR)
          return FIA_ERROR;
-     }
 
-     FIBITMAP *ifft = FIA_IFFT(fft_fib);
-
-     FIBITMAP *real = FIA_ComplexImageToRealValued(ifft);
+     FIBITMAP *real = FIA_RealIFFT(fft2, pad_width);
 
  #ifdef GENERATE_DEBUG_IMAGES
      FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft.png", BIT24);
@@ -975,8 +1499,6 @@ FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft1_fib, FIBITMAP *_src1,
      }
 
      FreeImage_Unload(real);
-     FreeImage_Unload(fft_fib);
-     FreeImage_Unload(ifft);
      FreeImage_Unload(fft2);
      FreeImage_Unload(src1);
      FreeImage_Unload(src2);
@@ -1035,3 +1557,430 @@ FIA_FFTCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1, FIBITMAP * src2,
 
     return FIA_SUCCESS;
 }
+
+// Batched correlation. Every region is padded to one size, large enough that
+// no pair wraps around, so each distinct region is filtered and transformed
+// once however many pairs use it. A larger pad than a pair needs on its own
+// only adds zeros so the peak is the same as FIA_FFTCorrelateImages finds.
+// A transform is freed as soon as the last pair using it has finished.
+
+typedef struct
+{
+    int image;
+    FIARECT rect;
+
+    int width;
+    int height;
+    int uses;           // pairs that have not finished with the transform
+    FIBITMAP *fft;
+
+} CorrelationRegion;
+
+typedef struct
+{
+    FIBITMAP **images;
+    CorrelationPair *pairs;
+    CorrelationRegion *regions;
+    int *pair_regions;  // first and second region of each pair
+    int pad_width;      // every region is padded to this size
+    int pad_height;
+    CORRELATION_PREFILTER filter;
+    PeakFitType fit;
+
+} CorrelationBatch;
+
+struct CorrelationRegionKey
+{
+    int image, left, top, right, bottom;
+
+    bool operator<(const CorrelationRegionKey &k) const
+    {
+        if (image != k.image) return image < k.image;
+        if (left != k.left) return left < k.left;
+        if (top != k.top) return top < k.top;
+        if (right != k.right) return right < k.right;
+        return bottom < k.bottom;
+    }
+};
+
+// Size of the region FIA_Copy would return. An empty rect is the whole image.
+static void
+GetCorrelationRegionSize(FIBITMAP *src, FIARECT rect, int *width, int *height)
+{
+    int max_right = FreeImage_GetWidth(src);
+    int max_bottom = FreeImage_GetHeight(src);
+
+    if (FIARectIsEmpty(rect))
+    {
+        *width = max_right;
+        *height = max_bottom;
+        return;
+    }
+
+    *width = MIN(rect.right + 1, max_right) - MAX(rect.left, 0);
+    *height = MIN(rect.bottom + 1, max_bottom) - MAX(rect.top, 0);
+}
+
+// Greyscale, filter and transform a region the same way FIA_FFTCorrelateImages does.
+static FIBITMAP *
+TransformCorrelationRegion(CorrelationBatch *batch, CorrelationRegion *region)
+{
+    FIBITMAP *src = batch->images[region->image];
+    FIBITMAP *rgn;
+
+    if (FIARectIsEmpty(region->rect))
+        rgn = FreeImage_Clone(src);
+    else
+        rgn = FIA_Copy(src, region->rect.left, region->rect.top,
+                region->rect.right, region->rect.bottom);
+
+    if (rgn == NULL)
+        return NULL;
+
+    if (FreeImage_GetBPP(rgn) >= 24 && FreeImage_GetImageType(rgn) == FIT_BITMAP)
+        FIA_InPlaceConvertToGreyscale(&rgn);
+
+    FIA_InPlaceConvertToStandardType(&rgn, 0);
+
+    if (batch->filter != NULL)
+    {
+        FIBITMAP *filtered = batch->filter(rgn);
+
+        FreeImage_Unload(rgn);
+
+        if (filtered == NULL)
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "Filter function returned NULL");
+            return NULL;
+        }
+
+        rgn = filtered;
+        FIA_InPlaceConvertToStandardType(&rgn, 0);
+    }
+
+    if ((int) FreeImage_GetWidth(rgn) != region->width
+            || (int) FreeImage_GetHeight(rgn) != region->height)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Filter function has changed the size of the source input");
+        FreeImage_Unload(rgn);
+        return NULL;
+    }
+
+    FIBITMAP *padded = PadImage(rgn, batch->pad_width, batch->pad_height);
+    FIBITMAP *fft = FIA_RealFFT(padded);
+
+    FreeImage_Unload(padded);
+    FreeImage_Unload(rgn);
+
+    return fft;
+}
+
+// Returns the transform of a region, making it if no other pair has yet.
+// Two threads may both make it; the second copy is thrown away.
+static FIBITMAP *
+GetCorrelationRegionTransform(CorrelationBatch *batch, int index)
+{
+    CorrelationRegion *region = &batch->regions[index];
+
+    EnterGlobalLock();
+    FIBITMAP *fft = region->fft;
+    LeaveGlobalLock();
+
+    if (fft != NULL)
+        return fft;
+
+    FIBITMAP *new_fft = TransformCorrelationRegion(batch, region);
+
+    if (new_fft == NULL)
+        return NULL;
+
+    EnterGlobalLock();
+
+    if (region->fft == NULL)
+    {
+        region->fft = new_fft;
+        new_fft = NULL;
+    }
+
+    fft = region->fft;
+
+    LeaveGlobalLock();
+
+    if (new_fft != NULL)
+        FreeImage_Unload(new_fft);
+
+    return fft;
+}
+
+static void
+ReleaseCorrelationRegionTransform(CorrelationBatch *batch, int index)
+{
+    CorrelationRegion *region = &batch->regions[index];
+    FIBITMAP *fft = NULL;
+
+    EnterGlobalLock();
+
+    if (--region->uses == 0)
+    {
+        fft = region->fft;
+        region->fft = NULL;
+    }
+
+    LeaveGlobalLock();
+
+    if (fft != NULL)
+        FreeImage_Unload(fft);
+}
+
+static int
+CorrelateBatchPair(CorrelationBatch *batch, int index)
+{
+    CorrelationPair *pair = &batch->pairs[index];
+    CorrelationRegion *region1 = &batch->regions[batch->pair_regions[index * 2]];
+    FIAPOINT *pt = &pair->offset;
+
+    FIBITMAP *fft1 = GetCorrelationRegionTransform(batch, batch->pair_regions[index * 2]);
+    FIBITMAP *fft2 = GetCorrelationRegionTransform(batch, batch->pair_regions[index * 2 + 1]);
+
+    if (fft1 == NULL || fft2 == NULL)
+        return FIA_ERROR;
+
+    // fft1 * conj(fft2) without changing the shared transforms.
+    int width = FreeImage_GetWidth(fft1);
+    int height = FreeImage_GetHeight(fft1);
+
+    FIBITMAP *product = FreeImage_AllocateT(FIT_COMPLEX, width, height, 32, 0, 0, 0);
+
+    if (product == NULL)
+        return FIA_ERROR;
+
+    for(int y = 0; y < height; y++)
+    {
+        FICOMPLEX *a = (FICOMPLEX *) FreeImage_GetScanLine(fft1, y);
+        FICOMPLEX *b = (FICOMPLEX *) FreeImage_GetScanLine(fft2, y);
+        FICOMPLEX *dst = (FICOMPLEX *) FreeImage_GetScanLine(product, y);
+
+        for(int x = 0; x < width; x++)
+        {
+            dst[x].r = a[x].r * b[x].r + a[x].i * b[x].i;
+            dst[x].i = a[x].i * b[x].r - a[x].r * b[x].i;
+        }
+    }
+
+    FIBITMAP *real = FIA_RealIFFT(product, batch->pad_width);
+
+    FreeImage_Unload(product);
+
+    if (real == NULL)
+        return FIA_ERROR;
+
+    double dx, dy;
+
+    FIA_FindMaxXY(real, &pair->peak, pt);
+
+    FitCorrelationPeak(real, *pt, batch->fit, 1, FIA_EMPTY_RECT, NULL, &dx, &dy);
+
+    FreeImage_Unload(real);
+
+    if (pt->x > region1->width)
+    {
+        pt->x = pt->x - batch->pad_width;
+    }
+
+    // FIBITMAPS start 0 at bottom row
+    pt->y = batch->pad_height - pt->y - 1;
+
+    if (pt->y > region1->height)
+    {
+        pt->y = pt->y - batch->pad_height;
+    }
+
+    // Adjust for the selected region in both images as FIA_FFTCorrelateImageRegions does.
+    if (pair->first == pair->second)
+    {
+        pt->x += pair->first_rect.left;
+        pt->y += pair->first_rect.top;
+    }
+    else
+    {
+        pt->x = pt->x - pair->second_rect.left + pair->first_rect.left;
+        pt->y = pt->y - pair->second_rect.top + pair->first_rect.top;
+    }
+
+    // pt->y is from the top so dy changes sign
+    pair->subpixel_offset.x = pt->x + dx;
+    pair->subpixel_offset.y = pt->y - dy;
+
+    return FIA_SUCCESS;
+}
+
+static void
+CorrelateBatchPairRange(void *user_data, int start, int end)
+{
+    CorrelationBatch *batch = (CorrelationBatch *) user_data;
+
+    for(int i = start; i < end; i++)
+    {
+        CorrelationPair *pair = &batch->pairs[i];
+
+        // Invalid pairs were marked before the batch started.
+        if (pair->result == FIA_ERROR)
+            continue;
+
+        pair->result = CorrelateBatchPair(batch, i);
+
+        ReleaseCorrelationRegionTransform(batch, batch->pair_regions[i * 2]);
+        ReleaseCorrelationRegionTransform(batch, batch->pair_regions[i * 2 + 1]);
+    }
+}
+
+static int
+CheckCorrelationPair(FIBITMAP **images, int number_of_images, CorrelationPair *pair)
+{
+    if (pair->first < 0 || pair->first >= number_of_images
+            || pair->second < 0 || pair->second >= number_of_images)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "Image index out of range");
+        return FIA_ERROR;
+    }
+
+    FIBITMAP *src1 = images[pair->first];
+    FIBITMAP *src2 = images[pair->second];
+
+    if (src1 == NULL || src2 == NULL)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
+        return FIA_ERROR;
+    }
+
+    if (FreeImage_GetImageType(src1) != FreeImage_GetImageType(src2))
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must be of the same type");
+        return FIA_ERROR;
+    }
+
+    if (FreeImage_GetBPP(src1) != FreeImage_GetBPP(src2))
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must have the same bpp");
+        return FIA_ERROR;
+    }
+
+    return FIA_SUCCESS;
+}
+
+int DLL_CALLCONV
+FIA_FFTCorrelateImagePairs(FIBITMAP **images, int number_of_images,
+        CorrelationPair *pairs, int number_of_pairs, CORRELATION_PREFILTER filter, PeakFitType fit)
+{
+    if (images == NULL || pairs == NULL || number_of_pairs < 1)
+        return FIA_ERROR;
+
+    std::map<CorrelationRegionKey, int> region_indices;
+
+    CorrelationRegion *regions =
+        (CorrelationRegion *) malloc(sizeof(CorrelationRegion) * number_of_pairs * 2);
+    int *pair_regions = (int *) malloc(sizeof(int) * number_of_pairs * 2);
+
+    if (CheckMemory(regions) < 0 || CheckMemory(pair_regions) < 0)
+    {
+        free(regions);
+        free(pair_regions);
+        return FIA_ERROR;
+    }
+
+    int number_of_regions = 0;
+    int pair_width = 1, pair_height = 1;
+
+    for(int i = 0; i < number_of_pairs; i++)
+    {
+        CorrelationPair *pair = &pairs[i];
+
+        pair->offset.x = 0;
+        pair->offset.y = 0;
+        pair->subpixel_offset.x = 0.0;
+        pair->subpixel_offset.y = 0.0;
+        pair->peak = 0.0;
+        pair->result = CheckCorrelationPair(images, number_of_images, pair);
+
+        if (pair->result == FIA_ERROR)
+            continue;
+
+        int image[2] = {pair->first, pair->second};
+        FIARECT rect[2] = {pair->first_rect, pair->second_rect};
+        int width[2], height[2];
+
+        for(int j = 0; j < 2; j++)
+            GetCorrelationRegionSize(images[image[j]], rect[j], &width[j], &height[j]);
+
+        // The common pad must stop every pair wrapping around.
+        pair_width = MAX(pair_width, width[0] + width[1] + 1);
+        pair_height = MAX(pair_height, height[0] + height[1] + 1);
+
+        for(int j = 0; j < 2; j++)
+        {
+            CorrelationRegionKey key = {image[j], rect[j].left, rect[j].top,
+                rect[j].right, rect[j].bottom};
+            std::map<CorrelationRegionKey, int>::iterator it = region_indices.find(key);
+            int index;
+
+            if (it == region_indices.end())
+            {
+                CorrelationRegion *region = &regions[number_of_regions];
+
+                region->image = image[j];
+                region->rect = rect[j];
+                region->width = width[j];
+                region->height = height[j];
+                region->uses = 0;
+                region->fft = NULL;
+
+                index = number_of_regions++;
+                region_indices[key] = index;
+            }
+            else
+            {
+                index = it->second;
+            }
+
+            regions[index].uses++;
+            pair_regions[i * 2 + j] = index;
+        }
+    }
+
+    CorrelationBatch batch;
+
+    batch.images = images;
+    batch.pairs = pairs;
+    batch.regions = regions;
+    batch.pair_regions = pair_regions;
+    batch.pad_width = kiss_fftr_next_fast_size_real(pair_width);
+    batch.pad_height = kiss_fft_next_fast_size(pair_height);
+    batch.filter = filter;
+    batch.fit = fit;
+
+    RunRowRangesInParallel(number_of_pairs, 1, CorrelateBatchPairRange, &batch);
+
+    int err = FIA_SUCCESS;
+
+    for(int i = 0; i < number_of_pairs; i++)
+    {
+        if (pairs[i].result == FIA_ERROR)
+            err = FIA_ERROR;
+    }
+
+    // Only left over if a pair failed before releasing its transforms.
+    for(int i = 0; i < number_of_regions; i++)
+    {
+        if (regions[i].fft != NULL)
+            FreeImage_Unload(regions[i].fft);
+    }
+
+    free(regions);
+    free(pair_regions);
+
+    return err;
+}
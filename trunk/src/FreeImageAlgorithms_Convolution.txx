@@ -24,19 +24,29 @@
 #include "FreeImageAlgorithms_Utilities.h"
 
 #include "FreeImageAlgorithms_Utils.h"
+#include "FreeImageAlgorithms_Palettes.h"
+
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits>
 
 #define BLOCKSIZE 8
 
-template < typename Tsrc > class Kernel;
+// Tsrc is the pixel type of the image the kernel is moved over.
+// Tkernel is the type of the kernel values. Convolution and correlation
+// use double kernel values so integer images are accumulated in double
+// without first converting the whole image.
+template < typename Tsrc, typename Tkernel = Tsrc > class Kernel;
 
-template < typename Tsrc > class KernelIterator
+template < typename Tsrc, typename Tkernel = Tsrc > class KernelIterator
 {
   public:
 
-    KernelIterator (Kernel < Tsrc > *kernel)
+    KernelIterator (Kernel < Tsrc, Tkernel > *kernel)
     {
         this->kernel = kernel;
-        this->current_kernel_ptr = const_cast < Tsrc * >(kernel->KernelValues ());
+        this->current_kernel_ptr = const_cast < Tkernel * >(kernel->KernelValues ());
         this->current_image_ptr = kernel->KernelFirstValuePtr ();
     }
 
@@ -52,7 +62,7 @@ template < typename Tsrc > class KernelIterator
         this->current_image_ptr += kernel->ImagePitchInPixels ();
     }
 
-    inline Tsrc GetKernelValue ()
+    inline Tkernel GetKernelValue ()
     {
         return *(this->current_kernel_ptr);
     }
@@ -62,7 +72,7 @@ template < typename Tsrc > class KernelIterator
         return *(this->current_image_ptr);
     }
 
-    inline Tsrc *GetKernelPtrValue ()
+    inline Tkernel *GetKernelPtrValue ()
     {
         return this->current_kernel_ptr;
     }
@@ -72,23 +82,100 @@ template < typename Tsrc > class KernelIterator
         return this->current_image_ptr;
     }
 
-    inline Kernel < Tsrc > *GetKernel ()
+    inline Kernel < Tsrc, Tkernel > *GetKernel ()
     {
         return this->kernel;
     }
 
   private:
 
-    Tsrc * current_kernel_ptr;
+    Tkernel * current_kernel_ptr;
     Tsrc *current_image_ptr;
 
-    Kernel < Tsrc > *kernel;
+    Kernel < Tsrc, Tkernel > *kernel;
 };
 
-template < typename Tsrc > class Kernel
+// Converts an accumulated kernel result to the destination pixel type.
+// Integer destinations are rounded and clamped to the range of the type.
+template < typename Tdst > inline Tdst
+KernelResultToType (double value)
+{
+    if (!std::numeric_limits < Tdst >::is_integer)
+        return static_cast < Tdst > (value);
+
+    if (value <= (double) (std::numeric_limits < Tdst >::min) ())
+        return (std::numeric_limits < Tdst >::min) ();
+
+    if (value >= (double) (std::numeric_limits < Tdst >::max) ())
+        return (std::numeric_limits < Tdst >::max) ();
+
+    return static_cast < Tdst > ((value < 0.0) ? value - 0.5 : value + 0.5);
+}
+
+// Allocates an image that a kernel can write its results to.
+// Returns NULL for types other than 8bit FIT_BITMAP, FIT_UINT16, FIT_INT16,
+// FIT_FLOAT and FIT_DOUBLE.
+inline FIBITMAP *
+KernelAllocateImage (FREE_IMAGE_TYPE type, int width, int height)
+{
+    FIBITMAP *dst = NULL;
+
+    switch (type)
+    {
+        case FIT_BITMAP:
+            dst = FreeImage_AllocateT (FIT_BITMAP, width, height, 8, 0, 0, 0);
+            FIA_SetGreyLevelPalette (dst);
+            break;
+
+        case FIT_UINT16:
+        case FIT_INT16:
+            dst = FreeImage_AllocateT (type, width, height, 16, 0, 0, 0);
+            break;
+
+        case FIT_FLOAT:
+            dst = FreeImage_AllocateT (type, width, height, 32, 0, 0, 0);
+            break;
+
+        case FIT_DOUBLE:
+            dst = FreeImage_AllocateT (type, width, height, 64, 0, 0, 0);
+            break;
+
+        default:
+            break;
+    }
+
+    return dst;
+}
+
+// Describes the rows one thread works on, see RunRowRangesInParallel.
+typedef struct
+{
+    void *kernel;
+    FIBITMAP *dst;
+    int dst_row_offset;
+    FIARECT rect;
+    double kernel_normalise_sum;
+    int error;
+
+} KernelRowRange;
+
+// Sums of the pixels of the image under the kernel are kept as 64 bit
+// integers for integer images so the energy under the kernel is exact.
+template < typename Tsrc, bool is_integer = std::numeric_limits < Tsrc >::is_integer >
+struct KernelSumType
+{
+    typedef double Type;
+};
+
+template < typename Tsrc > struct KernelSumType < Tsrc, true >
+{
+    typedef long long Type;
+};
+
+template < typename Tsrc, typename Tkernel > class Kernel
 {
   public:
-    Kernel (FIABITMAP * src, int x_radius, int y_radius, const Tsrc * values, double divider);
+    Kernel (FIABITMAP * src, int x_radius, int y_radius, const Tkernel * values, double divider);
 
 	inline Tsrc* GetPtrToLine (int line)
     {
@@ -108,7 +195,7 @@ template < typename Tsrc > class Kernel
     {
 		this->current_src_ptr = GetPtrToLine (y) + (x_amount_to_image + x);
 
-        this->current_src_center_ptr = this->current_src_ptr + (y_radius * this->src_pitch_in_pixels) - x_radius;
+        this->current_src_center_ptr = this->current_src_ptr + (y_radius * this->src_pitch_in_pixels) + x_radius;
     }
 
 	/*
@@ -158,7 +245,7 @@ template < typename Tsrc > class Kernel
     {
         return this->src_pitch_in_pixels;
     }
-    inline const Tsrc *KernelValues ()
+    inline const Tkernel *KernelValues ()
     {
         return this->values;
     }
@@ -198,22 +285,40 @@ template < typename Tsrc > class Kernel
     {
         return *(this->current_src_center_ptr);
     }
-    inline KernelIterator < Tsrc > Begin ()
+    inline KernelIterator < Tsrc, Tkernel > Begin ()
     {
-        return KernelIterator < Tsrc > (this);
+        return KernelIterator < Tsrc, Tkernel > (this);
     }
 
-    FIBITMAP *Convolve ();
+    // Returns a new image of dst_type. Supported types are 8bit FIT_BITMAP,
+    // FIT_UINT16, FIT_INT16, FIT_FLOAT and FIT_DOUBLE.
+    FIBITMAP *Convolve (FREE_IMAGE_TYPE dst_type);
+
+    // Writes the result into an existing image starting at row dst_row_offset.
+    // dst must be as wide as the result and have room for all of its rows.
+    int ConvolveInto (FIBITMAP * dst, int dst_row_offset);
+
+    // Always returns a FIT_DOUBLE image of correlation coefficients.
     FIBITMAP *Correlate ();
 
   private:
 
-    inline void ConvolveKernel ();
-    inline void CorrelateKernel ();
-    inline void ConvolveKernelRow (KernelIterator < Tsrc > &iterator);
-    inline double AddKernelRow (KernelIterator < Tsrc > &iterator);
-    inline double ImageAverageAtKernel (void);
-    inline void CorrelateKernelRow (KernelIterator < Tsrc > &iterator, double average);
+    template < typename Tdst > int ConvolveToImage (FIBITMAP * dst, int dst_row_offset);
+    template < typename Tdst > int ConvolveRowsToImage (FIBITMAP * dst, int dst_row_offset,
+                                                        int start_row, int end_row);
+    template < typename Tdst > static void ConvolveRowRange (void *data, int start_row, int end_row);
+
+    void CorrelateRows (FIBITMAP * dst, FIARECT rect, double kernel_normalise_sum,
+                        int start_row, int end_row);
+    static void CorrelateRowRange (void *data, int start_row, int end_row);
+
+    typedef typename KernelSumType < Tsrc >::Type SumType;
+
+    int BuildSummedAreaTables (FIARECT rect);
+    void FreeSummedAreaTables ();
+
+    inline double CorrelateKernel ();
+    inline double EnergyAtKernel (int x, int y);
 
     FIBITMAP *dib;
     FIBITMAP *mask;
@@ -234,23 +339,32 @@ template < typename Tsrc > class Kernel
     const int y_max_block_size;
     const int src_pitch_in_pixels;
     const FREE_IMAGE_TYPE src_image_type;
-    const Tsrc *values;
+    const Tkernel *values;
     int x_amount_to_image;
     int y_amount_to_image;
     double kernel_average;
 
     Tsrc *src_first_pixel_address_ptr;
 
-    double sum;
-    double correlation_sum_squared;
+    // Kernel values less their mean, used by Correlate
+    double *centred_values;
+
+    // Summed area tables used by Correlate, see BuildSummedAreaTables
+    SumType *table;
+    SumType *table_squared;
+    SumType table_offset;
+    int table_x;
+    int table_y;
+    int table_stride;
 
     Tsrc *current_src_center_ptr;
     Tsrc *current_src_ptr;
 };
 
 // The following code does a lot of loop unrolling for performance.
-template < typename Tsrc > Kernel < Tsrc >::Kernel (FIABITMAP * src, int x_radius, int y_radius,
-                                                    const Tsrc * values, double divider):
+template < typename Tsrc, typename Tkernel > Kernel < Tsrc, Tkernel >::Kernel (FIABITMAP * src,
+                                                    int x_radius, int y_radius,
+                                                    const Tkernel * values, double divider):
 xborder (src->xborder),
 yborder (src->yborder),
 x_radius (x_radius),
@@ -286,547 +400,356 @@ values (values)
     this->Move (0, 0);
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::ConvolveKernelRow (KernelIterator < Tsrc >
-                                                                           &iterator)
+// Scalar version for source types without a SIMD implementation.
+template < typename Tsrc > inline void
+KernelRowMultiplyAdd (double *acc, const Tsrc * src, double value, int n)
 {
-    register double *tmp, *kernel_ptr;
+    for(register int i = 0; i < n; i++)
+        acc[i] += src[i] * value;
+}
 
-    int x_max_block_size = this->x_max_block_size;
-    int x_reminder = this->x_reminder;
+// Works on a whole output row at a time. Each kernel value is multiplied
+// with a row of source pixels and added to a row of sums, so the SIMD row
+// functions process several output pixels per instruction.
+// Zero kernel values, common in edge detection kernels, are skipped.
+template < typename Tsrc, typename Tkernel > template < typename Tdst > int
+Kernel < Tsrc, Tkernel >::ConvolveRowsToImage (FIBITMAP * dst, int dst_row_offset,
+                                               int start_row, int end_row)
+{
+    const int dst_width = src_image_width - (2 * this->xborder);
 
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
-    {
-        tmp = iterator.GetImagePtrValue () + col;
-        kernel_ptr = iterator.GetKernelPtrValue () + col;
+    double *sums = (double *) malloc (sizeof (double) * dst_width);
 
-        sum += tmp[0] * kernel_ptr[0] + tmp[1] * kernel_ptr[1] + tmp[2] * kernel_ptr[2] + tmp[3]
-            * kernel_ptr[3] + tmp[4] * kernel_ptr[4] + tmp[5] * kernel_ptr[5] + tmp[6]
-            * kernel_ptr[6] + tmp[7] * kernel_ptr[7];
-    }
+    if (sums == NULL)
+        return FIA_ERROR;
 
-    if (x_reminder)
-    {
-        tmp = iterator.GetImagePtrValue () + x_max_block_size;
-        kernel_ptr = iterator.GetKernelPtrValue () + x_max_block_size;
-    }
+    register Tdst *dst_ptr;
 
-    switch (x_reminder)
+    for(register int y = start_row; y < end_row; y++)
     {
-        case 7:
-        {
-            sum += tmp[6] * kernel_ptr[6] + tmp[5] * kernel_ptr[5] + tmp[4] * kernel_ptr[4]
-                + tmp[3] * kernel_ptr[3] + tmp[2] * kernel_ptr[2] + tmp[1] * kernel_ptr[1]
-                + tmp[0] * kernel_ptr[0];
-            break;
-        }
-        case 6:
-        {
-            sum += tmp[5] * kernel_ptr[5] + tmp[4] * kernel_ptr[4] + tmp[3] * kernel_ptr[3]
-                + tmp[2] * kernel_ptr[2] + tmp[1] * kernel_ptr[1] + tmp[0] * kernel_ptr[0];
-            break;
-        }
-        case 5:
-        {
-            sum += tmp[4] * kernel_ptr[4] + tmp[3] * kernel_ptr[3] + tmp[2] * kernel_ptr[2]
-                + tmp[1] * kernel_ptr[1] + tmp[0] * kernel_ptr[0];
-            break;
-        }
-        case 4:
-        {
-            sum += tmp[3] * kernel_ptr[3] + tmp[2] * kernel_ptr[2] + tmp[1] * kernel_ptr[1]
-                + tmp[0] * kernel_ptr[0];
-            break;
-        }
-        case 3:
-        {
-            sum += tmp[2] * kernel_ptr[2] + tmp[1] * kernel_ptr[1] + tmp[0] * kernel_ptr[0];
-            break;
-        }
-        case 2:
-        {
-            sum += tmp[1] * kernel_ptr[1] + tmp[0] * kernel_ptr[0];
-            break;
-        }
-        case 1:
-        {
-            sum += tmp[0] * kernel_ptr[0];
-        }
-    }
-}
+        memset (sums, 0, sizeof (double) * dst_width);
 
-template < typename Tsrc > inline void Kernel < Tsrc >::ConvolveKernel ()
-{
-    this->sum = 0.0f;
+        this->Move (0, y);
 
-    KernelIterator < Tsrc > iterator = this->Begin ();
+        Tsrc *src_row_ptr = this->KernelFirstValuePtr ();
+        const Tkernel *kernel_ptr = this->values;
 
-    for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
-    {
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+        for(register int row = 0; row < this->kernel_height; row++)
+        {
+            for(register int col = 0; col < this->kernel_width; col++, kernel_ptr++)
+            {
+                if (*kernel_ptr == 0)
+                    continue;
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+                KernelRowMultiplyAdd (sums, src_row_ptr + col, (double) *kernel_ptr, dst_width);
+            }
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+            src_row_ptr += this->src_pitch_in_pixels;
+        }
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+        dst_ptr = (Tdst *) FreeImage_GetScanLine (dst, y + dst_row_offset);
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+        for(register int x = 0; x < dst_width; x++)
+            dst_ptr[x] = KernelResultToType < Tdst > (sums[x] / this->divider);
+    }
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+    free (sums);
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
+    return FIA_SUCCESS;
+}
 
-        ConvolveKernelRow (iterator);
-        iterator.IncrementByRow ();
-    }
+// Each range of rows uses its own copy of the kernel as moving
+// the kernel over the image changes its state.
+template < typename Tsrc, typename Tkernel > template < typename Tdst > void
+Kernel < Tsrc, Tkernel >::ConvolveRowRange (void *data, int start_row, int end_row)
+{
+    KernelRowRange *range = (KernelRowRange *) data;
+    Kernel < Tsrc, Tkernel > kernel (*((Kernel < Tsrc, Tkernel > *) range->kernel));
 
-    switch (this->y_reminder)
+    if (kernel.ConvolveRowsToImage < Tdst > (range->dst, range->dst_row_offset,
+                                             start_row, end_row) == FIA_ERROR)
     {
-        case 7:
-        {
-            ConvolveKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 6:
-        {
-            ConvolveKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 5:
-        {
-            ConvolveKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 4:
-        {
-            ConvolveKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 3:
-        {
-            ConvolveKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 2:
-        {
-            ConvolveKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 1:
-        {
-            ConvolveKernelRow (iterator);
-        }
+        range->error = 1;
     }
 }
 
-template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Convolve ()
+// The rows are split between FIA_GetNumberOfThreads threads.
+// Every output pixel is calculated the same way whichever thread does it.
+template < typename Tsrc, typename Tkernel > template < typename Tdst > int
+Kernel < Tsrc, Tkernel >::ConvolveToImage (FIBITMAP * dst, int dst_row_offset)
 {
-    const int dst_width = src_image_width - (2 * this->xborder);
     const int dst_height = src_image_height - (2 * this->yborder);
 
-    FIBITMAP *dst = FIA_CloneImageType (this->dib, dst_width, dst_height);
-
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (Tsrc);
+    KernelRowRange range;
 
-    register double *dst_ptr;
+    range.kernel = this;
+    range.dst = dst;
+    range.dst_row_offset = dst_row_offset;
+    range.error = 0;
 
-    double *dst_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (dst);
-
-    for(register int y = 0; y < dst_height; y++)
-    {
-        this->Move (0, y);
-        dst_ptr = (dst_first_pixel_address_ptr + y * dst_pitch_in_pixels);
-
-        for(register int x = 0; x < dst_width; x++)
-        {
-            this->ConvolveKernel ();
-            *dst_ptr++ = this->sum / this->divider;
-            this->Increment ();
-        }
-    }
+    RunRowRangesInParallel (dst_height, 4, ConvolveRowRange < Tdst >, &range);
 
-    return dst;
+    return range.error ? FIA_ERROR : FIA_SUCCESS;
 }
 
-// Adds the pixel values of the original image pixels
-// that are covered by the kernel row.
-template < typename Tsrc > inline double Kernel < Tsrc >::AddKernelRow (KernelIterator < Tsrc >
-                                                                        &iterator)
+template < typename Tsrc, typename Tkernel > int
+Kernel < Tsrc, Tkernel >::ConvolveInto (FIBITMAP * dst, int dst_row_offset)
 {
-    register double *tmp;
-
-    int x_max_block_size = this->x_max_block_size;
-    int x_reminder = this->x_reminder;
-    double sum = 0.0;
-
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
+    if ((int) FreeImage_GetWidth (dst) != src_image_width - (2 * this->xborder) ||
+        (int) FreeImage_GetHeight (dst) < dst_row_offset + src_image_height - (2 * this->yborder))
     {
-        tmp = iterator.GetImagePtrValue () + col;
-
-        sum += tmp[0] + tmp[1] + tmp[2] + tmp[3] + tmp[4] + tmp[5] + tmp[6] + tmp[7];
+        return FIA_ERROR;
     }
 
-    if (x_reminder)
+    switch (FreeImage_GetImageType (dst))
     {
-        tmp = iterator.GetImagePtrValue () + x_max_block_size;
-    }
-
-    switch (x_reminder)
-    {
-        case 7:
+        case FIT_BITMAP:
         {
-            sum += tmp[6] + tmp[5] + tmp[4] + tmp[3] + tmp[2] + tmp[1] + tmp[0];
-            break;
-        }
+            if (FreeImage_GetBPP (dst) != 8)
+                return FIA_ERROR;
 
-        case 6:
-        {
-            sum += tmp[5] + tmp[4] + tmp[3] + tmp[2] + tmp[1] + tmp[0];
-            break;
+            return this->ConvolveToImage < unsigned char > (dst, dst_row_offset);
         }
 
-        case 5:
-        {
-            sum += tmp[4] + tmp[3] + tmp[2] + tmp[1] + tmp[0];
-            break;
-        }
+        case FIT_UINT16:
+            return this->ConvolveToImage < unsigned short > (dst, dst_row_offset);
 
-        case 4:
-        {
-            sum += tmp[3] + tmp[2] + tmp[1] + tmp[0];
-            break;
-        }
+        case FIT_INT16:
+            return this->ConvolveToImage < short > (dst, dst_row_offset);
 
-        case 3:
-        {
-            sum += tmp[2] + tmp[1] + tmp[0];
-            break;
-        }
-        case 2:
-        {
-            sum += tmp[1] + tmp[0];
-            break;
-        }
-        case 1:
-        {
-            sum += tmp[0];
-        }
+        case FIT_FLOAT:
+            return this->ConvolveToImage < float > (dst, dst_row_offset);
+
+        case FIT_DOUBLE:
+            return this->ConvolveToImage < double > (dst, dst_row_offset);
+
+        default:
+            return FIA_ERROR;
     }
 
-    return sum;
+    return FIA_SUCCESS;
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (KernelIterator < Tsrc >
-                                                                            &iterator, double avg)
+template < typename Tsrc, typename Tkernel > FIBITMAP *
+Kernel < Tsrc, Tkernel >::Convolve (FREE_IMAGE_TYPE dst_type)
 {
-    register double *tmp, *kernel_ptr;
+    const int dst_width = src_image_width - (2 * this->xborder);
+    const int dst_height = src_image_height - (2 * this->yborder);
+
+    FIBITMAP *dst = KernelAllocateImage (dst_type, dst_width, dst_height);
 
-    int x_max_block_size = this->x_max_block_size;
-    int x_reminder = this->x_reminder;
-    double kavg = this->kernel_average;
-    double var0, var1, var2, var3, var4, var5, var6, var7;
+    if (dst == NULL)
+        return NULL;
 
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
+    if (this->ConvolveInto (dst, 0) == FIA_ERROR)
     {
-        tmp = iterator.GetImagePtrValue () + col;
-        kernel_ptr = iterator.GetKernelPtrValue () + col;
+        FreeImage_Unload (dst);
+        return NULL;
+    }
 
-        var0 = tmp[0] - avg;
-        var1 = tmp[1] - avg;
-        var2 = tmp[2] - avg;
-        var3 = tmp[3] - avg;
-        var4 = tmp[4] - avg;
-        var5 = tmp[5] - avg;
-        var6 = tmp[6] - avg;
-        var7 = tmp[7] - avg;
+    return dst;
+}
 
-        this->sum += (var0 * (kernel_ptr[0] - kavg) + var1 * (kernel_ptr[1] - kavg) + var2
-                      * (kernel_ptr[2] - kavg) + var3 * (kernel_ptr[3] - kavg) +
-                      var4 * (kernel_ptr[4] - kavg) + var5 * (kernel_ptr[5] - kavg) +
-                      var6 * (kernel_ptr[6] - kavg) + var7 * (kernel_ptr[7] - kavg));
+// Builds summed area tables of the pixels, and the squared pixels, under
+// every kernel position in rect. The energy under the kernel is then four
+// lookups whatever the kernel size.
+template < typename Tsrc, typename Tkernel > int
+Kernel < Tsrc, Tkernel >::BuildSummedAreaTables (FIARECT rect)
+{
+    const int table_height = rect.top - rect.bottom + this->kernel_height - 1;
+    const int stride = rect.right - rect.left + this->kernel_width;
 
-        this->correlation_sum_squared += ((var0 * var0) + (var1 * var1) + (var2 * var2) + (var3
-                                                                                           * var3) +
-                                          (var4 * var4) + (var5 * var5) + (var6 * var6) +
-                                          (var7 * var7));
-    }
+    this->table_x = rect.left;
+    this->table_y = rect.bottom;
+    this->table_stride = stride;
 
-    if (x_reminder)
-    {
-        tmp = iterator.GetImagePtrValue () + x_max_block_size;
-        kernel_ptr = iterator.GetKernelPtrValue () + x_max_block_size;
+    this->table = (SumType *) calloc ((size_t) stride * (table_height + 1), sizeof (SumType));
+    this->table_squared = (SumType *) calloc ((size_t) stride * (table_height + 1), sizeof (SumType));
 
-        var0 = tmp[0] - avg;
-        var1 = tmp[1] - avg;
-        var2 = tmp[2] - avg;
-        var3 = tmp[3] - avg;
-        var4 = tmp[4] - avg;
-        var5 = tmp[5] - avg;
-        var6 = tmp[6] - avg;
-        var7 = tmp[7] - avg;
-    }
+    if (this->table == NULL || this->table_squared == NULL)
+        return FIA_ERROR;
 
-    switch (x_reminder)
-    {
-        case 7:
-        {
-            this->sum += ((tmp[6] - avg) * (kernel_ptr[6] - kavg) + (tmp[5] - avg) * (kernel_ptr[5]
-                                                                                      - kavg) +
-                          (tmp[4] - avg) * (kernel_ptr[4] - kavg) + (tmp[3] -
-                                                                     avg) * (kernel_ptr[3] - kavg) +
-                          (tmp[2] - avg) * (kernel_ptr[2] - kavg) + (tmp[1] -
-                                                                     avg) * (kernel_ptr[1] - kavg) +
-                          (tmp[0] - avg) * (kernel_ptr[0] - kavg));
-
-            this->correlation_sum_squared += ((var6 * var6) + (var5 * var5) + (var4 * var4) + (var3
-                                                                                               *
-                                                                                               var3)
-                                              + (var2 * var2) + (var1 * var1) + (var0 * var0));
+    // The energy is the difference of two large sums. Floating point images
+    // have their mean taken off first so less precision is lost.
+    this->table_offset = 0;
 
-            break;
-        }
-        case 6:
-        {
-            this->sum += ((tmp[5] - avg) * (kernel_ptr[5] - kavg) + (tmp[4] - avg) * (kernel_ptr[4]
-                                                                                      - kavg) +
-                          (tmp[3] - avg) * (kernel_ptr[3] - kavg) + (tmp[2] -
-                                                                     avg) * (kernel_ptr[2] - kavg) +
-                          (tmp[1] - avg) * (kernel_ptr[1] - kavg) + (tmp[0] -
-                                                                     avg) * (kernel_ptr[0] - kavg));
-
-            this->correlation_sum_squared += ((var5 * var5) + (var4 * var4) + (var3 * var3) + (var2
-                                                                                               *
-                                                                                               var2)
-                                              + (var1 * var1) + (var0 * var0));
+    if (!std::numeric_limits < Tsrc >::is_integer)
+    {
+        double mean = 0.0;
 
-            break;
-        }
-        case 5:
+        for(register int y = 0; y < table_height; y++)
         {
-            this->sum += ((tmp[4] - avg) * (kernel_ptr[4] - kavg) + (tmp[3] - avg) * (kernel_ptr[3]
-                                                                                      - kavg) +
-                          (tmp[2] - avg) * (kernel_ptr[2] - kavg) + (tmp[1] -
-                                                                     avg) * (kernel_ptr[1] - kavg) +
-                          (tmp[0] - avg) * (kernel_ptr[0] - kavg));
-
-            this->correlation_sum_squared += ((var4 * var4) + (var3 * var3) + (var2 * var2) + (var1
-                                                                                               *
-                                                                                               var1)
-                                              + (var0 * var0));
+            const Tsrc *src_ptr = this->GetPtrToLine (rect.bottom + y) + this->x_amount_to_image + rect.left;
 
-            break;
+            for(register int x = 0; x < stride - 1; x++)
+                mean += src_ptr[x];
         }
-        case 4:
-        {
-            this->sum += ((tmp[3] - avg) * (kernel_ptr[3] - kavg) + (tmp[2] - avg) * (kernel_ptr[2]
-                                                                                      - kavg) +
-                          (tmp[1] - avg) * (kernel_ptr[1] - kavg) + (tmp[0] -
-                                                                     avg) * (kernel_ptr[0] - kavg));
-
-            this->correlation_sum_squared += ((var3 * var3) + (var2 * var2) + (var1 * var1) + (var0
-                                                                                               *
-                                                                                               var0));
 
-            break;
-        }
-        case 3:
-        {
-            this->sum += ((tmp[2] - avg) * (kernel_ptr[2] - kavg) + (tmp[1] - avg) * (kernel_ptr[1]
-                                                                                      - kavg) +
-                          (tmp[0] - avg) * (kernel_ptr[0] - kavg));
+        this->table_offset = (SumType) (mean / ((double) table_height * (stride - 1)));
+    }
 
-            this->correlation_sum_squared += ((var2 * var2) + (var1 * var1) + (var0 * var0));
+    for(register int y = 0; y < table_height; y++)
+    {
+        const Tsrc *src_ptr = this->GetPtrToLine (rect.bottom + y) + this->x_amount_to_image + rect.left;
+        const SumType *below = this->table + y * stride;
+        const SumType *below_squared = this->table_squared + y * stride;
+        SumType *row = this->table + (y + 1) * stride;
+        SumType *row_squared = this->table_squared + (y + 1) * stride;
+        SumType sum = 0, sum_squared = 0;
 
-            break;
-        }
-        case 2:
+        for(register int x = 0; x < stride - 1; x++)
         {
-            this->sum += ((tmp[1] - avg) * (kernel_ptr[1] - kavg) + (tmp[0] - avg) * (kernel_ptr[0]
-                                                                                      - kavg));
+            SumType value = (SumType) src_ptr[x] - this->table_offset;
 
-            this->correlation_sum_squared += ((var1 * var1) + (var0 * var0));
-
-            break;
-        }
-        case 1:
-        {
-            this->sum += (tmp[0] - avg) * (kernel_ptr[0] - kavg);
+            sum += value;
+            sum_squared += value * value;
 
-            this->correlation_sum_squared += (var0 * var0);
+            row[x + 1] = below[x + 1] + sum;
+            row_squared[x + 1] = below_squared[x + 1] + sum_squared;
         }
     }
+
+    return FIA_SUCCESS;
 }
 
-// Calculates the average value of the pixels in the original image
-// of the pixels covered by the kernel.
-template < typename Tsrc > inline double Kernel < Tsrc >::ImageAverageAtKernel (void)
+template < typename Tsrc, typename Tkernel > void
+Kernel < Tsrc, Tkernel >::FreeSummedAreaTables ()
 {
-    double sum = 0.0f;
-    int kernel_size = kernel_width * kernel_height;
-
-    KernelIterator < Tsrc > iterator = this->Begin ();
-
-    for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
-    {
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+    free (this->table);
+    free (this->table_squared);
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+    this->table = NULL;
+    this->table_squared = NULL;
+}
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+// Sum of (pixel - mean)^2 under the kernel at x, y.
+template < typename Tsrc, typename Tkernel > inline double
+Kernel < Tsrc, Tkernel >::EnergyAtKernel (int x, int y)
+{
+    const int offset = (y - this->table_y) * this->table_stride + (x - this->table_x);
+    const int top = this->kernel_height * this->table_stride;
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+    const SumType *t = this->table + offset;
+    const SumType *t_squared = this->table_squared + offset;
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+    SumType sum = t[top + this->kernel_width] - t[top] - t[this->kernel_width] + t[0];
+    SumType sum_squared = t_squared[top + this->kernel_width] - t_squared[top]
+        - t_squared[this->kernel_width] + t_squared[0];
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+    double energy = (double) sum_squared -
+        ((double) sum * (double) sum) / (this->kernel_width * this->kernel_height);
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
+    return (energy > 0.0) ? energy : 0.0;
+}
 
-        sum += AddKernelRow (iterator);
-        iterator.IncrementByRow ();
-    }
+// Scalar version for source types without a SIMD implementation.
+template < typename Tsrc > inline double
+KernelRowDotProduct (const Tsrc * src, const double *kernel, int n)
+{
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    register int i = 0;
 
-    switch (this->y_reminder)
+    for(; i + 4 <= n; i += 4)
     {
-        case 7:
-        {
-            sum += AddKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 6:
-        {
-            sum += AddKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 5:
-        {
-            sum += AddKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 4:
-        {
-            sum += AddKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 3:
-        {
-            sum += AddKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 2:
-        {
-            sum += AddKernelRow (iterator);
-            iterator.IncrementByRow ();
-        }
-        case 1:
-        {
-            sum += AddKernelRow (iterator);
-        }
+        s0 += (double) src[i] * kernel[i];
+        s1 += (double) src[i + 1] * kernel[i + 1];
+        s2 += (double) src[i + 2] * kernel[i + 2];
+        s3 += (double) src[i + 3] * kernel[i + 3];
     }
 
-    return sum / kernel_size;
+    double sum = (s0 + s2) + (s1 + s3);
+
+    for(; i < n; i++)
+        sum += (double) src[i] * kernel[i];
+
+    return sum;
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernel ()
+// Sum of pixel * (kernel value - kernel mean) under the kernel. As the
+// centred kernel values add up to zero this equals the sum of
+// (pixel - mean) * (kernel value - kernel mean) without needing the mean.
+template < typename Tsrc, typename Tkernel > inline double
+Kernel < Tsrc, Tkernel >::CorrelateKernel ()
 {
-    this->sum = 0.0f;
-    this->correlation_sum_squared = 0.0f;
-    double average = ImageAverageAtKernel ();
-
-    KernelIterator < Tsrc > iterator = this->Begin ();
+    const Tsrc *src_row_ptr = this->KernelFirstValuePtr ();
+    const double *kernel_ptr = this->centred_values;
+    double sum = 0.0;
 
-    for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
+    for(register int row = 0; row < this->kernel_height; row++)
     {
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
-
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+        sum += KernelRowDotProduct (src_row_ptr, kernel_ptr, this->kernel_width);
 
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+        src_row_ptr += this->src_pitch_in_pixels;
+        kernel_ptr += this->kernel_width;
+    }
 
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+    return sum;
+}
 
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+template < typename Tsrc, typename Tkernel > void
+Kernel < Tsrc, Tkernel >::CorrelateRows (FIBITMAP * dst, FIARECT rect, double kernel_normalise_sum,
+                                         int start_row, int end_row)
+{
+    register double *dst_ptr;
 
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+	if(this->mask != NULL)
+	{
+		BYTE *mask_ptr = NULL;
+	
+		for(register int y = start_row; y < end_row; y++)
+		{
+			this->Move (rect.left, y);
+			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+			mask_ptr = (BYTE *) FreeImage_GetScanLine (this->mask, y);
 
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+			for(register int x = rect.left; x < rect.right; x++)
+			{
+				if(mask_ptr[x] == 0) {
+					this->Increment ();
+					continue;
+				}
+				
+				double dominator = sqrt (this->EnergyAtKernel (x, y) * kernel_normalise_sum);
 
-        CorrelateKernelRow (iterator, average);
-        iterator.IncrementByRow ();
+				dst_ptr[x] = this->CorrelateKernel () / dominator;
+				this->Increment ();
+			}
+		}
     }
-
-    switch (this->y_reminder)
+    else
     {
-        case 7:
-        {
-            CorrelateKernelRow (iterator, average);
-            iterator.IncrementByRow ();
-        }
-        case 6:
-        {
-            CorrelateKernelRow (iterator, average);
-            iterator.IncrementByRow ();
-        }
-        case 5:
-        {
-            CorrelateKernelRow (iterator, average);
-            iterator.IncrementByRow ();
-        }
-        case 4:
-        {
-            CorrelateKernelRow (iterator, average);
-            iterator.IncrementByRow ();
-        }
-        case 3:
-        {
-            CorrelateKernelRow (iterator, average);
-            iterator.IncrementByRow ();
-        }
-        case 2:
-        {
-            CorrelateKernelRow (iterator, average);
-            iterator.IncrementByRow ();
-        }
-        case 1:
-        {
-            CorrelateKernelRow (iterator, average);
-        }
+		for(register int y = start_row; y < end_row; y++)
+		{
+			this->Move (rect.left, y);
+			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+
+			for(register int x = rect.left; x < rect.right; x++)
+			{
+				double dominator = sqrt (this->EnergyAtKernel (x, y) * kernel_normalise_sum);
+
+				dst_ptr[x] = this->CorrelateKernel () / dominator;
+				this->Increment ();
+			}
+		}
     }
 }
 
-template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Correlate ()
+template < typename Tsrc, typename Tkernel > void
+Kernel < Tsrc, Tkernel >::CorrelateRowRange (void *data, int start_row, int end_row)
 {
-    const int dst_width = src_image_width - (2 * this->xborder);
-    const int dst_height = src_image_height - (2 * this->yborder);
+    KernelRowRange *range = (KernelRowRange *) data;
+    Kernel < Tsrc, Tkernel > kernel (*((Kernel < Tsrc, Tkernel > *) range->kernel));
 
-    FIBITMAP *dst = FIA_CloneImageType (this->dib, dst_width, dst_height);
-
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (Tsrc);
+    kernel.CorrelateRows (range->dst, range->rect, range->kernel_normalise_sum,
+                          range->rect.bottom + start_row, range->rect.bottom + end_row);
+}
 
-    register double *dst_ptr;
+template < typename Tsrc, typename Tkernel > FIBITMAP * Kernel < Tsrc, Tkernel >::Correlate ()
+{
+    const int dst_width = src_image_width - (2 * this->xborder);
+    const int dst_height = src_image_height - (2 * this->yborder);
 
-    double *dst_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (dst);
+    FIBITMAP *dst = FreeImage_AllocateT (FIT_DOUBLE, dst_width, dst_height, 64, 0, 0, 0);
 
     this->kernel_average = 0.0;
     int kernel_size = kernel_width * kernel_height;
@@ -840,8 +763,18 @@ template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Correlate ()
 
     double kernel_normalise_sum = 0.0;
 
+    this->centred_values = (double *) malloc (sizeof (double) * kernel_size);
+
+    if (this->centred_values == NULL)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
     for(int i = 0; i < kernel_size; i++)
     {
+        this->centred_values[i] = this->values[i] - this->kernel_average;
+
         kernel_normalise_sum += ((this->values[i] - this->kernel_average) * 
 				(this->values[i] - this->kernel_average));
     }
@@ -872,49 +805,35 @@ template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Correlate ()
 	if(rect.bottom < 0)
 		rect.bottom = 0;
 
-	if(this->mask != NULL)
-	{
-		BYTE *mask_ptr = NULL;
-	
-		for(register int y = rect.bottom; y < rect.top; y++)
-		{
-			this->Move (rect.left, y);
-			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
-			mask_ptr = (BYTE *) FreeImage_GetScanLine (this->mask, y);
+    KernelRowRange range;
 
-			for(register int x = rect.left; x < rect.right; x++)
-			{
-				if(mask_ptr[x] == 0) {
-					this->Increment ();
-					continue;
-				}
-				
-				this->CorrelateKernel ();
-				double dominator = sqrt (this->correlation_sum_squared * kernel_normalise_sum);
+    range.kernel = this;
+    range.dst = dst;
+    range.rect = rect;
+    range.kernel_normalise_sum = kernel_normalise_sum;
+    range.error = 0;
 
-				dst_ptr[x] = this->sum / dominator;
-				this->Increment ();
-			}
-		}
-    }
-    else
-    {
-		for(register int y = rect.bottom; y < rect.top; y++)
-		{
-			this->Move (rect.left, y);
-			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+    this->table = NULL;
+    this->table_squared = NULL;
 
-			for(register int x = rect.left; x < rect.right; x++)
-			{
-				this->CorrelateKernel ();
-				double dominator = sqrt (this->correlation_sum_squared * kernel_normalise_sum);
+    if (rect.top > rect.bottom && rect.right > rect.left)
+    {
+        if (this->BuildSummedAreaTables (rect) == FIA_ERROR)
+        {
+            this->FreeSummedAreaTables ();
+            free (this->centred_values);
+            FreeImage_Unload (dst);
+            return NULL;
+        }
 
-				dst_ptr[x] = this->sum / dominator;
-				this->Increment ();
-			}
-		}
+        RunRowRangesInParallel (rect.top - rect.bottom, 1, CorrelateRowRange, &range);
     }
 
+    this->FreeSummedAreaTables ();
+
+    free (this->centred_values);
+    this->centred_values = NULL;
+
     return dst;
 }
 
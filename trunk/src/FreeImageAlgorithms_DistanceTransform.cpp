@@ -22,12 +22,8 @@
 #include "FreeImageAlgorithms_Utils.h"
 #include "FreeImageAlgorithms_Utilities.h"
 
-#include <algorithm>
 #include <math.h>
 #include <float.h>
-#include <iostream>
-
-#define INF 1E10
 
 template < class T > static inline T
 square (const T & x)
@@ -35,146 +31,286 @@ square (const T & x)
     return x * x;
 }
 
-/* dt of 1d function using squared distance */
-static float *
-dt (float *f, int n)
+// The squared distance transform of Felzenszwalb and Huttenlocher,
+// "Distance Transforms of Sampled Functions", done as a column pass and
+// then a row pass. For a binary image the column pass only has to find the
+// nearest feature row in each column, which takes one scan up and one scan
+// down the image. The row pass takes the lower envelope of the parabolas
+// rooted at each column's squared distance.
+//
+// The column pass is split into bands of columns that each scan every row
+// so the image is read in memory order, the row pass into ranges of rows.
+// Each range has its own scratch buffers.
+
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *nearest_row;      // FIT_INT32, row of the nearest feature in the column or -1
+    FIBITMAP *dst;
+    FIBITMAP *nearest;          // FIT_INT32, index of the nearest feature or NULL
+    double x_spacing;
+    double y_spacing;
+    int squared;
+    int error;
+
+} DistanceRange;
+
+static void
+NearestRowRange (void *data, int start_col, int end_col)
 {
-    float *d = new float[n];
-    int *v = new int[n];
-    float *z = new float[n + 1];
-    int k = 0;
+    DistanceRange *range = (DistanceRange *) data;
+    const int height = FreeImage_GetHeight (range->src);
+    const int width = end_col - start_col;
 
-    v[0] = 0;
-    z[0] = -INF;
-    z[1] = INF;
+    int *last = (int *) malloc (width * sizeof (int));
 
-    for(int q = 1; q <= n - 1; q++)
+    if (last == NULL)
     {
-        float s = ((f[q] + square (q)) - (f[v[k]] + square (v[k]))) / (2 * q - 2 * v[k]);
+        range->error = 1;
+        return;
+    }
 
-        while (s <= z[k])
+    // Scan up the image keeping the last feature row seen in each column
+    for(register int x = 0; x < width; x++)
+        last[x] = -1;
+
+    for(register int y = 0; y < height; y++)
+    {
+        const BYTE *src_ptr = FreeImage_GetScanLine (range->src, y) + start_col;
+        int *row_ptr = (int *) FreeImage_GetScanLine (range->nearest_row, y) + start_col;
+
+        for(register int x = 0; x < width; x++)
         {
-            k--;
-            s = ((f[q] + square (q)) - (f[v[k]] + square (v[k]))) / (2 * q - 2 * v[k]);
+            if (src_ptr[x] == 0)
+                last[x] = y;
+
+            row_ptr[x] = last[x];
         }
-        k++;
-        v[k] = q;
-        z[k] = s;
-        z[k + 1] = INF;
     }
 
-    k = 0;
-    for(int q = 0; q <= n - 1; q++)
+    // Scan down, taking the feature above when it is nearer
+    for(register int x = 0; x < width; x++)
+        last[x] = -1;
+
+    for(register int y = height - 1; y >= 0; y--)
     {
-        while (z[k + 1] < q)
+        const BYTE *src_ptr = FreeImage_GetScanLine (range->src, y) + start_col;
+        int *row_ptr = (int *) FreeImage_GetScanLine (range->nearest_row, y) + start_col;
+
+        for(register int x = 0; x < width; x++)
         {
-            k++;
-        }
+            if (src_ptr[x] == 0)
+                last[x] = y;
 
-        d[q] = square (q - v[k]) + f[v[k]];
+            if (last[x] >= 0 && (row_ptr[x] < 0 || last[x] - y < y - row_ptr[x]))
+                row_ptr[x] = last[x];
+        }
     }
 
-    delete[]v;
-    delete[]z;
-    return d;
+    free (last);
 }
 
-/* dt of 2d function using squared distance */
 static void
-dt2d (FIBITMAP * src)
+DistanceRowRange (void *data, int start_row, int end_row)
 {
-    int width = FreeImage_GetWidth (src);
-    int height = FreeImage_GetHeight (src);
-    float *f = new float[MAX (width, height)];
-    register int x, y;
+    DistanceRange *range = (DistanceRange *) data;
+    const int width = FreeImage_GetWidth (range->src);
+    const double xx = square (range->x_spacing);
+    const double yy = square (range->y_spacing);
+
+    double *f = (double *) malloc (width * sizeof (double));
+    double *z = (double *) malloc ((width + 1) * sizeof (double));
+    int *v = (int *) malloc (width * sizeof (int));
 
-    register float *src_ptr;
+    if (f == NULL || z == NULL || v == NULL)
+    {
+        free (f);
+        free (z);
+        free (v);
+        range->error = 1;
+        return;
+    }
 
-    // transform along columns
-    for(x = 0; x < width; x++)
+    for(int y = start_row; y < end_row; y++)
     {
-        for(y = 0; y < height; y++)
+        const int *row_ptr = (int *) FreeImage_GetScanLine (range->nearest_row, y);
+        int k = -1;
+
+        // Lower envelope of the parabolas of the columns with a feature.
+        // z[k] is where parabola v[k] starts to be the lowest.
+        for(register int q = 0; q < width; q++)
         {
+            if (row_ptr[q] < 0)
+                continue;
 
-            src_ptr = (float *) FreeImage_GetScanLine (src, y);
-            f[y] = src_ptr[x];
-        }
+            f[q] = yy * square ((double) (y - row_ptr[q]));
 
-        float *d = dt (f, height);
+            if (k < 0)
+            {
+                k = 0;
+                v[0] = q;
+                z[0] = -DBL_MAX;
+                z[1] = DBL_MAX;
+                continue;
+            }
 
-        for(y = 0; y < height; y++)
-        {
+            double s;
 
-            src_ptr = (float *) FreeImage_GetScanLine (src, y);
-            src_ptr[x] = d[y];
-        }
+            while (1)
+            {
+                int p = v[k];
 
-        delete[]d;
-    }
+                s = ((f[q] + xx * square ((double) q)) - (f[p] + xx * square ((double) p)))
+                    / (2.0 * xx * (q - p));
 
-    // transform along rows
-    for(y = 0; y < height; y++)
-    {
-        src_ptr = (float *) FreeImage_GetScanLine (src, y);
+                if (s > z[k])
+                    break;
 
-        for(x = 0; x < width; x++)
-        {
-            f[x] = src_ptr[x];
+                k--;
+            }
+
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = DBL_MAX;
         }
 
-        float *d = dt (f, width);
+        float *dst_ptr = (float *) FreeImage_GetScanLine (range->dst, y);
+        DWORD *squared_ptr = (DWORD *) dst_ptr;
+        int *nearest_ptr = (range->nearest == NULL) ? NULL :
+            (int *) FreeImage_GetScanLine (range->nearest, y);
 
-        for(x = 0; x < width; x++)
+        // No feature anywhere in the image
+        if (k < 0)
         {
-            src_ptr[x] = d[x];
+            for(register int q = 0; q < width; q++)
+            {
+                if (range->squared)
+                    squared_ptr[q] = 0xFFFFFFFF;
+                else
+                    dst_ptr[q] = FLT_MAX;
+
+                if (nearest_ptr != NULL)
+                    nearest_ptr[q] = -1;
+            }
+
+            continue;
         }
 
-        delete[]d;
+        k = 0;
+
+        for(register int q = 0; q < width; q++)
+        {
+            while (z[k + 1] < q)
+                k++;
+
+            int p = v[k];
+            double d = xx * square ((double) (q - p)) + f[p];
+
+            if (range->squared)
+                squared_ptr[q] = (d < 4294967295.0) ? (DWORD) (d + 0.5) : 0xFFFFFFFF;
+            else
+                dst_ptr[q] = (float) sqrt (d);
+
+            if (nearest_ptr != NULL)
+                nearest_ptr[q] = row_ptr[p] * width + p;
+        }
     }
 
-    delete f;
+    free (f);
+    free (z);
+    free (v);
 }
 
-/* dt of binary image using squared distance */
 FIBITMAP *DLL_CALLCONV
-FIA_DistanceTransform (FIBITMAP * src)
+FIA_DistanceTransformEx (FIBITMAP * src, double x_spacing, double y_spacing,
+                         int squared, FIBITMAP ** nearest)
 {
+    if (nearest != NULL)
+        *nearest = NULL;
+
+    if (src == NULL)
+        return NULL;
+
+    if (FreeImage_GetImageType (src) != FIT_BITMAP || FreeImage_GetBPP (src) != 8)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Distance transform needs an 8bit image");
+        return NULL;
+    }
+
+    if (x_spacing <= 0.0 || y_spacing <= 0.0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Pixel spacing must be above zero");
+        return NULL;
+    }
+
     int width = FreeImage_GetWidth (src);
     int height = FreeImage_GetHeight (src);
-    float *out_ptr;
-    unsigned char *src_ptr;
 
-    FIBITMAP *out = FIA_ConvertToGreyscaleFloatType (src, FIT_FLOAT);
+    DistanceRange range;
 
-    for(register int y = 0; y < height; y++)
+    range.src = src;
+    range.nearest_row = FreeImage_AllocateT (FIT_INT32, width, height, 32, 0, 0, 0);
+    range.dst = FreeImage_AllocateT (squared ? FIT_UINT32 : FIT_FLOAT, width, height, 32, 0, 0, 0);
+    range.nearest = (nearest == NULL) ? NULL :
+        FreeImage_AllocateT (FIT_INT32, width, height, 32, 0, 0, 0);
+    range.x_spacing = x_spacing;
+    range.y_spacing = y_spacing;
+    range.squared = squared;
+    range.error = (range.nearest_row == NULL || range.dst == NULL
+                   || (nearest != NULL && range.nearest == NULL));
+
+    if (!range.error)
+        RunRowRangesInParallel (width, 64, NearestRowRange, &range);
+
+    if (!range.error)
+        RunRowRangesInParallel (height, 16, DistanceRowRange, &range);
+
+    if (range.nearest_row != NULL)
+        FreeImage_Unload (range.nearest_row);
+
+    if (range.error)
     {
-        src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
-        out_ptr = (float *) FreeImage_GetScanLine (out, y);
+        if (range.dst != NULL)
+            FreeImage_Unload (range.dst);
 
-        for(register int x = 0; x < width; x++)
-        {
+        if (range.nearest != NULL)
+            FreeImage_Unload (range.nearest);
 
-            if (src_ptr[x] == 0)
-            {
-                out_ptr[x] = 0.0f;
-            }
-            else
-            {
-                out_ptr[x] = INF;
-            }
-        }
+        return NULL;
     }
 
-    dt2d (out);
+    if (nearest != NULL)
+        *nearest = range.nearest;
+
+    return range.dst;
+}
+
+// The distance FIA_DistanceTransform has always given when the image has
+// no feature, the square root of the 1E10 it used as infinity.
+#define NO_FEATURE_DISTANCE 1E5
+
+/* dt of binary image using squared distance */
+FIBITMAP *DLL_CALLCONV
+FIA_DistanceTransform (FIBITMAP * src)
+{
+    FIBITMAP *out = FIA_DistanceTransformEx (src, 1.0, 1.0, 0, NULL);
+
+    if (out == NULL)
+        return NULL;
+
+    // Keep the values finite for the conversion to 8 bit
+    int width = FreeImage_GetWidth (out);
+    int height = FreeImage_GetHeight (out);
 
-    // take square roots
     for(register int y = 0; y < height; y++)
     {
-        out_ptr = (float *) FreeImage_GetScanLine (out, y);
+        float *out_ptr = (float *) FreeImage_GetScanLine (out, y);
 
         for(register int x = 0; x < width; x++)
         {
-            out_ptr[x] = sqrt (out_ptr[x]);
+            if (out_ptr[x] == FLT_MAX)
+                out_ptr[x] = (float) NO_FEATURE_DISTANCE;
         }
     }
 
@@ -24,12 +24,14 @@
 #include "FreeImageAlgorithms_FFT.h"
 
 #include "kiss_fftnd.h"
+#include "kiss_fftndr.h"
 #include <iostream>
 
 template<class Tsrc> class FFT2D
 {
     public:
         FIBITMAP* FFT(FIBITMAP *src);
+        FIBITMAP* RealFFT(FIBITMAP *src);
 };
 
 // Do FFT for type X
@@ -41,6 +43,157 @@ static FFT2D<long> fftLongImage;
 static FFT2D<float> fftFloatImage;
 static FFT2D<double> fftDoubleImage;
 
+// Plans are kept after use so repeated transforms of the same size skip
+// the twiddle factor calculation. A kiss plan holds scratch buffers so it
+// can only be used by one thread at a time. AcquireFFTPlan takes a plan out
+// of the cache and ReleaseFFTPlan puts it back, so several threads working
+// on the same size each end up with their own plan.
+#define MAX_CACHED_FFT_PLANS 32
+
+typedef struct FFTPlan
+{
+    int rows;
+    int cols;
+    int inverse;
+    int real;       // kiss_fftndr plan rather than kiss_fftnd
+    void *cfg;
+    struct FFTPlan *next;
+
+} FFTPlan;
+
+static FFTPlan *cached_plans = NULL;
+static int number_of_cached_plans = 0;
+
+static void
+FreeFFTPlans(FFTPlan *plan)
+{
+    while (plan != NULL) {
+
+        FFTPlan *next = plan->next;
+
+        free(plan->cfg);
+        free(plan);
+
+        plan = next;
+    }
+}
+
+static FFTPlan*
+AcquireFFTPlan(int rows, int cols, int inverse, int real)
+{
+    FFTPlan *plan, **link;
+
+    EnterGlobalLock();
+
+    for(link = &cached_plans; (plan = *link) != NULL; link = &plan->next) {
+
+        if (plan->rows == rows && plan->cols == cols &&
+            plan->inverse == inverse && plan->real == real) {
+
+            *link = plan->next;
+            number_of_cached_plans--;
+            break;
+        }
+    }
+
+    LeaveGlobalLock();
+
+    if (plan != NULL) {
+        plan->next = NULL;
+        return plan;
+    }
+
+    plan = (FFTPlan*) malloc(sizeof(FFTPlan));
+
+    if (CheckMemory(plan) < 0)
+        return NULL;
+
+    // Dims needs to be {rows, cols}, if you have contiguous rows.
+    int dims[2] = {rows, cols};
+
+    plan->rows = rows;
+    plan->cols = cols;
+    plan->inverse = inverse;
+    plan->real = real;
+    plan->next = NULL;
+
+    if (real)
+        plan->cfg = kiss_fftndr_alloc (dims, 2, inverse, 0, 0);
+    else
+        plan->cfg = kiss_fftnd_alloc (dims, 2, inverse, 0, 0);
+
+    if (plan->cfg == NULL) {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "Unable to create a %d x %d FFT plan.", cols, rows);
+        free(plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+static void
+ReleaseFFTPlan(FFTPlan *plan)
+{
+    FFTPlan *evicted = NULL;
+
+    if (plan == NULL)
+        return;
+
+    EnterGlobalLock();
+
+    plan->next = cached_plans;
+    cached_plans = plan;
+    number_of_cached_plans++;
+
+    // Drop the least recently released plan.
+    if (number_of_cached_plans > MAX_CACHED_FFT_PLANS) {
+
+        FFTPlan **link = &cached_plans;
+
+        while ((*link)->next != NULL)
+            link = &(*link)->next;
+
+        evicted = *link;
+        *link = NULL;
+        number_of_cached_plans--;
+    }
+
+    LeaveGlobalLock();
+
+    FreeFFTPlans(evicted);
+}
+
+int DLL_CALLCONV
+FIA_PrepareFFTPlan(int width, int height, int inverse, int real)
+{
+    if (width < 1 || height < 1 || (real && (width & 1)))
+        return FIA_ERROR;
+
+    FFTPlan *plan = AcquireFFTPlan(height, width, inverse ? 1 : 0, real ? 1 : 0);
+
+    if (plan == NULL)
+        return FIA_ERROR;
+
+    ReleaseFFTPlan(plan);
+
+    return FIA_SUCCESS;
+}
+
+void DLL_CALLCONV
+FIA_ClearFFTPlanCache(void)
+{
+    EnterGlobalLock();
+
+    FFTPlan *plans = cached_plans;
+
+    cached_plans = NULL;
+    number_of_cached_plans = 0;
+
+    LeaveGlobalLock();
+
+    FreeFFTPlans(plans);
+}
+
 /*
 static inline void GetAbsoluteXValues(kiss_fft_cpx* fftbuf, double *out_values, int size)
 {
@@ -103,21 +256,18 @@ FFT2D<Tsrc>::FFT(FIBITMAP *src)
 	int height, width;
 
 	int i=0, x, y;
-	int dims[2];
-	int ndims = 2;
     size_t bufsize;
 	Tsrc *bits; 
 	FICOMPLEX *outbits;
 	FIBITMAP *dst = NULL;
 	
-	kiss_fftnd_cfg st;
+	FFTPlan *plan = NULL;
 	kiss_fft_cpx* fftbuf;
 	kiss_fft_cpx* fftoutbuf;
     kiss_fft_cpx* tmp_fftoutbuf;
 
-	// Dims needs to be {rows, cols}, if you have contiguous rows.
-	dims[0] = height = FreeImage_GetHeight(src);
-	dims[1] = width = FreeImage_GetWidth(src);
+	height = FreeImage_GetHeight(src);
+	width = FreeImage_GetWidth(src);
 	
     bufsize = width * height * sizeof(kiss_fft_cpx);
 	fftbuf = (kiss_fft_cpx*) malloc(bufsize);
@@ -129,7 +279,8 @@ FFT2D<Tsrc>::FFT(FIBITMAP *src)
 	memset(fftbuf,0,bufsize);
     memset(tmp_fftoutbuf,0,bufsize);
 
-	st = kiss_fftnd_alloc (dims, ndims, 0, 0, 0);
+	if ((plan = AcquireFFTPlan(height, width, 0, 0)) == NULL)
+		goto Error;
 
 	for(y = height - 1; y >= 0; y--) { 
 		
@@ -144,7 +295,7 @@ FFT2D<Tsrc>::FFT(FIBITMAP *src)
 		}
 	}
 
-	kiss_fftnd(st, fftbuf, tmp_fftoutbuf);
+	kiss_fftnd((kiss_fftnd_cfg) plan->cfg, fftbuf, tmp_fftoutbuf);
 
 	if ( (dst = FreeImage_AllocateT(FIT_COMPLEX, width, height, 32, 0, 0, 0)) == NULL )
 		goto Error;
@@ -166,7 +317,77 @@ Error:
  
     free(fftbuf);
     free(fftoutbuf);
-    free(st);
+    ReleaseFFTPlan(plan);
+
+	return dst;
+}
+
+// The spectrum of a real image is conjugate symmetric so only
+// width / 2 + 1 columns are computed and stored.
+template<class Tsrc> FIBITMAP* 
+FFT2D<Tsrc>::RealFFT(FIBITMAP *src)
+{
+	int height, width, bins;
+
+	int i=0, x, y;
+	Tsrc *bits; 
+	FICOMPLEX *outbits;
+	FIBITMAP *dst = NULL;
+	
+	FFTPlan *plan = NULL;
+	kiss_fft_scalar* timebuf = NULL;
+	kiss_fft_cpx* freqbuf = NULL;
+    kiss_fft_cpx* tmp_freqbuf;
+
+	height = FreeImage_GetHeight(src);
+	width = FreeImage_GetWidth(src);
+	bins = width / 2 + 1;
+
+	if (width & 1) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "FIA_RealFFT: Image width %d must be even.", width);
+		return NULL;
+	}
+
+	timebuf = (kiss_fft_scalar*) malloc(width * height * sizeof(kiss_fft_scalar));
+	tmp_freqbuf = freqbuf = (kiss_fft_cpx*) malloc(bins * height * sizeof(kiss_fft_cpx));
+
+	if (CheckMemory(timebuf) < 0 || CheckMemory(freqbuf) < 0)
+		goto Error;
+
+	if ((plan = AcquireFFTPlan(height, width, 0, 1)) == NULL)
+		goto Error;
+
+	for(y = height - 1; y >= 0; y--) { 
+		
+		bits = (Tsrc *) FreeImage_GetScanLine(src, y);
+		
+		for(x=0; x < width; x++)
+			timebuf[i++] = (kiss_fft_scalar) bits[x];
+	}
+
+	kiss_fftndr((kiss_fftndr_cfg) plan->cfg, timebuf, freqbuf);
+
+	if ( (dst = FreeImage_AllocateT(FIT_COMPLEX, bins, height, 32, 0, 0, 0)) == NULL )
+		goto Error;
+
+	for(y = height - 1; y >= 0; y--) { 
+		
+		outbits = (FICOMPLEX *) FreeImage_GetScanLine(dst, y);
+
+		for(x=0; x < bins; x++) {
+				
+			(outbits + x)->r = (double)((tmp_freqbuf + x)->r);
+			(outbits + x)->i = (double)((tmp_freqbuf + x)->i);	  
+		}
+
+		tmp_freqbuf += bins;
+	}
+
+Error:
+ 
+    free(timebuf);
+    free(freqbuf);
+    ReleaseFFTPlan(plan);
 
 	return dst;
 }
@@ -224,30 +445,31 @@ FIA_IFFT(FIBITMAP *src)
 	int height, width;
 
 	int i=0, x, y;
-	int dims[2];
-	int ndims = 2;
     size_t bufsize;
 	FICOMPLEX *bits; 
 	FICOMPLEX *outbits;
 	FIBITMAP *dst = NULL;
 	
-	kiss_fftnd_cfg st;
+	FFTPlan *plan = NULL;
 	kiss_fft_cpx* fftbuf;
 	kiss_fft_cpx* fftoutbuf;
     kiss_fft_cpx* tmp_fftoutbuf;
 
-	// Dims needs to be {rows, cols}, if you have contiguous rows.
-    dims[0] = height = FreeImage_GetHeight(src);
-    dims[1] = width = FreeImage_GetWidth(src);
+    height = FreeImage_GetHeight(src);
+    width = FreeImage_GetWidth(src);
 	
     bufsize = width * height * sizeof(kiss_fft_cpx);
 	fftbuf = (kiss_fft_cpx*) malloc(bufsize);
 	tmp_fftoutbuf = fftoutbuf = (kiss_fft_cpx*) malloc(bufsize); 
 	
+	if (CheckMemory(fftbuf) < 0 || CheckMemory(fftoutbuf) < 0)
+		goto Error;
+
     memset(fftbuf,0,bufsize);
     memset(tmp_fftoutbuf,0,bufsize);
 
-	st = kiss_fftnd_alloc (dims, ndims, 1, 0, 0);
+	if ((plan = AcquireFFTPlan(height, width, 1, 0)) == NULL)
+		goto Error;
 	
 	for(y = height - 1; y >= 0; y--) { 
 			
@@ -262,7 +484,7 @@ FIA_IFFT(FIBITMAP *src)
 		}
 	}
 
-	kiss_fftnd(st, fftbuf, tmp_fftoutbuf);
+	kiss_fftnd((kiss_fftnd_cfg) plan->cfg, fftbuf, tmp_fftoutbuf);
 
 	if ( (dst = FreeImage_AllocateT(FIT_COMPLEX, width, height, 32, 0, 0, 0)) == NULL )
 		goto Error;
@@ -280,13 +502,11 @@ FIA_IFFT(FIBITMAP *src)
 		tmp_fftoutbuf += width;
 	}
 
-	return dst;
-
 Error:
  
     free(fftbuf);
     free(fftoutbuf);
-    free(st);
+    ReleaseFFTPlan(plan);
 
 	return dst;
 }
@@ -335,6 +555,122 @@ FIA_FFT(FIBITMAP *src)
 	return NULL;
 }
 
+FIBITMAP* DLL_CALLCONV
+FIA_RealFFT(FIBITMAP *src)
+{
+	if(!src)
+		return NULL;
+
+	FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src);
+
+	switch (src_type)
+    {
+		case FIT_BITMAP:	// standard image: 1-, 4-, 8-, 16-, 24-, 32-bit
+			if(FreeImage_GetBPP(src) == 8)
+				return fftUCharImage.RealFFT(src);				
+			break;
+			
+		case FIT_UINT16:	// array of unsigned short: unsigned 16-bit
+			return fftUShortImage.RealFFT(src);
+	
+		case FIT_INT16:		// array of short: signed 16-bit
+			return fftShortImage.RealFFT(src);
+		
+		case FIT_UINT32:	// array of unsigned long: unsigned 32-bit
+			return fftULongImage.RealFFT(src);
+		
+		case FIT_INT32:		// array of long: signed 32-bit
+			return fftLongImage.RealFFT(src);
+		
+		case FIT_FLOAT:		// array of float: 32-bit
+			return fftFloatImage.RealFFT(src);
+		
+		case FIT_DOUBLE:	// array of double: 64-bit
+			return fftDoubleImage.RealFFT(src);
+				
+		default:
+			break;
+	}
+
+	FreeImage_OutputMessageProc(FIF_UNKNOWN, "FREE_IMAGE_TYPE: Unable to perform FFT for type %d.", src_type);
+
+	return NULL;
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_RealIFFT(FIBITMAP *src, int width)
+{
+	int height, bins;
+
+	int i=0, x, y;
+	FICOMPLEX *bits; 
+	double *outbits;
+	FIBITMAP *dst = NULL;
+	
+	FFTPlan *plan = NULL;
+	kiss_fft_cpx* freqbuf = NULL;
+	kiss_fft_scalar* timebuf = NULL;
+    kiss_fft_scalar* tmp_timebuf;
+
+	if(!src || FreeImage_GetImageType(src) != FIT_COMPLEX)
+		return NULL;
+
+	bins = FreeImage_GetWidth(src);
+
+	if ((width & 1) || width / 2 + 1 != bins) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN,
+			"FIA_RealIFFT: Width %d does not match a half spectrum of %d columns.", width, bins);
+		return NULL;
+	}
+
+	height = FreeImage_GetHeight(src);
+
+	freqbuf = (kiss_fft_cpx*) malloc(bins * height * sizeof(kiss_fft_cpx));
+	tmp_timebuf = timebuf = (kiss_fft_scalar*) malloc(width * height * sizeof(kiss_fft_scalar));
+
+	if (CheckMemory(freqbuf) < 0 || CheckMemory(timebuf) < 0)
+		goto Error;
+
+	if ((plan = AcquireFFTPlan(height, width, 1, 1)) == NULL)
+		goto Error;
+
+	for(y = height - 1; y >= 0; y--) { 
+			
+		bits = (FICOMPLEX*) FreeImage_GetScanLine(src, y);
+			
+		for(x=0; x < bins; x++) {	
+
+			freqbuf[i].r = (kiss_fft_scalar) bits[x].r;
+   			freqbuf[i].i = (kiss_fft_scalar) bits[x].i;
+	        
+   			i++;
+		}
+	}
+
+	kiss_fftndri((kiss_fftndr_cfg) plan->cfg, freqbuf, timebuf);
+
+	if ( (dst = FreeImage_AllocateT(FIT_DOUBLE, width, height, 32, 0, 0, 0)) == NULL )
+		goto Error;
+
+	for(y = height - 1; y >= 0; y--) { 
+		
+		outbits = (double *) FreeImage_GetScanLine(dst, y);
+
+		for(x=0; x < width; x++)
+			outbits[x] = (double) tmp_timebuf[x];
+
+		tmp_timebuf += width;
+	}
+
+Error:
+ 
+    free(freqbuf);
+    free(timebuf);
+    ReleaseFFTPlan(plan);
+
+	return dst;
+}
+
 
 static FIBITMAP*
 ConvertComplexImageToAbsoluteValued(FIBITMAP *src, bool squared)
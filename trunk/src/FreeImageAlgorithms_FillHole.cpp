@@ -25,110 +25,180 @@
 #include "FreeImageAlgorithms_Particle.h"
 #include "FreeImageAlgorithms_Utilities.h"
 
-FIBITMAP *DLL_CALLCONV
-FIA_Fillholes(FIBITMAP* src, unsigned char white_on_black)
-{
-	const int width = FreeImage_GetWidth(src);
-	const int height = FreeImage_GetHeight(src);
+#include <vector>
 
-	unsigned char* src_ptr;
+typedef struct
+{
+	int x;
+	int y;
+
+} FillholeSeed;
+
+// Clears every pixel of background that can be reached from the border of the
+// image. background is set for the background pixels and is width * height.
+// Whole runs are cleared at once and each run pushes the start of the runs next
+// to it on the rows above and below, so the time is linear in the size of the
+// image however many border pixels are background.
+static void
+ClearBackgroundFromBorder(unsigned char* background, int width, int height,
+						  FIA_CONNECTIVITY connectivity)
+{
+	const int reach = (connectivity == FIA_CONNECTIVITY_4) ? 0 : 1;
 
-	int bg_val, fg_val;
+	std::vector<FillholeSeed> stack;
+	FillholeSeed seed, next;
 
-	if (white_on_black)
+	// Seed with the border
+	for (int y = 0; y < height; y++)
 	{
-		bg_val = 0;
-		fg_val = 255;
+		int step = (y == 0 || y == height - 1) ? 1 : MAX(1, width - 1);
+
+		for (int x = 0; x < width; x += step)
+		{
+			if (background[(size_t)y * width + x])
+			{
+				seed.x = x;
+				seed.y = y;
+				stack.push_back(seed);
+			}
+		}
 	}
-	else
+
+	while (!stack.empty())
 	{
-		bg_val = 1;
-		fg_val = 255;
-	}
+		seed = stack.back();
+		stack.pop_back();
 
-	FIBITMAP* filled_src;
-	register int y;
+		unsigned char* row = background + (size_t)seed.y * width;
 
-	// Find first background pixel
-	// To be a valid image I am assumming one of the first pixels on
-	// the left side of the image is background.
-	// Ie if there is a large strip of foreground on the left the image
-	// is not valis for filling holes.
-	/*for (y = 0; y < height - 1; y++)
-	{
-		src_ptr = (unsigned char*)FreeImage_GetScanLine(src, y);
+		if (!row[seed.x])
+		{
+			continue;
+		}
 
-		if (src_ptr[0] == bg_val)
+		// Clear the whole run
+		int left = seed.x, right = seed.x;
+
+		while (left > 0 && row[left - 1])
 		{
-			break;
+			left--;
 		}
-	}
-	filled_src = FIA_FloodFill(src, 0, y, fg_val);
-	*/
 
-	// Alternate, flood fill any border pixel, if it is bg
-	// Purpose: identify all the image bg
-	filled_src = FreeImage_Clone(src);
-	for (y = 0; y < height - 1; y++)
-	{
-		src_ptr = (unsigned char*)FreeImage_GetScanLine(filled_src, y);
-		if (src_ptr[0] == bg_val)
+		while (right < width - 1 && row[right + 1])
 		{
-			FIA_InPlaceFloodFill(filled_src, 0, y, fg_val);
+			right++;
 		}
-	}
 
-	for (y = 0; y < height - 1; y++)
-	{
-		src_ptr = (unsigned char*)FreeImage_GetScanLine(filled_src, y);
-		if (src_ptr[width - 1] == bg_val)
+		memset(row + left, 0, right - left + 1);
+
+		// Push the start of each run touching it on the rows either side
+		int start = MAX(0, left - reach);
+		int end = MIN(width - 1, right + reach);
+
+		for (int ny = seed.y - 1; ny <= seed.y + 1; ny += 2)
 		{
-			FIA_InPlaceFloodFill(filled_src, width - 1, y, fg_val);
+			if (ny < 0 || ny >= height)
+			{
+				continue;
+			}
+
+			const unsigned char* next_row = background + (size_t)ny * width;
+
+			for (int x = start; x <= end; x++)
+			{
+				if (next_row[x])
+				{
+					next.x = x;
+					next.y = ny;
+					stack.push_back(next);
+
+					while (x < end && next_row[x + 1])
+					{
+						x++;
+					}
+				}
+			}
 		}
 	}
+}
 
-	src_ptr = (unsigned char*)FreeImage_GetScanLine(filled_src, 0);
-	for (y = 0; y < width - 1; y++)
+FIBITMAP *DLL_CALLCONV
+FIA_FillholesWithConnectivity(FIBITMAP* src, unsigned char white_on_black,
+							  FIA_CONNECTIVITY connectivity)
+{
+	if (src == NULL)
 	{
-		if (src_ptr[y] == bg_val)
-		{
-			FIA_InPlaceFloodFill(filled_src, y, 0, fg_val);
-		}
+		return NULL;
+	}
+
+	if (FreeImage_GetBPP(src) != 8 || FreeImage_GetImageType(src) != FIT_BITMAP)
+	{
+		FreeImage_OutputMessageProc(FIF_UNKNOWN,
+			"Error performing Fillholes. Source image must be an 8bit FIT_BITMAP");
+		return NULL;
+	}
+
+	if (CheckConnectivity(connectivity) == FIA_ERROR)
+	{
+		return NULL;
+	}
+
+	const int width = FreeImage_GetWidth(src);
+	const int height = FreeImage_GetHeight(src);
+
+	unsigned char bg_val = white_on_black ? 0 : 1;
+	unsigned char fg_val = 255;
+
+	unsigned char* background = (unsigned char*)malloc((size_t)width * height);
+
+	if (CheckMemory(background) < 0)
+	{
+		return NULL;
 	}
 
-	src_ptr = (unsigned char*)FreeImage_GetScanLine(filled_src, height-1);
-	for (y = 0; y < width - 1; y++)
+	for (register int y = 0; y < height; y++)
 	{
-		if (src_ptr[y] == bg_val)
+		const unsigned char* src_ptr = (unsigned char*)FreeImage_GetScanLine(src, y);
+		unsigned char* background_ptr = background + (size_t)y * width;
+
+		for (register int x = 0; x < width; x++)
 		{
-			FIA_InPlaceFloodFill(filled_src, y, height - 1, fg_val);
+			background_ptr[x] = (src_ptr[x] == bg_val);
 		}
 	}
 
+	// Purpose: identify all the image bg, what is left are the holes
+	ClearBackgroundFromBorder(background, width, height, connectivity);
+
 	FIBITMAP* dst = FreeImage_Clone(src);
 
-	// Go through filled_src image find background pixels and copy then to dst
-	unsigned char* filled_src_first_ptr = (unsigned char*)FreeImage_GetBits(filled_src);
-	unsigned char* dst_first_ptr = (unsigned char*)FreeImage_GetBits(dst);
-	unsigned char* filled_src_ptr, * dst_ptr;
-	unsigned int src_pitch_in_pixels = FreeImage_GetPitch(src) / sizeof(unsigned char);
+	if (dst == NULL)
+	{
+		free(background);
+		return NULL;
+	}
 
 	for (register int y = 0; y < height; y++)
 	{
-		filled_src_ptr = (filled_src_first_ptr + y * src_pitch_in_pixels);
-		dst_ptr = (dst_first_ptr + y * src_pitch_in_pixels);
+		unsigned char* dst_ptr = (unsigned char*)FreeImage_GetScanLine(dst, y);
+		const unsigned char* background_ptr = background + (size_t)y * width;
 
 		for (register int x = 0; x < width; x++)
 		{
-			// If bg pixel copy to dst
-			if (filled_src_ptr[x] == bg_val)
+			if (background_ptr[x])
 			{
 				dst_ptr[x] = fg_val;
 			}
 		}
 	}
 
-	FreeImage_Unload(filled_src);
+	free(background);
 
 	return dst;
 }
+
+FIBITMAP *DLL_CALLCONV
+FIA_Fillholes(FIBITMAP* src, unsigned char white_on_black)
+{
+	return FIA_FillholesWithConnectivity(src, white_on_black, FIA_CONNECTIVITY_4);
+}
@@ -28,13 +28,12 @@
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Arithmetic.h"
 #include "FreeImageAlgorithms_Convolution.h"
+#include "FreeImageAlgorithms_Morphology.h"
 
 #include <sstream>
 #include <iostream>
 #include <math.h>
 
-#define MAX_REGIONGROW_CALLS 5000
-
 typedef float (*GetPixelValueFunction) (FIBITMAP * src, int x, int y);
 
 class FindMaxima
@@ -46,12 +45,7 @@ class FindMaxima
 
   private:
 
-    void NonMaxSupression ();
-    inline unsigned char NeighbourhoodNMS (double *ptr);
-    inline void SetNeighbours (unsigned char *ptr);
-    void SetNeigbourPixels ();
-    void RegionGrow (int x, int y);
-    void PerformRegionGrow ();
+    int FindRegionalMaxima ();
     void DrawMaxima (int size);
     int StoreBrightestPeaks (int number, FIAPeak ** peaks);
 
@@ -61,7 +55,6 @@ class FindMaxima
 	int oval_draw;
     int width;
     int height;
-    int regionGrowCount;
 
     FIBITMAP *original_image;
     FIBITMAP *original_image_double;
@@ -69,315 +62,33 @@ class FindMaxima
     FIBITMAP *peek_image;
 };
 
-inline unsigned char
-FindMaxima::NeighbourhoodNMS (double *ptr)
-{
-    int pitch_in_pixels = FIA_GetPitchInPixels (this->original_image_double);
-    
-    // Top left of 3x3 kernel
-    double *tmp_ptr = ptr - pitch_in_pixels - 1;
-
-    if (*ptr < tmp_ptr[0])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[1])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[2])
-    {
-        return 0;
-    }
-
-    // Next kernel line
-    tmp_ptr = ptr - 1;
-
-    if (*ptr < tmp_ptr[0])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[2])
-    {
-        return 0;
-    }
-
-    // Next kernel line
-    tmp_ptr = ptr + pitch_in_pixels - 1;
-
-    if (*ptr < tmp_ptr[0])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[1])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[2])
-    {
-        return 0;
-    }
-
-    return 1;
-}
-
-void
-FindMaxima::NonMaxSupression ()
-{
-    register double *src_ptr;
-    register unsigned char *dst_ptr;
-
-    for(register int y = 1; y < height - 1; y++)
-    {
-        src_ptr = (double *) FreeImage_GetScanLine(this->original_image_double, y);
-        dst_ptr = (unsigned char *) FreeImage_GetScanLine(this->processing_image, y);
-
-        for(register int x = 1; x < width - 1; x++)
-        {
-            if (src_ptr[x] > this->threshold)
-            {
-                dst_ptr[x] = NeighbourhoodNMS (src_ptr + x);
-            }
-        }
-    }
-}
-
-inline void
-FindMaxima::SetNeighbours (unsigned char *ptr)
+// Plateaux are counted as peaks but shoulders, plateaux that touch a higher
+// pixel, are not. That is exactly the regional maxima of the image, which
+// are found by reconstruction so there is no limit on the size of a plateau.
+int
+FindMaxima::FindRegionalMaxima ()
 {
-    int pitch_in_pixels = FIA_GetPitchInPixels (this->processing_image);
-    
-    unsigned char *tmp_ptr = ptr - pitch_in_pixels - 1;
-
-    if (!tmp_ptr[0])
-    {
-        tmp_ptr[0] = 2;
-    }
-
-    if (!tmp_ptr[1])
-    {
-        tmp_ptr[1] = 2;
-    }
-
-    if (!tmp_ptr[2])
-    {
-        tmp_ptr[2] = 2;
-    }
-
-    // Next kernel line
-    tmp_ptr += pitch_in_pixels;
-
-    if (!tmp_ptr[0])
-    {
-        tmp_ptr[0] = 2;
-    }
-
-    if (!tmp_ptr[2])
-    {
-        tmp_ptr[2] = 2;
-    }
-
-    // Next kernel line
-    tmp_ptr += pitch_in_pixels;
-
-    if (!tmp_ptr[0])
-    {
-        tmp_ptr[0] = 2;
-    }
+    this->processing_image = FIA_RegionalMaxima (this->original_image_double, FIA_CONNECTIVITY_8);
 
-    if (!tmp_ptr[1])
-    {
-        tmp_ptr[1] = 2;
-    }
+    if (this->processing_image == NULL)
+        return FIA_ERROR;
 
-    if (!tmp_ptr[2])
+    // Only keep the maxima above the threshold
+    for(register int y = 0; y < height; y++)
     {
-        tmp_ptr[2] = 2;
-    }
-}
+        double *src_ptr = (double *) FreeImage_GetScanLine(this->original_image_double, y);
+        BYTE *dst_ptr = (BYTE *) FreeImage_GetScanLine(this->processing_image, y);
 
-// Set adjoining pixels to 2
-void
-FindMaxima::SetNeigbourPixels ()
-{
-    register BYTE *src_ptr;
-
-    for(register int y = 1; y < height - 1; y++)
-    {
-        src_ptr = (BYTE *) FreeImage_GetScanLine(this->processing_image, y);
-    
-        for(register int x = 1; x < width - 1; x++)
+        for(register int x = 0; x < width; x++)
         {
-            if (src_ptr[x] == 1)
+            if (src_ptr[x] <= this->threshold)
             {
-                this->SetNeighbours (src_ptr + x);
+                dst_ptr[x] = 0;
             }
         }
     }
-}
 
-/*
-// Region growing downhill
-void
-FindMaxima::RegionGrow (int x, int y)
-{
-    if (regionGrowCount++ > MAX_REGIONGROW_CALLS)
-        return;
-
-    register double *optr = this->original_first_pixel_address_ptr;
-    register byte *pptr = this->processing_first_pixel_address_ptr;
-
-    int pos, n_pos;
-
-    if (x > 0 && x < (this->width - 1) && y > 0 && y < (this->height - 1))
-    {
-        pos = y * this->pitch_in_pixels + x;
-        n_pos = pos - this->pitch_in_pixels - 1;        // Position of neighbour
-        pptr[pos] = 3;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x - 1, y - 1);
-        }
-
-
-
-        n_pos++;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x, y - 1);
-        }
-
-        n_pos++;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x + 1, y - 1);
-        }
-
-        n_pos = pos - 1;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x - 1, y);
-        }
-
-        n_pos += 2;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x + 1, y);
-        }
-
-        n_pos = pos + this->pitch_in_pixels - 1;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x - 1, y + 1);
-        }
-
-        n_pos++;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x, y + 1);
-        }
-
-        n_pos++;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x + 1, y + 1);
-        }
-    }
-}
-*/
-
-static inline bool CheckToGrowDownHill(double kernel_centre_val, double kernel_neighbour_val)
-{
-    if(kernel_neighbour_val != 0.0 && kernel_neighbour_val <= kernel_centre_val)
-        return true;
-
-    return false;
-}
-
-// Region growing downhill
-inline void
-FindMaxima::RegionGrow (int x, int y)
-{
-    if (regionGrowCount++ > MAX_REGIONGROW_CALLS)
-        return;
-
-    if(y <= 0 || y >= (this->height - 1))
-        return;
-
-    if (x <= 0 || x >= (this->width - 1))
-        return;
-
-    double *original_ptr_ptr = (double *) FreeImage_GetScanLine(this->original_image_double, y) + x;
-    BYTE *processing_image_ptr = FreeImage_GetScanLine(this->processing_image, y) + x;
-
-    *processing_image_ptr = 3;	// Mark as done
-
-    // Top left of 3x3 kernel
-    double *kernel_original_ptr = original_ptr_ptr + FIA_GetPitchInPixels(this->original_image_double) - 1;
-    BYTE *kernel_processing_ptr = processing_image_ptr + FIA_GetPitchInPixels(this->processing_image) - 1;
-
-    if(kernel_processing_ptr[0] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[0]))
-         RegionGrow (x-1, y+1);
-
-    if(kernel_processing_ptr[1] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[1]))
-         RegionGrow (x, y+1);
-
-    if(kernel_processing_ptr[2] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[2]))
-         RegionGrow (x+1, y+1);
-
-    kernel_original_ptr = original_ptr_ptr - 1;
-    kernel_processing_ptr = processing_image_ptr - 1;
-
-    if(kernel_processing_ptr[0] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[0]))
-         RegionGrow (x-1, y);
-
-    if(kernel_processing_ptr[2] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[2]))
-         RegionGrow (x+1, y);
-
-    kernel_original_ptr = original_ptr_ptr - FIA_GetPitchInPixels(this->original_image_double) - 1;
-    kernel_processing_ptr = processing_image_ptr - FIA_GetPitchInPixels(this->processing_image) - 1;
-
-    if(kernel_processing_ptr[0] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[0]))
-         RegionGrow (x-1, y-1);
-
-    if(kernel_processing_ptr[1] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[1]))
-         RegionGrow (x, y-1);
-
-    if(kernel_processing_ptr[2] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[2]))
-         RegionGrow (x+1, y-1);
-}
-
-void
-FindMaxima::PerformRegionGrow ()
-{
-    register BYTE *processing_ptr;
-
-    for(register int y = 1; y < height - 1; y++)
-    {
-        processing_ptr = (BYTE *) FreeImage_GetScanLine(this->processing_image, y);
-
-        for(register int x = 1; x < width - 1; x++)
-        {
-            if (processing_ptr[x] == 2)
-            {
-                regionGrowCount = 0;
-                RegionGrow (x, y);
-            }
-        }
-    }
+    return FIA_SUCCESS;
 }
 
 static int COMPAT_WITH_OLD_BROKEN_CODE = 0;
@@ -418,7 +129,7 @@ FindMaxima::DrawMaxima (int size)
 
         for(register int x = 0; x < width; x++)
         {
-            if (src_ptr[x] == 1)
+            if (src_ptr[x])
             {		
                 rect.left = x - half_size;
 				rect.top = y - half_size;
@@ -531,7 +242,6 @@ FindMaxima::FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold,
 {
     *peaks_found = 0;
 
-    this->regionGrowCount = 0;
     this->threshold = threshold;
     this->min_separation = min_separation;
 
@@ -549,13 +259,15 @@ FindMaxima::FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold,
     }
 
     this->original_image_double = FIA_ConvertToGreyscaleFloatType(this->original_image, FIT_DOUBLE);
-    this->processing_image = FreeImage_Allocate (this->width, this->height, 8, 0, 0, 0);
-
-    this->NonMaxSupression ();
 
-    SetNeigbourPixels ();
+    if (this->original_image_double == NULL)
+        return NULL;
 
-    PerformRegionGrow ();
+    if (FindRegionalMaxima () == FIA_ERROR)
+    {
+        FreeImage_Unload (this->original_image_double);
+        return NULL;
+    }
 
     DrawMaxima (min_separation);
 
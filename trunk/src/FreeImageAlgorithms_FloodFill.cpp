@@ -25,169 +25,280 @@
 #include "FreeImageAlgorithms_Utilities.h"
 
 #include <vector>
+#include <limits>
+#include <math.h>
 
-template < typename IntType > class GS_FLOODFILL
+// Represents a linear range that has been filled and is to be branched from.
+struct FloodFillRange
+{
+    int left;
+    int right;
+    int line;
+};
+
+// The ranges waiting to be branched from. They are kept in blocks that stay
+// allocated while the stack shrinks and grows again, so memory is only
+// allocated when the stack is deeper than it has been before, never per range.
+// A range is pushed once for each run filled so the stack is never deeper
+// than the number of runs in the image.
+class FloodFillStack
 {
   public:
 
-    int FloodFill (FIBITMAP * src, int seed_x, int seed_y, unsigned char fill_colour);
+    FloodFillStack ():number_of_ranges (0)
+    {
+    }
+
+    ~FloodFillStack ()
+    {
+        for(size_t i = 0; i < blocks.size (); i++)
+            free (blocks[i]);
+    }
+
+    int Push (const FloodFillRange & range)
+    {
+        size_t block = number_of_ranges / BLOCK_SIZE;
+
+        if (block == blocks.size ())
+        {
+            FloodFillRange *ranges = (FloodFillRange *) malloc (BLOCK_SIZE * sizeof (FloodFillRange));
+
+            if (CheckMemory(ranges) < 0) return FIA_ERROR;
+
+            blocks.push_back (ranges);
+        }
+
+        blocks[block][number_of_ranges % BLOCK_SIZE] = range;
+        number_of_ranges++;
+
+        return FIA_SUCCESS;
+    }
+
+    bool Pop (FloodFillRange * range)
+    {
+        if (number_of_ranges == 0)
+            return false;
+
+        number_of_ranges--;
+        *range = blocks[number_of_ranges / BLOCK_SIZE][number_of_ranges % BLOCK_SIZE];
+
+        return true;
+    }
 
   private:
 
-    // Represents a linear range to be filled and branched from.
-    struct FloodFillRange
+    enum { BLOCK_SIZE = 4096 };
+
+    std::vector < FloodFillRange * >blocks;
+    size_t number_of_ranges;
+};
+
+static inline int
+IsMaskBitSet (const BinaryMaskWord * row, int x)
+{
+    return (int) ((row[x >> 6] >> (x & 63)) & 1);
+}
+
+// Sets the bits of row from left to right inclusive.
+static inline void
+SetMaskBits (BinaryMaskWord * row, int left, int right)
+{
+    int first = left >> 6, last = right >> 6;
+    BinaryMaskWord first_bits = ~(BinaryMaskWord) 0 << (left & 63);
+    BinaryMaskWord last_bits = ~(BinaryMaskWord) 0 >> (63 - (right & 63));
+
+    if (first == last)
     {
-        int left;
-        int right;
-        int line;
-    };
+        row[first] |= first_bits & last_bits;
+        return;
+    }
 
-    std::vector < FloodFillRange > ranges;
+    row[first] |= first_bits;
 
-    void LinearFill (int x, int y);
+    for(int i = first + 1; i < last; i++)
+        row[i] = ~(BinaryMaskWord) 0;
+
+    row[last] |= last_bits;
+}
+
+// Fills the connected pixels with values from lower to upper inclusive, starting
+// from the seed. Filled pixels are set in filled, which also stops a pixel being
+// filled twice, and are set to fill_colour if fill is set.
+template < typename Tp > class GS_FLOODFILL
+{
+  public:
+
+    int FloodFill (FIBITMAP * src, int seed_x, int seed_y, double lower, double upper,
+                   FIA_CONNECTIVITY connectivity, int fill, double fill_colour,
+                   BinaryMask * filled);
+
+  private:
+
+    FloodFillRange LinearFill (int x, int y);
+
+    inline bool Inside (const Tp * row, const BinaryMaskWord * filled_row, int x) const
+    {
+        return row[x] >= lower && row[x] <= upper && !IsMaskBitSet (filled_row, x);
+    }
 
     int width;
     int height;
     int src_pitch_in_pixels;
-    IntType fill_colour;
-    IntType seed_colour;
-    IntType *first_pixel_ptr;
-    FIBITMAP *dst;
+    Tp lower;
+    Tp upper;
+    int fill;
+    Tp fill_colour;
+    Tp *first_pixel_ptr;
+    BinaryMask *filled;
 };
 
 /*
  Finds the furthermost left and right boundaries of the fill area
  on a given y coordinate, starting from a given x coordinate, filling as it goes.
- Adds the resulting horizontal range to the queue of floodfill ranges,
- to be processed in the main loop.
+ Returns the resulting horizontal range to be branched from.
  */
-template < typename IntType > void GS_FLOODFILL < IntType >::LinearFill (int x, int y)
+template < typename Tp > FloodFillRange GS_FLOODFILL < Tp >::LinearFill (int x, int y)
 {
-    // Find Left Edge of bg or fg area
-    int lFillLoc = x;           //the location to check/fill on the left
-    IntType *idx = this->first_pixel_ptr + this->src_pitch_in_pixels * y + x;
-
-    while (1)
-    {
-        // Fill with the color
-        *idx = this->fill_colour;
+    Tp *row = this->first_pixel_ptr + this->src_pitch_in_pixels * y;
+    BinaryMaskWord *filled_row = BinaryMaskRow (this->filled, y);
 
-        lFillLoc--;             // Move left
-        idx--;
+    FloodFillRange range;
 
-        // Exit loop if we're at edge of bitmap or fill color area
-        if (*idx == this->fill_colour || *idx != this->seed_colour || lFillLoc <= 0)
-        {
-            break;
-        }
-    }
+    range.left = x;
+    range.right = x;
+    range.line = y;
 
-    lFillLoc++;
+    while (range.left > 0 && Inside (row, filled_row, range.left - 1))
+        range.left--;
 
-    // Find Right Edge of Color Area
-    int rFillLoc = x;           //the location to check/fill on the left
+    while (range.right < this->width - 1 && Inside (row, filled_row, range.right + 1))
+        range.right++;
 
-    idx = this->first_pixel_ptr + this->src_pitch_in_pixels * y + x + 1;
+    SetMaskBits (filled_row, range.left, range.right);
 
-    while (1)
+    if (this->fill)
     {
-        // Fill with the color
-        *idx = this->fill_colour;
-
-        rFillLoc++;             // Move right
-        idx++;
-
-        // Exit loop if we're at edge of bitmap or fill color area
-        if (*idx == this->fill_colour || *idx != this->seed_colour || rFillLoc >= this->width)
-        {
-            break;
-        }
+        for(register int i = range.left; i <= range.right; i++)
+            row[i] = this->fill_colour;
     }
 
-    rFillLoc--;
-
-    //add range to queue
-    FloodFillRange r;
-
-    r.left = lFillLoc;
-    r.right = rFillLoc;
-    r.line = y;
-
-    ranges.push_back (r);
+    return range;
 }
 
-template < typename IntType > int GS_FLOODFILL < IntType >::FloodFill (FIBITMAP * src, int seed_x,
-                                                                       int seed_y,
-                                                                       unsigned char fill_colour)
+template < typename Tp > int GS_FLOODFILL < Tp >::FloodFill (FIBITMAP * src, int seed_x, int seed_y,
+                                                             double lower, double upper,
+                                                             FIA_CONNECTIVITY connectivity,
+                                                             int fill, double fill_colour,
+                                                             BinaryMask * filled)
 {
     this->width = FreeImage_GetWidth (src);
     this->height = FreeImage_GetHeight (src);
-    this->ranges.reserve (width * height);
-    this->fill_colour = fill_colour;
-    this->src_pitch_in_pixels = FreeImage_GetPitch (src) / sizeof (IntType);
+    this->src_pitch_in_pixels = FreeImage_GetPitch (src) / sizeof (Tp);
+    this->first_pixel_ptr = (Tp *) FreeImage_GetBits (src);
+    this->fill = fill;
+    this->fill_colour = (Tp) fill_colour;
+    this->filled = filled;
+
+    // With 8 connectivity the rows either side are searched one pixel further
+    const int reach = (connectivity == FIA_CONNECTIVITY_8) ? 1 : 0;
+
+    // The range in the pixel type, or nothing is filled if it holds no values.
+    // Integer types round inwards.
+    const double type_min = std::numeric_limits < Tp >::is_integer ?
+        (double) std::numeric_limits < Tp >::min () : -std::numeric_limits < Tp >::max ();
+    const double type_max = (double) std::numeric_limits < Tp >::max ();
+
+    if (std::numeric_limits < Tp >::is_integer)
+    {
+        lower = ceil (lower);
+        upper = floor (upper);
+    }
 
-    this->first_pixel_ptr = (IntType *) FreeImage_GetBits (src);
+    if (lower > upper || upper < type_min || lower > type_max)
+        return FIA_SUCCESS;
 
-    this->seed_colour = *(this->first_pixel_ptr + this->src_pitch_in_pixels * seed_y + seed_x);
-    this->LinearFill (seed_x, seed_y);
+    this->lower = (Tp) MAX (lower, type_min);
+    this->upper = (Tp) MIN (upper, type_max);
 
-    FloodFillRange range;
+    FloodFillStack ranges;
 
-    while (!this->ranges.empty ())
+    if (!Inside (this->first_pixel_ptr + this->src_pitch_in_pixels * seed_y,
+                 BinaryMaskRow (filled, seed_y), seed_x))
     {
-        // Get Next Range Off the Queue
-        range = ranges.back ();
-        ranges.pop_back ();
+        return FIA_SUCCESS;
+    }
 
-        // Check Above and Below Each Pixel in the Floodfill Range
+    if (ranges.Push (this->LinearFill (seed_x, seed_y)) == FIA_ERROR)
+        return FIA_ERROR;
 
-        IntType *down_idx = this->first_pixel_ptr + this->src_pitch_in_pixels * (range.line - 1)
-            + range.left;
+    FloodFillRange range;
 
-        IntType *up_idx = this->first_pixel_ptr + this->src_pitch_in_pixels * (range.line + 1)
-            + range.left;
+    while (ranges.Pop (&range))
+    {
+        // Check Above and Below Each Pixel in the Floodfill Range
+        int start = MAX (0, range.left - reach);
+        int end = MIN (this->width - 1, range.right + reach);
 
-        for(int i = range.left; i <= range.right; i++)
+        for(int line = range.line - 1; line <= range.line + 1; line += 2)
         {
-            // Start Fill Upwards
-            if (range.line < (this->height - 1) && *up_idx == this->seed_colour)
-            {
-                LinearFill (i, range.line + 1);
-            }
+            if (line < 0 || line >= this->height)
+                continue;
+
+            const Tp *row = this->first_pixel_ptr + this->src_pitch_in_pixels * line;
+            const BinaryMaskWord *filled_row = BinaryMaskRow (filled, line);
 
-            // Start Fill Downwards
-            // If we're not below the bottom of the bitmap and the pixel below this one is within the color tolerance
-            if (range.line > 0 && *down_idx == this->seed_colour)
+            for(int i = start; i <= end; i++)
             {
-                LinearFill (i, range.line - 1);
+                // Skip whole words of filled pixels
+                if ((i & 63) == 0 && filled_row[i >> 6] == ~(BinaryMaskWord) 0)
+                {
+                    i += 63;
+                    continue;
+                }
+
+                if (Inside (row, filled_row, i))
+                {
+                    FloodFillRange next = this->LinearFill (i, line);
+
+                    if (ranges.Push (next) == FIA_ERROR)
+                        return FIA_ERROR;
+
+                    // The rest of this run is filled
+                    i = next.right + 1;
+                }
             }
-
-            up_idx++;
-            down_idx++;
         }
     }
 
     return FIA_SUCCESS;
 }
 
-GS_FLOODFILL < unsigned char >floodfillUCharImage;
-GS_FLOODFILL < unsigned short >floodfillUShortImage;
-GS_FLOODFILL < short >floodfillShortImage;
-GS_FLOODFILL < unsigned long >floodfillULongImage;
-GS_FLOODFILL < long >floodfillLongImage;
-
-FIBITMAP *DLL_CALLCONV
-FIA_FloodFill (FIBITMAP * src, int seed_x, int seed_y, int fill_colour)
+// Fills from the seed on the pixel type of src. The seed value, plus or minus
+// tolerance, gives the values that are filled.
+static int
+FloodFillImage (FIBITMAP * src, int seed_x, int seed_y, double tolerance,
+                FIA_CONNECTIVITY connectivity, int fill, double fill_colour, BinaryMask * filled)
 {
-    if (!src)
+    if (src == NULL || CheckConnectivity (connectivity) == FIA_ERROR)
     {
-        return NULL;
+        return FIA_ERROR;
     }
 
-    FIBITMAP *dst = FreeImage_Clone (src);
+    if (seed_x < 0 || seed_y < 0 || seed_x >= (int) FreeImage_GetWidth (src)
+        || seed_y >= (int) FreeImage_GetHeight (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Error performing FloodFill. Seed is outside the image");
+        return FIA_ERROR;
+    }
+
+    double seed_value;
+
+    FIA_GetPixelValue (src, seed_x, seed_y, &seed_value);
+
+    double lower = seed_value - tolerance;
+    double upper = seed_value + tolerance;
 
     FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
-    int err = 0;
 
     switch (type)
     {
@@ -195,29 +306,54 @@ FIA_FloodFill (FIBITMAP * src, int seed_x, int seed_y, int fill_colour)
         {                       // standard image: 1-, 4-, 8-, 16-, 24-, 32-bit
             if (FreeImage_GetBPP (src) == 8)
             {
-                err = floodfillUCharImage.FloodFill (dst, seed_x, seed_y, fill_colour);
+                GS_FLOODFILL < unsigned char >floodfill;
+
+                return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                            fill, fill_colour, filled);
             }
             break;
         }
         case FIT_UINT16:
         {                       // array of unsigned short: unsigned 16-bit
-            err = floodfillUShortImage.FloodFill (dst, seed_x, seed_y, fill_colour);
-            break;
+            GS_FLOODFILL < unsigned short >floodfill;
+
+            return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                        fill, fill_colour, filled);
         }
         case FIT_INT16:
         {                       // array of short: signed 16-bit
-            err = floodfillShortImage.FloodFill (dst, seed_x, seed_y, fill_colour);
-            break;
+            GS_FLOODFILL < short >floodfill;
+
+            return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                        fill, fill_colour, filled);
         }
         case FIT_UINT32:
         {                       // array of unsigned long: unsigned 32-bit
-            err = floodfillULongImage.FloodFill (dst, seed_x, seed_y, fill_colour);
-            break;
+            GS_FLOODFILL < unsigned long >floodfill;
+
+            return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                        fill, fill_colour, filled);
         }
         case FIT_INT32:
         {                       // array of long: signed 32-bit
-            err = floodfillLongImage.FloodFill (dst, seed_x, seed_y, fill_colour);
-            break;
+            GS_FLOODFILL < long >floodfill;
+
+            return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                        fill, fill_colour, filled);
+        }
+        case FIT_FLOAT:
+        {                       // array of float: 32-bit
+            GS_FLOODFILL < float >floodfill;
+
+            return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                        fill, fill_colour, filled);
+        }
+        case FIT_DOUBLE:
+        {                       // array of double: 64-bit
+            GS_FLOODFILL < double >floodfill;
+
+            return floodfill.FloodFill (src, seed_x, seed_y, lower, upper, connectivity,
+                                        fill, fill_colour, filled);
         }
         default:
         {
@@ -225,71 +361,108 @@ FIA_FloodFill (FIBITMAP * src, int seed_x, int seed_y, int fill_colour)
         }
     }
 
-    if (err == 0)
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "Error performing FloodFill. Image type %d is not a greyscale type", type);
+
+    return FIA_ERROR;
+}
+
+int DLL_CALLCONV
+FIA_InPlaceFloodFillWithTolerance (FIBITMAP * src, int seed_x, int seed_y, double fill_colour,
+                                   double tolerance, FIA_CONNECTIVITY connectivity)
+{
+    if (src == NULL)
     {
-        FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                     "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                                     type, FIT_BITMAP);
-        return NULL;
+        return FIA_ERROR;
     }
 
-    return dst;
-};
+    BinaryMask *filled = NewBinaryMask (FreeImage_GetWidth (src), FreeImage_GetHeight (src));
+
+    if (filled == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    int err = FloodFillImage (src, seed_x, seed_y, tolerance, connectivity, 1, fill_colour, filled);
+
+    FreeBinaryMask (filled);
+
+    return err;
+}
 
 int DLL_CALLCONV
 FIA_InPlaceFloodFill (FIBITMAP * src, int seed_x, int seed_y, int fill_colour)
+{
+    return FIA_InPlaceFloodFillWithTolerance (src, seed_x, seed_y, fill_colour, 0.0,
+                                              FIA_CONNECTIVITY_4);
+};
+
+FIBITMAP *DLL_CALLCONV
+FIA_FloodFill (FIBITMAP * src, int seed_x, int seed_y, int fill_colour)
 {
     if (!src)
     {
-        return FIA_ERROR;
+        return NULL;
     }
 
-    FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
-    int err = 0;
+    FIBITMAP *dst = FreeImage_Clone (src);
 
-    switch (type)
+    if (dst == NULL)
     {
-        case FIT_BITMAP:
-        {                       // standard image: 1-, 4-, 8-, 16-, 24-, 32-bit
-            if (FreeImage_GetBPP (src) == 8)
-            {
-                err = floodfillUCharImage.FloodFill (src, seed_x, seed_y, fill_colour);
-            }
-            break;
-        }
-        case FIT_UINT16:
-        {                       // array of unsigned short: unsigned 16-bit
-            err = floodfillUShortImage.FloodFill (src, seed_x, seed_y, fill_colour);
-            break;
-        }
-        case FIT_INT16:
-        {                       // array of short: signed 16-bit
-            err = floodfillShortImage.FloodFill (src, seed_x, seed_y, fill_colour);
-            break;
-        }
-        case FIT_UINT32:
-        {                       // array of unsigned long: unsigned 32-bit
-            err = floodfillULongImage.FloodFill (src, seed_x, seed_y, fill_colour);
-            break;
-        }
-        case FIT_INT32:
-        {                       // array of long: signed 32-bit
-            err = floodfillLongImage.FloodFill (src, seed_x, seed_y, fill_colour);
-            break;
-        }
-        default:
-        {                       // array of FICOMPLEX: 2 x 64-bit
-            break;
-        }
+        return NULL;
     }
 
-    if (err == 0)
+    if (FIA_InPlaceFloodFill (dst, seed_x, seed_y, fill_colour) == FIA_ERROR)
     {
-        FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                     "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                                     type, FIT_BITMAP);
-        return FIA_ERROR;
+        FreeImage_Unload (dst);
+        return NULL;
     }
 
-    return FIA_SUCCESS;
+    return dst;
 };
+
+FIBITMAP *DLL_CALLCONV
+FIA_FloodFillMask (FIBITMAP * src, int seed_x, int seed_y, double tolerance,
+                   FIA_CONNECTIVITY connectivity)
+{
+    if (src == NULL)
+    {
+        return NULL;
+    }
+
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    BinaryMask *filled = NewBinaryMask (width, height);
+
+    if (filled == NULL)
+    {
+        return NULL;
+    }
+
+    if (FloodFillImage (src, seed_x, seed_y, tolerance, connectivity, 0, 0.0, filled) == FIA_ERROR)
+    {
+        FreeBinaryMask (filled);
+        return NULL;
+    }
+
+    FIBITMAP *dst = FreeImage_Allocate (width, height, 8, 0, 0, 0);
+
+    if (dst != NULL)
+    {
+        FIA_SetGreyLevelPalette (dst);
+
+        for(int y = 0; y < height; y++)
+        {
+            const BinaryMaskWord *filled_row = BinaryMaskRow (filled, y);
+            unsigned char *dst_ptr = (unsigned char *) FreeImage_GetScanLine (dst, y);
+
+            for(register int x = 0; x < width; x++)
+                dst_ptr[x] = IsMaskBitSet (filled_row, x) ? 255 : 0;
+        }
+    }
+
+    FreeBinaryMask (filled);
+
+    return dst;
+}
@@ -462,3 +462,326 @@ FIA_InplaceLinearScaleToStandardType (FIBITMAP ** src, double min, double max, d
 
     return FIA_SUCCESS;
 }
+
+// Scaling to a palette colour. The index of a value is worked out as
+// LINEAR_SCALE does so the colours match a scaled 8 bit image that has
+// been given the palette and converted to 24 or 32 bits.
+
+static inline int
+LinearScaleIndex (double val, double min, double max, double scale)
+{
+    // NaN fails every comparison below so give it the first colour
+    if (val != val)
+        return 0;
+
+    // Only one value to scale - just round as a conversion would
+    if (min == max)
+        return (val <= 0.0) ? 0 : ((val >= 255.0) ? 255 : (int) (val + 0.5));
+
+    if (val <= min)
+        return 0;
+
+    if (val >= max)
+        return 255;
+
+    int index = (int) (scale * (val - min));
+
+    return (index < 0) ? 0 : ((index > 255) ? 255 : index);
+}
+
+// 8 and 16 bit images are coloured through a table of every value.
+template < class Tsrc > struct ColourLookup
+{
+    static const int size = 0;
+    static const int first = 0;
+};
+
+template <> struct ColourLookup < unsigned char >
+{
+    static const int size = 256;
+    static const int first = 0;
+};
+
+template <> struct ColourLookup < unsigned short >
+{
+    static const int size = 65536;
+    static const int first = 0;
+};
+
+template <> struct ColourLookup < short >
+{
+    static const int size = 65536;
+    static const int first = -32768;
+};
+
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *dst;
+    double min;
+    double max;
+    int found;
+    const RGBQUAD *colours;     // The 256 palette colours with an opaque alpha
+    const RGBQUAD *lut;         // The colour of each value from ColourLookup::first or NULL
+
+} ColourScaleRange;
+
+template < class Tsrc > static void
+MinMaxRowRange (void *data, int start_row, int end_row)
+{
+    ColourScaleRange *range = (ColourScaleRange *) data;
+    const int width = FreeImage_GetWidth (range->src);
+
+    const Tsrc *first = NULL;
+
+    // Start from the first value that is not NaN. After that NaN fails
+    // both comparisons below and is skipped.
+    for(int y = start_row; y < end_row && first == NULL; y++)
+    {
+        const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+
+        for(register int x = 0; x < width; x++)
+        {
+            if (src_ptr[x] == src_ptr[x])
+            {
+                first = src_ptr + x;
+                break;
+            }
+        }
+    }
+
+    if (first == NULL)
+        return;
+
+    Tsrc min = *first;
+    Tsrc max = min;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+
+        for(register int x = 0; x < width; x++)
+        {
+            if (src_ptr[x] < min)
+                min = src_ptr[x];
+            else if (src_ptr[x] > max)
+                max = src_ptr[x];
+        }
+    }
+
+    EnterGlobalLock ();
+
+    if (!range->found || min < range->min)
+        range->min = min;
+
+    if (!range->found || max > range->max)
+        range->max = max;
+
+    range->found = 1;
+
+    LeaveGlobalLock ();
+}
+
+template < class Tsrc > static void
+ColourScaleRowRange (void *data, int start_row, int end_row)
+{
+    ColourScaleRange *range = (ColourScaleRange *) data;
+    const int width = FreeImage_GetWidth (range->src);
+    const int bytes_per_pixel = FreeImage_GetBPP (range->dst) / 8;
+    const double min = range->min, max = range->max;
+    const double scale = (min == max) ? 0.0 : 255.0 / (max - min);
+    const RGBQUAD *lut = range->lut - ColourLookup < Tsrc >::first;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+        BYTE *dst_ptr = FreeImage_GetScanLine (range->dst, y);
+
+        if (bytes_per_pixel == 4)
+        {
+            RGBQUAD *dst_colours = (RGBQUAD *) dst_ptr;
+
+            if (range->lut != NULL)
+            {
+                for(register int x = 0; x < width; x++)
+                    dst_colours[x] = lut[(int) src_ptr[x]];
+            }
+            else
+            {
+                for(register int x = 0; x < width; x++)
+                    dst_colours[x] = range->colours[LinearScaleIndex (src_ptr[x], min, max, scale)];
+            }
+        }
+        else
+        {
+            for(register int x = 0; x < width; x++, dst_ptr += 3)
+            {
+                const RGBQUAD & colour = (range->lut != NULL) ? lut[(int) src_ptr[x]]
+                    : range->colours[LinearScaleIndex (src_ptr[x], min, max, scale)];
+
+                dst_ptr[FI_RGBA_RED] = colour.rgbRed;
+                dst_ptr[FI_RGBA_GREEN] = colour.rgbGreen;
+                dst_ptr[FI_RGBA_BLUE] = colour.rgbBlue;
+            }
+        }
+    }
+}
+
+template < class Tsrc > static int
+LinearScaleToColour (FIBITMAP * dst, FIBITMAP * src, double min, double max, RGBQUAD * palette,
+                     double *min_within_image, double *max_within_image)
+{
+    const int height = FreeImage_GetHeight (src);
+
+    ColourScaleRange range;
+    RGBQUAD colours[256];
+
+    range.src = src;
+    range.dst = dst;
+    range.min = min;
+    range.max = max;
+    range.found = 0;
+    range.colours = colours;
+    range.lut = NULL;
+
+    // If the user has not specifed min & max use the min and max pixels in the image.
+    if (max == 0.0 && min == 0.0)
+        RunRowRangesInParallel (height, 64, MinMaxRowRange < Tsrc >, &range);
+
+    if (min_within_image != NULL)
+        *min_within_image = range.min;
+
+    if (max_within_image != NULL)
+        *max_within_image = range.max;
+
+    if (palette != NULL)
+        memcpy (colours, palette, sizeof (colours));
+    else
+        FIA_GetGreyLevelPalette (colours);
+
+    for(int i = 0; i < 256; i++)
+        colours[i].rgbReserved = 0xFF;
+
+    RGBQUAD *lut = NULL;
+
+    // A table only pays for itself if it is smaller than the image
+    if (ColourLookup < Tsrc >::size > 0
+        && ColourLookup < Tsrc >::size < (double) FreeImage_GetWidth (src) * height)
+    {
+        lut = (RGBQUAD *) malloc (ColourLookup < Tsrc >::size * sizeof (RGBQUAD));
+
+        if (lut == NULL)
+            return FIA_ERROR;
+
+        const double scale = (range.min == range.max) ? 0.0 : 255.0 / (range.max - range.min);
+
+        for(int i = 0; i < ColourLookup < Tsrc >::size; i++)
+        {
+            lut[i] = colours[LinearScaleIndex ((Tsrc) (i + ColourLookup < Tsrc >::first),
+                                               range.min, range.max, scale)];
+        }
+
+        range.lut = lut;
+    }
+
+    RunRowRangesInParallel (height, 64, ColourScaleRowRange < Tsrc >, &range);
+
+    free (lut);
+
+    return FIA_SUCCESS;
+}
+
+int DLL_CALLCONV
+FIA_LinearScaleToColourDst (FIBITMAP * dst, FIBITMAP * src, double min, double max,
+                            RGBQUAD * palette, double *min_within_image, double *max_within_image)
+{
+    if (src == NULL || dst == NULL)
+        return FIA_ERROR;
+
+    if (FreeImage_GetImageType (dst) != FIT_BITMAP
+        || (FreeImage_GetBPP (dst) != 24 && FreeImage_GetBPP (dst) != 32)
+        || FreeImage_GetWidth (dst) != FreeImage_GetWidth (src)
+        || FreeImage_GetHeight (dst) != FreeImage_GetHeight (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Destination must be a 24 or 32 bit image the size of the source");
+        return FIA_ERROR;
+    }
+
+    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType (src);
+
+    switch (src_type)
+    {
+        case FIT_BITMAP:
+        {                       // standard image: 1-, 4-, 8-, 16-, 24-, 32-bit
+            if (FreeImage_GetBPP (src) == 8)
+            {
+                return LinearScaleToColour < unsigned char > (dst, src, min, max, palette,
+                                                              min_within_image, max_within_image);
+            }
+            break;
+        }
+        case FIT_UINT16:
+        {                       // array of unsigned short: unsigned 16-bit
+            return LinearScaleToColour < unsigned short > (dst, src, min, max, palette,
+                                                           min_within_image, max_within_image);
+        }
+        case FIT_INT16:
+        {                       // array of short: signed 16-bit
+            return LinearScaleToColour < short > (dst, src, min, max, palette,
+                                                  min_within_image, max_within_image);
+        }
+        case FIT_UINT32:
+        {                       // array of unsigned long: unsigned 32-bit
+            return LinearScaleToColour < unsigned long > (dst, src, min, max, palette,
+                                                          min_within_image, max_within_image);
+        }
+        case FIT_INT32:
+        {                       // array of long: signed 32-bit
+            return LinearScaleToColour < long > (dst, src, min, max, palette,
+                                                 min_within_image, max_within_image);
+        }
+        case FIT_FLOAT:
+        {                       // array of float: 32-bit
+            return LinearScaleToColour < float > (dst, src, min, max, palette,
+                                                  min_within_image, max_within_image);
+        }
+        case FIT_DOUBLE:
+        {                       // array of double: 64-bit
+            return LinearScaleToColour < double > (dst, src, min, max, palette,
+                                                   min_within_image, max_within_image);
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
+                                 src_type, FIT_BITMAP);
+
+    return FIA_ERROR;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_LinearScaleToColour (FIBITMAP * src, double min, double max, RGBQUAD * palette, int bpp,
+                         double *min_within_image, double *max_within_image)
+{
+    if (src == NULL || (bpp != 24 && bpp != 32))
+        return NULL;
+
+    FIBITMAP *dst = FreeImage_Allocate (FreeImage_GetWidth (src), FreeImage_GetHeight (src), bpp, 0, 0, 0);
+
+    if (dst == NULL)
+        return NULL;
+
+    if (FIA_LinearScaleToColourDst (dst, src, min, max, palette, min_within_image,
+                                    max_within_image) == FIA_ERROR)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    return dst;
+}
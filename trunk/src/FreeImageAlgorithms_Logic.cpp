@@ -21,6 +21,7 @@
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_Logic.h"
 #include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_Utils.h"
 #include <limits>
 #include <float.h>
 #include <math.h>
@@ -194,8 +195,13 @@ FIA_ReverseMaskImage (FIBITMAP * mask, unsigned char foreground_val)
     return FIA_SUCCESS;
 }
 
-FIBITMAP *DLL_CALLCONV
-FIA_BinaryOr (FIBITMAP *src1, FIBITMAP *src2, int Not)
+typedef void (*BinaryMaskOperation) (BinaryMask * dst, const BinaryMask * a,
+                                     const BinaryMask * b);
+
+// The logic works on packed masks 64 pixels at a time.
+// Set pixels of the result are 1.
+static FIBITMAP *
+BinaryLogic (FIBITMAP * src1, FIBITMAP * src2, int Not, BinaryMaskOperation operation)
 {
     if (src1 == NULL || src2 == NULL)
         return NULL;
@@ -203,97 +209,43 @@ FIA_BinaryOr (FIBITMAP *src1, FIBITMAP *src2, int Not)
     int width = FreeImage_GetWidth (src1);
     int height = FreeImage_GetHeight (src1);
 
-	if (width != FreeImage_GetWidth (src2) || height != FreeImage_GetHeight (src2))
-		return NULL;
+    if (width != FreeImage_GetWidth (src2) || height != FreeImage_GetHeight (src2))
+        return NULL;
 
     // src has to be 8 bit 
     if (FreeImage_GetBPP (src1) != 8 || FreeImage_GetImageType (src1) != FIT_BITMAP)
-		return NULL;
+        return NULL;
     if (FreeImage_GetBPP (src2) != 8 || FreeImage_GetImageType (src2) != FIT_BITMAP)
-		return NULL;
-
-    FIBITMAP *dst = FIA_CloneImageType (src1, width, height);
-
-	if (Not)
-	{
-		for(register int y = 0; y < height; y++)
-		{
-			unsigned char *src1_ptr = (unsigned char *) FreeImage_GetScanLine (src1, y);
-			unsigned char *src2_ptr = (unsigned char *) FreeImage_GetScanLine (src2, y);
-			unsigned char *dst_ptr  = (unsigned char *) FreeImage_GetScanLine (dst, y);
-
-			for(register int x = 0; x < width; x++)
-			{
-				dst_ptr[x] = !(src1_ptr[x] || src2_ptr[x]);
-			}
-		}
-	}
-	else 
-	{
-		for(register int y = 0; y < height; y++)
-		{
-			unsigned char *src1_ptr = (unsigned char *) FreeImage_GetScanLine (src1, y);
-			unsigned char *src2_ptr = (unsigned char *) FreeImage_GetScanLine (src2, y);
-			unsigned char *dst_ptr  = (unsigned char *) FreeImage_GetScanLine (dst, y);
-
-			for(register int x = 0; x < width; x++)
-			{
-				dst_ptr[x] = src1_ptr[x] || src2_ptr[x];
-			}
-		}
-	}
+        return NULL;
 
-    return dst;
-}
+    BinaryMask *mask1 = BinaryMaskFromImage (src1);
+    BinaryMask *mask2 = BinaryMaskFromImage (src2);
+    FIBITMAP *dst = NULL;
 
-FIBITMAP *DLL_CALLCONV
-FIA_BinaryAnd (FIBITMAP *src1, FIBITMAP *src2, int Not)
-{
-    if (src1 == NULL || src2 == NULL)
-        return NULL;
+    if (mask1 != NULL && mask2 != NULL)
+    {
+        operation (mask1, mask1, mask2);
 
-    int width = FreeImage_GetWidth (src1);
-    int height = FreeImage_GetHeight (src1);
+        if (Not)
+            BinaryMaskNot (mask1, mask1);
 
-	if (width != FreeImage_GetWidth (src2) || height != FreeImage_GetHeight (src2))
-		return NULL;
+        dst = BinaryMaskToImage (mask1, src1, 0, 1);
+    }
 
-    // src has to be 8 bit 
-    if (FreeImage_GetBPP (src1) != 8 || FreeImage_GetImageType (src1) != FIT_BITMAP)
-		return NULL;
-    if (FreeImage_GetBPP (src2) != 8 || FreeImage_GetImageType (src2) != FIT_BITMAP)
-		return NULL;
-
-    FIBITMAP *dst = FIA_CloneImageType (src1, width, height);
-
-	if (Not)
-	{
-		for(register int y = 0; y < height; y++)
-		{
-			unsigned char *src1_ptr = (unsigned char *) FreeImage_GetScanLine (src1, y);
-			unsigned char *src2_ptr = (unsigned char *) FreeImage_GetScanLine (src2, y);
-			unsigned char *dst_ptr  = (unsigned char *) FreeImage_GetScanLine (dst, y);
-
-			for(register int x = 0; x < width; x++)
-			{
-				dst_ptr[x] = !(src1_ptr[x] && src2_ptr[x]);
-			}
-		}
-	}
-	else 
-	{
-		for(register int y = 0; y < height; y++)
-		{
-			unsigned char *src1_ptr = (unsigned char *) FreeImage_GetScanLine (src1, y);
-			unsigned char *src2_ptr = (unsigned char *) FreeImage_GetScanLine (src2, y);
-			unsigned char *dst_ptr  = (unsigned char *) FreeImage_GetScanLine (dst, y);
-
-			for(register int x = 0; x < width; x++)
-			{
-				dst_ptr[x] = src1_ptr[x] && src2_ptr[x];
-			}
-		}
-	}
+    FreeBinaryMask (mask1);
+    FreeBinaryMask (mask2);
 
     return dst;
 }
+
+FIBITMAP *DLL_CALLCONV
+FIA_BinaryOr (FIBITMAP *src1, FIBITMAP *src2, int Not)
+{
+    return BinaryLogic (src1, src2, Not, BinaryMaskOr);
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_BinaryAnd (FIBITMAP *src1, FIBITMAP *src2, int Not)
+{
+    return BinaryLogic (src1, src2, Not, BinaryMaskAnd);
+}
@@ -23,28 +23,14 @@
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Statistics.h"  // Required because FIA_GetMedianFromImage is declared there (without this it does not get exported to dll)
 
-#define BLOCKSIZE 8
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 
 template < class Tsrc > class FILTER
 {
   public:
-    FIBITMAP * MedianFilter (FIABITMAP * src, int kernel_x_radius, int kernel_y_radius);
     Tsrc GetMedianFromImage (FIBITMAP * src);
-
-  private:
-
-    inline Tsrc KernelMedian (Tsrc * src_row_ptr);
-    inline void GetRow (Tsrc * ptr, Tsrc * kernel_data);
-    inline Tsrc quick_select (Tsrc arr[], int n);
-
-    int kernel_width;
-    int kernel_height;
-    int x_reminder;
-    int y_reminder;
-    int x_max_block_size;
-    int y_max_block_size;
-    int src_pitch_in_pixels;
-    Tsrc *kernel_tmp_array;
 };
 
 template < typename Tsrc > inline Tsrc FILTER < Tsrc >::GetMedianFromImage (FIBITMAP * src)
@@ -73,163 +59,310 @@ template < typename Tsrc > inline Tsrc FILTER < Tsrc >::GetMedianFromImage (FIBI
     return ret;
 }
 
-template < typename Tsrc > inline void FILTER < Tsrc >::GetRow (Tsrc * ptr, Tsrc * kernel_data)
+// Describes the images a median filter works on, see RunRowRangesInParallel.
+typedef struct
+{
+    FIABITMAP *src;
+    FIBITMAP *dst;
+    int x_radius;
+    int y_radius;
+    int error;
+
+} MedianRowRange;
+
+// Maps pixel values to histogram bins for the histogram median.
+template < typename Tsrc > struct MedianHistogramBins;
+
+template <> struct MedianHistogramBins < unsigned char >
+{
+    enum { bits = 8 };
+
+    static inline int Bin (unsigned char value) { return value; }
+    static inline unsigned char Value (int bin) { return (unsigned char) bin; }
+};
+
+template <> struct MedianHistogramBins < unsigned short >
+{
+    enum { bits = 16 };
+
+    static inline int Bin (unsigned short value) { return value; }
+    static inline unsigned short Value (int bin) { return (unsigned short) bin; }
+};
+
+template <> struct MedianHistogramBins < short >
 {
-    int x_max_block_size = this->x_max_block_size;
-    register Tsrc *tmp;
-    register Tsrc *result = kernel_data;
+    enum { bits = 16 };
 
-    size_t tsrc_size = sizeof (Tsrc);
-    size_t blocksize_in_bytes = tsrc_size * BLOCKSIZE;
+    static inline int Bin (short value) { return value + 32768; }
+    static inline short Value (int bin) { return (short) (bin - 32768); }
+};
 
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
+// Histogram of the pixels under the kernel (Huang's sliding histogram).
+// The bins are grouped into coarse blocks. The block holding the median
+// and the count of pixels in the blocks below it are kept up to date as
+// pixels are added and removed, so finding the median only needs to
+// search one block rather than the whole histogram.
+template < typename Tsrc > class HistogramMedian
+{
+  public:
+
+    HistogramMedian (int window_size)
     {
-        tmp = ptr + col;
+        this->coarse_shift = MedianHistogramBins < Tsrc >::bits / 2;
+        this->fine = (unsigned int *) calloc (1 << MedianHistogramBins < Tsrc >::bits,
+                                              sizeof (unsigned int));
+        this->coarse = (unsigned int *) calloc (1 << (MedianHistogramBins < Tsrc >::bits -
+                                                      this->coarse_shift), sizeof (unsigned int));
+        this->median_block = 0;
+        this->below = 0;
+        this->target = window_size / 2;
+    }
 
-        memcpy (result, tmp, blocksize_in_bytes);
+    ~HistogramMedian ()
+    {
+        free (this->fine);
+        free (this->coarse);
     }
 
-    tmp = ptr + x_max_block_size;
-    result += x_max_block_size;
+    inline int IsValid ()
+    {
+        return this->fine != NULL && this->coarse != NULL;
+    }
 
-    switch (this->x_reminder)
+    inline void Add (Tsrc value)
     {
-        case 7:
-        {
-            memcpy (result, tmp, tsrc_size * 7);
-            break;
-        }
+        int bin = MedianHistogramBins < Tsrc >::Bin (value);
+
+        this->fine[bin]++;
+        this->coarse[bin >> this->coarse_shift]++;
+
+        if ((bin >> this->coarse_shift) < this->median_block)
+            this->below++;
+    }
+
+    inline void Remove (Tsrc value)
+    {
+        int bin = MedianHistogramBins < Tsrc >::Bin (value);
+
+        this->fine[bin]--;
+        this->coarse[bin >> this->coarse_shift]--;
 
-        case 6:
+        if ((bin >> this->coarse_shift) < this->median_block)
+            this->below--;
+    }
+
+    inline Tsrc Median ()
+    {
+        while (this->below > this->target)
         {
-            memcpy (result, tmp, tsrc_size * 6);
-            break;
+            this->median_block--;
+            this->below -= this->coarse[this->median_block];
         }
 
-        case 5:
+        while (this->below + (int) this->coarse[this->median_block] <= this->target)
         {
-            memcpy (result, tmp, tsrc_size * 5);
-            break;
+            this->below += this->coarse[this->median_block];
+            this->median_block++;
         }
 
-        case 4:
+        register int count = this->below;
+        register int bin = this->median_block << this->coarse_shift;
+
+        for(;; bin++)
         {
-            memcpy (result, tmp, tsrc_size * 4);
-            break;
+            count += this->fine[bin];
+
+            if (count > this->target)
+                break;
         }
 
-        case 3:
+        return MedianHistogramBins < Tsrc >::Value (bin);
+    }
+
+  private:
+
+    unsigned int *fine;
+    unsigned int *coarse;
+    int coarse_shift;
+    int median_block;
+    int below;
+    int target;
+};
+
+// Each output row costs O(radius) per pixel: sliding the kernel one pixel
+// removes the left column from the histogram and adds the new right column.
+template < typename Tsrc > static void
+HistogramMedianRows (void *data, int start_row, int end_row)
+{
+    MedianRowRange *range = (MedianRowRange *) data;
+
+    const int kernel_width = (range->x_radius * 2) + 1;
+    const int kernel_height = (range->y_radius * 2) + 1;
+    const int dst_width = FreeImage_GetWidth (range->dst);
+    const int src_pitch_in_pixels = FreeImage_GetPitch (range->src->fib) / sizeof (Tsrc);
+
+    // Amount we need to move in x to get pass the border and onto the image.
+    const int x_amount_to_image = range->src->xborder - range->x_radius;
+    const int y_amount_to_image = range->src->yborder - range->y_radius;
+
+    Tsrc *src_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (range->src->fib);
+
+    HistogramMedian < Tsrc > histogram (kernel_width * kernel_height);
+
+    if (!histogram.IsValid ())
+    {
+        range->error = 1;
+        return;
+    }
+
+    register Tsrc *column_ptr;
+
+    for(register int y = start_row; y < end_row; y++)
+    {
+        Tsrc *window_ptr = src_first_pixel_address_ptr + (y + y_amount_to_image)
+            * src_pitch_in_pixels + x_amount_to_image;
+
+        Tsrc *dst_ptr = (Tsrc *) FreeImage_GetScanLine (range->dst, y);
+
+        for(register int row = 0; row < kernel_height; row++)
         {
-            memcpy (result, tmp, tsrc_size * 3);
-            break;
+            for(register int col = 0; col < kernel_width; col++)
+                histogram.Add (window_ptr[row * src_pitch_in_pixels + col]);
         }
 
-        case 2:
+        dst_ptr[0] = histogram.Median ();
+
+        for(register int x = 1; x < dst_width; x++)
         {
-            memcpy (result, tmp, tsrc_size * 2);
-            break;
+            column_ptr = window_ptr + x - 1;
+
+            for(register int row = 0; row < kernel_height; row++)
+            {
+                histogram.Remove (column_ptr[0]);
+                histogram.Add (column_ptr[kernel_width]);
+                column_ptr += src_pitch_in_pixels;
+            }
+
+            dst_ptr[x] = histogram.Median ();
         }
 
-        case 1:
+        // Empty the histogram ready for the next row.
+        column_ptr = window_ptr + dst_width - 1;
+
+        for(register int row = 0; row < kernel_height; row++)
         {
-            memcpy (result, tmp, tsrc_size * 1);
+            for(register int col = 0; col < kernel_width; col++)
+                histogram.Remove (column_ptr[row * src_pitch_in_pixels + col]);
         }
     }
 }
 
-template < typename Tsrc > inline Tsrc FILTER < Tsrc >::KernelMedian (Tsrc * src_row_ptr)
+// Orders NaN after every other value so sorting is always well defined.
+template < typename Tsrc > struct MedianLess
 {
-    register Tsrc *array_ptr = this->kernel_tmp_array;
-    register Tsrc *tmp_ptr = src_row_ptr;
-
-    for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
+    inline bool operator () (Tsrc a, Tsrc b) const
     {
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+        return a < b || (b != b && a == a);
+    }
+};
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+// For types with too many values for a histogram the pixels under the kernel
+// are kept sorted. Sliding the kernel one pixel removes the sorted outgoing
+// column from the window and merges in the sorted incoming column, O(r * r)
+// sequential work rather than a selection over the whole window.
+template < typename Tsrc > static void
+SortedWindowMedianRows (void *data, int start_row, int end_row)
+{
+    MedianRowRange *range = (MedianRowRange *) data;
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    const int kernel_width = (range->x_radius * 2) + 1;
+    const int kernel_height = (range->y_radius * 2) + 1;
+    const int window_size = kernel_width * kernel_height;
+    const int dst_width = FreeImage_GetWidth (range->dst);
+    const int src_pitch_in_pixels = FreeImage_GetPitch (range->src->fib) / sizeof (Tsrc);
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    // Amount we need to move in x to get pass the border and onto the image.
+    const int x_amount_to_image = range->src->xborder - range->x_radius;
+    const int y_amount_to_image = range->src->yborder - range->y_radius;
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    Tsrc *src_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (range->src->fib);
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    MedianLess < Tsrc > less;
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    Tsrc *window = (Tsrc *) malloc (sizeof (Tsrc) * window_size);
+    Tsrc *merged = (Tsrc *) malloc (sizeof (Tsrc) * window_size);
+    Tsrc *outgoing = (Tsrc *) malloc (sizeof (Tsrc) * kernel_height);
+    Tsrc *incoming = (Tsrc *) malloc (sizeof (Tsrc) * kernel_height);
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    if (window == NULL || merged == NULL || outgoing == NULL || incoming == NULL)
+    {
+        range->error = 1;
+        goto CLEANUP;
     }
 
-    switch (this->y_reminder)
+    for(register int y = start_row; y < end_row; y++)
     {
-        case 7:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 6:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 5:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 4:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 3:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 2:
+        Tsrc *window_ptr = src_first_pixel_address_ptr + (y + y_amount_to_image)
+            * src_pitch_in_pixels + x_amount_to_image;
+
+        Tsrc *dst_ptr = (Tsrc *) FreeImage_GetScanLine (range->dst, y);
+
+        for(register int row = 0; row < kernel_height; row++)
         {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
+            memcpy (window + row * kernel_width, window_ptr + row * src_pitch_in_pixels,
+                    sizeof (Tsrc) * kernel_width);
         }
-        case 1:
+
+        std::sort (window, window + window_size, less);
+
+        dst_ptr[0] = window[window_size / 2];
+
+        for(register int x = 1; x < dst_width; x++)
         {
-            GetRow (tmp_ptr, array_ptr);
+            Tsrc *column_ptr = window_ptr + x - 1;
+
+            for(register int row = 0; row < kernel_height; row++)
+            {
+                outgoing[row] = column_ptr[0];
+                incoming[row] = column_ptr[kernel_width];
+                column_ptr += src_pitch_in_pixels;
+            }
+
+            std::sort (outgoing, outgoing + kernel_height, less);
+            std::sort (incoming, incoming + kernel_height, less);
+
+            // Remove the outgoing column, leaving window_size - kernel_height values.
+            register int i = 0, j = 0, m = 0;
+
+            for(; i < window_size && j < kernel_height && m < window_size - kernel_height; i++)
+            {
+                if (!less (window[i], outgoing[j]) && !less (outgoing[j], window[i]))
+                    j++;
+                else
+                    merged[m++] = window[i];
+            }
+
+            for(; i < window_size && m < window_size - kernel_height; i++)
+                merged[m++] = window[i];
+
+            // Merge in the incoming column.
+            std::merge (merged, merged + m, incoming, incoming + kernel_height, window, less);
+
+            dst_ptr[x] = window[window_size / 2];
         }
     }
 
-    int kernel_length = this->kernel_width * this->kernel_height;
+  CLEANUP:
 
-    // We must now find and return the median value.
-    return quick_select_median (this->kernel_tmp_array, kernel_length);
+    free (window);
+    free (merged);
+    free (outgoing);
+    free (incoming);
 }
 
-template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::MedianFilter (FIABITMAP * src,
-                                                                     int kernel_x_radius,
-                                                                     int kernel_y_radius)
+template < typename Tsrc > static FIBITMAP *
+MedianFilterImage (FIABITMAP * src, int kernel_x_radius, int kernel_y_radius,
+                   FIA_ROW_RANGE_FUNCTION rows_function)
 {
     // Border must be large enough to account for kernel radius
     if (src->xborder < kernel_x_radius || src->yborder < kernel_y_radius)
@@ -237,55 +370,30 @@ template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::MedianFilter (FIABITMAP *
         return NULL;
     }
 
-    const int src_image_width = FreeImage_GetWidth (src->fib);
-    const int src_image_height = FreeImage_GetHeight (src->fib);
-
-    const int dst_width = src_image_width - (2 * src->xborder);
-    const int dst_height = src_image_height - (2 * src->yborder);
+    const int dst_width = FreeImage_GetWidth (src->fib) - (2 * src->xborder);
+    const int dst_height = FreeImage_GetHeight (src->fib) - (2 * src->yborder);
 
     FIBITMAP *dst = FIA_CloneImageType (src->fib, dst_width, dst_height);
 
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (Tsrc);
-
-    this->kernel_width = (kernel_x_radius * 2) + 1;
-    this->kernel_height = (kernel_y_radius * 2) + 1;
-    this->x_reminder = this->kernel_width % BLOCKSIZE;
-    this->y_reminder = this->kernel_height % BLOCKSIZE;
-    this->x_max_block_size = (this->kernel_width / BLOCKSIZE) * BLOCKSIZE;
-    this->y_max_block_size = (this->kernel_height / BLOCKSIZE) * BLOCKSIZE;
-    this->src_pitch_in_pixels = FreeImage_GetPitch (src->fib) / sizeof (Tsrc);
-
-    Tsrc *src_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (src->fib);
-    Tsrc *dst_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (dst);
-
-    this->kernel_tmp_array
-        = (Tsrc *) malloc (sizeof (Tsrc) * this->kernel_width * this->kernel_height);
+    if (dst == NULL)
+        return NULL;
 
-    if (CheckMemory(this->kernel_tmp_array) < 0) return NULL;
+    MedianRowRange range;
 
-    register Tsrc *dst_ptr;
-    register Tsrc *src_row_ptr;
+    range.src = src;
+    range.dst = dst;
+    range.x_radius = kernel_x_radius;
+    range.y_radius = kernel_y_radius;
+    range.error = 0;
 
-    // Amount we need to move in x to get pass the border and onto the image.
-    int x_amount_to_image = src->xborder - kernel_x_radius;
-    int y_amount_to_image = src->yborder - kernel_y_radius;
+    RunRowRangesInParallel (dst_height, 4, rows_function, &range);
 
-    for(register int y = 0; y < dst_height; y++)
+    if (range.error)
     {
-        src_row_ptr = src_first_pixel_address_ptr + (y + y_amount_to_image)
-            * this->src_pitch_in_pixels + x_amount_to_image;
-
-        dst_ptr = (dst_first_pixel_address_ptr + y * dst_pitch_in_pixels);
-
-        for(register int x = 0; x < dst_width; x++)
-        {
-            *dst_ptr++ = KernelMedian (src_row_ptr);
-            src_row_ptr++;
-        }
+        FreeImage_Unload (dst);
+        return NULL;
     }
 
-    free (this->kernel_tmp_array);
-
     return dst;
 }
 
@@ -316,38 +424,45 @@ FIA_MedianFilter (FIABITMAP * src, int kernel_x_radius, int kernel_y_radius)
         {                       // standard image: 1-, 4-, 8-, 16-, 24-, 32-bit
             if (FreeImage_GetBPP (src->fib) == 8)
             {
-                dst = filterUCharImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+                dst = MedianFilterImage < unsigned char > (src, kernel_x_radius, kernel_y_radius,
+                        HistogramMedianRows < unsigned char >);
             }
             break;
         }
         case FIT_UINT16:
         {                       // array of unsigned short: unsigned 16-bit
-            dst = filterUShortImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = MedianFilterImage < unsigned short > (src, kernel_x_radius, kernel_y_radius,
+                    HistogramMedianRows < unsigned short >);
             break;
         }
         case FIT_INT16:
         {                       // array of short: signed 16-bit
-            dst = filterShortImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = MedianFilterImage < short > (src, kernel_x_radius, kernel_y_radius,
+                    HistogramMedianRows < short >);
             break;
         }
         case FIT_UINT32:
         {                       // array of unsigned long: unsigned 32-bit
-            dst = filterULongImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = MedianFilterImage < unsigned long > (src, kernel_x_radius, kernel_y_radius,
+                    SortedWindowMedianRows < unsigned long >);
             break;
         }
         case FIT_INT32:
         {                       // array of long: signed 32-bit
-            dst = filterLongImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = MedianFilterImage < long > (src, kernel_x_radius, kernel_y_radius,
+                    SortedWindowMedianRows < long >);
             break;
         }
         case FIT_FLOAT:
         {                       // array of float: 32-bit
-            dst = filterFloatImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = MedianFilterImage < float > (src, kernel_x_radius, kernel_y_radius,
+                    SortedWindowMedianRows < float >);
             break;
         }
         case FIT_DOUBLE:
         {                       // array of double: 64-bit
-            dst = filterDoubleImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = MedianFilterImage < double > (src, kernel_x_radius, kernel_y_radius,
+                    SortedWindowMedianRows < double >);
             break;
         }
         default:
@@ -27,6 +27,9 @@
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Utils.h"
 
+#include <math.h>
+#include <limits>
+
 inline void
 DilateKernelRow (KernelIterator < unsigned char >&iterator, unsigned char *dst_ptr)
 {
@@ -363,9 +366,419 @@ BinaryDilateKernel (Kernel < unsigned char >*kernel, unsigned char *dst_ptr)
     }
 }
 
+// Rectangular and line structuring elements are separable, so they are
+// applied as a horizontal then a vertical pass of a running maximum or
+// minimum using the van Herk / Gil-Werman algorithm. That takes about
+// three comparisons per pixel whatever the size of the kernel.
+
+template < typename T > struct MorphologyMax
+{
+    static inline T Apply (T a, T b)
+    {
+        return (a > b) ? a : b;
+    }
+
+    // The value that leaves any other value unchanged.
+    static inline T Identity ()
+    {
+        return std::numeric_limits < T >::is_integer ?
+            std::numeric_limits < T >::min () : -std::numeric_limits < T >::max ();
+    }
+};
+
+template < typename T > struct MorphologyMin
+{
+    static inline T Apply (T a, T b)
+    {
+        return (a < b) ? a : b;
+    }
+
+    static inline T Identity ()
+    {
+        return std::numeric_limits < T >::max ();
+    }
+};
+
+// Returns 1 if every value of the kernel is set.
+static int
+IsFullKernel (FilterKernel kernel)
+{
+    int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
+
+    for(int i = 0; i < kernel_size; i++)
+    {
+        if (kernel.values[i] <= 0.0)
+            return 0;
+    }
+
+    return 1;
+}
+
+// Returns 1 if every value of the kernel is set and the border of
+// src is the size of the kernel radius.
+static int
+IsRectangleKernel (FIABITMAP * src, FilterKernel kernel)
+{
+    if (src->xborder != kernel.x_radius || src->yborder != kernel.y_radius)
+        return 0;
+
+    return IsFullKernel (kernel);
+}
+
+// The window is split into blocks of size pixels. forward holds the running
+// value from the start of each block and backward from its end, so any
+// window is backward at its first pixel and forward at its last.
+template < typename T, typename Op > static void
+VanHerkRow (const T * src, T * dst, int width, int size, T * forward, T * backward)
+{
+    for(int start = 0; start < width; start += size)
+    {
+        int end = MIN (start + size, width);
+
+        forward[start] = src[start];
+
+        for(register int x = start + 1; x < end; x++)
+            forward[x] = Op::Apply (forward[x - 1], src[x]);
+
+        backward[end - 1] = src[end - 1];
+
+        for(register int x = end - 2; x >= start; x--)
+            backward[x] = Op::Apply (backward[x + 1], src[x]);
+    }
+
+    for(register int x = 0; x <= width - size; x++)
+        dst[x] = Op::Apply (backward[x], forward[x + size - 1]);
+}
+
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *dst;
+    int size;
+    int error;
+
+} VanHerkRange;
+
+template < typename T, typename Op > static void
+VanHerkRowRange (void *data, int start_row, int end_row)
+{
+    VanHerkRange *range = (VanHerkRange *) data;
+    int width = FreeImage_GetWidth (range->src);
+
+    T *forward = (T *) malloc (width * sizeof (T));
+    T *backward = (T *) malloc (width * sizeof (T));
+
+    if (forward == NULL || backward == NULL)
+    {
+        range->error = 1;
+    }
+    else
+    {
+        for(int y = start_row; y < end_row; y++)
+        {
+            VanHerkRow < T, Op > ((T *) FreeImage_GetScanLine (range->src, y),
+                                  (T *) FreeImage_GetScanLine (range->dst, y), width,
+                                  range->size, forward, backward);
+        }
+    }
+
+    free (forward);
+    free (backward);
+}
+
+// The vertical pass works on whole rows of the columns from start_col to
+// end_col so the image is read in memory order.
+template < typename T, typename Op > static void
+VanHerkColumnRange (void *data, int start_col, int end_col)
+{
+    VanHerkRange *range = (VanHerkRange *) data;
+    int height = FreeImage_GetHeight (range->src);
+    int dst_height = FreeImage_GetHeight (range->dst);
+    int width = end_col - start_col;
+    int size = range->size;
+
+    T *forward = (T *) malloc ((size_t) width * height * sizeof (T));
+    T *backward = (T *) malloc ((size_t) width * height * sizeof (T));
+
+    if (forward == NULL || backward == NULL)
+    {
+        free (forward);
+        free (backward);
+        range->error = 1;
+        return;
+    }
+
+    for(int start = 0; start < height; start += size)
+    {
+        int end = MIN (start + size, height);
+
+        memcpy (forward + start * width,
+                (T *) FreeImage_GetScanLine (range->src, start) + start_col, width * sizeof (T));
+
+        for(int y = start + 1; y < end; y++)
+        {
+            const T *src_ptr = (T *) FreeImage_GetScanLine (range->src, y) + start_col;
+            const T *previous = forward + (y - 1) * width;
+            T *current = forward + y * width;
+
+            for(register int x = 0; x < width; x++)
+                current[x] = Op::Apply (previous[x], src_ptr[x]);
+        }
+
+        memcpy (backward + (end - 1) * width,
+                (T *) FreeImage_GetScanLine (range->src, end - 1) + start_col, width * sizeof (T));
+
+        for(int y = end - 2; y >= start; y--)
+        {
+            const T *src_ptr = (T *) FreeImage_GetScanLine (range->src, y) + start_col;
+            const T *next = backward + (y + 1) * width;
+            T *current = backward + y * width;
+
+            for(register int x = 0; x < width; x++)
+                current[x] = Op::Apply (next[x], src_ptr[x]);
+        }
+    }
+
+    for(int y = 0; y < dst_height; y++)
+    {
+        const T *first = backward + y * width;
+        const T *last = forward + (y + size - 1) * width;
+        T *dst_ptr = (T *) FreeImage_GetScanLine (range->dst, y) + start_col;
+
+        for(register int x = 0; x < width; x++)
+            dst_ptr[x] = Op::Apply (first[x], last[x]);
+    }
+
+    free (forward);
+    free (backward);
+}
+
+// The maximum or minimum of src under a kernel that has every value set.
+// The result is smaller than src by the kernel radius on each side.
+template < typename T, typename Op > static FIBITMAP *
+RectangleMinMax (FIBITMAP * src, FilterKernel kernel)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+    const int dst_width = width - (2 * kernel.x_radius);
+    const int dst_height = height - (2 * kernel.y_radius);
+
+    FIBITMAP *rows = FIA_CloneImageType (src, dst_width, height);
+    FIBITMAP *dst = FIA_CloneImageType (src, dst_width, dst_height);
+
+    if (rows == NULL || dst == NULL)
+    {
+        if (rows != NULL)
+            FreeImage_Unload (rows);
+
+        if (dst != NULL)
+            FreeImage_Unload (dst);
+
+        return NULL;
+    }
+
+    VanHerkRange range;
+
+    range.src = src;
+    range.dst = rows;
+    range.size = kernel.x_radius * 2 + 1;
+    range.error = 0;
+
+    RunRowRangesInParallel (height, 16, VanHerkRowRange < T, Op >, &range);
+
+    range.src = rows;
+    range.dst = dst;
+    range.size = kernel.y_radius * 2 + 1;
+
+    if (!range.error)
+        RunRowRangesInParallel (dst_width, 64, VanHerkColumnRange < T, Op >, &range);
+
+    FreeImage_Unload (rows);
+
+    if (range.error)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    return dst;
+}
+
+// Dilation or erosion with a kernel that has every value set. The result
+// is the same as the per pixel code: a dilated pixel keeps its value if
+// it was set or becomes 255, an eroded pixel keeps its value or becomes 0.
+template < typename Op > static FIBITMAP *
+RectangleMorphology (FIABITMAP * src, FilterKernel kernel)
+{
+    FIBITMAP *dst = RectangleMinMax < unsigned char, Op > (src->fib, kernel);
+
+    if (dst == NULL)
+        return NULL;
+
+    const int dst_width = FreeImage_GetWidth (dst);
+    const int dst_height = FreeImage_GetHeight (dst);
+
+    // Put back the values of the pixels that keep their value.
+    for(register int y = 0; y < dst_height; y++)
+    {
+        const unsigned char *centre_ptr = FreeImage_GetScanLine (src->fib, y + kernel.y_radius)
+            + kernel.x_radius;
+        unsigned char *dst_ptr = FreeImage_GetScanLine (dst, y);
+
+        for(register int x = 0; x < dst_width; x++)
+        {
+            if (Op::Apply (0, 255) == 255)
+                dst_ptr[x] = centre_ptr[x] ? centre_ptr[x] : (dst_ptr[x] ? 255 : 0);
+            else
+                dst_ptr[x] = dst_ptr[x] ? centre_ptr[x] : 0;
+        }
+    }
+
+    return dst;
+}
+
+// Other shapes are split into horizontal runs of set values. Each run is
+// a running maximum or minimum along one source row so a pixel costs
+// about three comparisons per run rather than one per kernel value.
+
+typedef struct
+{
+    int x;
+    int length;
+
+} KernelRun;
+
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *dst;
+    int kernel_height;
+    const int *first_run;       // The runs of kernel row j are first_run[j] to first_run[j + 1]
+    const KernelRun *runs;
+    int error;
+
+} ShapedRange;
+
+template < typename T, typename Op > static void
+ShapedRowRange (void *data, int start_row, int end_row)
+{
+    ShapedRange *range = (ShapedRange *) data;
+    const int width = FreeImage_GetWidth (range->src);
+    const int dst_width = FreeImage_GetWidth (range->dst);
+
+    T *forward = (T *) malloc (width * sizeof (T));
+    T *backward = (T *) malloc (width * sizeof (T));
+    T *line = (T *) malloc (width * sizeof (T));
+
+    if (forward == NULL || backward == NULL || line == NULL)
+    {
+        range->error = 1;
+    }
+    else
+    {
+        for(int y = start_row; y < end_row; y++)
+        {
+            T *dst_ptr = (T *) FreeImage_GetScanLine (range->dst, y);
+
+            for(register int x = 0; x < dst_width; x++)
+                dst_ptr[x] = Op::Identity ();
+
+            for(int j = 0; j < range->kernel_height; j++)
+            {
+                const T *src_ptr = (T *) FreeImage_GetScanLine (range->src, y + j);
+
+                for(int r = range->first_run[j]; r < range->first_run[j + 1]; r++)
+                {
+                    const KernelRun & run = range->runs[r];
+
+                    VanHerkRow < T, Op > (src_ptr + run.x, line, dst_width + run.length - 1,
+                                          run.length, forward, backward);
+
+                    for(register int x = 0; x < dst_width; x++)
+                        dst_ptr[x] = Op::Apply (dst_ptr[x], line[x]);
+                }
+            }
+        }
+    }
+
+    free (forward);
+    free (backward);
+    free (line);
+}
+
+// The maximum or minimum of src under the set values of any kernel.
+template < typename T, typename Op > static FIBITMAP *
+ShapedMinMax (FIBITMAP * src, FilterKernel kernel)
+{
+    const int kernel_width = kernel.x_radius * 2 + 1;
+    const int kernel_height = kernel.y_radius * 2 + 1;
+    const int dst_width = FreeImage_GetWidth (src) - (2 * kernel.x_radius);
+    const int dst_height = FreeImage_GetHeight (src) - (2 * kernel.y_radius);
+
+    int *first_run = (int *) malloc ((kernel_height + 1) * sizeof (int));
+    KernelRun *runs = (KernelRun *) malloc (kernel_width * kernel_height * sizeof (KernelRun));
+    FIBITMAP *dst = FIA_CloneImageType (src, dst_width, dst_height);
+
+    ShapedRange range;
+
+    range.src = src;
+    range.dst = dst;
+    range.kernel_height = kernel_height;
+    range.first_run = first_run;
+    range.runs = runs;
+    range.error = (first_run == NULL || runs == NULL || dst == NULL);
+
+    if (!range.error)
+    {
+        int number_of_runs = 0;
+
+        for(int j = 0; j < kernel_height; j++)
+        {
+            const double *values = kernel.values + j * kernel_width;
+
+            first_run[j] = number_of_runs;
+
+            for(int i = 0; i < kernel_width; i++)
+            {
+                if (values[i] <= 0.0)
+                    continue;
+
+                if (i > 0 && values[i - 1] > 0.0)
+                {
+                    runs[number_of_runs - 1].length++;
+                }
+                else
+                {
+                    runs[number_of_runs].x = i;
+                    runs[number_of_runs].length = 1;
+                    number_of_runs++;
+                }
+            }
+        }
+
+        first_run[kernel_height] = number_of_runs;
+
+        RunRowRangesInParallel (dst_height, 16, ShapedRowRange < T, Op >, &range);
+    }
+
+    free (first_run);
+    free (runs);
+
+    if (range.error && dst != NULL)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    return dst;
+}
+
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryDilation (FIABITMAP * src, FilterKernel kernel)
 {
+    if (IsRectangleKernel (src, kernel))
+        return RectangleMorphology < MorphologyMax < unsigned char > > (src, kernel);
+
     const int dst_width = FreeImage_GetWidth (src->fib) - (2 * kernel.x_radius);
     const int dst_height = FreeImage_GetHeight (src->fib) - (2 * kernel.y_radius);
 
@@ -377,7 +790,7 @@ FIA_BinaryDilation (FIABITMAP * src, FilterKernel kernel)
 
     unsigned char *dst_first_pixel_address_ptr = (unsigned char *) FreeImage_GetBits (dst);
 
-    int kernel_size = (kernel.x_radius * 2 + kernel.y_radius * 2) + 1;
+    int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
     unsigned char *vals = new unsigned char[kernel_size];
 
     for(int i = 0; i < kernel_size; i++)
@@ -405,6 +818,7 @@ FIA_BinaryDilation (FIABITMAP * src, FilterKernel kernel)
     }
 
     delete kern;
+    delete[] vals;
 
     return dst;
 };
@@ -463,13 +877,13 @@ ErodeKernelRow (KernelIterator < unsigned char >&iterator, unsigned char *dst_pt
             return;
         }
 
-        if (kernel_ptr[6] > 0 && row_ptr[6] > 0)
+        if (kernel_ptr[6] > 0 && row_ptr[6] == 0)
         {
             *center_value = 0;
             return;
         }
 
-        if (kernel_ptr[7] > 0 && row_ptr[7] > 0)
+        if (kernel_ptr[7] > 0 && row_ptr[7] == 0)
         {
             *center_value = 0;
             return;
@@ -741,6 +1155,9 @@ BinaryErodeKernel (Kernel < unsigned char >*kernel, unsigned char *dst_ptr)
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryErosion (FIABITMAP * src, FilterKernel kernel)
 {
+    if (IsRectangleKernel (src, kernel))
+        return RectangleMorphology < MorphologyMin < unsigned char > > (src, kernel);
+
     const int dst_width = FreeImage_GetWidth (src->fib) - (2 * kernel.x_radius);
     const int dst_height = FreeImage_GetHeight (src->fib) - (2 * kernel.y_radius);
 
@@ -752,7 +1169,7 @@ FIA_BinaryErosion (FIABITMAP * src, FilterKernel kernel)
 
     unsigned char *dst_first_pixel_address_ptr = (unsigned char *) FreeImage_GetBits (dst);
 
-    int kernel_size = (kernel.x_radius * 2 + kernel.y_radius * 2) + 1;
+    int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
     unsigned char *vals = new unsigned char[kernel_size];
 
     for(int i = 0; i < kernel_size; i++)
@@ -780,6 +1197,7 @@ FIA_BinaryErosion (FIABITMAP * src, FilterKernel kernel)
     }
 
     delete kern;
+    delete[] vals;
 
     return dst;
 };
@@ -824,94 +1242,852 @@ FIA_BinaryClosing (FIABITMAP * src, FilterKernel kernel)
     return tmp;
 };
 
+// The 3x3 functions work on packed masks. As with FIA_BinaryDilation
+// and FIA_BinaryErosion set pixels keep their value and pixels that
+// become set are 255. Pixels outside the image count as unset.
+
+static BinaryMask *
+PackBinaryImage (FIBITMAP * src)
+{
+    BinaryMask *mask = BinaryMaskFromImage (src);
+
+    if (mask == NULL)
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Image must be an 8bit FIT_BITMAP");
+
+    return mask;
+}
+
+// Returns a new mask or NULL on error or if src is NULL.
+static BinaryMask *
+Apply3x3 (const BinaryMask * src, int (*operation) (BinaryMask *, const BinaryMask *))
+{
+    if (src == NULL)
+        return NULL;
+
+    BinaryMask *dst = NewBinaryMask (src->width, src->height);
+
+    if (dst != NULL && operation (dst, src) == FIA_ERROR)
+    {
+        FreeBinaryMask (dst);
+        return NULL;
+    }
+
+    return dst;
+}
+
+// Frees the result mask.
+static FIBITMAP *
+UnpackBinaryImage (BinaryMask * result, FIBITMAP * src)
+{
+    if (result == NULL)
+        return NULL;
+
+    FIBITMAP *dst = BinaryMaskToImage (result, src, 1, 255);
+
+    FreeBinaryMask (result);
+
+    return dst;
+}
+
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Dilation (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryDilation(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+    BinaryMask *mask = PackBinaryImage (src);
+    BinaryMask *dilated = Apply3x3 (mask, BinaryMask3x3Dilate);
 
-	return dst;
+    FreeBinaryMask (mask);
+
+    return UnpackBinaryImage (dilated, src);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Erosion (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryErosion(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+    BinaryMask *mask = PackBinaryImage (src);
+    BinaryMask *eroded = Apply3x3 (mask, BinaryMask3x3Erode);
 
-	return dst;
+    FreeBinaryMask (mask);
+
+    return UnpackBinaryImage (eroded, src);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Opening (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryOpening(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+    BinaryMask *mask = PackBinaryImage (src);
+    BinaryMask *eroded = Apply3x3 (mask, BinaryMask3x3Erode);
+    BinaryMask *opened = Apply3x3 (eroded, BinaryMask3x3Dilate);
 
-	return dst;
+    FreeBinaryMask (mask);
+    FreeBinaryMask (eroded);
+
+    return UnpackBinaryImage (opened, src);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Closing (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryClosing(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+    BinaryMask *mask = PackBinaryImage (src);
+    BinaryMask *dilated = Apply3x3 (mask, BinaryMask3x3Dilate);
+    BinaryMask *closed = Apply3x3 (dilated, BinaryMask3x3Erode);
 
-	return dst;
-}
+    FreeBinaryMask (mask);
+    FreeBinaryMask (dilated);
+
+    return UnpackBinaryImage (closed, src);
+}
 
+// The set pixels of src that are not set in its erosion.
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryInnerBorder (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryErosion(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
-
-	FIBITMAP *dst2 = FreeImage_Clone(src);
-
-//	FIA_InPlaceConvertToInt32Type (&dst2, 0);
-//	FIA_SubtractGreyLevelImages(dst2, dst);
-//	FIA_InPlaceConvertToStandardType(&dst2, 0);
-	FIA_Subtract(dst2, dst);
-	FreeImage_Unload(dst);
-
-	return dst2;
-}
+    BinaryMask *mask = PackBinaryImage (src);
+    BinaryMask *border = Apply3x3 (mask, BinaryMask3x3Erode);
+
+    if (border != NULL)
+        BinaryMaskAndNot (border, mask, border);
+
+    FreeBinaryMask (mask);
+
+    return UnpackBinaryImage (border, src);
+}
 
+// The set pixels of the dilation of src that are not set in src.
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryOuterBorder (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryDilation(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
-
-//	FIA_InPlaceConvertToInt32Type (&dst, 0);
-//	FIA_SubtractGreyLevelImages(dst, src);
-//	FIA_InPlaceConvertToStandardType(&dst, 0);
-	FIA_Subtract(dst, src);
-
-	return dst;
+    BinaryMask *mask = PackBinaryImage (src);
+    BinaryMask *border = Apply3x3 (mask, BinaryMask3x3Dilate);
+
+    if (border != NULL)
+        BinaryMaskAndNot (border, border, mask);
+
+    FreeBinaryMask (mask);
+
+    return UnpackBinaryImage (border, src);
+}
+
+// Greyscale morphology treats the kernel values above zero as a flat
+// structuring element. Kernels with every value set use the separable
+// running maximum or minimum, other shapes are split into runs.
+
+template < typename T, typename Op > static FIBITMAP *
+GreyscaleMinMax (FIBITMAP * src, FilterKernel kernel)
+{
+    if (IsFullKernel (kernel))
+        return RectangleMinMax < T, Op > (src, kernel);
+
+    return ShapedMinMax < T, Op > (src, kernel);
+}
+
+template < typename T > static FIBITMAP *
+GreyscaleMorphology (FIBITMAP * src, FilterKernel kernel, int dilate)
+{
+    if (dilate)
+        return GreyscaleMinMax < T, MorphologyMax < T > > (src, kernel);
+
+    return GreyscaleMinMax < T, MorphologyMin < T > > (src, kernel);
+}
+
+static FIBITMAP *
+GreyscaleMorphology (FIABITMAP * src, FilterKernel kernel, int dilate)
+{
+    if (src == NULL || src->fib == NULL)
+        return NULL;
+
+    if ((int) FreeImage_GetWidth (src->fib) <= 2 * kernel.x_radius
+        || (int) FreeImage_GetHeight (src->fib) <= 2 * kernel.y_radius)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Image is smaller than the kernel");
+        return NULL;
+    }
+
+    int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
+    int set_values = 0;
+
+    for(int i = 0; i < kernel_size; i++)
+    {
+        if (kernel.values[i] > 0.0)
+            set_values++;
+    }
+
+    if (set_values == 0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Kernel has no values above zero");
+        return NULL;
+    }
+
+    switch (FreeImage_GetImageType (src->fib))
+    {
+        case FIT_BITMAP:
+        {
+            if (FreeImage_GetBPP (src->fib) == 8)
+                return GreyscaleMorphology < unsigned char > (src->fib, kernel, dilate);
+
+            break;
+        }
+        case FIT_UINT16:
+        {
+            return GreyscaleMorphology < unsigned short > (src->fib, kernel, dilate);
+        }
+        case FIT_INT16:
+        {
+            return GreyscaleMorphology < short > (src->fib, kernel, dilate);
+        }
+        case FIT_UINT32:
+        {
+            return GreyscaleMorphology < unsigned long > (src->fib, kernel, dilate);
+        }
+        case FIT_INT32:
+        {
+            return GreyscaleMorphology < long > (src->fib, kernel, dilate);
+        }
+        case FIT_FLOAT:
+        {
+            return GreyscaleMorphology < float > (src->fib, kernel, dilate);
+        }
+        case FIT_DOUBLE:
+        {
+            return GreyscaleMorphology < double > (src->fib, kernel, dilate);
+        }
+        default:
+        {
+            break;
+        }
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "Greyscale morphology needs an 8bit or greyscale image");
+
+    return NULL;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleDilation (FIABITMAP * src, FilterKernel kernel)
+{
+    return GreyscaleMorphology (src, kernel, 1);
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleErosion (FIABITMAP * src, FilterKernel kernel)
+{
+    return GreyscaleMorphology (src, kernel, 0);
 }
 
+// The second operation sees the edge pixels of the first copied into its border.
+static FIBITMAP *
+GreyscaleMorphologyPair (FIABITMAP * src, FilterKernel kernel, int dilate_first)
+{
+    FIBITMAP *tmp = GreyscaleMorphology (src, kernel, dilate_first);
+
+    if (tmp == NULL)
+        return NULL;
+
+    FIABITMAP *border_dib = FIA_SetBorder (tmp, kernel.x_radius, kernel.y_radius,
+                                           BorderType_Copy, 0.0);
+
+    FreeImage_Unload (tmp);
+
+    if (border_dib == NULL)
+        return NULL;
+
+    tmp = GreyscaleMorphology (border_dib, kernel, !dilate_first);
+
+    FIA_Unload (border_dib);
+
+    return tmp;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleOpening (FIABITMAP * src, FilterKernel kernel)
+{
+    return GreyscaleMorphologyPair (src, kernel, 0);
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleClosing (FIABITMAP * src, FilterKernel kernel)
+{
+    return GreyscaleMorphologyPair (src, kernel, 1);
+}
+
+// Replaces dst with src - dst for a white top-hat or dst - src for a black
+// top-hat. src is read from x_offset, y_offset. Differences below zero are 0.
+template < typename T > static void
+TopHatDifference (FIBITMAP * src, FIBITMAP * dst, int x_offset, int y_offset, int white)
+{
+    const int width = FreeImage_GetWidth (dst);
+    const int height = FreeImage_GetHeight (dst);
+
+    for(register int y = 0; y < height; y++)
+    {
+        const T *src_ptr = (T *) FreeImage_GetScanLine (src, y + y_offset) + x_offset;
+        T *dst_ptr = (T *) FreeImage_GetScanLine (dst, y);
+
+        for(register int x = 0; x < width; x++)
+        {
+            T a = white ? src_ptr[x] : dst_ptr[x];
+            T b = white ? dst_ptr[x] : src_ptr[x];
+
+            dst_ptr[x] = (a > b) ? (T) (a - b) : (T) 0;
+        }
+    }
+}
+
+static FIBITMAP *
+GreyscaleTopHat (FIABITMAP * src, FilterKernel kernel, int white)
+{
+    FIBITMAP *dst = GreyscaleMorphologyPair (src, kernel, !white);
+
+    if (dst == NULL)
+        return NULL;
+
+    int x = kernel.x_radius;
+    int y = kernel.y_radius;
+
+    switch (FreeImage_GetImageType (dst))
+    {
+        case FIT_BITMAP:
+            TopHatDifference < unsigned char > (src->fib, dst, x, y, white);
+            break;
+        case FIT_UINT16:
+            TopHatDifference < unsigned short > (src->fib, dst, x, y, white);
+            break;
+        case FIT_INT16:
+            TopHatDifference < short > (src->fib, dst, x, y, white);
+            break;
+        case FIT_UINT32:
+            TopHatDifference < unsigned long > (src->fib, dst, x, y, white);
+            break;
+        case FIT_INT32:
+            TopHatDifference < long > (src->fib, dst, x, y, white);
+            break;
+        case FIT_FLOAT:
+            TopHatDifference < float > (src->fib, dst, x, y, white);
+            break;
+        case FIT_DOUBLE:
+            TopHatDifference < double > (src->fib, dst, x, y, white);
+            break;
+        default:
+            break;
+    }
+
+    return dst;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleWhiteTopHat (FIABITMAP * src, FilterKernel kernel)
+{
+    return GreyscaleTopHat (src, kernel, 1);
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleBlackTopHat (FIABITMAP * src, FilterKernel kernel)
+{
+    return GreyscaleTopHat (src, kernel, 0);
+}
+
+// Greyscale reconstruction by dilation uses the hybrid algorithm of
+// L. Vincent, "Morphological Grayscale Reconstruction in Image Analysis",
+// IEEE Transactions on Image Processing, 1993. A raster and an anti-raster
+// pass do most of the work, then a FIFO of pixel offsets finishes the
+// pixels the two passes could not reach. Each pixel is queued a bounded
+// number of times so the time is linear in the size of the image.
+
+// A FIFO of pixel offsets that grows when it is full.
+typedef struct
+{
+    size_t *data;
+    size_t capacity;
+    size_t head;
+    size_t count;
+
+} PixelQueue;
+
+static int
+PixelQueuePush (PixelQueue * queue, size_t offset)
+{
+    if (queue->count == queue->capacity)
+    {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 4096;
+        size_t *data = (size_t *) realloc (queue->data, capacity * sizeof (size_t));
+
+        if (data == NULL)
+            return 0;
+
+        // Move the wrapped part at the start to the end of the old block.
+        if (queue->head > 0)
+            memcpy (data + queue->capacity, data, queue->head * sizeof (size_t));
+
+        queue->data = data;
+        queue->capacity = capacity;
+    }
+
+    size_t tail = queue->head + queue->count;
+
+    if (tail >= queue->capacity)
+        tail -= queue->capacity;
+
+    queue->data[tail] = offset;
+    queue->count++;
+
+    return 1;
+}
+
+static inline size_t
+PixelQueuePop (PixelQueue * queue)
+{
+    size_t offset = queue->data[queue->head];
+
+    if (++queue->head == queue->capacity)
+        queue->head = 0;
+
+    queue->count--;
+
+    return offset;
+}
+
+// Neighbour offsets, the 4 connected ones first.
+static const int neighbour_dx[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+static const int neighbour_dy[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+
+// Number of entries of neighbour_dx and neighbour_dy to use.
+static inline int
+NumberOfNeighbours (int connectivity)
+{
+    return (connectivity == FIA_CONNECTIVITY_8) ? 8 : 4;
+}
+
+// Replaces dst, which must be no greater than mask, by its reconstruction
+// under mask. dst and mask have the same type and size so share a pitch.
+template < typename T > static int
+Reconstruct (FIBITMAP * dst, FIBITMAP * mask, int connectivity)
+{
+    typedef MorphologyMax < T > Max;
+    typedef MorphologyMin < T > Min;
+
+    const int width = FreeImage_GetWidth (dst);
+    const int height = FreeImage_GetHeight (dst);
+    const int pitch = FIA_GetPitchInPixels (dst);
+    const int eight = (connectivity == FIA_CONNECTIVITY_8);
+    const int neighbours = NumberOfNeighbours (connectivity);
+
+    if (CheckConnectivity (connectivity) == FIA_ERROR)
+        return FIA_ERROR;
+
+    T *J = (T *) FreeImage_GetBits (dst);
+    const T *I = (T *) FreeImage_GetBits (mask);
+
+    // Raster pass, each pixel takes the maximum of itself and the
+    // neighbours before it, limited by the mask.
+    for(register int y = 0; y < height; y++)
+    {
+        T *row = J + (size_t) y * pitch;
+        const T *mask_row = I + (size_t) y * pitch;
+        const T *previous = row - pitch;
+
+        for(register int x = 0; x < width; x++)
+        {
+            T value = row[x];
+
+            if (x > 0)
+                value = Max::Apply (value, row[x - 1]);
+
+            if (y > 0)
+            {
+                value = Max::Apply (value, previous[x]);
+
+                if (eight)
+                {
+                    if (x > 0)
+                        value = Max::Apply (value, previous[x - 1]);
+
+                    if (x < width - 1)
+                        value = Max::Apply (value, previous[x + 1]);
+                }
+            }
+
+            row[x] = Min::Apply (value, mask_row[x]);
+        }
+    }
+
+    PixelQueue queue;
+
+    memset (&queue, 0, sizeof (PixelQueue));
+
+    // Anti-raster pass with the neighbours after each pixel. A pixel that
+    // could still raise one of those neighbours is queued.
+    for(register int y = height - 1; y >= 0; y--)
+    {
+        T *row = J + (size_t) y * pitch;
+        const T *mask_row = I + (size_t) y * pitch;
+        T *next = row + pitch;
+        const T *mask_next = mask_row + pitch;
+
+        for(register int x = width - 1; x >= 0; x--)
+        {
+            T value = row[x];
+
+            if (x < width - 1)
+                value = Max::Apply (value, row[x + 1]);
+
+            if (y < height - 1)
+            {
+                value = Max::Apply (value, next[x]);
+
+                if (eight)
+                {
+                    if (x > 0)
+                        value = Max::Apply (value, next[x - 1]);
+
+                    if (x < width - 1)
+                        value = Max::Apply (value, next[x + 1]);
+                }
+            }
+
+            value = Min::Apply (value, mask_row[x]);
+            row[x] = value;
+
+            int raises = (x < width - 1 && row[x + 1] < value && row[x + 1] < mask_row[x + 1]);
+
+            if (!raises && y < height - 1)
+            {
+                raises = (next[x] < value && next[x] < mask_next[x]);
+
+                if (!raises && eight)
+                {
+                    raises = (x > 0 && next[x - 1] < value && next[x - 1] < mask_next[x - 1])
+                        || (x < width - 1 && next[x + 1] < value && next[x + 1] < mask_next[x + 1]);
+                }
+            }
+
+            if (raises && !PixelQueuePush (&queue, (size_t) y * pitch + x))
+            {
+                free (queue.data);
+                return FIA_ERROR;
+            }
+        }
+    }
+
+    // Propagate from the queued pixels until nothing changes.
+    while (queue.count > 0)
+    {
+        size_t offset = PixelQueuePop (&queue);
+        int y = (int) (offset / pitch);
+        int x = (int) (offset - (size_t) y * pitch);
+        T value = J[offset];
+
+        for(int n = 0; n < neighbours; n++)
+        {
+            int nx = x + neighbour_dx[n];
+            int ny = y + neighbour_dy[n];
+
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+                continue;
+
+            size_t neighbour = (size_t) ny * pitch + nx;
+
+            if (J[neighbour] < value && J[neighbour] != I[neighbour])
+            {
+                J[neighbour] = Min::Apply (value, I[neighbour]);
+
+                if (!PixelQueuePush (&queue, neighbour))
+                {
+                    free (queue.data);
+                    return FIA_ERROR;
+                }
+            }
+        }
+    }
+
+    free (queue.data);
+
+    return FIA_SUCCESS;
+}
+
+template < typename T > static FIBITMAP *
+GreyscaleReconstruction (FIBITMAP * marker, FIBITMAP * mask, int connectivity)
+{
+    FIBITMAP *dst = FreeImage_Clone (marker);
+
+    if (dst == NULL)
+        return NULL;
+
+    const int width = FreeImage_GetWidth (dst);
+    const int height = FreeImage_GetHeight (dst);
+
+    for(register int y = 0; y < height; y++)
+    {
+        T *dst_ptr = (T *) FreeImage_GetScanLine (dst, y);
+        const T *mask_ptr = (T *) FreeImage_GetScanLine (mask, y);
+
+        for(register int x = 0; x < width; x++)
+            dst_ptr[x] = MorphologyMin < T >::Apply (dst_ptr[x], mask_ptr[x]);
+    }
+
+    if (Reconstruct < T > (dst, mask, connectivity) == FIA_ERROR)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    return dst;
+}
+
+// src lowered by h, values that would go below the lowest value of the
+// type stop there.
+template < typename T > static FIBITMAP *
+HMaxima (FIBITMAP * src, double h, int connectivity)
+{
+    FIBITMAP *dst = FreeImage_Clone (src);
+
+    if (dst == NULL)
+        return NULL;
+
+    if (std::numeric_limits < T >::is_integer)
+        h = floor (h + 0.5);
+
+    const int width = FreeImage_GetWidth (dst);
+    const int height = FreeImage_GetHeight (dst);
+    const double lowest = (double) MorphologyMax < T >::Identity ();
+
+    for(register int y = 0; y < height; y++)
+    {
+        T *dst_ptr = (T *) FreeImage_GetScanLine (dst, y);
+
+        for(register int x = 0; x < width; x++)
+        {
+            double value = (double) dst_ptr[x] - h;
+
+            dst_ptr[x] = (value > lowest) ? (T) value : (T) lowest;
+        }
+    }
+
+    if (Reconstruct < T > (dst, src, connectivity) == FIA_ERROR)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    return dst;
+}
+
+// A pixel is outside every regional maximum when its plateau touches a
+// higher pixel. Those pixels seed a marker at their own value and the
+// reconstruction carries the value across the plateau. Pixels of a
+// regional maximum can only be reached through lower pixels so they end
+// up below their value.
+template < typename T > static FIBITMAP *
+RegionalMaxima (FIBITMAP * src, int connectivity)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+    const T lowest = MorphologyMax < T >::Identity ();
+    const int neighbours = NumberOfNeighbours (connectivity);
+
+    FIBITMAP *marker = FreeImage_Clone (src);
+    FIBITMAP *dst = FreeImage_Allocate (width, height, 8, 0, 0, 0);
+
+    if (marker == NULL || dst == NULL)
+    {
+        if (marker != NULL)
+            FreeImage_Unload (marker);
+
+        if (dst != NULL)
+            FreeImage_Unload (dst);
+
+        return NULL;
+    }
+
+    FIA_SetGreyLevelPalette (dst);
+
+    for(register int y = 0; y < height; y++)
+    {
+        const T *src_ptr = (T *) FreeImage_GetScanLine (src, y);
+        T *marker_ptr = (T *) FreeImage_GetScanLine (marker, y);
+
+        for(register int x = 0; x < width; x++)
+        {
+            int higher = 0;
+
+            for(int n = 0; n < neighbours && !higher; n++)
+            {
+                int nx = x + neighbour_dx[n];
+                int ny = y + neighbour_dy[n];
+
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+                    continue;
+
+                higher = ((T *) FreeImage_GetScanLine (src, ny))[nx] > src_ptr[x];
+            }
+
+            if (!higher)
+                marker_ptr[x] = lowest;
+        }
+    }
+
+    if (Reconstruct < T > (marker, src, connectivity) == FIA_ERROR)
+    {
+        FreeImage_Unload (marker);
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    for(register int y = 0; y < height; y++)
+    {
+        const T *src_ptr = (T *) FreeImage_GetScanLine (src, y);
+        const T *marker_ptr = (T *) FreeImage_GetScanLine (marker, y);
+        BYTE *dst_ptr = FreeImage_GetScanLine (dst, y);
+
+        for(register int x = 0; x < width; x++)
+            dst_ptr[x] = (marker_ptr[x] < src_ptr[x]) ? 255 : 0;
+    }
+
+    FreeImage_Unload (marker);
+
+    return dst;
+}
+
+static int
+IsReconstructionType (FIBITMAP * src)
+{
+    switch (FreeImage_GetImageType (src))
+    {
+        case FIT_BITMAP:
+            return FreeImage_GetBPP (src) == 8;
+        case FIT_UINT16:
+        case FIT_INT16:
+        case FIT_UINT32:
+        case FIT_INT32:
+        case FIT_FLOAT:
+        case FIT_DOUBLE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleReconstruction (FIBITMAP * marker, FIBITMAP * mask, FIA_CONNECTIVITY connectivity)
+{
+    if (marker == NULL || mask == NULL)
+        return NULL;
+
+    if (!IsReconstructionType (mask))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Reconstruction needs an 8bit or greyscale image");
+        return NULL;
+    }
+
+    if (FreeImage_GetImageType (marker) != FreeImage_GetImageType (mask)
+        || FreeImage_GetBPP (marker) != FreeImage_GetBPP (mask)
+        || FreeImage_GetWidth (marker) != FreeImage_GetWidth (mask)
+        || FreeImage_GetHeight (marker) != FreeImage_GetHeight (mask))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Marker and mask must be the same type and size");
+        return NULL;
+    }
+
+    if (CheckConnectivity (connectivity) == FIA_ERROR)
+        return NULL;
+
+    switch (FreeImage_GetImageType (mask))
+    {
+        case FIT_BITMAP:
+            return GreyscaleReconstruction < unsigned char > (marker, mask, connectivity);
+        case FIT_UINT16:
+            return GreyscaleReconstruction < unsigned short > (marker, mask, connectivity);
+        case FIT_INT16:
+            return GreyscaleReconstruction < short > (marker, mask, connectivity);
+        case FIT_UINT32:
+            return GreyscaleReconstruction < unsigned long > (marker, mask, connectivity);
+        case FIT_INT32:
+            return GreyscaleReconstruction < long > (marker, mask, connectivity);
+        case FIT_FLOAT:
+            return GreyscaleReconstruction < float > (marker, mask, connectivity);
+        case FIT_DOUBLE:
+            return GreyscaleReconstruction < double > (marker, mask, connectivity);
+        default:
+            return NULL;
+    }
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_HMaxima (FIBITMAP * src, double h, FIA_CONNECTIVITY connectivity)
+{
+    if (src == NULL)
+        return NULL;
+
+    if (!IsReconstructionType (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "HMaxima needs an 8bit or greyscale image");
+        return NULL;
+    }
+
+    if (h < 0.0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "HMaxima needs a height of zero or more");
+        return NULL;
+    }
+
+    if (CheckConnectivity (connectivity) == FIA_ERROR)
+        return NULL;
+
+    switch (FreeImage_GetImageType (src))
+    {
+        case FIT_BITMAP:
+            return HMaxima < unsigned char > (src, h, connectivity);
+        case FIT_UINT16:
+            return HMaxima < unsigned short > (src, h, connectivity);
+        case FIT_INT16:
+            return HMaxima < short > (src, h, connectivity);
+        case FIT_UINT32:
+            return HMaxima < unsigned long > (src, h, connectivity);
+        case FIT_INT32:
+            return HMaxima < long > (src, h, connectivity);
+        case FIT_FLOAT:
+            return HMaxima < float > (src, h, connectivity);
+        case FIT_DOUBLE:
+            return HMaxima < double > (src, h, connectivity);
+        default:
+            return NULL;
+    }
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_RegionalMaxima (FIBITMAP * src, FIA_CONNECTIVITY connectivity)
+{
+    if (src == NULL)
+        return NULL;
+
+    if (!IsReconstructionType (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "RegionalMaxima needs an 8bit or greyscale image");
+        return NULL;
+    }
+
+    if (CheckConnectivity (connectivity) == FIA_ERROR)
+        return NULL;
+
+    switch (FreeImage_GetImageType (src))
+    {
+        case FIT_BITMAP:
+            return RegionalMaxima < unsigned char > (src, connectivity);
+        case FIT_UINT16:
+            return RegionalMaxima < unsigned short > (src, connectivity);
+        case FIT_INT16:
+            return RegionalMaxima < short > (src, connectivity);
+        case FIT_UINT32:
+            return RegionalMaxima < unsigned long > (src, connectivity);
+        case FIT_INT32:
+            return RegionalMaxima < long > (src, connectivity);
+        case FIT_FLOAT:
+            return RegionalMaxima < float > (src, connectivity);
+        case FIT_DOUBLE:
+            return RegionalMaxima < double > (src, connectivity);
+        default:
+            return NULL;
+    }
+}
@@ -24,6 +24,32 @@
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Utilities.h"
 
+#include <float.h>
+#include <math.h>
+
+static const double PI = 3.14159265358979323846;
+
+// The extra measurements of a blob, kept only when they are asked for.
+// Coordinates are those of memory so y increases up the displayed image.
+struct BlobMeasure
+{
+    double intensity_sum;
+    double intensity_min;
+    double intensity_max;
+    long long perimeter;
+
+    double sum_x;
+    double sum_y;
+    double sum_xx;
+    double sum_yy;
+    double sum_xy;
+
+    // The corners of the runs, reduced to their convex hull from time to time
+    FIAPOINT *points;
+    int number_of_points;
+    int points_capacity;
+};
+
 struct Blob
 {
     int left;
@@ -31,11 +57,16 @@ struct Blob
     int right;
     int top;
     int area;
-    int sum_x;
-    int sum_y;
+    long long sum_x;
+    long long sum_y;
+    int first_x;                // x of the first pixel of the bottom row
 
+    int index;                  // Position in the pool
+    int number;                 // Particle number once labelling is finished
     int rank;
     Blob *parent;
+
+    BlobMeasure *measure;       // NULL unless measuring
 };
 
 struct Run
@@ -43,35 +74,36 @@ struct Run
     int x;
     int y;
     int end_x;
-    int sum_x;
+    long long sum_x;
 
     Blob *blob;
 };
 
+// Blobs are allocated in chunks as they are needed so they never move.
+#define BLOB_CHUNK_SIZE 4096
+
 typedef struct
 {
-    Blob *blobpool_start_ptr;   // Start of memory allocated for blobpool
-    Blob *blobpool_ptr;         // The current pointer into the blobpool
+    Blob **chunks;              // Memory allocated for blobpool
+    BlobMeasure **measure_chunks;   // The measures of the blobs if measuring
+    int number_of_chunks;
+    int chunk_capacity;
     int blobpool_blobcount;     // Number of blobs in the pool including merged ones.
     // We don't want to delete merged blobs until the end for performance.
     int real_blobcount;         // This is the real blob count that takes account of merging.
+    int measure;
+    int error;                  // Set if memory for the measurements ran out
 
 } BLOBPOOL;
 
 static BLOBPOOL *
-UnionFindInit (int size)
+UnionFindInit (int measure)
 {
-    BLOBPOOL *pool = (BLOBPOOL *) malloc (sizeof (BLOBPOOL));
+    BLOBPOOL *pool = (BLOBPOOL *) calloc (1, sizeof (BLOBPOOL));
 
     if (CheckMemory(pool) < 0) return NULL;
 
-    pool->blobpool_start_ptr = (Blob *) malloc (size * sizeof (Blob));
-
-    if (CheckMemory(pool->blobpool_start_ptr) < 0) return NULL;
-
-    pool->blobpool_ptr = pool->blobpool_start_ptr;
-    pool->blobpool_blobcount = 0;
-    pool->real_blobcount = 0;
+    pool->measure = measure;
 
     return pool;
 }
@@ -79,38 +111,280 @@ UnionFindInit (int size)
 static void
 UnionFindFree (BLOBPOOL * pool)
 {
-    free (pool->blobpool_start_ptr);
-    pool->blobpool_start_ptr = NULL;
-    pool->blobpool_ptr = NULL;
+    if (pool == NULL)
+        return;
+
+    for(int i = 0; i < pool->number_of_chunks; i++)
+        free (pool->chunks[i]);
+
+    if (pool->measure_chunks != NULL)
+    {
+        for(int i = 0; i < pool->blobpool_blobcount; i++)
+        {
+            free (pool->measure_chunks[i / BLOB_CHUNK_SIZE][i % BLOB_CHUNK_SIZE].points);
+        }
+
+        for(int i = 0; i < pool->number_of_chunks; i++)
+            free (pool->measure_chunks[i]);
+    }
+
+    free (pool->chunks);
+    free (pool->measure_chunks);
     free (pool);
 }
 
-// New blob references itself as parent.
+static inline Blob *
+PoolBlob (BLOBPOOL * pool, int index)
+{
+    return &pool->chunks[index / BLOB_CHUNK_SIZE][index % BLOB_CHUNK_SIZE];
+}
+
+// New blob references itself as parent. Returns NULL if out of memory.
 static inline Blob *
 NewBlob (BLOBPOOL * pool, unsigned int top_row, Run * run)
 {
-    Blob *b = pool->blobpool_ptr;
+    if (pool->blobpool_blobcount == pool->number_of_chunks * BLOB_CHUNK_SIZE)
+    {
+        if (pool->number_of_chunks == pool->chunk_capacity)
+        {
+            int capacity = MAX (16, pool->chunk_capacity * 2);
+            Blob **chunks = (Blob **) realloc (pool->chunks, capacity * sizeof (Blob *));
+
+            if (CheckMemory(chunks) < 0) return NULL;
+
+            pool->chunks = chunks;
+
+            if (pool->measure)
+            {
+                BlobMeasure **measure_chunks = (BlobMeasure **) realloc (pool->measure_chunks,
+                    capacity * sizeof (BlobMeasure *));
+
+                if (CheckMemory(measure_chunks) < 0) return NULL;
+
+                pool->measure_chunks = measure_chunks;
+            }
+
+            pool->chunk_capacity = capacity;
+        }
+
+        Blob *chunk = (Blob *) malloc (BLOB_CHUNK_SIZE * sizeof (Blob));
+
+        if (CheckMemory(chunk) < 0) return NULL;
+
+        if (pool->measure)
+        {
+            BlobMeasure *measure_chunk = (BlobMeasure *) malloc (BLOB_CHUNK_SIZE * sizeof (BlobMeasure));
+
+            if (CheckMemory(measure_chunk) < 0)
+            {
+                free (chunk);
+                return NULL;
+            }
+
+            pool->measure_chunks[pool->number_of_chunks] = measure_chunk;
+        }
+
+        pool->chunks[pool->number_of_chunks++] = chunk;
+    }
+
+    Blob *b = PoolBlob (pool, pool->blobpool_blobcount);
+
+    b->measure = NULL;
+
+    if (pool->measure)
+    {
+        int i = pool->blobpool_blobcount;
+
+        b->measure = &pool->measure_chunks[i / BLOB_CHUNK_SIZE][i % BLOB_CHUNK_SIZE];
+        memset (b->measure, 0, sizeof (BlobMeasure));
+        b->measure->intensity_min = DBL_MAX;
+        b->measure->intensity_max = -DBL_MAX;
+    }
 
     b->parent = b;
     b->rank = 0;
+    b->index = pool->blobpool_blobcount;
     b->left = run->x;
+    b->first_x = run->x;
     b->bottom = run->y;
     b->right = run->end_x;
     b->top = b->bottom;
 
     b->area = run->end_x - run->x + 1;
     b->sum_x = run->sum_x;
-    b->sum_y = (top_row - run->y) * b->area;    // Current row times number in run
+    b->sum_y = (long long) (top_row - run->y) * b->area;    // Current row times number in run
 
     run->blob = b;
 
-    pool->blobpool_ptr++;
     pool->blobpool_blobcount++;
     pool->real_blobcount++;
 
     return b;
 }
 
+static int
+ComparePoints (const void *element1, const void *element2)
+{
+    const FIAPOINT *point1 = (const FIAPOINT *) element1;
+    const FIAPOINT *point2 = (const FIAPOINT *) element2;
+
+    if (point1->x != point2->x)
+        return (point1->x < point2->x) ? -1 : 1;
+
+    return (point1->y < point2->y) ? -1 : (point1->y > point2->y);
+}
+
+// Replaces the points of the measure with the vertices of their convex hull.
+static int
+ReduceToConvexHull (BlobMeasure * measure)
+{
+    int n = measure->number_of_points;
+
+    if (n < 3)
+        return FIA_SUCCESS;
+
+    FIAPOINT *points = measure->points;
+
+    // ChainHull_2D wants the points sorted by x then y
+    qsort (points, n, sizeof (FIAPOINT), ComparePoints);
+
+    int unique = 1;
+
+    for(int i = 1; i < n; i++)
+    {
+        if (points[i].x != points[unique - 1].x || points[i].y != points[unique - 1].y)
+            points[unique++] = points[i];
+    }
+
+    FIAPOINT *hull = (FIAPOINT *) malloc (sizeof (FIAPOINT) * (unique + 1));
+
+    if (CheckMemory(hull) < 0) return FIA_ERROR;
+
+    int number_of_hull_points = ChainHull_2D (points, unique, hull);
+
+    // The hull is closed by repeating the first point
+    if (number_of_hull_points > 1 && hull[number_of_hull_points - 1].x == hull[0].x
+        && hull[number_of_hull_points - 1].y == hull[0].y)
+    {
+        number_of_hull_points--;
+    }
+
+    memcpy (points, hull, sizeof (FIAPOINT) * number_of_hull_points);
+    measure->number_of_points = number_of_hull_points;
+
+    free (hull);
+
+    return FIA_SUCCESS;
+}
+
+static int
+AddPoints (BlobMeasure * measure, const FIAPOINT * points, int n)
+{
+    if (measure->number_of_points + n > measure->points_capacity)
+    {
+        if (ReduceToConvexHull (measure) == FIA_ERROR)
+            return FIA_ERROR;
+
+        // Grow if the hull still takes more than half the space
+        int needed = measure->number_of_points + n;
+
+        if (needed * 2 > measure->points_capacity)
+        {
+            int capacity = MAX (16, MAX (needed * 2, measure->points_capacity * 2));
+            FIAPOINT *grown = (FIAPOINT *) realloc (measure->points, sizeof (FIAPOINT) * capacity);
+
+            if (CheckMemory(grown) < 0) return FIA_ERROR;
+
+            measure->points = grown;
+            measure->points_capacity = capacity;
+        }
+    }
+
+    memcpy (measure->points + measure->number_of_points, points, sizeof (FIAPOINT) * n);
+    measure->number_of_points += n;
+
+    return FIA_SUCCESS;
+}
+
+// Adds the pixels of a run to the measure. grey_row holds the intensities
+// of the row or is NULL. overlap is the number of pixels of the run that
+// have a foreground pixel below them, which do not add to the perimeter.
+static int
+MeasureRun (BlobMeasure * measure, const Run * run, const double *grey_row, int overlap)
+{
+    const double length = run->end_x - run->x + 1;
+    const double y = run->y;
+
+    if (grey_row != NULL)
+    {
+        for(register int x = run->x; x <= run->end_x; x++)
+        {
+            double value = grey_row[x];
+
+            measure->intensity_sum += value;
+
+            if (value < measure->intensity_min)
+                measure->intensity_min = value;
+
+            if (value > measure->intensity_max)
+                measure->intensity_max = value;
+        }
+    }
+
+    // Each pixel has four edges, less two for each neighbour in the run,
+    // the one below and the one above when that row is added.
+    measure->perimeter += 2 * (run->end_x - run->x + 1) + 2 - 2 * overlap;
+
+    // Sums of x and x squared along the run
+    const double sum_x = (double) run->sum_x;
+    const double last = run->end_x, first = run->x - 1.0;
+    const double sum_xx = (last * (last + 1) * (2 * last + 1) - first * (first + 1) * (2 * first + 1)) / 6.0;
+
+    measure->sum_x += sum_x;
+    measure->sum_y += y * length;
+    measure->sum_xx += sum_xx;
+    measure->sum_yy += y * y * length;
+    measure->sum_xy += y * sum_x;
+
+    // The outer corners of the run
+    FIAPOINT corners[4];
+
+    corners[0].x = run->x;
+    corners[0].y = run->y;
+    corners[1].x = run->x;
+    corners[1].y = run->y + 1;
+    corners[2].x = run->end_x + 1;
+    corners[2].y = run->y;
+    corners[3].x = run->end_x + 1;
+    corners[3].y = run->y + 1;
+
+    return AddPoints (measure, corners, 4);
+}
+
+// Moves the measure of from into to.
+static int
+MergeMeasures (BlobMeasure * to, BlobMeasure * from)
+{
+    to->intensity_sum += from->intensity_sum;
+    to->intensity_min = MIN (to->intensity_min, from->intensity_min);
+    to->intensity_max = MAX (to->intensity_max, from->intensity_max);
+    to->perimeter += from->perimeter;
+    to->sum_x += from->sum_x;
+    to->sum_y += from->sum_y;
+    to->sum_xx += from->sum_xx;
+    to->sum_yy += from->sum_yy;
+    to->sum_xy += from->sum_xy;
+
+    int result = AddPoints (to, from->points, from->number_of_points);
+
+    free (from->points);
+    from->points = NULL;
+    from->number_of_points = 0;
+    from->points_capacity = 0;
+
+    return result;
+}
+
 static inline Blob *
 FindBlob (Blob * blob)
 {
@@ -146,6 +420,8 @@ MergeBlobs (BLOBPOOL * pool, Blob * blob1, Blob * blob2)
     }
 
     // Set new width height etc
+    b1->parent->first_x = (b1->bottom == b2->bottom) ? MIN (b1->first_x, b2->first_x) :
+        ((b1->bottom < b2->bottom) ? b1->first_x : b2->first_x);
     b1->parent->left = MIN (b1->left, b2->left);
     b1->parent->bottom = MIN (b1->bottom, b2->bottom);
     b1->parent->right = MAX (b1->right, b2->right);
@@ -154,241 +430,887 @@ MergeBlobs (BLOBPOOL * pool, Blob * blob1, Blob * blob2)
     b1->parent->sum_x = b1->sum_x + b2->sum_x;
     b1->parent->sum_y = b1->sum_y + b2->sum_y;
 
+    if (b1->measure != NULL)
+    {
+        Blob *child = (b1->parent == b1) ? b2 : b1;
+
+        if (MergeMeasures (b1->parent->measure, child->measure) == FIA_ERROR)
+            pool->error = 1;
+    }
+
     pool->real_blobcount--;
 
     return b1->parent;
 }
 
-int DLL_CALLCONV
-FIA_ParticleInfo (FIBITMAP * src, PARTICLEINFO ** info, unsigned char white_on_black)
+// The rows from start_row up to but not including end_row labelled with
+// their own pool. The runs of the first and last rows are kept so the
+// blobs can be joined to those of the strips either side.
+typedef struct
 {
-    if (src == NULL)
-    {
-        return FIA_ERROR;
-    }
+    int start_row;
+    int end_row;
 
-    // Make sure we have the 8bit greyscale image.
-    if (FreeImage_GetBPP (src) != 8 && FreeImage_GetImageType (src) != FIT_BITMAP)
-    {
-        FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                     "Error performing ParticleInfo. Source image must be an 8bit FIT_BITMAP");
-        return FIA_ERROR;
-    }
+    BLOBPOOL *pool;
 
-    const int width = FreeImage_GetWidth (src);
-    const int height = FreeImage_GetHeight (src);
+    Run *first_runs;
+    int first_run_count;
+    Run *last_runs;
+    int last_run_count;
 
-    if(width == 0 || height == 0) {
+} RunStrip;
 
-        FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                         "Error image size is %d x %d", width, height);
-        return FIA_ERROR;
+static void
+FreeRunStrips (RunStrip * strips, int number_of_strips)
+{
+    if (strips == NULL)
+        return;
+
+    for(int i = 0; i < number_of_strips; i++)
+    {
+        UnionFindFree (strips[i].pool);
+        free (strips[i].first_runs);
+        free (strips[i].last_runs);
     }
 
-    unsigned int top_row = height - 1;
-    unsigned char *src_ptr;
+    free (strips);
+}
 
-    register int i = 0;
-    register int x = 0;
+// Returns 0 with 4 connectivity and 1 with 8, the only values the public
+// functions accept. Runs touch if the end of one
+// plus the reach is not before the start of the other.
+static inline int
+ConnectivityReach (FIA_CONNECTIVITY connectivity)
+{
+    return (connectivity == FIA_CONNECTIVITY_4) ? 0 : 1;
+}
 
-    unsigned char bg_val = 0;
+template < typename T > static void
+GreyRowToDouble (const void *src, double *dst, int width)
+{
+    const T *src_ptr = (const T *) src;
 
-    if (!white_on_black)
+    for(register int x = 0; x < width; x++)
+        dst[x] = (double) src_ptr[x];
+}
+
+typedef void (*GREY_ROW_FUNCTION) (const void *src, double *dst, int width);
+
+// Returns NULL if the image type has no intensities to measure.
+static GREY_ROW_FUNCTION
+GetGreyRowFunction (FIBITMAP * grey)
+{
+    switch (FreeImage_GetImageType (grey))
     {
-        bg_val = 1;
-    }
+        case FIT_BITMAP:
+            return (FreeImage_GetBPP (grey) == 8) ? GreyRowToDouble < unsigned char > : NULL;
 
-    Run *current_runs = (Run *) malloc (sizeof (Run) * width / 2);      // Array of all runs
+        case FIT_UINT16:
+            return GreyRowToDouble < unsigned short >;
 
-    if (CheckMemory(current_runs) < 0) return FIA_ERROR;
+        case FIT_INT16:
+            return GreyRowToDouble < short >;
 
-    Run *last_runs = (Run *) malloc (sizeof (Run) * width / 2);
+        case FIT_UINT32:
+            return GreyRowToDouble < unsigned long >;
 
-    if (CheckMemory(last_runs) < 0) return FIA_ERROR;
+        case FIT_INT32:
+            return GreyRowToDouble < long >;
 
-    Run *last_runs_ptr = last_runs, *current_runs_ptr = current_runs;
+        case FIT_FLOAT:
+            return GreyRowToDouble < float >;
 
-    BLOBPOOL *pool = UnionFindInit (width * height / 2);
+        case FIT_DOUBLE:
+            return GreyRowToDouble < double >;
 
-    int last_row_run_count = 0, current_run_count = 0;
+        default:
+            return NULL;
+    }
+}
 
-    // Do the first line
-    src_ptr = (unsigned char *) FreeImage_GetScanLine (src, 0);
+// What to label and what to keep while labelling.
+typedef struct
+{
+    FIBITMAP *src;
+    unsigned char bg_val;
+    FIA_CONNECTIVITY connectivity;
 
-    // Pass through first row - Skip background pixels
-    // All runs are new so no merging takes place.
-    for(x = 0; x < width; x++)
-    {
-        // If bg pixel
-        if (src_ptr[x] == bg_val)
-        {
-            continue;
-        }
+    FIBITMAP *labels;           // Pool indices of the blobs plus one are written here if not NULL
+    int measure;                // Whether the blobs keep a BlobMeasure
+    FIBITMAP *grey;             // The intensities to measure or NULL
 
-        // new blob
-        last_runs_ptr[last_row_run_count].x = x;
-        last_runs_ptr[last_row_run_count].y = 0;
-        last_runs_ptr[last_row_run_count].sum_x = 0;
+} LabelParameters;
 
-        // While fg pixel increment.
-        while (src_ptr[x] != bg_val && x < width)
-        {
+// Finds the runs of foreground pixels on each row of the strip and joins the
+// runs that touch runs of the row below into blobs. Runs touch if they overlap
+// or, with 8 connectivity, meet at a corner.
+static int
+LabelRuns (const LabelParameters * params, RunStrip * strip)
+{
+    FIBITMAP *src = params->src;
+    FIBITMAP *labels = params->labels;
+    const unsigned char bg_val = params->bg_val;
+    const int width = FreeImage_GetWidth (src);
+    const unsigned int top_row = FreeImage_GetHeight (src) - 1;
+    const int reach = ConnectivityReach (params->connectivity);
 
-            last_runs_ptr[last_row_run_count].sum_x += x;
-            x++;
-        }
+    // A row has at most one run for every two pixels
+    const int max_runs = (width + 1) / 2;
 
-        last_runs_ptr[last_row_run_count].end_x = x - 1;
+    Run *last_runs = (Run *) malloc (sizeof (Run) * max_runs);
+    Run *current_runs = (Run *) malloc (sizeof (Run) * max_runs);
 
-        // This is the first line so all new runs are new blobs update the blob info
-        NewBlob (pool, top_row, &last_runs_ptr[last_row_run_count]);
+    GREY_ROW_FUNCTION grey_row_function = NULL;
+    double *grey_row = NULL;
 
-        last_row_run_count++;
+    if (params->grey != NULL)
+    {
+        grey_row_function = GetGreyRowFunction (params->grey);
+        grey_row = (double *) malloc (sizeof (double) * width);
     }
 
-    Blob *last_blob = NULL;
+    strip->pool = UnionFindInit (params->measure);
+    strip->first_runs = (Run *) malloc (sizeof (Run) * max_runs);
+    strip->first_run_count = 0;
+    strip->last_runs = NULL;
+    strip->last_run_count = 0;
 
-    // Do the rest of the rows
-    for(register int y = 1; y < height; y++)
+    int last_row_run_count = 0;
+    int error = (CheckMemory(last_runs) < 0 || CheckMemory(current_runs) < 0 ||
+                 CheckMemory(strip->first_runs) < 0 || strip->pool == NULL ||
+                 (params->grey != NULL && CheckMemory(grey_row) < 0));
+
+    for(register int y = strip->start_row; y < strip->end_row && !error; y++)
     {
-        current_run_count = 0;
+        const unsigned char *src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
+        DWORD *label_ptr = (labels == NULL) ? NULL : (DWORD *) FreeImage_GetScanLine (labels, y);
+
+        if (grey_row != NULL)
+            grey_row_function (FreeImage_GetScanLine (params->grey, y), grey_row, width);
 
-        src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
+        int current_run_count = 0;
 
-        Run tmp_run;
+        // Runs of the last row before this index end before the current run starts
+        int first_last_run = 0;
 
-        // Pass through next row - Skip background pixels
-        for(x = 0; x < width; x++)
+        // Pass through the row - Skip background pixels
+        for(register int x = 0; x < width; x++)
         {
-            // Skip bg pixels
             if (src_ptr[x] == bg_val)
             {
                 continue;
             }
 
-            tmp_run.x = x;
-            tmp_run.y = y;
-            tmp_run.sum_x = 0;
-            tmp_run.blob = NULL;
+            Run run;
+
+            run.x = x;
+            run.y = y;
+            run.sum_x = 0;
+            run.blob = NULL;
 
             // While fg pixel increment.
-            while (src_ptr[x] != bg_val && x < width)
+            while (x < width && src_ptr[x] != bg_val)
             {
-                tmp_run.sum_x += x;
+                run.sum_x += x;
                 x++;
             }
 
-            tmp_run.end_x = x - 1;
+            run.end_x = x - 1;
+
+            int run_length = run.end_x - run.x + 1;
+            int overlap = 0;
 
-            // Check whether run is overlapping with previous runs
-            for(i = 0; i < last_row_run_count; i++)
+            // The runs of both rows are in order of x so the runs of the
+            // last row that end too early for this run are too early for the rest.
+            while (first_last_run < last_row_run_count
+                   && last_runs[first_last_run].end_x + reach < run.x)
             {
-                Run *last_run = &last_runs_ptr[i];
+                first_last_run++;
+            }
 
-                last_blob = FindBlob (last_run->blob);
+            for(int i = first_last_run;
+                i < last_row_run_count && last_runs[i].x - reach <= run.end_x; i++)
+            {
+                Blob *last_blob = FindBlob (last_runs[i].blob);
 
-                // Are runs overlapping ?
-                // The -1 are to allow pixels connected on the diagonal
-                if (tmp_run.end_x >= last_run->x - 1 && tmp_run.x <= last_run->end_x + 1)
-                {
+                overlap += MAX (0, MIN (run.end_x, last_runs[i].end_x) -
+                                MAX (run.x, last_runs[i].x) + 1);
 
-                    // Point to same blob as overlapped run if the blobs are the same
-                    // Or if its the first overlapping run in the previous line.
-                    if (tmp_run.blob == NULL)
-                    {
-                        // Set new width height etc
-                        tmp_run.blob = last_blob;
-
-                        if (tmp_run.x < last_blob->left)
-                        {
-                            last_blob->left = tmp_run.x;
-                        }
-
-                        if (tmp_run.end_x > last_blob->right)
-                        {
-                            last_blob->right = tmp_run.end_x;
-                        }
-
-                        tmp_run.blob->top = y;
-
-                        tmp_run.blob->area = tmp_run.end_x - tmp_run.x + 1 + last_blob->area;
-                        tmp_run.blob->sum_x = tmp_run.sum_x + last_blob->sum_x;
-                        tmp_run.blob->sum_y += ((top_row - y) * (tmp_run.end_x - tmp_run.x + 1));
-
-						if(tmp_run.blob->sum_y < 0) {
-							tmp_run.blob->sum_y = tmp_run.blob->sum_y;
-						}
-
-                    }
-                    else if (tmp_run.blob != last_blob)
-                    {
-                        // We have more than one previous overlapping run.
-                        // The blobs are not the same so we merge them.
-                        tmp_run.blob = MergeBlobs (pool, tmp_run.blob, last_blob);
-                    }
+                // The first touching run gives the run its blob
+                if (run.blob == NULL)
+                {
+                    run.blob = last_blob;
+
+                    last_blob->left = MIN (last_blob->left, run.x);
+                    last_blob->right = MAX (last_blob->right, run.end_x);
+                    last_blob->top = y;
+                    last_blob->area += run_length;
+                    last_blob->sum_x += run.sum_x;
+                    last_blob->sum_y += (long long) (top_row - y) * run_length;
+                }
+                else if (run.blob != last_blob)
+                {
+                    // We have more than one previous overlapping run.
+                    // The blobs are not the same so we merge them.
+                    run.blob = MergeBlobs (strip->pool, run.blob, last_blob);
                 }
             }
 
             // We have no connected runs create a new blob
-            if (tmp_run.blob == NULL)
+            if (run.blob == NULL && NewBlob (strip->pool, top_row, &run) == NULL)
+            {
+                error = 1;
+                break;
+            }
+
+            if (run.blob->measure != NULL
+                && MeasureRun (run.blob->measure, &run, grey_row, overlap) == FIA_ERROR)
             {
-                NewBlob (pool, top_row, &tmp_run);
+                error = 1;
+                break;
             }
 
-            // Add run to current run array
-            current_runs_ptr[current_run_count].x = tmp_run.x;
-            current_runs_ptr[current_run_count].y = tmp_run.y;
-            current_runs_ptr[current_run_count].end_x = tmp_run.end_x;
-            current_runs_ptr[current_run_count].sum_x = tmp_run.sum_x;
-            current_runs_ptr[current_run_count].blob = tmp_run.blob;
+            if (label_ptr != NULL)
+            {
+                DWORD label = run.blob->index + 1;
+
+                for(register int i = run.x; i <= run.end_x; i++)
+                    label_ptr[i] = label;
+            }
 
-            current_run_count++;
+            current_runs[current_run_count++] = run;
+        }
+
+        if (y == strip->start_row)
+        {
+            memcpy (strip->first_runs, current_runs, sizeof (Run) * current_run_count);
+            strip->first_run_count = current_run_count;
         }
 
         // Switch pointer to current runs to last runs a reloop
-        SWAP (last_runs_ptr, current_runs_ptr);
+        SWAP (last_runs, current_runs);
 
         last_row_run_count = current_run_count;
+
+        error |= (strip->pool != NULL && strip->pool->error);
+    }
+
+    free (current_runs);
+    free (grey_row);
+
+    strip->last_runs = last_runs;
+    strip->last_run_count = last_row_run_count;
+
+    return error ? FIA_ERROR : FIA_SUCCESS;
+}
+
+// Labels the whole image as one strip.
+static RunStrip *
+LabelImage (const LabelParameters * params)
+{
+    RunStrip *strip = (RunStrip *) calloc (1, sizeof (RunStrip));
+
+    if (CheckMemory(strip) < 0) return NULL;
+
+    strip->start_row = 0;
+    strip->end_row = FreeImage_GetHeight (params->src);
+
+    if (LabelRuns (params, strip) == FIA_ERROR)
+    {
+        FreeRunStrips (strip, 1);
+        return NULL;
+    }
+
+    return strip;
+}
+
+typedef struct
+{
+    const LabelParameters *params;
+    RunStrip *strips;
+    int error;
+
+} StripRange;
+
+static void
+LabelStripRange (void *data, int start_strip, int end_strip)
+{
+    StripRange *range = (StripRange *) data;
+
+    for(int i = start_strip; i < end_strip; i++)
+    {
+        if (LabelRuns (range->params, &range->strips[i]) == FIA_ERROR)
+        {
+            range->error = 1;
+        }
+    }
+}
+
+// Joins the blobs of the last row of below to those of the first row of above.
+static int
+MergeStripBorder (RunStrip * below, RunStrip * above, int reach)
+{
+    int first_last_run = 0;
+
+    for(int r = 0; r < above->first_run_count; r++)
+    {
+        const Run & run = above->first_runs[r];
+
+        while (first_last_run < below->last_run_count
+               && below->last_runs[first_last_run].end_x + reach < run.x)
+        {
+            first_last_run++;
+        }
+
+        for(int i = first_last_run;
+            i < below->last_run_count && below->last_runs[i].x - reach <= run.end_x; i++)
+        {
+            const Run & last_run = below->last_runs[i];
+            Blob *b1 = FindBlob (last_run.blob);
+            Blob *b2 = FindBlob (run.blob);
+
+            if (b1 != b2)
+                b1 = MergeBlobs (above->pool, b1, b2);
+
+            // The first row of above was measured as if nothing was below it
+            if (b1->measure != NULL)
+            {
+                b1->measure->perimeter -= 2 * MAX (0, MIN (run.end_x, last_run.end_x) -
+                                                   MAX (run.x, last_run.x) + 1);
+            }
+        }
+    }
+
+    return above->pool->error ? FIA_ERROR : FIA_SUCCESS;
+}
+
+// Strips are at least this many rows so the border merge stays cheap.
+#define MIN_ROWS_PER_STRIP 64
+
+// Labels horizontal strips of the image in parallel, each with its own pool,
+// then joins the blobs that meet across the borders of the strips.
+static RunStrip *
+LabelImageInStrips (const LabelParameters * params, int *number_of_strips)
+{
+    const int height = FreeImage_GetHeight (params->src);
+    const int threads = FIA_GetNumberOfThreads ();
+
+    int strip_height = MAX (MIN_ROWS_PER_STRIP, (height + threads * 4 - 1) / (threads * 4));
+
+    *number_of_strips = (height + strip_height - 1) / strip_height;
+
+    RunStrip *strips = (RunStrip *) calloc (*number_of_strips, sizeof (RunStrip));
+
+    if (CheckMemory(strips) < 0) return NULL;
+
+    for(int i = 0; i < *number_of_strips; i++)
+    {
+        strips[i].start_row = i * strip_height;
+        strips[i].end_row = MIN (height, (i + 1) * strip_height);
+    }
+
+    StripRange range;
+
+    range.params = params;
+    range.strips = strips;
+    range.error = 0;
+
+    RunRowRangesInParallel (*number_of_strips, 1, LabelStripRange, &range);
+
+    for(int i = 1; i < *number_of_strips && !range.error; i++)
+    {
+        if (MergeStripBorder (&strips[i - 1], &strips[i],
+                              ConnectivityReach (params->connectivity)) == FIA_ERROR)
+        {
+            range.error = 1;
+        }
+    }
+
+    if (range.error)
+    {
+        FreeRunStrips (strips, *number_of_strips);
+        return NULL;
+    }
+
+    return strips;
+}
+
+static int
+CompareFirstPixel (const void *a, const void *b)
+{
+    const Blob *b1 = *(const Blob **) a;
+    const Blob *b2 = *(const Blob **) b;
+
+    if (b1->bottom != b2->bottom)
+        return (b1->bottom < b2->bottom) ? -1 : 1;
+
+    return (b1->first_x < b2->first_x) ? -1 : (b1->first_x > b2->first_x);
+}
+
+// Returns the blobs that were not merged into another, which are the particles,
+// in the order of the strips and their pools. If sort is set they are sorted
+// by their first pixel in memory order instead. Each is given its number from 1.
+static Blob **
+GetParticles (RunStrip * strips, int number_of_strips, int sort, int *number_of_particles)
+{
+    int count = 0;
+
+    for(int s = 0; s < number_of_strips; s++)
+        count += strips[s].pool->real_blobcount;
+
+    Blob **particles = (Blob **) malloc (sizeof (Blob *) * MAX (1, count));
+
+    if (CheckMemory(particles) < 0) return NULL;
+
+    int j = 0;
+
+    for(int s = 0; s < number_of_strips; s++)
+    {
+        BLOBPOOL *pool = strips[s].pool;
+
+        for(int i = 0; i < pool->blobpool_blobcount; i++)
+        {
+            Blob *ptr = PoolBlob (pool, i);
+
+            if (ptr == ptr->parent)
+                particles[j++] = ptr;
+        }
     }
 
+    if (sort)
+        qsort (particles, count, sizeof (Blob *), CompareFirstPixel);
+
+    for(int i = 0; i < count; i++)
+        particles[i]->number = i + 1;
+
+    *number_of_particles = count;
+
+    return particles;
+}
+
+static void
+SetBlobInfo (const Blob * ptr, unsigned int top_row, BLOBINFO * blob)
+{
+    blob->rect.left = ptr->left;
+    blob->rect.top = top_row - ptr->top;
+    blob->rect.right = ptr->right;
+    blob->rect.bottom = top_row - ptr->bottom;
+    blob->area = ptr->area;
+    blob->center_x = (int) (ptr->sum_x / ptr->area);
+    blob->center_y = (int) (ptr->sum_y / ptr->area);
+}
+
+static int
+GetParticleInfo (Blob ** particles, int number_of_particles, unsigned int top_row,
+                 PARTICLEINFO ** info)
+{
     // Create PARTICLEINFO/BLOBINFO array
     *info = (PARTICLEINFO *) malloc (sizeof (PARTICLEINFO));
     if (CheckMemory(*info) < 0) return FIA_ERROR;
 
-    (*info)->number_of_blobs = pool->real_blobcount;
-    (*info)->blobs = (BLOBINFO *) malloc (sizeof (BLOBINFO) * pool->real_blobcount);
+    (*info)->number_of_blobs = number_of_particles;
+    (*info)->blobs = (BLOBINFO *) malloc (sizeof (BLOBINFO) * MAX (1, number_of_particles));
 
-    if (CheckMemory((*info)->blobs) < 0) return FIA_ERROR;
+    if (CheckMemory((*info)->blobs) < 0)
+    {
+        free (*info);
+        *info = NULL;
+        return FIA_ERROR;
+    }
 
     // Get blobs
-    for(int i = 0, j = 0; i < pool->blobpool_blobcount; i++)
+    for(int j = 0; j < number_of_particles; j++)
+    {
+        SetBlobInfo (particles[j], top_row, &(*info)->blobs[j]);
+    }
+
+    return FIA_SUCCESS;
+}
+
+static int
+CheckParticleImage (FIBITMAP * src)
+{
+    if (src == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    // Make sure we have the 8bit greyscale image.
+    if (FreeImage_GetBPP (src) != 8 || FreeImage_GetImageType (src) != FIT_BITMAP)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Error performing ParticleInfo. Source image must be an 8bit FIT_BITMAP");
+        return FIA_ERROR;
+    }
+
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    if(width == 0 || height == 0) {
+
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                         "Error image size is %d x %d", width, height);
+        return FIA_ERROR;
+    }
+
+    return FIA_SUCCESS;
+}
+
+// Returns the particles of the strips as a PARTICLEINFO list.
+static int
+StripsParticleInfo (RunStrip * strips, int number_of_strips, int sort, unsigned int top_row,
+                    PARTICLEINFO ** info)
+{
+    int number_of_particles = 0;
+    Blob **particles = GetParticles (strips, number_of_strips, sort, &number_of_particles);
+
+    if (particles == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    int result = GetParticleInfo (particles, number_of_particles, top_row, info);
+
+    free (particles);
+
+    return result;
+}
+
+int DLL_CALLCONV
+FIA_ParticleInfo (FIBITMAP * src, PARTICLEINFO ** info, unsigned char white_on_black)
+{
+    if (CheckParticleImage (src) == FIA_ERROR)
+    {
+        return FIA_ERROR;
+    }
+
+    unsigned char bg_val = 0;
+
+    if (!white_on_black)
+    {
+        bg_val = 1;
+    }
+
+    LabelParameters params;
+
+    params.src = src;
+    params.bg_val = bg_val;
+    params.connectivity = FIA_CONNECTIVITY_8;
+    params.labels = NULL;
+    params.measure = 0;
+    params.grey = NULL;
+
+    RunStrip *strip = LabelImage (&params);
+
+    if (strip == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    int result = StripsParticleInfo (strip, 1, 0, FreeImage_GetHeight (src) - 1, info);
+
+    FreeRunStrips (strip, 1);
+
+    return result;
+};
+
+int DLL_CALLCONV
+FIA_ParallelParticleInfo (FIBITMAP * src, PARTICLEINFO ** info, unsigned char white_on_black)
+{
+    if (CheckParticleImage (src) == FIA_ERROR)
+    {
+        return FIA_ERROR;
+    }
+
+    LabelParameters params;
+
+    params.src = src;
+    params.bg_val = white_on_black ? 0 : 1;
+    params.connectivity = FIA_CONNECTIVITY_8;
+    params.labels = NULL;
+    params.measure = 0;
+    params.grey = NULL;
+
+    int number_of_strips = 0;
+    RunStrip *strips = LabelImageInStrips (&params, &number_of_strips);
+
+    if (strips == NULL)
     {
-        Blob *ptr = &(pool->blobpool_start_ptr[i]);
+        return FIA_ERROR;
+    }
+
+    int result = StripsParticleInfo (strips, number_of_strips, 1,
+                                     FreeImage_GetHeight (src) - 1, info);
 
-        if (ptr != ptr->parent)
+    FreeRunStrips (strips, number_of_strips);
+
+    return result;
+}
+
+typedef struct
+{
+    FIBITMAP *labels;
+    const RunStrip *strips;
+    const DWORD *const *numbers;    // The particle number of each blob of each strip
+
+} RelabelRange;
+
+static void
+RelabelRowRange (void *data, int start_row, int end_row)
+{
+    RelabelRange *range = (RelabelRange *) data;
+    const int width = FreeImage_GetWidth (range->labels);
+    const int strip_height = range->strips[0].end_row - range->strips[0].start_row;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        DWORD *label_ptr = (DWORD *) FreeImage_GetScanLine (range->labels, y);
+        const DWORD *numbers = range->numbers[y / strip_height];
+
+        for(register int x = 0; x < width; x++)
         {
-            continue;
+            if (label_ptr[x])
+                label_ptr[x] = numbers[label_ptr[x] - 1];
         }
+    }
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_LabelParticles (FIBITMAP * src, unsigned char white_on_black,
+                    FIA_CONNECTIVITY connectivity, PARTICLEINFO ** info)
+{
+    if (CheckParticleImage (src) == FIA_ERROR || CheckConnectivity (connectivity) == FIA_ERROR)
+    {
+        return NULL;
+    }
 
-        (*info)->blobs[j].rect.left = ptr->left;
-        (*info)->blobs[j].rect.top = top_row - ptr->top;
-        (*info)->blobs[j].rect.right = ptr->right;
-        (*info)->blobs[j].rect.bottom = top_row - ptr->bottom;
-        (*info)->blobs[j].area = ptr->area;
-        (*info)->blobs[j].center_x = ptr->sum_x / ptr->area;
-        (*info)->blobs[j].center_y = ptr->sum_y / ptr->area;
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
 
-        j++;
+    FIBITMAP *labels = FreeImage_AllocateT (FIT_UINT32, width, height, 32, 0, 0, 0);
+
+    if (labels == NULL)
+    {
+        return NULL;
     }
 
-    UnionFindFree (pool);
-    free (current_runs);
-    current_runs = NULL;
-    free (last_runs);
-    last_runs = NULL;
+    LabelParameters params;
+
+    params.src = src;
+    params.bg_val = white_on_black ? 0 : 1;
+    params.connectivity = connectivity;
+    params.labels = labels;
+    params.measure = 0;
+    params.grey = NULL;
+
+    int number_of_strips = 0;
+    RunStrip *strips = LabelImageInStrips (&params, &number_of_strips);
+
+    int number_of_particles = 0;
+    Blob **particles = NULL;
+    DWORD **numbers = NULL;
+    DWORD *blob_numbers = NULL;
+
+    if (strips != NULL)
+    {
+        particles = GetParticles (strips, number_of_strips, 1, &number_of_particles);
+
+        int number_of_blobs = 0;
+
+        for(int s = 0; s < number_of_strips; s++)
+            number_of_blobs += strips[s].pool->blobpool_blobcount;
+
+        numbers = (DWORD **) malloc (sizeof (DWORD *) * number_of_strips);
+        blob_numbers = (DWORD *) malloc (sizeof (DWORD) * MAX (1, number_of_blobs));
+    }
+
+    if (strips == NULL || particles == NULL || CheckMemory(numbers) < 0
+        || CheckMemory(blob_numbers) < 0)
+    {
+        free (particles);
+        free (numbers);
+        free (blob_numbers);
+        FreeRunStrips (strips, number_of_strips);
+        FreeImage_Unload (labels);
+        return NULL;
+    }
+
+    // Give every blob the number of its particle.
+    for(int s = 0, offset = 0; s < number_of_strips; s++)
+    {
+        BLOBPOOL *pool = strips[s].pool;
+
+        numbers[s] = blob_numbers + offset;
+
+        for(int i = 0; i < pool->blobpool_blobcount; i++)
+            blob_numbers[offset + i] = FindBlob (PoolBlob (pool, i))->number;
+
+        offset += pool->blobpool_blobcount;
+    }
+
+    RelabelRange range;
+
+    range.labels = labels;
+    range.strips = strips;
+    range.numbers = numbers;
+
+    RunRowRangesInParallel (height, 64, RelabelRowRange, &range);
+
+    free (numbers);
+    free (blob_numbers);
+
+    int result = FIA_SUCCESS;
+
+    if (info != NULL)
+    {
+        result = GetParticleInfo (particles, number_of_particles, height - 1, info);
+    }
+
+    free (particles);
+    FreeRunStrips (strips, number_of_strips);
+
+    if (result == FIA_ERROR)
+    {
+        FreeImage_Unload (labels);
+        return NULL;
+    }
+
+    return labels;
+}
+
+// Works out the measurements of a particle from what was summed over its runs.
+static int
+SetBlobMeasurement (Blob * ptr, unsigned int top_row, int have_grey, BLOBMEASUREMENT * blob)
+{
+    BlobMeasure *measure = ptr->measure;
+    const double n = ptr->area;
+
+    SetBlobInfo (ptr, top_row, &blob->info);
+
+    blob->intensity_sum = have_grey ? measure->intensity_sum : 0.0;
+    blob->intensity_mean = have_grey ? measure->intensity_sum / n : 0.0;
+    blob->intensity_min = have_grey ? measure->intensity_min : 0.0;
+    blob->intensity_max = have_grey ? measure->intensity_max : 0.0;
+    blob->perimeter = (int) measure->perimeter;
+
+    // Central second order moments
+    const double mean_x = measure->sum_x / n;
+    const double mean_y = measure->sum_y / n;
+    const double mu20 = measure->sum_xx / n - mean_x * mean_x;
+    const double mu02 = measure->sum_yy / n - mean_y * mean_y;
+    const double mu11 = measure->sum_xy / n - mean_x * mean_y;
+
+    // Eigenvalues of the covariance, the variances along the major and minor axes
+    const double half_sum = (mu20 + mu02) / 2.0;
+    const double half_difference = sqrt ((mu20 - mu02) * (mu20 - mu02) / 4.0 + mu11 * mu11);
+    const double major = half_sum + half_difference;
+    const double minor = MAX (0.0, half_sum - half_difference);
+
+    blob->orientation = 0.5 * atan2 (2.0 * mu11, mu20 - mu02);
+    blob->eccentricity = (major > 0.0) ? sqrt (MAX (0.0, 1.0 - minor / major)) : 0.0;
+    blob->equivalent_diameter = sqrt (4.0 * n / PI);
+
+    if (ReduceToConvexHull (measure) == FIA_ERROR)
+        return FIA_ERROR;
+
+    // Shoelace formula over the hull vertices
+    const FIAPOINT *hull = measure->points;
+    double twice_area = 0.0;
+
+    for(int i = 0; i < measure->number_of_points; i++)
+    {
+        const FIAPOINT & p1 = hull[i];
+        const FIAPOINT & p2 = hull[(i + 1) % measure->number_of_points];
+
+        twice_area += (double) p1.x * p2.y - (double) p2.x * p1.y;
+    }
+
+    blob->convex_hull_area = fabs (twice_area) / 2.0;
 
     return FIA_SUCCESS;
-};
+}
+
+int DLL_CALLCONV
+FIA_ParticleMeasurements (FIBITMAP * src, FIBITMAP * grey, unsigned char white_on_black,
+                          FIA_CONNECTIVITY connectivity, PARTICLEMEASUREMENTS ** measurements)
+{
+    if (CheckParticleImage (src) == FIA_ERROR || CheckConnectivity (connectivity) == FIA_ERROR)
+    {
+        return FIA_ERROR;
+    }
+
+    if (grey != NULL && (FreeImage_GetWidth (grey) != FreeImage_GetWidth (src)
+                         || FreeImage_GetHeight (grey) != FreeImage_GetHeight (src)
+                         || GetGreyRowFunction (grey) == NULL))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Error performing ParticleMeasurements. The grey image must be a greyscale image the size of the particle image");
+        return FIA_ERROR;
+    }
+
+    LabelParameters params;
+
+    params.src = src;
+    params.bg_val = white_on_black ? 0 : 1;
+    params.connectivity = connectivity;
+    params.labels = NULL;
+    params.measure = 1;
+    params.grey = grey;
+
+    int number_of_strips = 0;
+    RunStrip *strips = LabelImageInStrips (&params, &number_of_strips);
+
+    if (strips == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    int number_of_particles = 0;
+    Blob **particles = GetParticles (strips, number_of_strips, 1, &number_of_particles);
+
+    PARTICLEMEASUREMENTS *list = (PARTICLEMEASUREMENTS *) calloc (1, sizeof (PARTICLEMEASUREMENTS));
+    int result = FIA_ERROR;
+
+    if (particles != NULL && CheckMemory(list) >= 0)
+    {
+        list->number_of_blobs = number_of_particles;
+        list->blobs = (BLOBMEASUREMENT *) malloc (sizeof (BLOBMEASUREMENT) * MAX (1, number_of_particles));
+
+        if (CheckMemory(list->blobs) >= 0)
+            result = FIA_SUCCESS;
+    }
+
+    const unsigned int top_row = FreeImage_GetHeight (src) - 1;
+
+    for(int j = 0; j < number_of_particles && result == FIA_SUCCESS; j++)
+    {
+        result = SetBlobMeasurement (particles[j], top_row, grey != NULL, &list->blobs[j]);
+    }
+
+    free (particles);
+    FreeRunStrips (strips, number_of_strips);
+
+    if (result == FIA_ERROR)
+    {
+        if (list != NULL)
+            FIA_FreeParticleMeasurements (list);
+
+        return FIA_ERROR;
+    }
+
+    *measurements = list;
+
+    return FIA_SUCCESS;
+}
+
+void DLL_CALLCONV
+FIA_FreeParticleMeasurements (PARTICLEMEASUREMENTS * measurements)
+{
+    free (measurements->blobs);
+    measurements->blobs = NULL;
+
+    free (measurements);
+}
 
 void DLL_CALLCONV
 FIA_FreeParticleInfo (PARTICLEINFO * info)
@@ -0,0 +1,408 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ * Oxford University (Gray Institute for Radiation Oncology and Biology)
+ *
+ * This file is part of FreeImageAlgorithms.
+ *
+ * FreeImageAlgorithms is free software: you can redistribute it and/or modify
+ * it under the terms of the Lesser GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeImageAlgorithms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * Lesser GNU General Public License for more details.
+ *
+ * You should have received a copy of the Lesser GNU General Public License
+ * along with FreeImageAlgorithms.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_Utils.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FIA_X86_SIMD
+#endif
+
+#ifdef FIA_X86_SIMD
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define FIA_TARGET_SSE2
+#define FIA_TARGET_AVX2
+#else
+#define FIA_TARGET_SSE2 __attribute__((target("sse2")))
+#define FIA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#endif
+
+// The SSE2 and AVX2 versions multiply then add exactly like the scalar
+// loops (no fused multiply add) so every path gives identical results.
+// Dot products keep four running sums, one for each of i % 4, on every path.
+
+// The instruction sets are detected by FIA_GetCpuFeatures, see
+// _os_support in FreeImageAlgorithms_Utilities.cpp.
+
+static void
+KernelRowMultiplyAddScalar (double *acc, const double *src, double value, int n)
+{
+    for(register int i = 0; i < n; i++)
+        acc[i] += src[i] * value;
+}
+
+static void
+KernelRowMultiplyAddScalar (double *acc, const float *src, double value, int n)
+{
+    for(register int i = 0; i < n; i++)
+        acc[i] += (double) src[i] * value;
+}
+
+template < typename Tsrc > static double
+KernelRowDotProductScalar (const Tsrc * src, const double *kernel, int n)
+{
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+    {
+        s0 += (double) src[i] * kernel[i];
+        s1 += (double) src[i + 1] * kernel[i + 1];
+        s2 += (double) src[i + 2] * kernel[i + 2];
+        s3 += (double) src[i + 3] * kernel[i + 3];
+    }
+
+    double sum = (s0 + s2) + (s1 + s3);
+
+    for(; i < n; i++)
+        sum += (double) src[i] * kernel[i];
+
+    return sum;
+}
+
+// Packs the pixels from start up to width into the words from start / 64.
+static void
+PackBinaryRowScalar (BinaryMaskWord * dst, const unsigned char *src, int start, int width)
+{
+    for(; start < width; start += 64)
+    {
+        int end = MIN (start + 64, width);
+        BinaryMaskWord word = 0;
+
+        for(register int x = start; x < end; x++)
+        {
+            if (src[x])
+                word |= (BinaryMaskWord) 1 << (x - start);
+        }
+
+        dst[start / 64] = word;
+    }
+}
+
+#ifdef FIA_X86_SIMD
+
+// Each movemask gives the bits of 16 pixels.
+FIA_TARGET_SSE2 static void
+PackBinaryRowSSE2 (BinaryMaskWord * dst, const unsigned char *src, int width)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    register int x = 0;
+
+    for(; x + 64 <= width; x += 64)
+    {
+        BinaryMaskWord word = 0;
+
+        for(int i = 0; i < 4; i++)
+        {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (src + x + i * 16));
+            unsigned int unset = (unsigned int) _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, zero));
+
+            word |= (BinaryMaskWord) (~unset & 0xFFFF) << (i * 16);
+        }
+
+        dst[x / 64] = word;
+    }
+
+    PackBinaryRowScalar (dst, src, x, width);
+}
+
+FIA_TARGET_SSE2 static void
+KernelRowMultiplyAddSSE2 (double *acc, const double *src, double value, int n)
+{
+    const __m128d k = _mm_set1_pd (value);
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128d a0 = _mm_loadu_pd (acc + i);
+        __m128d a1 = _mm_loadu_pd (acc + i + 2);
+
+        a0 = _mm_add_pd (a0, _mm_mul_pd (_mm_loadu_pd (src + i), k));
+        a1 = _mm_add_pd (a1, _mm_mul_pd (_mm_loadu_pd (src + i + 2), k));
+
+        _mm_storeu_pd (acc + i, a0);
+        _mm_storeu_pd (acc + i + 2, a1);
+    }
+
+    for(; i < n; i++)
+        acc[i] += src[i] * value;
+}
+
+FIA_TARGET_SSE2 static void
+KernelRowMultiplyAddSSE2 (double *acc, const float *src, double value, int n)
+{
+    const __m128d k = _mm_set1_pd (value);
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 s = _mm_loadu_ps (src + i);
+        __m128d a0 = _mm_loadu_pd (acc + i);
+        __m128d a1 = _mm_loadu_pd (acc + i + 2);
+
+        a0 = _mm_add_pd (a0, _mm_mul_pd (_mm_cvtps_pd (s), k));
+        a1 = _mm_add_pd (a1, _mm_mul_pd (_mm_cvtps_pd (_mm_movehl_ps (s, s)), k));
+
+        _mm_storeu_pd (acc + i, a0);
+        _mm_storeu_pd (acc + i + 2, a1);
+    }
+
+    for(; i < n; i++)
+        acc[i] += (double) src[i] * value;
+}
+
+FIA_TARGET_AVX2 static void
+KernelRowMultiplyAddAVX2 (double *acc, const double *src, double value, int n)
+{
+    const __m256d k = _mm256_set1_pd (value);
+    register int i = 0;
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256d a0 = _mm256_loadu_pd (acc + i);
+        __m256d a1 = _mm256_loadu_pd (acc + i + 4);
+
+        a0 = _mm256_add_pd (a0, _mm256_mul_pd (_mm256_loadu_pd (src + i), k));
+        a1 = _mm256_add_pd (a1, _mm256_mul_pd (_mm256_loadu_pd (src + i + 4), k));
+
+        _mm256_storeu_pd (acc + i, a0);
+        _mm256_storeu_pd (acc + i + 4, a1);
+    }
+
+    for(; i < n; i++)
+        acc[i] += src[i] * value;
+}
+
+FIA_TARGET_AVX2 static void
+KernelRowMultiplyAddAVX2 (double *acc, const float *src, double value, int n)
+{
+    const __m256d k = _mm256_set1_pd (value);
+    register int i = 0;
+
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256d a0 = _mm256_loadu_pd (acc + i);
+        __m256d a1 = _mm256_loadu_pd (acc + i + 4);
+
+        a0 = _mm256_add_pd (a0, _mm256_mul_pd (_mm256_cvtps_pd (_mm_loadu_ps (src + i)), k));
+        a1 = _mm256_add_pd (a1, _mm256_mul_pd (_mm256_cvtps_pd (_mm_loadu_ps (src + i + 4)), k));
+
+        _mm256_storeu_pd (acc + i, a0);
+        _mm256_storeu_pd (acc + i + 4, a1);
+    }
+
+    for(; i < n; i++)
+        acc[i] += (double) src[i] * value;
+}
+
+FIA_TARGET_SSE2 static double
+KernelRowDotProductSSE2 (const double *src, const double *kernel, int n)
+{
+    __m128d s0 = _mm_setzero_pd ();
+    __m128d s1 = _mm_setzero_pd ();
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+    {
+        s0 = _mm_add_pd (s0, _mm_mul_pd (_mm_loadu_pd (src + i), _mm_loadu_pd (kernel + i)));
+        s1 = _mm_add_pd (s1, _mm_mul_pd (_mm_loadu_pd (src + i + 2), _mm_loadu_pd (kernel + i + 2)));
+    }
+
+    double lanes[2];
+
+    _mm_storeu_pd (lanes, _mm_add_pd (s0, s1));
+
+    double sum = lanes[0] + lanes[1];
+
+    for(; i < n; i++)
+        sum += src[i] * kernel[i];
+
+    return sum;
+}
+
+FIA_TARGET_SSE2 static double
+KernelRowDotProductSSE2 (const float *src, const double *kernel, int n)
+{
+    __m128d s0 = _mm_setzero_pd ();
+    __m128d s1 = _mm_setzero_pd ();
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+    {
+        __m128 s = _mm_loadu_ps (src + i);
+
+        s0 = _mm_add_pd (s0, _mm_mul_pd (_mm_cvtps_pd (s), _mm_loadu_pd (kernel + i)));
+        s1 = _mm_add_pd (s1, _mm_mul_pd (_mm_cvtps_pd (_mm_movehl_ps (s, s)),
+                                         _mm_loadu_pd (kernel + i + 2)));
+    }
+
+    double lanes[2];
+
+    _mm_storeu_pd (lanes, _mm_add_pd (s0, s1));
+
+    double sum = lanes[0] + lanes[1];
+
+    for(; i < n; i++)
+        sum += (double) src[i] * kernel[i];
+
+    return sum;
+}
+
+FIA_TARGET_AVX2 static double
+KernelRowDotProductAVX2 (const double *src, const double *kernel, int n)
+{
+    __m256d s = _mm256_setzero_pd ();
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+        s = _mm256_add_pd (s, _mm256_mul_pd (_mm256_loadu_pd (src + i), _mm256_loadu_pd (kernel + i)));
+
+    double lanes[2];
+
+    _mm_storeu_pd (lanes, _mm_add_pd (_mm256_castpd256_pd128 (s), _mm256_extractf128_pd (s, 1)));
+
+    double sum = lanes[0] + lanes[1];
+
+    for(; i < n; i++)
+        sum += src[i] * kernel[i];
+
+    return sum;
+}
+
+FIA_TARGET_AVX2 static double
+KernelRowDotProductAVX2 (const float *src, const double *kernel, int n)
+{
+    __m256d s = _mm256_setzero_pd ();
+    register int i = 0;
+
+    for(; i + 4 <= n; i += 4)
+        s = _mm256_add_pd (s, _mm256_mul_pd (_mm256_cvtps_pd (_mm_loadu_ps (src + i)),
+                                             _mm256_loadu_pd (kernel + i)));
+
+    double lanes[2];
+
+    _mm_storeu_pd (lanes, _mm_add_pd (_mm256_castpd256_pd128 (s), _mm256_extractf128_pd (s, 1)));
+
+    double sum = lanes[0] + lanes[1];
+
+    for(; i < n; i++)
+        sum += (double) src[i] * kernel[i];
+
+    return sum;
+}
+
+#endif
+
+void
+KernelRowMultiplyAdd (double *acc, const double *src, double value, int n)
+{
+#ifdef FIA_X86_SIMD
+    int features = FIA_GetCpuFeatures ();
+
+    if (features & _CPU_FEATURE_AVX2)
+    {
+        KernelRowMultiplyAddAVX2 (acc, src, value, n);
+        return;
+    }
+
+    if (features & _CPU_FEATURE_SSE2)
+    {
+        KernelRowMultiplyAddSSE2 (acc, src, value, n);
+        return;
+    }
+#endif
+
+    KernelRowMultiplyAddScalar (acc, src, value, n);
+}
+
+void
+KernelRowMultiplyAdd (double *acc, const float *src, double value, int n)
+{
+#ifdef FIA_X86_SIMD
+    int features = FIA_GetCpuFeatures ();
+
+    if (features & _CPU_FEATURE_AVX2)
+    {
+        KernelRowMultiplyAddAVX2 (acc, src, value, n);
+        return;
+    }
+
+    if (features & _CPU_FEATURE_SSE2)
+    {
+        KernelRowMultiplyAddSSE2 (acc, src, value, n);
+        return;
+    }
+#endif
+
+    KernelRowMultiplyAddScalar (acc, src, value, n);
+}
+
+double
+KernelRowDotProduct (const double *src, const double *kernel, int n)
+{
+#ifdef FIA_X86_SIMD
+    int features = FIA_GetCpuFeatures ();
+
+    if (features & _CPU_FEATURE_AVX2)
+        return KernelRowDotProductAVX2 (src, kernel, n);
+
+    if (features & _CPU_FEATURE_SSE2)
+        return KernelRowDotProductSSE2 (src, kernel, n);
+#endif
+
+    return KernelRowDotProductScalar (src, kernel, n);
+}
+
+double
+KernelRowDotProduct (const float *src, const double *kernel, int n)
+{
+#ifdef FIA_X86_SIMD
+    int features = FIA_GetCpuFeatures ();
+
+    if (features & _CPU_FEATURE_AVX2)
+        return KernelRowDotProductAVX2 (src, kernel, n);
+
+    if (features & _CPU_FEATURE_SSE2)
+        return KernelRowDotProductSSE2 (src, kernel, n);
+#endif
+
+    return KernelRowDotProductScalar (src, kernel, n);
+}
+
+void
+PackBinaryRow (BinaryMaskWord * dst, const unsigned char *src, int width)
+{
+#ifdef FIA_X86_SIMD
+    if (FIA_GetCpuFeatures () & _CPU_FEATURE_SSE2)
+    {
+        PackBinaryRowSSE2 (dst, src, width);
+        return;
+    }
+#endif
+
+    PackBinaryRowScalar (dst, src, 0, width);
+}
@@ -47,6 +47,266 @@ template < class Tsrc > class Statistic
                               unsigned long **hist);
 };
 
+// 8 and 16 bit histograms look up the bin of each pixel value directly.
+// When each bin holds a power of two of values the bin is a shift of the
+// value, otherwise it comes from a table of the bin of every possible value
+// worked out with the same sums as the general code, so the counts are the
+// same either way.
+//
+// Each range of rows counts into four sub-histograms, taking turns pixel by
+// pixel, so runs of equal values do not wait on the increment of the pixel
+// before. The sub-histograms have an extra bin that counts the pixels
+// outside min to max. They are added to the result at the end of the range.
+
+struct ShiftBin
+{
+    int min;
+    unsigned int range;
+    int shift;
+    int outside;
+
+    inline int operator () (unsigned int value) const
+    {
+        unsigned int offset = value - min;
+
+        return (offset <= range) ? (int) (offset >> shift) : outside;
+    }
+};
+
+struct TableBin
+{
+    const int *table;
+
+    inline int operator () (unsigned int value) const
+    {
+        return table[value];
+    }
+};
+
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *mask;
+    int number_of_bins;
+    ShiftBin shift_bin;
+    const int *table;           // NULL to use shift_bin
+    unsigned long *hist;
+    int error;
+
+} IntegerHistogramRange;
+
+template < class Tsrc, class Bin > static void
+CountIntegerHistogram (IntegerHistogramRange * range, const Bin & bin, unsigned int **sub,
+                       int start_row, int end_row)
+{
+    int width = FreeImage_GetWidth (range->src);
+    unsigned int *sub0 = sub[0], *sub1 = sub[1], *sub2 = sub[2], *sub3 = sub[3];
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const Tsrc *bits = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+        register int x = 0;
+
+        if (range->mask == NULL)
+        {
+            for(; x < width - 3; x += 4)
+            {
+                sub0[bin (bits[x])]++;
+                sub1[bin (bits[x + 1])]++;
+                sub2[bin (bits[x + 2])]++;
+                sub3[bin (bits[x + 3])]++;
+            }
+
+            for(; x < width; x++)
+                sub0[bin (bits[x])]++;
+        }
+        else
+        {
+            const BYTE *mask_ptr = FreeImage_GetScanLine (range->mask, y);
+
+            for(; x < width - 3; x += 4)
+            {
+                sub0[bin (bits[x])] += (mask_ptr[x] != 0);
+                sub1[bin (bits[x + 1])] += (mask_ptr[x + 1] != 0);
+                sub2[bin (bits[x + 2])] += (mask_ptr[x + 2] != 0);
+                sub3[bin (bits[x + 3])] += (mask_ptr[x + 3] != 0);
+            }
+
+            for(; x < width; x++)
+                sub0[bin (bits[x])] += (mask_ptr[x] != 0);
+        }
+    }
+}
+
+template < class Tsrc > static void
+IntegerHistogramRows (void *data, int start_row, int end_row)
+{
+    IntegerHistogramRange *range = (IntegerHistogramRange *) data;
+    int stride = range->number_of_bins + 1;
+    unsigned int *counts = (unsigned int *) calloc (4 * stride, sizeof (unsigned int));
+
+    if (counts == NULL)
+    {
+        range->error = 1;
+        return;
+    }
+
+    unsigned int *sub[4] = { counts, counts + stride, counts + 2 * stride, counts + 3 * stride };
+
+    if (range->table == NULL)
+    {
+        CountIntegerHistogram < Tsrc > (range, range->shift_bin, sub, start_row, end_row);
+    }
+    else
+    {
+        TableBin bin;
+
+        bin.table = range->table;
+        CountIntegerHistogram < Tsrc > (range, bin, sub, start_row, end_row);
+    }
+
+    EnterGlobalLock ();
+
+    for(int i = 0; i < range->number_of_bins; i++)
+        range->hist[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+
+    LeaveGlobalLock ();
+
+    free (counts);
+}
+
+// Counts into hist, which must be cleared. Returns FIA_ERROR if there is not
+// enough memory.
+template < class Tsrc > static int
+CalculateIntegerHistogram (FIBITMAP * src, FIBITMAP * mask, double min, double max,
+                           int number_of_bins, unsigned long *hist)
+{
+    const int number_of_values = 1 << (8 * sizeof (Tsrc));
+    double range_per_bin = (max - min) / (double) (number_of_bins - 1);
+    int *table = NULL;
+
+    IntegerHistogramRange range;
+
+    range.src = src;
+    range.mask = mask;
+    range.number_of_bins = number_of_bins;
+    range.hist = hist;
+    range.error = 0;
+    range.shift_bin.outside = number_of_bins;
+
+    // A power of two of whole values in each bin
+    int shift = -1;
+
+    if (number_of_bins > 1 && min >= 0.0 && max < number_of_values
+        && min == floor (min) && max == floor (max))
+    {
+        int value_range = (int) (max - min);
+
+        if (value_range > 0 && value_range % (number_of_bins - 1) == 0)
+        {
+            int values_per_bin = value_range / (number_of_bins - 1);
+
+            if ((values_per_bin & (values_per_bin - 1)) == 0)
+            {
+                for(shift = 0; (1 << shift) < values_per_bin; shift++) ;
+            }
+        }
+    }
+
+    if (shift >= 0)
+    {
+        range.shift_bin.min = (int) min;
+        range.shift_bin.range = (unsigned int) (max - min);
+        range.shift_bin.shift = shift;
+    }
+    else
+    {
+        table = (int *) malloc (number_of_values * sizeof (int));
+
+        if (CheckMemory (table) < 0)
+        {
+            return FIA_ERROR;
+        }
+
+        for(int value = 0; value < number_of_values; value++)
+        {
+            Tsrc pixel = (Tsrc) value;
+            int bin = number_of_bins;
+
+            if (pixel >= min && pixel <= max)
+            {
+                if (range_per_bin == 1)
+                {
+                    bin = (int) (pixel - min);
+                }
+                else
+                {
+                    bin = (int) ((pixel - min) / range_per_bin);
+                }
+
+                if (bin < 0 || bin >= number_of_bins)
+                {
+                    bin = number_of_bins;
+                }
+            }
+
+            table[value] = bin;
+        }
+    }
+
+    range.table = table;
+
+    RunRowRangesInParallel (FreeImage_GetHeight (src), 32, IntegerHistogramRows < Tsrc >, &range);
+
+    free (table);
+
+    return range.error ? FIA_ERROR : FIA_SUCCESS;
+}
+
+// Only unsigned 8 and 16 bit images take the direct path.
+template < class Tsrc > struct IntegerHistogram
+{
+    static int HasDirectPath ()
+    {
+        return 0;
+    }
+
+    static int Calculate (FIBITMAP *, FIBITMAP *, double, double, int, unsigned long *)
+    {
+        return FIA_ERROR;
+    }
+};
+
+template <> struct IntegerHistogram < unsigned char >
+{
+    static int HasDirectPath ()
+    {
+        return 1;
+    }
+
+    static int Calculate (FIBITMAP * src, FIBITMAP * mask, double min, double max,
+                          int number_of_bins, unsigned long *hist)
+    {
+        return CalculateIntegerHistogram < unsigned char > (src, mask, min, max,
+                                                            number_of_bins, hist);
+    }
+};
+
+template <> struct IntegerHistogram < unsigned short >
+{
+    static int HasDirectPath ()
+    {
+        return 1;
+    }
+
+    static int Calculate (FIBITMAP * src, FIBITMAP * mask, double min, double max,
+                          int number_of_bins, unsigned long *hist)
+    {
+        return CalculateIntegerHistogram < unsigned short > (src, mask, min, max,
+                                                             number_of_bins, hist);
+    }
+};
+
 template < class Tsrc > int Statistic < Tsrc >::CalculateHistogram (FIBITMAP * src, FIBITMAP * mask, double min,
                                                                     double max, int number_of_bins,
                                                                     unsigned long *hist)
@@ -96,6 +356,11 @@ template < class Tsrc > int Statistic < Tsrc >::CalculateHistogram (FIBITMAP * s
     // Clear histogram array
     memset (hist, 0, number_of_bins * sizeof (unsigned long));
 
+    if (IntegerHistogram < Tsrc >::HasDirectPath ())
+    {
+        return IntegerHistogram < Tsrc >::Calculate (src, mask, min, max, number_of_bins, hist);
+    }
+
 //    Tsrc tmp_min = (Tsrc) min;
 //    Tsrc tmp_max = (Tsrc) max;
 //    Tsrc range = tmp_max - tmp_min;
@@ -176,166 +441,283 @@ template < class Tsrc > int Statistic < Tsrc >::CalculateHistogram (FIBITMAP * s
     return FIA_SUCCESS;
 }
 
-template < class Tsrc > int Statistic < Tsrc >::CalculateStatisticReport (FIBITMAP * src, FIBITMAP * mask,
-                                                                          StatisticReport * report)
+// The count, mean, central moment sums and range of a set of pixels.
+// Two sets are merged with the formulas of P. Pebay, "Formulas for Robust,
+// One-Pass Parallel Computation of Covariances and Arbitrary-Order
+// Statistical Moments", Sandia Report SAND2008-6212, so the image can be
+// split into bands that are summed separately without losing precision.
+typedef struct
 {
-    memset(report, 0, sizeof(StatisticReport));
+    double n;
+    double mean;
+    double M2;
+    double M3;
+    double M4;
+    double min;
+    double max;
+    double underloaded;
+    double overloaded;
+
+} MomentAccumulator;
+
+static void
+MergeMoments (MomentAccumulator * a, const MomentAccumulator * b)
+{
+    if (b->n == 0.0)
+        return;
 
-    if (report == NULL)
+    if (a->n == 0.0)
     {
-        return FIA_ERROR;
+        *a = *b;
+        return;
     }
 
-    if (mask != NULL)
+    double na = a->n, nb = b->n, n = na + nb;
+    double delta = b->mean - a->mean;
+    double delta_n = delta / n;
+    double delta_n2 = delta_n * delta_n;
+    double term = delta * delta_n * na * nb;
+
+    double M2 = a->M2 + b->M2 + term;
+
+    double M3 = a->M3 + b->M3 + term * delta_n * (na - nb)
+        + 3.0 * delta_n * (na * b->M2 - nb * a->M2);
+
+    double M4 = a->M4 + b->M4 + term * delta_n2 * (na * na - na * nb + nb * nb)
+        + 6.0 * delta_n2 * (na * na * b->M2 + nb * nb * a->M2)
+        + 4.0 * delta_n * (na * b->M3 - nb * a->M3);
+
+    a->mean += delta_n * nb;
+    a->n = n;
+    a->M2 = M2;
+    a->M3 = M3;
+    a->M4 = M4;
+    a->min = MIN (a->min, b->min);
+    a->max = MAX (a->max, b->max);
+    a->underloaded += b->underloaded;
+    a->overloaded += b->overloaded;
+}
+
+// Pixels are summed a block at a time. The first loop over a block finds
+// its count, sum and range, the second its moments about the block mean
+// while the block is still in the cache. Masked blocks are first copied
+// to a buffer of the pixels under the mask.
+#define MOMENT_BLOCK_SIZE 2048
+
+template < class Tsrc > static void
+AccumulateMomentBlock (const Tsrc * bits, int count, Tsrc min_possible, Tsrc max_possible,
+                       MomentAccumulator * acc)
+{
+    if (count == 0)
+        return;
+
+    MomentAccumulator block;
+    double sum0 = 0.0, sum1 = 0.0;
+    int underloaded = 0, overloaded = 0;
+    Tsrc min = bits[0], max = bits[0];
+    register int x;
+
+    for(x = 0; x < count - 1; x += 2)
     {
-        // Mask has to be the same size
-        if (FIA_CheckDimensions (src, mask) == FIA_ERROR)
-        {
-            FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                         "Image source and mask have different dimensions");
-            return FIA_ERROR;
-        }
+        Tsrc a = bits[x], b = bits[x + 1];
 
-        // Mask has to be 8 bit 
-        if (FreeImage_GetBPP (mask) != 8 || FreeImage_GetImageType (mask) != FIT_BITMAP)
-        {
-            FreeImage_OutputMessageProc (FIF_UNKNOWN, "Mask must be an 8bit FIT_BITMAP");
-            return FIA_ERROR;
-        }
+        min = (a < min) ? a : min;
+        max = (a > max) ? a : max;
+        min = (b < min) ? b : min;
+        max = (b > max) ? b : max;
+
+        underloaded += (a <= min_possible) + (b <= min_possible);
+        overloaded += (a >= max_possible) + (b >= max_possible);
+
+        sum0 += a;
+        sum1 += b;
     }
 
-    int width = FreeImage_GetWidth (src);
-    int height = FreeImage_GetHeight (src);
+    if (x < count)
+    {
+        Tsrc a = bits[x];
 
-    double sum = 0.0, sd_sum = 0.0, skew_sum = 0.0, kurt_sum = 0.0;
-    Tsrc *bits;
-	int number_of_pixels = 0;
-    int	amount_of_overloaded_pixels = 0;
-    int	amount_of_underloaded_pixels = 0;
+        min = (a < min) ? a : min;
+        max = (a > max) ? a : max;
 
-    double min_possible_for_type = 0.0;
-    double max_possible_for_type = 0.0;
+        underloaded += (a <= min_possible);
+        overloaded += (a >= max_possible);
 
-    FIA_GetMinPosibleValueForGreyScaleType (FreeImage_GetImageType(src), &min_possible_for_type);
-    FIA_GetMaxPosibleValueForGreyScaleType (FreeImage_GetImageType(src), &max_possible_for_type);
+        sum0 += a;
+    }
 
-    // start min at the highest val, max at the lowest.
-	report->maxValue = min_possible_for_type;
-	report->minValue = max_possible_for_type;
+    double mean = (sum0 + sum1) / count;
+    double M2a = 0.0, M3a = 0.0, M4a = 0.0;
+    double M2b = 0.0, M3b = 0.0, M4b = 0.0;
 
-    if (mask != NULL)
+    // Two sets of sums so the additions do not wait on each other
+    for(x = 0; x < count - 1; x += 2)
     {
-        for(register int y = 0; y < height; y++)
-        {
-            bits = (Tsrc *) FreeImage_GetScanLine (src, y);
-            BYTE *mask_ptr = (BYTE *) FreeImage_GetScanLine (mask, y);
+        double a = bits[x] - mean, b = bits[x + 1] - mean;
+        double a2 = a * a, b2 = b * b;
+
+        M2a += a2;
+        M3a += a2 * a;
+        M4a += a2 * a2;
+        M2b += b2;
+        M3b += b2 * b;
+        M4b += b2 * b2;
+    }
 
-            for(register int x = 0; x < width; x++)
-            {
-                if(mask_ptr[x] == 0)
-                    continue;
+    if (x < count)
+    {
+        double a = bits[x] - mean;
+        double a2 = a * a;
 
-                if (bits[x] > report->maxValue)
-                {
-                    report->maxValue = (double) bits[x];
-                }
+        M2a += a2;
+        M3a += a2 * a;
+        M4a += a2 * a2;
+    }
 
-                if (bits[x] < report->minValue)
-                {
-                    report->minValue = (double) bits[x];
-                }
+    block.n = count;
+    block.mean = mean;
+    block.M2 = M2a + M2b;
+    block.M3 = M3a + M3b;
+    block.M4 = M4a + M4b;
+    block.min = (double) min;
+    block.max = (double) max;
+    block.underloaded = underloaded;
+    block.overloaded = overloaded;
+
+    MergeMoments (acc, &block);
+}
 
-                if(bits[x] <= min_possible_for_type)
-                {
-                    amount_of_underloaded_pixels++;
-                }
+#define MOMENT_BAND_HEIGHT 32
 
-                if(bits[x] >= max_possible_for_type)
-                {
-                    amount_of_overloaded_pixels++;
-                }
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *mask;
+    double min_possible;
+    double max_possible;
+    MomentAccumulator *bands;
 
-				number_of_pixels++;
-                sum += bits[x];
-            }
-        }
-    }
-    else {
+} MomentRange;
+
+// Sums each band of rows into its own accumulator.
+template < class Tsrc > static void
+MomentBandRange (void *data, int start_band, int end_band)
+{
+    MomentRange *range = (MomentRange *) data;
+    int width = FreeImage_GetWidth (range->src);
+    int height = FreeImage_GetHeight (range->src);
+    Tsrc min_possible = (Tsrc) range->min_possible;
+    Tsrc max_possible = (Tsrc) range->max_possible;
+    Tsrc buffer[MOMENT_BLOCK_SIZE];
+
+    for(int band = start_band; band < end_band; band++)
+    {
+        MomentAccumulator *acc = range->bands + band;
+        int end_row = MIN (height, (band + 1) * MOMENT_BAND_HEIGHT);
 
-        for(register int y = 0; y < height; y++)
+        memset (acc, 0, sizeof (MomentAccumulator));
+
+        for(int y = band * MOMENT_BAND_HEIGHT; y < end_row; y++)
         {
-            bits = (Tsrc *) FreeImage_GetScanLine (src, y);
+            const Tsrc *bits = (Tsrc *) FreeImage_GetScanLine (range->src, y);
 
-            for(register int x = 0; x < width; x++)
+            for(int start = 0; start < width; start += MOMENT_BLOCK_SIZE)
             {
-                if (bits[x] > report->maxValue)
-                {
-                    report->maxValue = (double) bits[x];
-                }
+                int count = MIN (MOMENT_BLOCK_SIZE, width - start);
 
-                if (bits[x] < report->minValue)
+                if (range->mask == NULL)
                 {
-                    report->minValue = (double) bits[x];
+                    AccumulateMomentBlock < Tsrc > (bits + start, count,
+                                                    min_possible, max_possible, acc);
+                    continue;
                 }
 
-                if(bits[x] <= min_possible_for_type)
-                {
-                    amount_of_underloaded_pixels++;
-                }
+                const BYTE *mask_ptr = FreeImage_GetScanLine (range->mask, y) + start;
+                int n = 0;
 
-                if(bits[x] >= max_possible_for_type)
+                for(register int x = 0; x < count; x++)
                 {
-                    amount_of_overloaded_pixels++;
+                    buffer[n] = bits[start + x];
+                    n += (mask_ptr[x] != 0);
                 }
 
-				number_of_pixels++;
-                sum += bits[x];
+                AccumulateMomentBlock < Tsrc > (buffer, n, min_possible, max_possible, acc);
             }
         }
     }
+}
+
+template < class Tsrc > int Statistic < Tsrc >::CalculateStatisticReport (FIBITMAP * src, FIBITMAP * mask,
+                                                                          StatisticReport * report)
+{
+    if (report == NULL)
+    {
+        return FIA_ERROR;
+    }
 
-    report->area = number_of_pixels;
-    report->mean = (double) sum / report->area;
-    report->percentage_underloaded = (float) amount_of_underloaded_pixels / report->area;
-    report->percentage_overloaded = (float) amount_of_overloaded_pixels / report->area;
+    memset(report, 0, sizeof(StatisticReport));
 
-	// Calc SD, skewness and kurtosis
     if (mask != NULL)
     {
-        for(register int y = 0; y < height; y++)
+        // Mask has to be the same size
+        if (FIA_CheckDimensions (src, mask) == FIA_ERROR)
         {
-            bits = (Tsrc *) FreeImage_GetScanLine (src, y);
-            BYTE *mask_ptr = (BYTE *) FreeImage_GetScanLine (mask, y);
-
-            for(register int x = 0; x < width; x++)
-            {
-                if(mask_ptr[x] == 0)
-                    continue;
+            FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                         "Image source and mask have different dimensions");
+            return FIA_ERROR;
+        }
 
-                sd_sum += ((bits[x] - report->mean) * (bits[x] - report->mean));
-                skew_sum += ((bits[x] - report->mean) * (bits[x] - report->mean) * (bits[x] - report->mean));
-                kurt_sum += ((bits[x] - report->mean) * (bits[x] - report->mean) * (bits[x] - report->mean) * (bits[x] - report->mean));
-            }
+        // Mask has to be 8 bit 
+        if (FreeImage_GetBPP (mask) != 8 || FreeImage_GetImageType (mask) != FIT_BITMAP)
+        {
+            FreeImage_OutputMessageProc (FIF_UNKNOWN, "Mask must be an 8bit FIT_BITMAP");
+            return FIA_ERROR;
         }
     }
-    else
+
+    int height = FreeImage_GetHeight (src);
+    int number_of_bands = (height + MOMENT_BAND_HEIGHT - 1) / MOMENT_BAND_HEIGHT;
+
+    MomentRange range;
+
+    range.src = src;
+    range.mask = mask;
+    range.bands = (MomentAccumulator *) malloc (MAX (1, number_of_bands) * sizeof (MomentAccumulator));
+
+    if (CheckMemory (range.bands) < 0)
     {
-        for(register int y = 0; y < height; y++)
-        {
-            bits = (Tsrc *) FreeImage_GetScanLine (src, y);
+        return FIA_ERROR;
+    }
 
-            for(register int x = 0; x < width; x++)
-            {
-                sd_sum += ((bits[x] - report->mean) * (bits[x] - report->mean));
-                skew_sum += ((bits[x] - report->mean) * (bits[x] - report->mean) * (bits[x] - report->mean));
-                kurt_sum += ((bits[x] - report->mean) * (bits[x] - report->mean) * (bits[x] - report->mean) * (bits[x] - report->mean));
-            }
-        }
+    FIA_GetMinPosibleValueForGreyScaleType (FreeImage_GetImageType(src), &range.min_possible);
+    FIA_GetMaxPosibleValueForGreyScaleType (FreeImage_GetImageType(src), &range.max_possible);
+
+    RunRowRangesInParallel (number_of_bands, 1, MomentBandRange < Tsrc >, &range);
+
+    // Merge the bands in order so the result does not depend on the threads
+    MomentAccumulator total;
+
+    memset (&total, 0, sizeof (MomentAccumulator));
+
+    for(int band = 0; band < number_of_bands; band++)
+    {
+        MergeMoments (&total, range.bands + band);
     }
 
-    report->stdDeviation = sqrt ((double) sd_sum / (report->area - 1));
-    report->skewness     = (double) skew_sum / (report->area) / pow(report->stdDeviation, 3.0);
-    report->kurtosis     = (double) kurt_sum / (report->area) / pow(report->stdDeviation, 4.0) - 3.0;
+    free (range.bands);
+
+    // start min at the highest val, max at the lowest.
+    report->maxValue = (total.n > 0.0) ? total.max : range.min_possible;
+    report->minValue = (total.n > 0.0) ? total.min : range.max_possible;
+
+    report->area = (int) total.n;
+    report->mean = total.mean;
+    report->percentage_underloaded = (float) (total.underloaded / total.n);
+    report->percentage_overloaded = (float) (total.overloaded / total.n);
+
+    report->stdDeviation = sqrt (total.M2 / (total.n - 1));
+    report->skewness     = total.M3 / total.n / pow(report->stdDeviation, 3.0);
+    report->kurtosis     = total.M4 / total.n / pow(report->stdDeviation, 4.0) - 3.0;
 
     return FIA_SUCCESS;
 }
@@ -1386,84 +1768,439 @@ FIA_HistEq_Random_Additions (FIBITMAP * src)
     return dib;
 }
 
-FIBITMAP *DLL_CALLCONV
-FIA_HistEq (FIBITMAP * src)
+typedef struct
 {
+    FIBITMAP *src;
     FIBITMAP *dst;
-    int i;
-    const int number_grey_levels = 256;
-    int type, bpp, image_width, image_height;
-    unsigned char *src_bits, *dst_bits;
-    long total, Hsum;
-    DWORD *histogram;
-    double Havg;
-    long *mapping;
+    const void *lut;
 
-    bpp = FreeImage_GetBPP (src);
-    type = FreeImage_GetImageType (src);
+} LookupRange;
 
-    // The image is not 8bit greyscale return.
-    if (bpp != 8 || type != FIT_BITMAP)
+template < class Tsrc > static void
+LookupRowRange (void *data, int start_row, int end_row)
+{
+    LookupRange *range = (LookupRange *) data;
+    const Tsrc *lut = (const Tsrc *) range->lut;
+    const int width = FreeImage_GetWidth (range->src);
+
+    for(int y = start_row; y < end_row; y++)
     {
-        return NULL;
+        const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+        Tsrc *dst_ptr = (Tsrc *) FreeImage_GetScanLine (range->dst, y);
+
+        for(register int x = 0; x < width; x++)
+            dst_ptr[x] = lut[src_ptr[x]];
     }
+}
 
-    image_width = FreeImage_GetWidth (src);
-    image_height = FreeImage_GetHeight (src);
+// Maps each value through the cumulative histogram scaled to the
+// number_of_levels values of the type.
+template < class Tsrc > static FIBITMAP *
+HistEq (FIBITMAP * src, int number_of_levels)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
 
-    // Allocate a 8-bit dib
-    dst = FreeImage_AllocateT (FIT_BITMAP, image_width, image_height, 8, 0, 0, 0);
+    unsigned long *histogram = (unsigned long *) malloc (number_of_levels * sizeof (unsigned long));
+    Tsrc *lut = (Tsrc *) malloc (number_of_levels * sizeof (Tsrc));
+    FIBITMAP *dst = FIA_CloneImageType (src, width, height);
 
-    FIA_SetGreyLevelPalette (dst);
+    if (histogram == NULL || lut == NULL || dst == NULL
+        || FIA_Histogram (src, 0.0, number_of_levels - 1.0, number_of_levels, histogram) == FIA_ERROR)
+    {
+        free (histogram);
+        free (lut);
 
-    total = image_width * image_height;
+        if (dst != NULL)
+            FreeImage_Unload (dst);
 
-    mapping = (long *) malloc (sizeof (long) * number_grey_levels);
-    histogram = (DWORD *) malloc (sizeof (long) * number_grey_levels);
+        return NULL;
+    }
 
-    /*
-     * Clear histogram 
-     */
-    memset (histogram, 0, number_grey_levels);
-    memset (mapping, 0, number_grey_levels);
+    // interval value for uniform histogram
+    double Havg = (double) width * height / (number_of_levels - 1);
+    double Hsum = 0.0;
 
-    FreeImage_GetHistogram (src, histogram, FICC_BLACK);
+    for(int i = 0; i < number_of_levels; i++)
+    {
+        Hsum += histogram[i];
 
-    /*
-     * cumulative value for interval 
-     */
-    Hsum = 0;
+        lut[i] = (Tsrc) (int) ((Hsum / Havg) + 0.5);
+    }
 
-    /*
-     * interval value for uniform histogram     
-     */
-    Havg = (double) total / (number_grey_levels - 1);
+    LookupRange range;
 
-    for(i = 0; i < number_grey_levels; i++)
+    range.src = src;
+    range.dst = dst;
+    range.lut = lut;
+
+    RunRowRangesInParallel (height, 64, LookupRowRange < Tsrc >, &range);
+
+    free (histogram);
+    free (lut);
+
+    return dst;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_HistEq (FIBITMAP * src)
+{
+    if (src == NULL)
+        return NULL;
+
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
+
+    if (type == FIT_BITMAP && FreeImage_GetBPP (src) == 8)
     {
-        Hsum += histogram[i];
+        FIBITMAP *dst = HistEq < unsigned char > (src, 256);
 
-        mapping[i] = Hsum;
+        if (dst != NULL)
+            FIA_SetGreyLevelPalette (dst);
+
+        return dst;
     }
 
-    src_bits = (unsigned char *) FreeImage_GetBits (src);
-    dst_bits = (unsigned char *) FreeImage_GetBits (dst);
+    if (type == FIT_UINT16)
+        return HistEq < unsigned short > (src, 65536);
 
-    /*
-     * visit all input pixels and remap intensities 
-     */
-    for(i = 0; i < total; i++)
+    FreeImage_OutputMessageProc (FIF_UNKNOWN, "Histogram equalisation needs an 8 bit or FIT_UINT16 image");
+
+    return NULL;
+}
+
+// Contrast limited adaptive histogram equalisation after Zuiderveld,
+// Graphics Gems IV. Each tile gets a mapping from a clipped histogram and
+// every pixel is a bilinear blend of the mappings of the four tiles whose
+// centres surround it.
+
+typedef struct
+{
+    FIBITMAP *src;
+    FIBITMAP *dst;
+    int tiles_x;
+    int tiles_y;
+    int number_of_bins;
+    double clip_limit;
+    int min;
+    int max;
+    const int *tile_start_x;    // tiles_x + 1 entries
+    const int *tile_start_y;
+    const unsigned short *bins; // The bin of each value from min to max
+    float *luts;                // number_of_bins output values for each tile
+    const int *column_tile;     // The left tile and the weight of the right tile for each column
+    const float *column_weight;
+    int error;
+
+} ClaheRange;
+
+// Clips the histogram at limit and hands the excess back out evenly over
+// the bins, then a step at a time to the bins still under the limit.
+static void
+ClipHistogram (unsigned int *histogram, int number_of_bins, unsigned int limit)
+{
+    unsigned int excess = 0;
+
+    for(int i = 0; i < number_of_bins; i++)
     {
-        const unsigned char pixel = *src_bits++;
+        if (histogram[i] > limit)
+            excess += histogram[i] - limit;
+    }
+
+    unsigned int increment = excess / number_of_bins;
+    unsigned int upper = limit - increment;
+
+    for(int i = 0; i < number_of_bins; i++)
+    {
+        if (histogram[i] > limit)
+        {
+            histogram[i] = limit;
+        }
+        else if (histogram[i] > upper)
+        {
+            excess -= limit - histogram[i];
+            histogram[i] = limit;
+        }
+        else
+        {
+            excess -= increment;
+            histogram[i] += increment;
+        }
+    }
+
+    unsigned int previous_excess;
+
+    do
+    {
+        previous_excess = excess;
+
+        for(int start = 0; start < number_of_bins && excess > 0; start++)
+        {
+            int step = MAX (1, number_of_bins / (int) excess);
 
-        *dst_bits++ = (const unsigned char) (int) ((mapping[pixel] / Havg) + 0.5);
+            for(int i = start; i < number_of_bins && excess > 0; i += step)
+            {
+                if (histogram[i] < limit)
+                {
+                    histogram[i]++;
+                    excess--;
+                }
+            }
+        }
+    }
+    while (excess > 0 && excess < previous_excess);
+}
+
+template < class Tsrc > static void
+ClaheTileRange (void *data, int start_tile, int end_tile)
+{
+    ClaheRange *range = (ClaheRange *) data;
+    const int number_of_bins = range->number_of_bins;
+
+    unsigned int *histogram = (unsigned int *) malloc (number_of_bins * sizeof (unsigned int));
+
+    if (histogram == NULL)
+    {
+        range->error = 1;
+        return;
+    }
+
+    for(int tile = start_tile; tile < end_tile; tile++)
+    {
+        const int tx = tile % range->tiles_x;
+        const int ty = tile / range->tiles_x;
+        const int left = range->tile_start_x[tx], right = range->tile_start_x[tx + 1];
+        const int bottom = range->tile_start_y[ty], top = range->tile_start_y[ty + 1];
+        const unsigned int number_of_pixels = (right - left) * (top - bottom);
+
+        memset (histogram, 0, number_of_bins * sizeof (unsigned int));
+
+        for(int y = bottom; y < top; y++)
+        {
+            const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+
+            for(register int x = left; x < right; x++)
+                histogram[range->bins[src_ptr[x] - range->min]]++;
+        }
+
+        // The limit can not be below the mean count or the excess has nowhere to go
+        if (range->clip_limit > 0.0)
+        {
+            double limit = MAX (range->clip_limit, 1.0) * number_of_pixels / number_of_bins;
+
+            ClipHistogram (histogram, number_of_bins, (unsigned int) ceil (limit));
+        }
+
+        float *lut = range->luts + (size_t) tile * number_of_bins;
+        const double scale = (double) (range->max - range->min) / number_of_pixels;
+        unsigned int sum = 0;
+
+        for(int i = 0; i < number_of_bins; i++)
+        {
+            sum += histogram[i];
+            lut[i] = (float) MIN (range->min + sum * scale, (double) range->max);
+        }
     }
 
     free (histogram);
+}
+
+template < class Tsrc > static void
+ClaheRowRange (void *data, int start_row, int end_row)
+{
+    ClaheRange *range = (ClaheRange *) data;
+    const int width = FreeImage_GetWidth (range->src);
+    const int number_of_bins = range->number_of_bins;
+
+    for(int y = start_row; y < end_row; y++)
+    {
+        const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (range->src, y);
+        Tsrc *dst_ptr = (Tsrc *) FreeImage_GetScanLine (range->dst, y);
+
+        // The tile rows whose centres are below and above y
+        int ty = 0;
+
+        while (ty < range->tiles_y - 1
+               && (range->tile_start_y[ty + 1] + range->tile_start_y[ty + 2] - 1) / 2.0 <= y)
+            ty++;
+
+        double centre = (range->tile_start_y[ty] + range->tile_start_y[ty + 1] - 1) / 2.0;
+        int ty1 = ty;
+        float wy = 0.0f;
+
+        if (y > centre && ty < range->tiles_y - 1)
+        {
+            double next = (range->tile_start_y[ty + 1] + range->tile_start_y[ty + 2] - 1) / 2.0;
+
+            ty1 = ty + 1;
+            wy = (float) ((y - centre) / (next - centre));
+        }
+
+        const float *below = range->luts + (size_t) ty * range->tiles_x * number_of_bins;
+        const float *above = range->luts + (size_t) ty1 * range->tiles_x * number_of_bins;
+
+        for(register int x = 0; x < width; x++)
+        {
+            const int bin = range->bins[src_ptr[x] - range->min];
+            const int tx = range->column_tile[x];
+            const int tx1 = MIN (tx + 1, range->tiles_x - 1);
+            const float wx = range->column_weight[x];
+
+            const float b = below[tx * number_of_bins + bin] * (1.0f - wx)
+                + below[tx1 * number_of_bins + bin] * wx;
+            const float a = above[tx * number_of_bins + bin] * (1.0f - wx)
+                + above[tx1 * number_of_bins + bin] * wx;
+
+            dst_ptr[x] = (Tsrc) (b * (1.0f - wy) + a * wy + 0.5f);
+        }
+    }
+}
+
+template < class Tsrc > static FIBITMAP *
+ContrastLimitedAdaptiveHistEq (FIBITMAP * src, int tiles_x, int tiles_y, int number_of_bins,
+                               double clip_limit)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+    double min, max;
+
+    FIA_FindMinMax (src, &min, &max);
+
+    FIBITMAP *dst = FIA_CloneImageType (src, width, height);
+
+    if (dst == NULL)
+        return NULL;
+
+    ClaheRange range;
+
+    range.src = src;
+    range.dst = dst;
+    range.tiles_x = tiles_x;
+    range.tiles_y = tiles_y;
+    range.number_of_bins = number_of_bins;
+    range.clip_limit = clip_limit;
+    range.min = (int) min;
+    range.max = (int) max;
+    range.error = 0;
+
+    const int number_of_values = range.max - range.min + 1;
+
+    int *tile_start_x = (int *) malloc ((tiles_x + 1) * sizeof (int));
+    int *tile_start_y = (int *) malloc ((tiles_y + 1) * sizeof (int));
+    unsigned short *bins = (unsigned short *) malloc (number_of_values * sizeof (unsigned short));
+    int *column_tile = (int *) malloc (width * sizeof (int));
+    float *column_weight = (float *) malloc (width * sizeof (float));
+
+    range.luts = (float *) malloc ((size_t) tiles_x * tiles_y * number_of_bins * sizeof (float));
+
+    if (tile_start_x == NULL || tile_start_y == NULL || bins == NULL
+        || column_tile == NULL || column_weight == NULL || range.luts == NULL)
+    {
+        range.error = 1;
+    }
+    else
+    {
+        for(int i = 0; i <= tiles_x; i++)
+            tile_start_x[i] = (int) ((double) i * width / tiles_x);
+
+        for(int i = 0; i <= tiles_y; i++)
+            tile_start_y[i] = (int) ((double) i * height / tiles_y);
+
+        for(int i = 0; i < number_of_values; i++)
+            bins[i] = (unsigned short) ((double) i * number_of_bins / number_of_values);
+
+        // The tile whose centre is at or left of each column and the
+        // weight of the next tile. Columns outside the first and last
+        // centres take the edge tile alone.
+        int tx = 0;
+
+        for(int x = 0; x < width; x++)
+        {
+            while (tx < tiles_x - 1 && (tile_start_x[tx + 1] + tile_start_x[tx + 2] - 1) / 2.0 <= x)
+                tx++;
+
+            double centre = (tile_start_x[tx] + tile_start_x[tx + 1] - 1) / 2.0;
+
+            column_tile[x] = tx;
+            column_weight[x] = 0.0f;
+
+            if (x > centre && tx < tiles_x - 1)
+            {
+                double next = (tile_start_x[tx + 1] + tile_start_x[tx + 2] - 1) / 2.0;
+
+                column_weight[x] = (float) ((x - centre) / (next - centre));
+            }
+        }
+
+        range.tile_start_x = tile_start_x;
+        range.tile_start_y = tile_start_y;
+        range.bins = bins;
+        range.column_tile = column_tile;
+        range.column_weight = column_weight;
+
+        RunRowRangesInParallel (tiles_x * tiles_y, 1, ClaheTileRange < Tsrc >, &range);
+
+        if (!range.error)
+            RunRowRangesInParallel (height, 64, ClaheRowRange < Tsrc >, &range);
+    }
+
+    free (tile_start_x);
+    free (tile_start_y);
+    free (bins);
+    free (column_tile);
+    free (column_weight);
+    free (range.luts);
+
+    if (range.error)
+    {
+        FreeImage_Unload (dst);
+        return NULL;
+    }
 
     return dst;
 }
 
+FIBITMAP *DLL_CALLCONV
+FIA_ContrastLimitedAdaptiveHistEq (FIBITMAP * src, int tiles_x, int tiles_y,
+                                   int number_of_bins, double clip_limit)
+{
+    if (src == NULL)
+        return NULL;
+
+    if (tiles_x < 1 || tiles_y < 1 || tiles_x > (int) FreeImage_GetWidth (src)
+        || tiles_y > (int) FreeImage_GetHeight (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "The number of tiles must be between 1 and the image size");
+        return NULL;
+    }
+
+    if (number_of_bins < 2 || number_of_bins > 65536)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "The number of bins must be between 2 and 65536");
+        return NULL;
+    }
+
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
+
+    if (type == FIT_BITMAP && FreeImage_GetBPP (src) == 8)
+    {
+        FIBITMAP *dst = ContrastLimitedAdaptiveHistEq < unsigned char > (src, tiles_x, tiles_y,
+                                                                         number_of_bins, clip_limit);
+
+        if (dst != NULL)
+            FIA_SetGreyLevelPalette (dst);
+
+        return dst;
+    }
+
+    if (type == FIT_UINT16)
+        return ContrastLimitedAdaptiveHistEq < unsigned short > (src, tiles_x, tiles_y,
+                                                                number_of_bins, clip_limit);
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN, "Adaptive histogram equalisation needs an 8 bit or FIT_UINT16 image");
+
+    return NULL;
+}
+
 int DLL_CALLCONV
 FIA_MonoImageFindWhiteArea (FIBITMAP * src, unsigned int *white_area)
 {
@@ -1617,3 +2354,233 @@ FIA_MonoTrueFalsePositiveComparison (FIBITMAP * src, FIBITMAP * result,
 
     return FIA_SUCCESS;
 }
+
+// Summed area table. Entry (x, y) of a table holds the sum of the pixels of
+// the image rows below y and the columns left of x, so row and column 0
+// are zero and the sum of any rectangle is four lookups.
+struct _FIA_SummedAreaTable
+{
+    FREE_IMAGE_TYPE type;
+    int width;
+    int height;
+    int integer;                // 1 if the sums are exact 64 bit integers
+    double offset;              // Taken from each pixel when the sums are doubles to keep the variance accurate
+    void *sum;
+    void *sum_of_squares;
+};
+
+// Recomputes the entries right of column start_col on the table rows above
+// image row start_row. The entries left of start_col are unchanged so each
+// row restarts from the difference of the two entries at start_col.
+template < class Tsrc, class Tsum > static void
+FillSummedAreaTable (FIA_SummedAreaTable * table, FIBITMAP * src, int start_col, int start_row)
+{
+    const int stride = table->width + 1;
+    const Tsum offset = (Tsum) table->offset;
+
+    for(int y = start_row; y < table->height; y++)
+    {
+        const Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (src, y);
+        const Tsum *previous = (Tsum *) table->sum + (size_t) y * stride;
+        const Tsum *previous_sq = (Tsum *) table->sum_of_squares + (size_t) y * stride;
+        Tsum *current = (Tsum *) table->sum + (size_t) (y + 1) * stride;
+        Tsum *current_sq = (Tsum *) table->sum_of_squares + (size_t) (y + 1) * stride;
+
+        Tsum row_sum = current[start_col] - previous[start_col];
+        Tsum row_sq = current_sq[start_col] - previous_sq[start_col];
+
+        for(register int x = start_col; x < table->width; x++)
+        {
+            Tsum value = (Tsum) src_ptr[x] - offset;
+
+            row_sum += value;
+            row_sq += value * value;
+
+            current[x + 1] = previous[x + 1] + row_sum;
+            current_sq[x + 1] = previous_sq[x + 1] + row_sq;
+        }
+    }
+}
+
+template < class Tsum > static void
+SummedAreaTableLookup (FIA_SummedAreaTable * table, int left, int bottom, int right, int top,
+                       double *sum, double *sum_of_squares)
+{
+    const int stride = table->width + 1;
+    const Tsum *s = (Tsum *) table->sum;
+    const Tsum *sq = (Tsum *) table->sum_of_squares;
+
+    *sum = (double) (s[(size_t) top * stride + right] - s[(size_t) bottom * stride + right]
+                     - s[(size_t) top * stride + left] + s[(size_t) bottom * stride + left]);
+
+    *sum_of_squares = (double) (sq[(size_t) top * stride + right] - sq[(size_t) bottom * stride + right]
+                                - sq[(size_t) top * stride + left] + sq[(size_t) bottom * stride + left]);
+}
+
+static int
+FillSummedAreaTableOfType (FIA_SummedAreaTable * table, FIBITMAP * src, int start_col, int start_row)
+{
+    switch (table->type)
+    {
+        case FIT_BITMAP:
+            FillSummedAreaTable < unsigned char, long long > (table, src, start_col, start_row);
+            break;
+
+        case FIT_UINT16:
+            FillSummedAreaTable < unsigned short, long long > (table, src, start_col, start_row);
+            break;
+
+        case FIT_INT16:
+            FillSummedAreaTable < short, long long > (table, src, start_col, start_row);
+            break;
+
+        case FIT_UINT32:
+            FillSummedAreaTable < unsigned long, double > (table, src, start_col, start_row);
+            break;
+
+        case FIT_INT32:
+            FillSummedAreaTable < long, double > (table, src, start_col, start_row);
+            break;
+
+        case FIT_FLOAT:
+            FillSummedAreaTable < float, double > (table, src, start_col, start_row);
+            break;
+
+        case FIT_DOUBLE:
+            FillSummedAreaTable < double, double > (table, src, start_col, start_row);
+            break;
+
+        default:
+            return FIA_ERROR;
+    }
+
+    return FIA_SUCCESS;
+}
+
+FIA_SummedAreaTable *DLL_CALLCONV
+FIA_SummedAreaTableNew (FIBITMAP * src)
+{
+    if (src == NULL)
+        return NULL;
+
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
+
+    if (!FIA_IsGreyScale (src) || (type == FIT_BITMAP && FreeImage_GetBPP (src) != 8))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Summed area tables need an 8 bit or greyscale image");
+        return NULL;
+    }
+
+    FIA_SummedAreaTable *table = (FIA_SummedAreaTable *) malloc (sizeof (FIA_SummedAreaTable));
+
+    if (table == NULL)
+        return NULL;
+
+    table->type = type;
+    table->width = FreeImage_GetWidth (src);
+    table->height = FreeImage_GetHeight (src);
+    table->integer = (type == FIT_BITMAP || type == FIT_UINT16 || type == FIT_INT16);
+    table->offset = 0.0;
+
+    // Both types of sum are 8 bytes
+    size_t entries = (size_t) (table->width + 1) * (table->height + 1);
+
+    table->sum = calloc (entries, sizeof (double));
+    table->sum_of_squares = calloc (entries, sizeof (double));
+
+    if (table->sum == NULL || table->sum_of_squares == NULL)
+    {
+        FIA_SummedAreaTableDestroy (table);
+        return NULL;
+    }
+
+    // Sums of doubles lose the variance of pixels far from zero, so they are
+    // taken about the first pixel.
+    if (!table->integer)
+        FIA_GetPixelValue (src, 0, 0, &(table->offset));
+
+    if (FillSummedAreaTableOfType (table, src, 0, 0) == FIA_ERROR)
+    {
+        FIA_SummedAreaTableDestroy (table);
+        return NULL;
+    }
+
+    return table;
+}
+
+void DLL_CALLCONV
+FIA_SummedAreaTableDestroy (FIA_SummedAreaTable * table)
+{
+    if (table == NULL)
+        return;
+
+    free (table->sum);
+    free (table->sum_of_squares);
+    free (table);
+}
+
+int DLL_CALLCONV
+FIA_SummedAreaTableUpdate (FIA_SummedAreaTable * table, FIBITMAP * src, FIARECT rect)
+{
+    if (table == NULL || src == NULL)
+        return FIA_ERROR;
+
+    if (FreeImage_GetImageType (src) != table->type
+        || (int) FreeImage_GetWidth (src) != table->width
+        || (int) FreeImage_GetHeight (src) != table->height)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Image is not the type and size of the summed area table");
+        return FIA_ERROR;
+    }
+
+    // The lowest changed row in memory is the bottom of the rectangle.
+    int start_col = MAX (rect.left, 0);
+    int start_row = MAX (table->height - rect.bottom - 1, 0);
+
+    if (start_col >= table->width || start_row >= table->height)
+        return FIA_SUCCESS;
+
+    return FillSummedAreaTableOfType (table, src, start_col, start_row);
+}
+
+int DLL_CALLCONV
+FIA_SummedAreaTableStatistics (FIA_SummedAreaTable * table, FIARECT rect,
+                               double *sum, double *mean, double *variance)
+{
+    if (table == NULL)
+        return FIA_ERROR;
+
+    if (rect.left < 0 || rect.top < 0 || rect.right < rect.left || rect.bottom < rect.top
+        || rect.right >= table->width || rect.bottom >= table->height)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Rectangle is not inside the image");
+        return FIA_ERROR;
+    }
+
+    // Table rows are counted from the bottom of the image
+    int bottom = table->height - rect.bottom - 1;
+    int top = table->height - rect.top;
+    double n = (double) (rect.right - rect.left + 1) * (top - bottom);
+    double s, sq;
+
+    if (table->integer)
+        SummedAreaTableLookup < long long > (table, rect.left, bottom, rect.right + 1, top, &s, &sq);
+    else
+        SummedAreaTableLookup < double > (table, rect.left, bottom, rect.right + 1, top, &s, &sq);
+
+    // The variance does not depend on the offset
+    double m = s / n;
+
+    if (sum != NULL)
+        *sum = s + n * table->offset;
+
+    if (mean != NULL)
+        *mean = m + table->offset;
+
+    if (variance != NULL)
+        *variance = (n > 1.0) ? MAX ((sq - s * m) / (n - 1.0), 0.0) : 0.0;
+
+    return FIA_SUCCESS;
+}
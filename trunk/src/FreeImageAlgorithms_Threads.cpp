@@ -0,0 +1,398 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ * Oxford University (Gray Institute for Radiation Oncology and Biology)
+ *
+ * This file is part of FreeImageAlgorithms.
+ *
+ * FreeImageAlgorithms is free software: you can redistribute it and/or modify
+ * it under the terms of the Lesser GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeImageAlgorithms is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * Lesser GNU General Public License for more details.
+ *
+ * You should have received a copy of the Lesser GNU General Public License
+ * along with FreeImageAlgorithms.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_Utils.h"
+
+#include <stdlib.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// A small pool of worker threads that split the rows of an image between them.
+// The calling thread also takes rows so a pool for n threads has n - 1 workers.
+// Only one job runs on the pool at a time. A caller that finds the pool busy,
+// eg a call from a worker or from another application thread, does the rows itself.
+
+#ifdef WIN32
+
+typedef CRITICAL_SECTION PoolMutex;
+typedef CONDITION_VARIABLE PoolCondition;
+typedef HANDLE PoolThread;
+
+#define PoolMutexInit(m) InitializeCriticalSection(m)
+#define PoolMutexDestroy(m) DeleteCriticalSection(m)
+#define PoolMutexLock(m) EnterCriticalSection(m)
+#define PoolMutexTryLock(m) TryEnterCriticalSection(m)
+#define PoolMutexUnlock(m) LeaveCriticalSection(m)
+#define PoolConditionInit(c) InitializeConditionVariable(c)
+#define PoolConditionDestroy(c)
+#define PoolConditionWait(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define PoolConditionBroadcast(c) WakeAllConditionVariable(c)
+
+#else
+
+typedef pthread_mutex_t PoolMutex;
+typedef pthread_cond_t PoolCondition;
+typedef pthread_t PoolThread;
+
+#define PoolMutexInit(m) pthread_mutex_init(m, NULL)
+#define PoolMutexDestroy(m) pthread_mutex_destroy(m)
+#define PoolMutexLock(m) pthread_mutex_lock(m)
+#define PoolMutexTryLock(m) (pthread_mutex_trylock(m) == 0)
+#define PoolMutexUnlock(m) pthread_mutex_unlock(m)
+#define PoolConditionInit(c) pthread_cond_init(c, NULL)
+#define PoolConditionDestroy(c) pthread_cond_destroy(c)
+#define PoolConditionWait(c, m) pthread_cond_wait(c, m)
+#define PoolConditionBroadcast(c) pthread_cond_broadcast(c)
+
+#endif
+
+typedef struct
+{
+    FIA_ROW_RANGE_FUNCTION function;
+    void *user_data;
+    int number_of_rows;
+    int rows_per_range;
+    int next_row;
+    int busy_workers;
+
+} PoolJob;
+
+typedef struct
+{
+    int number_of_workers;
+    PoolThread *workers;
+
+    PoolMutex lock;
+    PoolCondition work_available;
+    PoolCondition work_finished;
+
+    // Held by the thread that owns the pool while a job runs.
+    PoolMutex job_lock;
+
+    PoolJob *job;
+    unsigned int generation;
+    int shutdown;
+
+} ThreadPool;
+
+static int number_of_threads = -1;
+static ThreadPool *volatile pool = NULL;
+
+// Statically initialised so it can be used before anything else is set up.
+#ifdef WIN32
+static SRWLOCK global_lock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int
+NumberOfProcessors (void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo (&info);
+
+    return (int) info.dwNumberOfProcessors;
+#else
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+    return (n < 1) ? 1 : (int) n;
+#endif
+}
+
+// Takes ranges of rows from the job until there are none left.
+static void
+RunJobRanges (PoolMutex * lock, PoolJob * job)
+{
+    for(;;)
+    {
+        PoolMutexLock (lock);
+
+        int start = job->next_row;
+
+        job->next_row += job->rows_per_range;
+
+        PoolMutexUnlock (lock);
+
+        if (start >= job->number_of_rows)
+            return;
+
+        int end = MIN (start + job->rows_per_range, job->number_of_rows);
+
+        job->function (job->user_data, start, end);
+    }
+}
+
+#ifdef WIN32
+static DWORD WINAPI
+PoolWorker (LPVOID data)
+#else
+static void *
+PoolWorker (void *data)
+#endif
+{
+    ThreadPool *p = (ThreadPool *) data;
+    unsigned int seen_generation = 0;
+
+    PoolMutexLock (&p->lock);
+
+    for(;;)
+    {
+        while (!p->shutdown && p->generation == seen_generation)
+            PoolConditionWait (&p->work_available, &p->lock);
+
+        if (p->shutdown)
+            break;
+
+        seen_generation = p->generation;
+
+        PoolJob *job = p->job;
+
+        PoolMutexUnlock (&p->lock);
+
+        RunJobRanges (&p->lock, job);
+
+        PoolMutexLock (&p->lock);
+
+        if (--job->busy_workers == 0)
+            PoolConditionBroadcast (&p->work_finished);
+    }
+
+    PoolMutexUnlock (&p->lock);
+
+    return 0;
+}
+
+static void
+DestroyThreadPool (ThreadPool * p)
+{
+    if (p == NULL)
+        return;
+
+    PoolMutexLock (&p->lock);
+    p->shutdown = 1;
+    PoolConditionBroadcast (&p->work_available);
+    PoolMutexUnlock (&p->lock);
+
+    for(int i = 0; i < p->number_of_workers; i++)
+    {
+#ifdef WIN32
+        WaitForSingleObject (p->workers[i], INFINITE);
+        CloseHandle (p->workers[i]);
+#else
+        pthread_join (p->workers[i], NULL);
+#endif
+    }
+
+    PoolConditionDestroy (&p->work_available);
+    PoolConditionDestroy (&p->work_finished);
+    PoolMutexDestroy (&p->lock);
+    PoolMutexDestroy (&p->job_lock);
+
+    free (p->workers);
+    free (p);
+}
+
+static ThreadPool *
+CreateThreadPool (int number_of_workers)
+{
+    ThreadPool *p = (ThreadPool *) calloc (1, sizeof (ThreadPool));
+
+    if (p == NULL)
+        return NULL;
+
+    p->workers = (PoolThread *) calloc (number_of_workers, sizeof (PoolThread));
+
+    if (p->workers == NULL)
+    {
+        free (p);
+        return NULL;
+    }
+
+    PoolMutexInit (&p->lock);
+    PoolMutexInit (&p->job_lock);
+    PoolConditionInit (&p->work_available);
+    PoolConditionInit (&p->work_finished);
+
+    for(int i = 0; i < number_of_workers; i++)
+    {
+#ifdef WIN32
+        p->workers[i] = CreateThread (NULL, 0, PoolWorker, p, 0, NULL);
+
+        if (p->workers[i] == NULL)
+            break;
+#else
+        if (pthread_create (&p->workers[i], NULL, PoolWorker, p) != 0)
+            break;
+#endif
+
+        p->number_of_workers++;
+    }
+
+    if (p->number_of_workers == 0)
+    {
+        DestroyThreadPool (p);
+        return NULL;
+    }
+
+    return p;
+}
+
+// Creates the pool on first use. If two threads race to create it
+// the loser destroys its pool and uses the winner's.
+static ThreadPool *
+GetThreadPool (int number_of_workers)
+{
+    if (pool != NULL)
+        return pool;
+
+    ThreadPool *p = CreateThreadPool (number_of_workers);
+
+    if (p == NULL)
+        return NULL;
+
+#ifdef WIN32
+    ThreadPool *existing =
+        (ThreadPool *) InterlockedCompareExchangePointer ((PVOID volatile *) &pool, p, NULL);
+#else
+    ThreadPool *existing = __sync_val_compare_and_swap (&pool, (ThreadPool *) NULL, p);
+#endif
+
+    if (existing != NULL)
+    {
+        DestroyThreadPool (p);
+        return existing;
+    }
+
+    return p;
+}
+
+void DLL_CALLCONV
+FIA_SetNumberOfThreads (int threads)
+{
+    DestroyThreadPool (pool);
+    pool = NULL;
+
+    number_of_threads = (threads < 1) ? NumberOfProcessors () : threads;
+}
+
+int DLL_CALLCONV
+FIA_GetNumberOfThreads (void)
+{
+    if (number_of_threads < 1)
+        number_of_threads = NumberOfProcessors ();
+
+    return number_of_threads;
+}
+
+int
+RunRowRangesInParallel (int number_of_rows, int min_rows_per_range,
+                        FIA_ROW_RANGE_FUNCTION function, void *user_data)
+{
+    if (number_of_rows <= 0)
+        return FIA_SUCCESS;
+
+    int threads = FIA_GetNumberOfThreads ();
+
+    if (min_rows_per_range < 1)
+        min_rows_per_range = 1;
+
+    if (threads < 2 || number_of_rows < 2 * min_rows_per_range)
+    {
+        function (user_data, 0, number_of_rows);
+        return FIA_SUCCESS;
+    }
+
+    ThreadPool *p = GetThreadPool (threads - 1);
+
+    if (p == NULL || !PoolMutexTryLock (&p->job_lock))
+    {
+        function (user_data, 0, number_of_rows);
+        return FIA_SUCCESS;
+    }
+
+    // Critical sections are recursive so a nested call from the
+    // thread running a job gets the lock. Run those rows here.
+    if (p->job != NULL)
+    {
+        PoolMutexUnlock (&p->job_lock);
+        function (user_data, 0, number_of_rows);
+        return FIA_SUCCESS;
+    }
+
+    // Several ranges per thread so a slow range does not hold up the rest.
+    PoolJob job;
+
+    job.function = function;
+    job.user_data = user_data;
+    job.number_of_rows = number_of_rows;
+    job.rows_per_range = MAX (min_rows_per_range, number_of_rows / (threads * 4));
+    job.next_row = 0;
+    job.busy_workers = p->number_of_workers;
+
+    PoolMutexLock (&p->lock);
+    p->job = &job;
+    p->generation++;
+    PoolConditionBroadcast (&p->work_available);
+    PoolMutexUnlock (&p->lock);
+
+    RunJobRanges (&p->lock, &job);
+
+    PoolMutexLock (&p->lock);
+
+    while (job.busy_workers > 0)
+        PoolConditionWait (&p->work_finished, &p->lock);
+
+    p->job = NULL;
+
+    PoolMutexUnlock (&p->lock);
+
+    PoolMutexUnlock (&p->job_lock);
+
+    return FIA_SUCCESS;
+}
+
+void
+EnterGlobalLock (void)
+{
+#ifdef WIN32
+    AcquireSRWLockExclusive (&global_lock);
+#else
+    pthread_mutex_lock (&global_lock);
+#endif
+}
+
+void
+LeaveGlobalLock (void)
+{
+#ifdef WIN32
+    ReleaseSRWLockExclusive (&global_lock);
+#else
+    pthread_mutex_unlock (&global_lock);
+#endif
+}
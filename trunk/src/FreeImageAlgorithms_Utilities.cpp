@@ -63,6 +63,142 @@ static TemplateImageFunctionClass < long > LongImage;
 static TemplateImageFunctionClass < float > FloatImage;
 static TemplateImageFunctionClass < double > DoubleImage;
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FIA_X86_CPU
+#endif
+
+#ifdef FIA_X86_CPU
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void
+CpuId (int leaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuidex (info, leaf, 0);
+
+    regs[0] = info[0];
+    regs[1] = info[1];
+    regs[2] = info[2];
+    regs[3] = info[3];
+#else
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    __get_cpuid_count (leaf, 0, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+}
+
+// AVX2 needs the OS to save the ymm registers on a context switch.
+// The OSXSAVE bit says xgetbv may be used to read XCR0, bits 1 and 2
+// of which are set when the xmm and ymm states are saved.
+static int
+OsSavesYmmRegisters (void)
+{
+    unsigned int regs[4];
+
+    CpuId (1, regs);
+
+    if (!(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28)))
+        return 0;
+
+#ifdef _MSC_VER
+    unsigned int xcr0 = (unsigned int) _xgetbv (0);
+#else
+    unsigned int xcr0, edx;
+
+    __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+#endif
+
+    return (xcr0 & 0x6) == 0x6;
+}
+
+static int
+DetectCpuFeatures (void)
+{
+    unsigned int regs[4];
+    int features = 0;
+
+    CpuId (0, regs);
+
+    unsigned int max_leaf = regs[0];
+
+    if (max_leaf < 1)
+        return 0;
+
+    CpuId (1, regs);
+
+    if ((regs[3] & (1 << 23)) && _os_support (_CPU_FEATURE_MMX))
+        features |= _CPU_FEATURE_MMX;
+
+    if ((regs[3] & (1 << 25)) && _os_support (_CPU_FEATURE_SSE))
+        features |= _CPU_FEATURE_SSE;
+
+    if ((regs[3] & (1 << 26)) && _os_support (_CPU_FEATURE_SSE2))
+        features |= _CPU_FEATURE_SSE2;
+
+    if (max_leaf >= 7)
+    {
+        CpuId (7, regs);
+
+        if ((regs[1] & (1 << 5)) && _os_support (_CPU_FEATURE_AVX2))
+            features |= _CPU_FEATURE_AVX2;
+    }
+
+    return features;
+}
+
+#else
+
+static int
+DetectCpuFeatures (void)
+{
+    return 0;
+}
+
+#endif // FIA_X86_CPU
+
+static int cpu_features = -1;
+static int cpu_feature_mask = ~0;
+
+int DLL_CALLCONV
+FIA_GetCpuFeatures (void)
+{
+    if (cpu_features < 0)
+        cpu_features = DetectCpuFeatures ();
+
+    return cpu_features & cpu_feature_mask;
+}
+
+void DLL_CALLCONV
+FIA_SetCpuFeatureMask (int mask)
+{
+    cpu_feature_mask = mask;
+}
+
+#ifndef _MSC_VER
+
+// Other compilers target systems that always save the mmx and xmm
+// registers, so only the AVX2 ymm registers need checking.
+int DLL_CALLCONV
+_os_support (int feature)
+{
+#ifdef FIA_X86_CPU
+    if (feature == _CPU_FEATURE_AVX2)
+        return OsSavesYmmRegisters ();
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#endif
+
 #ifdef _MSC_VER
 
 #include <xmmintrin.h>
@@ -82,6 +218,10 @@ static TemplateImageFunctionClass < double > DoubleImage;
 int DLL_CALLCONV
 _os_support (int feature)
 {
+    // Checked without running an AVX2 instruction
+    if (feature == _CPU_FEATURE_AVX2)
+        return OsSavesYmmRegisters ();
+
     __try
     {
         switch (feature)
@@ -1764,6 +1904,17 @@ CheckMemory (void *ptr)
     }
 }
 
+int
+CheckConnectivity (int connectivity)
+{
+    if (connectivity == FIA_CONNECTIVITY_4 || connectivity == FIA_CONNECTIVITY_8)
+        return FIA_SUCCESS;
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "Connectivity must be FIA_CONNECTIVITY_4 or FIA_CONNECTIVITY_8");
+    return FIA_ERROR;
+}
+
 int DLL_CALLCONV
 FIA_GetPixelValue (FIBITMAP * src, int x, int y, double *val)
 {